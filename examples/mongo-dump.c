@@ -24,39 +24,15 @@ typedef struct
 
 #define VLOG(...) { if (config->verbose) fprintf (stderr, __VA_ARGS__); }
 
-gdouble
-mongo_dump_packet (config_t *config, mongo_packet *p, gdouble pos, int fd)
-{
-  gint32 i;
-  mongo_reply_packet_header rh;
-
-  mongo_wire_reply_packet_get_header (p, &rh);
-
-  for (i = 1; i <= rh.returned; i++)
-    {
-      bson *b;
-
-      mongo_wire_reply_packet_get_nth_document (p, i, &b);
-      bson_finish (b);
-
-      write (fd, bson_data (b), bson_size (b));
-      bson_free (b);
-    }
-  VLOG("\r");
-
-  return pos + i - 1;
-}
-
 int
 mongo_dump (config_t *config)
 {
   mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
   bson *b;
   int fd;
 
   mongo_packet *p;
-  mongo_reply_packet_header rh;
-  gint64 cid;
   gdouble cnt, pos = 0;
 
   gchar *error;
@@ -142,37 +118,51 @@ mongo_dump (config_t *config)
     }
   bson_free (b);
 
-  mongo_wire_reply_packet_get_header (p, &rh);
-  cid = rh.cursor_id;
-  pos = mongo_dump_packet (config, p, pos, fd);
-  mongo_wire_packet_free (p);
+  cursor = mongo_sync_cursor_new (conn, config->ns, p);
+  if (!cursor)
+    {
+      e = errno;
+
+      mongo_wire_packet_free (p);
+      unlink (config->output);
+      close (fd);
 
-  while (pos < cnt)
+      fprintf (stderr, "Error creating the cursor: %s\n", strerror (e));
+      mongo_sync_disconnect (conn);
+      exit (1);
+    }
+
+  while (mongo_sync_cursor_next (cursor))
     {
-      gdouble pr = (pos + 10) / cnt;
+      gdouble pr = (pos + 1) / cnt;
+
+      b = mongo_sync_cursor_get_data (cursor);
+      write (fd, bson_data (b), bson_size (b));
+      bson_free (b);
+      pos++;
 
       VLOG ("\rDumping... %03.2f%%", ((pr > 1) ? 1 : pr) * 100);
       if (config->verbose)
 	fflush (stderr);
+    }
+  VLOG ("\r");
 
-      p = mongo_sync_cmd_get_more (conn, config->ns, 10, cid);
-      if (!p)
-	{
-	  e = errno;
+  if (errno != ENOENT)
+    {
+      e = errno;
 
-	  unlink (config->output);
-	  close (fd);
+      mongo_sync_cursor_free (cursor);
+      unlink (config->output);
+      close (fd);
 
-	  mongo_sync_cmd_get_last_error (conn, config->db, &error);
-	  fprintf (stderr, "Error advancing the cursor: %s\n",
-		   (error) ? error : strerror (e));
+      mongo_sync_cmd_get_last_error (conn, config->db, &error);
+      fprintf (stderr, "Error advancing the cursor: %s\n",
+	       (error) ? error : strerror (e));
 
-	  mongo_sync_disconnect (conn);
-	  exit (1);
-	}
-      pos = mongo_dump_packet (config, p, pos, fd);
-      mongo_wire_packet_free (p);
+      mongo_sync_disconnect (conn);
+      exit (1);
     }
+  mongo_sync_cursor_free (cursor);
 
   close (fd);
   mongo_sync_disconnect (conn);
@@ -40,6 +40,63 @@ struct _bson_cursor
 		       key. */
 };
 
+/** @internal Grow the buffer of a BSON object.
+ *
+ * Makes sure that the buffer of the object can hold at least @a size
+ * bytes, growing it to the next power of two if need be. Views, whose
+ * buffer is borrowed, get a buffer of their own, with a copy of their
+ * contents.
+ *
+ * @param b is the BSON object whose buffer to grow.
+ * @param size is the minimum size of the buffer.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_bson_reserve (bson *b, gsize size)
+{
+  gsize alloc;
+
+  if (size <= (gsize)b->alloc)
+    return TRUE;
+  if (size > G_MAXINT32)
+    return FALSE;
+
+  alloc = (b->alloc > 0) ? (gsize)b->alloc : 16;
+  while (alloc < size)
+    alloc <<= 1;
+  if (alloc > G_MAXINT32)
+    alloc = G_MAXINT32;
+
+  if (b->alloc == 0 && b->data)
+    {
+      guint8 *data = (guint8 *)_mongo_malloc (alloc);
+
+      memcpy (data, b->data, b->len);
+      b->data = data;
+    }
+  else
+    b->data = (guint8 *)_mongo_realloc (b->data, alloc);
+  b->alloc = (gint32)alloc;
+
+  return TRUE;
+}
+
+gboolean
+_bson_append_data (bson *b, const guint8 *data, gint32 size)
+{
+  if (size <= 0)
+    return (size == 0);
+
+  if (!_bson_reserve (b, (gsize)b->len + size))
+    return FALSE;
+
+  memcpy (b->data + b->len, data, size);
+  b->len += size;
+
+  return TRUE;
+}
+
 /** @internal Append a byte to a BSON stream.
  *
  * @param b is the BSON stream to append to.
@@ -48,7 +105,7 @@ struct _bson_cursor
 static inline void
 _bson_append_byte (bson *b, const guint8 byte)
 {
-  b->data = g_byte_array_append (b->data, &byte, sizeof (byte));
+  _bson_append_data (b, &byte, sizeof (byte));
 }
 
 /** @internal Append a 32-bit integer to a BSON stream.
@@ -59,7 +116,7 @@ _bson_append_byte (bson *b, const guint8 byte)
 static inline void
 _bson_append_int32 (bson *b, const gint32 i)
 {
-  b->data = g_byte_array_append (b->data, (const guint8 *)&i, sizeof (gint32));
+  _bson_append_data (b, (const guint8 *)&i, sizeof (gint32));
 }
 
 /** @internal Append a 64-bit integer to a BSON stream.
@@ -70,7 +127,7 @@ _bson_append_int32 (bson *b, const gint32 i)
 static inline void
 _bson_append_int64 (bson *b, const gint64 i)
 {
-  b->data = g_byte_array_append (b->data, (const guint8 *)&i, sizeof (gint64));
+  _bson_append_data (b, (const guint8 *)&i, sizeof (gint64));
 }
 
 /** @internal Append an element header to a BSON stream.
@@ -95,8 +152,7 @@ _bson_append_element_header (bson *b, bson_type type, const gchar *name)
     return FALSE;
 
   _bson_append_byte (b, (guint8) type);
-  b->data = g_byte_array_append (b->data, (const guint8 *)name,
-				 strlen (name) + 1);
+  _bson_append_data (b, (const guint8 *)name, strlen (name) + 1);
 
   return TRUE;
 }
@@ -134,7 +190,7 @@ _bson_append_string_element (bson *b, bson_type type, const gchar *name,
 
   _bson_append_int32 (b, GINT32_TO_LE (len));
 
-  b->data = g_byte_array_append (b->data, (const guint8 *)val, len - 1);
+  _bson_append_data (b, (const guint8 *)val, len - 1);
   _bson_append_byte (b, 0);
 
   return TRUE;
@@ -167,7 +223,7 @@ _bson_append_document_element (bson *b, bson_type type, const gchar *name,
   if (!_bson_append_element_header (b, type, name))
     return FALSE;
 
-  b->data = g_byte_array_append (b->data, bson_data (doc), bson_size (doc));
+  _bson_append_data (b, bson_data (doc), bson_size (doc));
   return TRUE;
 }
 
@@ -256,9 +312,9 @@ bson_new (void)
 bson *
 bson_new_sized (gint32 size)
 {
-  bson *b = g_new0 (bson, 1);
+  bson *b = _mongo_new0 (bson, 1);
 
-  b->data = g_byte_array_sized_new (size + 1);
+  _bson_reserve (b, (gsize)MAX (size, 0) + sizeof (gint32) + 1);
   _bson_append_int32 (b, 0);
 
   return b;
@@ -272,9 +328,30 @@ bson_new_from_data (const guint8 *data, gint32 size)
   if (!data || size <= 0)
     return NULL;
 
-  b = g_new0 (bson, 1);
-  b->data = g_byte_array_sized_new (size + 1);
-  b->data = g_byte_array_append (b->data, data, size);
+  b = _mongo_new0 (bson, 1);
+  _bson_reserve (b, size);
+  _bson_append_data (b, data, size);
+
+  return b;
+}
+
+bson *
+bson_new_view (const guint8 *data, gint32 size)
+{
+  bson *b;
+  gint32 l;
+
+  if (!data || size < (gint32)sizeof (gint32) + 1)
+    return NULL;
+
+  memcpy (&l, data, sizeof (gint32));
+  if (GINT32_FROM_LE (l) != size || data[size - 1] != 0)
+    return NULL;
+
+  b = _mongo_new0 (bson, 1);
+  b->data = (guint8 *)data;
+  b->len = size;
+  b->finished = TRUE;
 
   return b;
 }
@@ -529,8 +606,8 @@ bson_finish (bson *b)
 
   _bson_append_byte (b, 0);
 
-  i = (gint32 *) (&b->data->data[0]);
-  *i = GINT32_TO_LE ((gint32) (b->data->len));
+  i = (gint32 *) (&b->data[0]);
+  *i = GINT32_TO_LE (b->len);
 
   b->finished = TRUE;
 
@@ -544,7 +621,7 @@ bson_size (const bson *b)
     return -1;
 
   if (b->finished)
-    return b->data->len;
+    return b->len;
   else
     return -1;
 }
@@ -556,7 +633,7 @@ bson_data (const bson *b)
     return NULL;
 
   if (b->finished)
-    return b->data->data;
+    return b->data;
   else
     return NULL;
 }
@@ -568,7 +645,7 @@ bson_reset (bson *b)
     return FALSE;
 
   b->finished = FALSE;
-  g_byte_array_set_size (b->data, 0);
+  b->len = 0;
   _bson_append_int32 (b, 0);
 
   return TRUE;
@@ -580,9 +657,9 @@ bson_free (bson *b)
   if (!b)
     return;
 
-  if (b->data)
-    g_byte_array_free (b->data, TRUE);
-  g_free (b);
+  if (b->alloc > 0)
+    _mongo_free (b->data);
+  _mongo_free (b);
 }
 
 /*
@@ -597,7 +674,7 @@ bson_append_double (bson *b, const gchar *name, gdouble val)
   if (!_bson_append_element_header (b, BSON_TYPE_DOUBLE, name))
     return FALSE;
 
-  b->data = g_byte_array_append (b->data, (const guint8 *)&d, sizeof (val));
+  _bson_append_data (b, (const guint8 *)&d, sizeof (val));
   return TRUE;
 }
 
@@ -633,7 +710,7 @@ bson_append_binary (bson *b, const gchar *name, bson_binary_subtype subtype,
   _bson_append_int32 (b, GINT32_TO_LE (size));
   _bson_append_byte (b, (guint8)subtype);
 
-  b->data = g_byte_array_append (b->data, data, size);
+  _bson_append_data (b, data, size);
   return TRUE;
 }
 
@@ -646,7 +723,7 @@ bson_append_oid (bson *b, const gchar *name, const guint8 *oid)
   if (!_bson_append_element_header (b, BSON_TYPE_OID, name))
     return FALSE;
 
-  b->data = g_byte_array_append (b->data, oid, 12);
+  _bson_append_data (b, oid, 12);
   return TRUE;
 }
 
@@ -682,10 +759,8 @@ bson_append_regex (bson *b, const gchar *name, const gchar *regexp,
   if (!_bson_append_element_header (b, BSON_TYPE_REGEXP, name))
     return FALSE;
 
-  b->data = g_byte_array_append (b->data, (const guint8 *)regexp,
-				 strlen (regexp) + 1);
-  b->data = g_byte_array_append (b->data, (const guint8 *)options,
-				 strlen (options) + 1);
+  _bson_append_data (b, (const guint8 *)regexp, strlen (regexp) + 1);
+  _bson_append_data (b, (const guint8 *)options, strlen (options) + 1);
 
   return TRUE;
 }
@@ -726,12 +801,11 @@ bson_append_javascript_w_scope (bson *b, const gchar *name,
 
   /* Append the JS code */
   _bson_append_int32 (b, GINT32_TO_LE (length));
-  b->data = g_byte_array_append (b->data, (const guint8 *)js, length - 1);
+  _bson_append_data (b, (const guint8 *)js, length - 1);
   _bson_append_byte (b, 0);
 
   /* Append the scope */
-  b->data = g_byte_array_append (b->data, bson_data (scope),
-				 bson_size (scope));
+  _bson_append_data (b, bson_data (scope), bson_size (scope));
 
   return TRUE;
 }
@@ -769,7 +843,7 @@ bson_cursor_new (const bson *b)
   if (bson_size (b) == -1)
     return NULL;
 
-  c = (bson_cursor *)g_new0 (bson_cursor, 1);
+  c = _mongo_new0 (bson_cursor, 1);
   c->obj = b;
 
   return c;
@@ -778,7 +852,7 @@ bson_cursor_new (const bson *b)
 void
 bson_cursor_free (bson_cursor *c)
 {
-  g_free (c);
+  _mongo_free (c);
 }
 
 /** @internal Reads out the 32-bit documents size from a bytestream.
@@ -893,7 +967,7 @@ bson_find (const bson *b, const gchar *name)
 	{
 	  bson_cursor *c;
 
-	  c = (bson_cursor *)g_new0 (bson_cursor, 1);
+	  c = _mongo_new0 (bson_cursor, 1);
 
 	  c->obj = b;
 	  c->key = key;
@@ -987,9 +1061,8 @@ bson_cursor_get_document (const bson_cursor *c, bson **dest)
 
   size = _DOC_SIZE (bson_data(c->obj), c->value_pos) - sizeof (gint32) - 1;
   b = bson_new_sized (size);
-  b->data = g_byte_array_append (b->data,
-				 bson_data (c->obj) + c->value_pos +
-				 sizeof (gint32), size);
+  _bson_append_data (b, bson_data (c->obj) + c->value_pos + sizeof (gint32),
+		     size);
   bson_finish (b);
 
   *dest = b;
@@ -1010,9 +1083,8 @@ bson_cursor_get_array (const bson_cursor *c, bson **dest)
 
   size = _DOC_SIZE (bson_data(c->obj), c->value_pos) - sizeof (gint32) - 1;
   b = bson_new_sized (size);
-  b->data = g_byte_array_append (b->data,
-				 bson_data (c->obj) + c->value_pos +
-				 sizeof (gint32), size);
+  _bson_append_data (b, bson_data (c->obj) + c->value_pos + sizeof (gint32),
+		     size);
   bson_finish (b);
 
   *dest = b;
@@ -1138,9 +1210,8 @@ bson_cursor_get_javascript_w_scope (const bson_cursor *c,
   size = _DOC_SIZE (bson_data (c->obj), c->value_pos + docpos) -
     sizeof (gint32) - 1;
   b = bson_new_sized (size);
-  b->data = g_byte_array_append (b->data,
-				 bson_data (c->obj) + c->value_pos + docpos +
-				 sizeof (gint32), size);
+  _bson_append_data (b, bson_data (c->obj) + c->value_pos + docpos +
+		     sizeof (gint32), size);
   bson_finish (b);
 
   *scope = b;
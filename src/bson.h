@@ -170,6 +170,24 @@ bson *bson_new_sized (gint32 size);
  */
 bson *bson_new_from_data (const guint8 *data, gint32 size);
 
+/** Create a read-only BSON object over existing data.
+ *
+ * Unlike bson_new_from_data(), the data is not copied: the object
+ * points into @a data, and is only valid as long as @a data is. The
+ * object is finished, and can be read with cursors right away.
+ *
+ * Freeing the object with bson_free() does not free @a data. Calling
+ * bson_reset() on it gives it a buffer of its own.
+ *
+ * @param data is a complete BSON document, including its terminating
+ * zero byte.
+ * @param size is the size of the document.
+ *
+ * @returns A newly allocated object, or NULL if @a data does not look
+ * like a document of @a size bytes.
+ */
+bson *bson_new_view (const guint8 *data, gint32 size);
+
 /** Build a BSON object in one go, with full control.
  *
  * This function can be used to build a BSON object in one simple
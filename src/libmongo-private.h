@@ -21,22 +21,230 @@
 
 #include "mongo.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+
 /** @internal BSON structure.
  */
 struct _bson
 {
-  GByteArray *data; /**< The actual data of the BSON object. */
+  guint8 *data; /**< The actual data of the BSON object. */
+  gint32 len; /**< The length of the data. */
+  gint32 alloc; /**< The allocated size of the data buffer. */
   gboolean finished; /**< Flag to indicate whether the object is open
 			or finished. */
 };
 
+/** @internal Make a read-only BSON object over existing data.
+ *
+ * The object borrows @a data: it is only valid as long as @a data is,
+ * must not be modified, and must not be freed with bson_free().
+ *
+ * @param b is the object to initialise.
+ * @param data is the raw, finished BSON document.
+ * @param size is the size of the document.
+ */
+static inline void
+_bson_view_init (bson *b, const guint8 *data, gint32 size)
+{
+  b->data = (guint8 *)data;
+  b->len = size;
+  b->alloc = 0;
+  b->finished = TRUE;
+}
+
+/** @internal Allocate memory with the library allocator.
+ *
+ * @param n_bytes is the number of bytes to allocate.
+ *
+ * @returns A pointer to the allocated memory, or NULL if @a n_bytes
+ * is zero. Aborts if the allocator fails.
+ */
+gpointer _mongo_malloc (gsize n_bytes);
+
+/** @internal Allocate zero-filled memory with the library allocator.
+ *
+ * @param n_bytes is the number of bytes to allocate.
+ *
+ * @returns A pointer to the allocated memory, or NULL if @a n_bytes
+ * is zero. Aborts if the allocator fails.
+ */
+gpointer _mongo_malloc0 (gsize n_bytes);
+
+/** @internal Resize memory allocated with the library allocator.
+ *
+ * @param mem is the memory to resize, or NULL.
+ * @param n_bytes is the new size.
+ *
+ * @returns A pointer to the resized memory, or NULL if @a n_bytes is
+ * zero, in which case @a mem is freed. Aborts if the allocator fails.
+ */
+gpointer _mongo_realloc (gpointer mem, gsize n_bytes);
+
+/** @internal Free memory allocated with the library allocator.
+ *
+ * @param mem is the memory to free, or NULL.
+ */
+void _mongo_free (gpointer mem);
+
+/** @internal Allocate zero-filled structures with the library
+ * allocator.
+ *
+ * @param type is the type of the structures.
+ * @param n is the number of structures to allocate.
+ */
+#define _mongo_new0(type,n) ((type *)_mongo_malloc0 (sizeof (type) * (n)))
+
+/** @internal Append raw data to an unfinished BSON object.
+ *
+ * No validation is done on the data, use with care.
+ *
+ * @param b is the BSON object to append to.
+ * @param data is the data to append.
+ * @param size is the size of the data.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean _bson_append_data (bson *b, const guint8 *data, gint32 size);
+
+/** @internal The io_uring state of a connection, see
+ * mongo-uring.c. */
+typedef struct _mongo_uring mongo_uring;
+
 /** @internal Mongo Connection state object. */
 struct _mongo_connection
 {
   gint fd; /**< The file descriptor associated with the connection. */
   gint32 request_id; /**< The last sent command's requestID. */
+  gint timeout; /**< Send and receive timeout, in milliseconds. Zero
+		   means no timeout. */
+
+  mongo_connection_stats stats; /**< Statistics of the connection. */
+  gint64 last_send; /**< Monotonic time the last request was sent
+		       at. */
+
+  mongo_uring *uring; /**< The io_uring state of the connection, or
+			 NULL for plain socket calls. */
+  gboolean defer_reply; /**< Set while sending a request whose reply
+			   is not read right away, so that the
+			   transport does not wait for it along with
+			   the send. */
 };
 
+/** @internal Set up the io_uring state of a connection.
+ *
+ * The I/O itself goes through the ring of the calling thread, which
+ * is set up on first use, and shared by every connection of the
+ * thread.
+ *
+ * @returns A new state, or NULL if io_uring is not available: not
+ * compiled in, too old a kernel, or not permitted.
+ */
+mongo_uring *_mongo_uring_new (void);
+
+/** @internal Attach a connected socket to an io_uring state, and
+ * give it a read-ahead buffer.
+ *
+ * @param r is the state.
+ * @param fd is the socket. It remains owned by the caller.
+ */
+void _mongo_uring_attach (mongo_uring *r, gint fd);
+
+/** @internal Free an io_uring state. The attached socket is not
+ * closed.
+ *
+ * @param r is the state to free, may be NULL.
+ */
+void _mongo_uring_free (mongo_uring *r);
+
+/** @internal Connect a socket through the ring of the thread.
+ *
+ * @param r is the state.
+ * @param fd is the socket to connect.
+ * @param addr is the address to connect to.
+ * @param addrlen is the length of the address.
+ * @param deadline is the monotonic time (in microseconds) until which
+ * to wait, or zero to wait as long as the system does.
+ *
+ * @returns Zero on success, -1 otherwise, with errno set to ETIMEDOUT
+ * if the deadline passed.
+ */
+gint _mongo_uring_connect (mongo_uring *r, gint fd,
+			   const struct sockaddr *addr, socklen_t addrlen,
+			   gint64 deadline);
+
+/** @internal sendmsg() through the ring of the thread.
+ *
+ * If a reply is expected, and the message is small, the receive of
+ * the reply is submitted along with it, linked to the send, into the
+ * read-ahead buffer. A failure of that receive is reported by the
+ * next _mongo_uring_recv().
+ *
+ * @param r is the state.
+ * @param msg is the message to send.
+ * @param timeout is the timeout in milliseconds, zero for none.
+ * @param reply is whether the message completes a request the server
+ * replies to.
+ *
+ * @returns The number of bytes sent, or -1 on error, with errno set
+ * to EAGAIN on timeout, like sendmsg() on a socket with a send
+ * timeout.
+ */
+gssize _mongo_uring_sendmsg (mongo_uring *r, const struct msghdr *msg,
+			     gint timeout, gboolean reply);
+
+/** @internal recv() through the ring of the thread.
+ *
+ * Small reads are served from the read-ahead buffer, refilling it
+ * with whatever the socket has, up to the size of the buffer.
+ *
+ * @param r is the state.
+ * @param buf is the buffer to receive into.
+ * @param size is the size of the buffer.
+ * @param timeout is the timeout in milliseconds, zero for none.
+ *
+ * @returns The number of bytes received, zero at the end of the
+ * stream, or -1 on error, with errno set to EAGAIN on timeout.
+ */
+gssize _mongo_uring_recv (mongo_uring *r, void *buf, gsize size,
+			  gint timeout);
+
+/** @internal Map a wire protocol opcode to a statistics operation
+ * type. */
+static inline mongo_connection_stats_op
+_mongo_connection_stats_op (gint32 opcode)
+{
+  switch (opcode)
+    {
+    case 2001:
+      return MONGO_CONNECTION_STATS_OP_UPDATE;
+    case 2002:
+      return MONGO_CONNECTION_STATS_OP_INSERT;
+    case 2004:
+      return MONGO_CONNECTION_STATS_OP_QUERY;
+    case 2005:
+      return MONGO_CONNECTION_STATS_OP_GET_MORE;
+    case 2006:
+      return MONGO_CONNECTION_STATS_OP_DELETE;
+    case 2007:
+      return MONGO_CONNECTION_STATS_OP_KILL_CURSORS;
+    default:
+      return MONGO_CONNECTION_STATS_OP_OTHER;
+    }
+}
+
+/** @internal A server in the process-wide topology table.
+ *
+ * Entries are never freed, pointers to them stay valid for the
+ * lifetime of the process. The information about the server is
+ * protected by a lock, use _mongo_sync_server_get_info() to read it.
+ */
+typedef struct
+{
+  gchar *addr; /**< The "host:port" address, the key of the table. */
+  mongo_sync_server_info info; /**< What is known about the server. */
+} mongo_sync_server;
+
 /** @internal Synchronous connection object. */
 struct _mongo_sync_connection
 {
@@ -49,16 +257,30 @@ struct _mongo_sync_connection
   /** Replica Set properties. */
   struct
   {
-    GList *seeds; /**< Replica set seeds, as a list of strings. */
-    GList *hosts; /**< Replica set members, as a list of strings. */
-    gchar *primary; /**< The replica master, if any. */
+    GList *seeds; /**< Replica set seeds, as a list of servers. */
+    GList *hosts; /**< Replica set members, as a list of servers. */
+    mongo_sync_server *primary; /**< The replica master, if any. */
   } rs;
+  mongo_sync_server *server; /**< The server the connection is
+				connected to, if known. */
+
+  /** Topology monitor subscription. */
+  struct
+  {
+    mongo_sync_topology_monitor *monitor; /**< The monitor subscribed
+					     to, or NULL. */
+    mongo_sync_topology_snapshot *snapshot; /**< The last snapshot
+					       taken from the monitor,
+					       or NULL. */
+  } topology;
 
   gchar *last_error; /**< The last error from the server, caught
 			during queries. */
   gint32 max_insert_size; /**< Maximum number of bytes an insert
 			     command can be before being split to
 			     smaller chunks. Used for bulk inserts. */
+  gint reconnect_timeout; /**< Time limit of a single reconnect
+			     attempt, in milliseconds. */
 };
 
 /** @internal Synchronous pool connection object. */
@@ -70,6 +292,206 @@ struct _mongo_sync_pool_connection
   gboolean in_use; /**< Whether the object is in use or not. */
 };
 
+/** @internal Start connecting to a MongoDB server, without blocking.
+ *
+ * Resolves the host, and initiates a non-blocking connect towards
+ * the first address that accepts it. The connection attempt can be
+ * waited upon by polling the returned socket for writability, and
+ * must be completed with mongo_connect_nonblock_finish().
+ *
+ * @param host is the IP address of the server.
+ * @param port is the port to connect to.
+ *
+ * @returns The file descriptor of the socket the connect is in
+ * progress on, or -1 on error.
+ */
+gint mongo_connect_nonblock (const char *host, int port);
+
+/** @internal Complete a connection started by mongo_connect_nonblock().
+ *
+ * Checks whether the connection attempt succeeded, and if so, puts
+ * the socket back into blocking mode, and wraps it into a connection
+ * object.
+ *
+ * @param fd is the file descriptor returned by
+ * mongo_connect_nonblock().
+ *
+ * @returns A newly allocated mongo_connection object, or NULL on
+ * error, in which case the file descriptor is closed too.
+ */
+mongo_connection *mongo_connect_nonblock_finish (gint fd);
+
+/** @internal Get a server from the topology table.
+ *
+ * @param host is the host name of the server.
+ * @param port is the port of the server.
+ *
+ * @returns The server, added to the table if it was not there yet, or
+ * NULL on error.
+ */
+mongo_sync_server *_mongo_sync_server_get (const gchar *host, gint port);
+
+/** @internal Get a server from the topology table, by address.
+ *
+ * @param addr is the "host:port" address of the server.
+ *
+ * @returns The server, added to the table if it was not there yet, or
+ * NULL if the address cannot be parsed.
+ */
+mongo_sync_server *_mongo_sync_server_parse (const gchar *addr);
+
+/** @internal Get what is known about a server.
+ *
+ * @param server is the server to query.
+ * @param info is where the information is stored.
+ */
+void _mongo_sync_server_get_info (const mongo_sync_server *server,
+				  mongo_sync_server_info *info);
+
+/** @internal Record the ismaster reply of a server.
+ *
+ * @param server is the server that replied.
+ * @param res is the (finished) reply document.
+ * @param rtt is the round-trip time of the command, in microseconds.
+ */
+void _mongo_sync_server_seen (mongo_sync_server *server, const bson *res,
+			      gint64 rtt);
+
+/** @internal Record that a server could not be reached.
+ *
+ * @param server is the server that failed.
+ */
+void _mongo_sync_server_down (mongo_sync_server *server);
+
+/** @internal Get the servers a connection may reconnect to.
+ *
+ * @param conn is the connection to query.
+ *
+ * @returns A newly allocated list of servers, best first. The list
+ * must be freed with g_list_free(), the servers must not be freed.
+ */
+GList *_mongo_sync_server_candidates (const mongo_sync_connection *conn);
+
+/** @internal Catch up with the topology monitor of a connection.
+ *
+ * If the monitor published a new snapshot since the connection last
+ * looked, takes it, and updates the primary and the host list of the
+ * connection from it. Cheap when nothing changed.
+ *
+ * @param conn is the connection to update.
+ *
+ * @returns The primary according to the monitor, or NULL if the
+ * connection has no monitor, or the monitor knows no primary.
+ */
+mongo_sync_server *_mongo_sync_topology_refresh (mongo_sync_connection *conn);
+
+/** @internal Send a packet on a synchronous connection.
+ *
+ * @param conn is the connection to send the packet on.
+ * @param p is the packet to send. It will be freed, regardless of
+ * success or failure.
+ * @param force_master signals whether the connection must be
+ * connected to a master before sending.
+ * @param auto_reconnect signals whether to reconnect and retry once
+ * if sending fails, provided the connection has auto-reconnect
+ * enabled.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean _mongo_sync_packet_send (mongo_sync_connection *conn,
+				  mongo_packet *p,
+				  gboolean force_master,
+				  gboolean auto_reconnect);
+
+/** @internal Send multiple packets on a synchronous connection.
+ *
+ * The packets get consecutive request IDs from the counter of the
+ * connection, once it is known to be usable, so that they never
+ * collide with the commands sent while ensuring that. The ID of the
+ * last one is available through mongo_connection_get_requestid()
+ * afterwards.
+ *
+ * @param conn is the connection to send the packets on.
+ * @param packets is the array of packets to send. They are not freed,
+ * but their headers are rewritten.
+ * @param n is the number of packets.
+ * @param force_master signals whether the connection must be
+ * connected to a master before sending.
+ * @param auto_reconnect signals whether to reconnect and retry once
+ * if sending fails, provided the connection has auto-reconnect
+ * enabled.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean _mongo_sync_packet_send_n (mongo_sync_connection *conn,
+				    mongo_packet **packets, gint32 n,
+				    gboolean force_master,
+				    gboolean auto_reconnect);
+
+/** @internal Extract the error from a getLastError reply.
+ *
+ * @param conn is the connection the reply arrived on.
+ * @param p is the reply packet. It is freed.
+ * @param error is where the error string is stored, see
+ * mongo_sync_cmd_get_last_error().
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean _mongo_sync_packet_get_last_error (mongo_sync_connection *conn,
+					    mongo_packet *p, gchar **error);
+
+/** @internal Receive a reply on a synchronous connection.
+ *
+ * @param conn is the connection to receive from.
+ * @param rid is the request ID the reply must be a response to.
+ * @param flags are the reply flags that are considered failures.
+ *
+ * @returns The reply packet, or NULL on error. If the reply contains
+ * no documents, errno is set to ENOENT.
+ */
+mongo_packet *_mongo_sync_packet_recv (mongo_sync_connection *conn,
+				       gint32 rid, gint32 flags);
+
+/** @internal Check a reply packet for server side errors.
+ *
+ * Looks at the first document of the reply, and if it carries an
+ * error, stores it as the last error of the connection.
+ *
+ * @param conn is the connection the packet arrived on.
+ * @param p is the packet to check. It is freed on error.
+ * @param check_ok signals whether to require an "ok" field too.
+ *
+ * @returns The packet itself, or NULL on error.
+ */
+mongo_packet *_mongo_sync_packet_check_error (mongo_sync_connection *conn,
+					      mongo_packet *p,
+					      gboolean check_ok);
+
+/** @internal Check the "ok" field of a command reply.
+ *
+ * @param b is the (finished) reply document.
+ *
+ * @returns TRUE if the field is there and is 1, FALSE otherwise, with
+ * errno set to ENOENT, EINVAL or EPROTO.
+ */
+gboolean _mongo_sync_check_ok (bson *b);
+
+/** @internal Extract the error string from a reply document.
+ *
+ * @param rep is the (finished) reply document.
+ * @param error is where the error string is stored, or NULL if the
+ * reply carries no error. It must be freed with g_free().
+ *
+ * @returns TRUE if the reply has an error field (even a null one),
+ * FALSE otherwise.
+ */
+gboolean _mongo_sync_get_error (const bson *rep, gchar **error);
+
+/** @internal Size of the _id element injected into documents: the
+ * type, the "_id" key with its terminating zero, and the ObjectID.
+ */
+#define MONGO_WIRE_ID_ELEMENT_SIZE (1 + 4 + 12)
+
 /** @internal Construct a kill cursors command, using a va_list.
  *
  * @param id is the sequence id.
@@ -85,6 +507,64 @@ struct _mongo_sync_pool_connection
 mongo_packet *mongo_wire_cmd_kill_cursors_va (gint32 id, gint32 n,
 					      va_list ap);
 
+/** @internal A piece of payload referenced by a packet. */
+typedef struct
+{
+  const guint8 *data; /**< The referenced data. */
+  gint32 size; /**< The size of the data. */
+} mongo_wire_segment;
+
+/** @internal Prepare the data buffer of a packet to be filled in.
+ *
+ * Sets the size of the payload, and returns a buffer to write it
+ * into, so that received data can land in the packet without an
+ * intermediate copy. Any previous payload is discarded.
+ *
+ * @param p is the packet to prepare.
+ * @param size is the size of the payload.
+ * @param buffer is an optional caller-owned buffer, which the packet
+ * borrows if it is at least @a size bytes: it is not freed with the
+ * packet, and must outlive it. Otherwise, the packet uses a buffer of
+ * its own.
+ * @param buffer_size is the size of @a buffer.
+ *
+ * @returns The buffer to write @a size bytes of payload into, or NULL
+ * on error.
+ */
+guint8 *_mongo_wire_packet_prepare_data (mongo_packet *p, gint32 size,
+					 guint8 *buffer, gint32 buffer_size);
+
+/** @internal Get the Nth document of a reply packet, without
+ * copying it.
+ *
+ * @param p is the packet to retrieve a document from.
+ * @param n is the number of the document to retrieve.
+ * @param view is the object to point at the document, see
+ * _bson_view_init(). It is only valid as long as the packet is.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean _mongo_wire_reply_packet_get_nth_view (const mongo_packet *p,
+						gint32 n, bson *view);
+
+/** @internal Get the payload of a packet, without flattening it.
+ *
+ * Packets built by mongo_wire_cmd_insert_n_ref() and
+ * mongo_wire_cmd_update_ref() carry only the start of their payload
+ * in their own buffer, the documents are referenced as separate
+ * segments, to be sent after the data.
+ *
+ * @param p is the packet to query.
+ * @param data is where a pointer to the packet's own data is stored.
+ * @param size is where the size of the packet's own data is stored.
+ * @param segments is where a pointer to the segments is stored.
+ *
+ * @returns The number of segments, or -1 on error.
+ */
+gint32 mongo_wire_packet_get_segments (const mongo_packet *p,
+				       const guint8 **data, gint32 *size,
+				       const mongo_wire_segment **segments);
+
 /** @internal Get the header data of a packet, without conversion.
  *
  * Retrieve the mongo packet's header data, but do not convert the
@@ -0,0 +1,1012 @@
+/* mongo-async.c - libmongo-client asynchronous, callback based API
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-async.c
+ * MongoDB asynchronous API implementation.
+ */
+
+#include "config.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+/** @internal The largest message accepted from the server, in
+ * bytes. Anything larger is taken for a corrupt stream, rather than
+ * allocated. */
+#define MONGO_ASYNC_MAX_MESSAGE_SIZE (48 * 1024 * 1024)
+
+/** @internal The kind of completion a request waits for. */
+typedef enum
+{
+  MONGO_ASYNC_REQUEST_REPLY, /**< A reply, passed to the caller. */
+  MONGO_ASYNC_REQUEST_COUNT, /**< The reply of a count command. */
+  MONGO_ASYNC_REQUEST_WRITE /**< The reply of a getLastError command,
+			       or the flushing of the output. */
+} mongo_async_request_type;
+
+/** @internal A command waiting for completion. */
+typedef struct
+{
+  mongo_async_request_type type; /**< The kind of the request. */
+  gint32 rid; /**< The request ID the reply must be a response to, or
+		 zero if the request completes when flushed. */
+  guint64 end; /**< The output offset the request completes at, if it
+		  waits for the output to be flushed. */
+  gint32 fail_flags; /**< Reply flags that are considered failures. */
+  gboolean check_ok; /**< Whether the reply must have an "ok" field
+			that is 1. */
+
+  /** The completion callback. */
+  union
+  {
+    mongo_async_reply_callback reply; /**< For replies. */
+    mongo_async_count_callback count; /**< For counts. */
+    mongo_async_write_callback write; /**< For writes. */
+  } callback;
+  gpointer user_data; /**< Data passed to the callback. */
+} mongo_async_request;
+
+/** @internal Asynchronous connection object. */
+struct _mongo_async_connection
+{
+  mongo_connection super; /**< The parent object. */
+
+  GMainContext *context; /**< The main context the connection is
+			    attached to. */
+  GSource *watch; /**< The watch on the socket, or NULL. */
+  GIOCondition condition; /**< The conditions the watch waits for. */
+  gboolean connecting; /**< Whether the connection is still being
+			  established. */
+  gint error; /**< The error that broke the connection, or zero. */
+
+  gboolean safe_mode; /**< Safe-mode signal flag. */
+  gchar *last_error; /**< The last error reported by the server. */
+
+  GByteArray *out; /**< Output waiting to be written. */
+  guint out_sent; /**< Bytes of the output written already. */
+  guint64 out_base; /**< Bytes written in total, before the output
+		       buffer. */
+
+  GQueue *replies; /**< Requests waiting for a reply, in the order
+		      they were sent. */
+  GQueue *flushes; /**< Requests waiting for the output to be
+		      flushed, in the order they were queued. */
+
+  mongo_packet_header in_header; /**< Header of the packet being
+				    received. */
+  mongo_packet *in_packet; /**< Packet whose body is being received,
+			     or NULL while the header is. */
+  guint32 in_got; /**< Bytes of the header or body received. */
+
+  gint busy; /**< Nesting level of callbacks being dispatched. */
+  gboolean freed; /**< Whether the connection was disconnected while
+		     dispatching. */
+};
+
+/** @internal A watch on the socket of a connection. */
+typedef struct
+{
+  GSource source; /**< The parent object. */
+  GPollFD pollfd; /**< The socket, and the conditions watched. */
+} mongo_async_watch;
+
+static gboolean
+_mongo_async_watch_prepare (GSource *source G_GNUC_UNUSED, gint *timeout)
+{
+  *timeout = -1;
+  return FALSE;
+}
+
+static gboolean
+_mongo_async_watch_check (GSource *source)
+{
+  mongo_async_watch *watch = (mongo_async_watch *)source;
+
+  return (watch->pollfd.revents & watch->pollfd.events) != 0;
+}
+
+static gboolean
+_mongo_async_watch_dispatch (GSource *source G_GNUC_UNUSED,
+			     GSourceFunc callback, gpointer user_data)
+{
+  return callback (user_data);
+}
+
+static GSourceFuncs _mongo_async_watch_funcs =
+  {
+    _mongo_async_watch_prepare,
+    _mongo_async_watch_check,
+    _mongo_async_watch_dispatch,
+    NULL,
+    NULL,
+    NULL
+  };
+
+static gboolean _mongo_async_io (gpointer data);
+
+/** @internal Make the watch of a connection wait for the right
+ * conditions.
+ *
+ * Reading is always of interest, writing only while connecting, or
+ * while there is output to write.
+ */
+static void
+_mongo_async_watch_update (mongo_async_connection *conn)
+{
+  GIOCondition cond;
+  mongo_async_watch *watch;
+
+  if (conn->super.fd < 0)
+    return;
+
+  cond = G_IO_IN | G_IO_HUP | G_IO_ERR;
+  if (conn->connecting || conn->out_sent < conn->out->len)
+    cond |= G_IO_OUT;
+
+  if (conn->watch && cond == conn->condition)
+    return;
+
+  if (conn->watch)
+    {
+      g_source_destroy (conn->watch);
+      g_source_unref (conn->watch);
+    }
+
+  conn->condition = cond;
+  conn->watch = g_source_new (&_mongo_async_watch_funcs,
+			      sizeof (mongo_async_watch));
+  watch = (mongo_async_watch *)conn->watch;
+  watch->pollfd.fd = conn->super.fd;
+  watch->pollfd.events = cond;
+  g_source_add_poll (conn->watch, &watch->pollfd);
+  g_source_set_callback (conn->watch, _mongo_async_io, conn, NULL);
+  g_source_attach (conn->watch, conn->context);
+}
+
+/** @internal Call the callback of a request that failed. */
+static void
+_mongo_async_request_fail (mongo_async_connection *conn,
+			   mongo_async_request *req, gint error)
+{
+  switch (req->type)
+    {
+    case MONGO_ASYNC_REQUEST_REPLY:
+      if (req->callback.reply)
+	req->callback.reply (conn, NULL, error, req->user_data);
+      break;
+    case MONGO_ASYNC_REQUEST_COUNT:
+      if (req->callback.count)
+	req->callback.count (conn, -1, error, req->user_data);
+      break;
+    case MONGO_ASYNC_REQUEST_WRITE:
+      if (req->callback.write)
+	req->callback.write (conn, error, req->user_data);
+      break;
+    }
+  g_free (req);
+}
+
+/** @internal Break a connection.
+ *
+ * Closes the socket, and fails every request waiting for completion,
+ * in the order they were queued.
+ *
+ * @param conn is the connection to break.
+ * @param error is the error to fail the requests with.
+ */
+static void
+_mongo_async_fail (mongo_async_connection *conn, gint error)
+{
+  GQueue *replies, *flushes;
+  mongo_async_request *req;
+
+  if (conn->error)
+    return;
+  conn->error = error;
+
+  if (conn->watch)
+    {
+      g_source_destroy (conn->watch);
+      g_source_unref (conn->watch);
+      conn->watch = NULL;
+    }
+  if (conn->super.fd >= 0)
+    {
+      shutdown (conn->super.fd, SHUT_RDWR);
+      close (conn->super.fd);
+      conn->super.fd = -1;
+    }
+
+  g_byte_array_set_size (conn->out, 0);
+  conn->out_sent = 0;
+  if (conn->in_packet)
+    mongo_wire_packet_free (conn->in_packet);
+  conn->in_packet = NULL;
+  conn->in_got = 0;
+
+  /* Callbacks may queue new commands (which fail right away) or even
+     disconnect, so work on private copies of the queues. */
+  replies = conn->replies;
+  flushes = conn->flushes;
+  conn->replies = g_queue_new ();
+  conn->flushes = g_queue_new ();
+
+  conn->busy++;
+  while ((req = (mongo_async_request *)g_queue_pop_head (flushes)))
+    _mongo_async_request_fail (conn, req, error);
+  while ((req = (mongo_async_request *)g_queue_pop_head (replies)))
+    _mongo_async_request_fail (conn, req, error);
+  conn->busy--;
+
+  g_queue_free (flushes);
+  g_queue_free (replies);
+}
+
+/** @internal Check a reply the way mongo-sync does.
+ *
+ * @param conn is the connection the reply arrived on.
+ * @param req is the request the reply belongs to.
+ * @param p is the reply.
+ * @param doc is pointed at the first document of the reply, if not
+ * NULL. It is only valid as long as the reply is.
+ *
+ * @returns Zero if the reply is acceptable, an errno value otherwise.
+ */
+static gint
+_mongo_async_reply_check (mongo_async_connection *conn,
+			  const mongo_async_request *req,
+			  const mongo_packet *p, bson *doc)
+{
+  mongo_reply_packet_header rh;
+  bson b;
+  gint error = 0;
+
+  if (!mongo_wire_reply_packet_get_header (p, &rh))
+    return errno;
+  if (rh.flags & req->fail_flags)
+    return EPROTO;
+  if (rh.returned == 0)
+    return ENOENT;
+
+  if (!_mongo_wire_reply_packet_get_nth_view (p, 1, &b))
+    return EPROTO;
+
+  if (req->check_ok)
+    {
+      if (!_mongo_sync_check_ok (&b))
+	{
+	  error = errno;
+	  g_free (conn->last_error);
+	  conn->last_error = NULL;
+	  _mongo_sync_get_error (&b, &conn->last_error);
+	}
+    }
+  else
+    {
+      g_free (conn->last_error);
+      conn->last_error = NULL;
+      if (_mongo_sync_get_error (&b, &conn->last_error))
+	error = EPROTO;
+    }
+
+  if (!error && doc)
+    *doc = b;
+  return error;
+}
+
+/** @internal Complete a request with its reply.
+ *
+ * @param conn is the connection the reply arrived on.
+ * @param req is the request to complete. It is freed.
+ * @param p is the reply. It is freed, or passed on to the callback.
+ */
+static void
+_mongo_async_request_complete (mongo_async_connection *conn,
+			       mongo_async_request *req, mongo_packet *p)
+{
+  bson doc;
+  bson_cursor *c;
+  gchar *err = NULL;
+  gdouble d = -1;
+  gint error;
+
+  error = _mongo_async_reply_check
+    (conn, req, p, (req->type == MONGO_ASYNC_REQUEST_REPLY) ? NULL : &doc);
+  if (error)
+    {
+      mongo_wire_packet_free (p);
+      _mongo_async_request_fail (conn, req, error);
+      return;
+    }
+
+  switch (req->type)
+    {
+    case MONGO_ASYNC_REQUEST_REPLY:
+      if (req->callback.reply)
+	req->callback.reply (conn, p, 0, req->user_data);
+      else
+	mongo_wire_packet_free (p);
+      g_free (req);
+      return;
+
+    case MONGO_ASYNC_REQUEST_COUNT:
+      c = bson_find (&doc, "n");
+      if (!c)
+	error = ENOENT;
+      else if (!bson_cursor_get_double (c, &d))
+	error = EINVAL;
+      bson_cursor_free (c);
+      break;
+
+    case MONGO_ASYNC_REQUEST_WRITE:
+      if (!_mongo_sync_get_error (&doc, &err))
+	error = EPROTO;
+      else if (err)
+	{
+	  g_free (conn->last_error);
+	  conn->last_error = err;
+	  error = EPROTO;
+	}
+      break;
+    }
+  mongo_wire_packet_free (p);
+
+  if (error)
+    {
+      _mongo_async_request_fail (conn, req, error);
+      return;
+    }
+
+  if (req->type == MONGO_ASYNC_REQUEST_COUNT)
+    {
+      if (req->callback.count)
+	req->callback.count (conn, d, 0, req->user_data);
+    }
+  else if (req->callback.write)
+    req->callback.write (conn, 0, req->user_data);
+  g_free (req);
+}
+
+/** @internal Hand a received packet to the request waiting for it.
+ *
+ * Replies to requests nobody waits for are dropped.
+ */
+static void
+_mongo_async_dispatch (mongo_async_connection *conn, mongo_packet *p)
+{
+  mongo_packet_header h;
+  GList *l;
+
+  mongo_wire_packet_get_header_raw (p, &h);
+
+  /* The server answers in order, so the request is normally the
+     first one. */
+  for (l = conn->replies->head; l; l = l->next)
+    {
+      mongo_async_request *req = (mongo_async_request *)l->data;
+
+      if (req->rid == h.resp_to)
+	{
+	  g_queue_delete_link (conn->replies, l);
+	  _mongo_async_request_complete (conn, req, p);
+	  return;
+	}
+    }
+  mongo_wire_packet_free (p);
+}
+
+/** @internal Read whatever is available from the socket.
+ *
+ * @returns Zero on success, an errno value if the connection broke.
+ */
+static gint
+_mongo_async_read (mongo_async_connection *conn)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  guint8 *buf;
+  guint32 want;
+  gssize n;
+
+  while (conn->super.fd >= 0 && !conn->freed)
+    {
+      if (!conn->in_packet)
+	{
+	  buf = (guint8 *)&conn->in_header;
+	  want = sizeof (mongo_packet_header);
+	}
+      else
+	want = mongo_wire_packet_get_data (conn->in_packet,
+					   (const guint8 **)&buf);
+
+      if (conn->in_got < want)
+	{
+	  n = recv (conn->super.fd, buf + conn->in_got, want - conn->in_got,
+		    MSG_NOSIGNAL);
+	  if (n < 0 && errno == EINTR)
+	    continue;
+	  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return 0;
+	  if (n == 0)
+	    return ECONNRESET;
+	  if (n < 0)
+	    return errno;
+	  conn->in_got += n;
+	  if (conn->in_got < want)
+	    continue;
+	}
+
+      if (!conn->in_packet)
+	{
+	  h = conn->in_header;
+	  h.length = GINT32_FROM_LE (h.length);
+	  h.id = GINT32_FROM_LE (h.id);
+	  h.resp_to = GINT32_FROM_LE (h.resp_to);
+	  h.opcode = GINT32_FROM_LE (h.opcode);
+	  if (h.length <= (gint32)sizeof (mongo_packet_header) ||
+	      h.length > MONGO_ASYNC_MAX_MESSAGE_SIZE)
+	    return EPROTO;
+	  conn->in_header = h;
+
+	  /* The body is received straight into the packet. */
+	  p = mongo_wire_packet_new ();
+	  if (!mongo_wire_packet_set_header_raw (p, &h) ||
+	      !_mongo_wire_packet_prepare_data
+	      (p, h.length - sizeof (mongo_packet_header), NULL, 0))
+	    {
+	      mongo_wire_packet_free (p);
+	      return EPROTO;
+	    }
+	  conn->in_packet = p;
+	  conn->in_got = 0;
+	  continue;
+	}
+
+      p = conn->in_packet;
+      conn->in_packet = NULL;
+      conn->in_got = 0;
+
+      conn->super.stats.packets_received++;
+      conn->super.stats.bytes_received += conn->in_header.length;
+
+      _mongo_async_dispatch (conn, p);
+    }
+  return 0;
+}
+
+/** @internal Write as much of the output as the socket takes.
+ *
+ * Requests waiting for their part of the output to be flushed are
+ * completed.
+ *
+ * @returns Zero on success, an errno value if the connection broke.
+ */
+static gint
+_mongo_async_write (mongo_async_connection *conn)
+{
+  mongo_async_request *req;
+  gssize n;
+
+  while (conn->out_sent < conn->out->len)
+    {
+      n = send (conn->super.fd, conn->out->data + conn->out_sent,
+		conn->out->len - conn->out_sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+      if (n < 0)
+	return errno;
+      conn->out_sent += n;
+      conn->super.stats.bytes_sent += n;
+      conn->super.last_send = g_get_monotonic_time ();
+    }
+
+  if (conn->out_sent == conn->out->len)
+    {
+      conn->out_base += conn->out->len;
+      g_byte_array_set_size (conn->out, 0);
+      conn->out_sent = 0;
+    }
+
+  while ((req = (mongo_async_request *)g_queue_peek_head (conn->flushes)) &&
+	 req->end <= conn->out_base + conn->out_sent && !conn->freed)
+    {
+      g_queue_pop_head (conn->flushes);
+      if (req->callback.write)
+	req->callback.write (conn, 0, req->user_data);
+      g_free (req);
+    }
+  return 0;
+}
+
+/** @internal Free a connection, without calling any callbacks. */
+static void
+_mongo_async_free (mongo_async_connection *conn)
+{
+  g_queue_free (conn->replies);
+  g_queue_free (conn->flushes);
+  g_byte_array_free (conn->out, TRUE);
+  g_main_context_unref (conn->context);
+  g_free (conn->last_error);
+  g_free (conn);
+}
+
+/** @internal Handle the readiness of the socket of a connection. */
+static gboolean
+_mongo_async_io (gpointer data)
+{
+  mongo_async_connection *conn = (mongo_async_connection *)data;
+  GIOCondition cond;
+  gint error = 0;
+
+  cond = ((mongo_async_watch *)conn->watch)->pollfd.revents;
+
+  conn->busy++;
+
+  if (conn->connecting && (cond & (G_IO_OUT | G_IO_HUP | G_IO_ERR)))
+    {
+      socklen_t len = sizeof (error);
+
+      if (getsockopt (conn->super.fd, SOL_SOCKET, SO_ERROR,
+		      &error, &len) != 0)
+	error = errno;
+      if (error == 0)
+	{
+	  int one = 1;
+
+	  conn->connecting = FALSE;
+	  setsockopt (conn->super.fd, IPPROTO_TCP, TCP_NODELAY,
+		      (char *)&one, sizeof (one));
+	}
+    }
+
+  if (!error && !conn->connecting && (cond & G_IO_OUT))
+    error = _mongo_async_write (conn);
+  if (!error && !conn->freed && (cond & (G_IO_IN | G_IO_HUP | G_IO_ERR)))
+    {
+      error = _mongo_async_read (conn);
+      /* A hangup with nothing left to read still breaks the
+	 connection. */
+      if (!error && (cond & (G_IO_HUP | G_IO_ERR)))
+	error = ECONNRESET;
+    }
+
+  if (error && !conn->freed)
+    _mongo_async_fail (conn, error);
+
+  conn->busy--;
+
+  if (conn->freed)
+    {
+      if (conn->busy == 0)
+	_mongo_async_free (conn);
+      return FALSE;
+    }
+  if (!conn->error)
+    _mongo_async_watch_update (conn);
+  return TRUE;
+}
+
+mongo_async_connection *
+mongo_async_connect (const gchar *host, gint port, GMainContext *context)
+{
+  mongo_async_connection *conn;
+  gint fd;
+
+  if (!host)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  fd = mongo_connect_nonblock (host, port);
+  if (fd < 0)
+    return NULL;
+
+  conn = g_new0 (mongo_async_connection, 1);
+  conn->super.fd = fd;
+  conn->context = (context) ? g_main_context_ref (context) :
+    g_main_context_ref (g_main_context_default ());
+  conn->connecting = TRUE;
+  conn->out = g_byte_array_new ();
+  conn->replies = g_queue_new ();
+  conn->flushes = g_queue_new ();
+
+  _mongo_async_watch_update (conn);
+
+  return conn;
+}
+
+gboolean
+mongo_async_conn_set_safe_mode (mongo_async_connection *conn,
+				gboolean safe_mode)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  errno = 0;
+  conn->safe_mode = safe_mode;
+  return TRUE;
+}
+
+gboolean
+mongo_async_conn_get_safe_mode (const mongo_async_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  errno = 0;
+  return conn->safe_mode;
+}
+
+const gchar *
+mongo_async_conn_get_last_error (mongo_async_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  errno = 0;
+  return conn->last_error;
+}
+
+gint32
+mongo_async_conn_get_pending (const mongo_async_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+
+  return g_queue_get_length (conn->replies) +
+    g_queue_get_length (conn->flushes);
+}
+
+/** @internal Check whether commands can be queued on a connection. */
+static gboolean
+_mongo_async_check_conn (const mongo_async_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (conn->error || conn->freed)
+    {
+      errno = EBADF;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/** @internal Append a packet to the output of a connection.
+ *
+ * The packet is copied, and freed.
+ *
+ * @returns The request ID of the packet.
+ */
+static gint32
+_mongo_async_packet_queue (mongo_async_connection *conn, mongo_packet *p)
+{
+  mongo_packet_header h;
+  const guint8 *data;
+  const mongo_wire_segment *segments;
+  gint32 size, n, i;
+
+  mongo_wire_packet_get_header_raw (p, &h);
+  n = mongo_wire_packet_get_segments (p, &data, &size, &segments);
+
+  g_byte_array_append (conn->out, (const guint8 *)&h, sizeof (h));
+  g_byte_array_append (conn->out, data, size);
+  for (i = 0; i < n; i++)
+    g_byte_array_append (conn->out, segments[i].data, segments[i].size);
+
+  conn->super.stats.ops[_mongo_connection_stats_op
+			(GINT32_FROM_LE (h.opcode))]++;
+  conn->super.stats.packets_sent++;
+  conn->super.request_id = GINT32_FROM_LE (h.id);
+
+  mongo_wire_packet_free (p);
+
+  if (!conn->connecting)
+    _mongo_async_watch_update (conn);
+
+  return conn->super.request_id;
+}
+
+/** @internal Queue a command that waits for a reply.
+ *
+ * @param conn is the connection to queue on.
+ * @param p is the packet of the command. It is freed.
+ * @param type is the kind of completion to wait for.
+ * @param fail_flags are the reply flags considered failures.
+ * @param check_ok signals whether the reply must have an "ok" field.
+ * @param callback is the completion callback.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_mongo_async_cmd_queue (mongo_async_connection *conn, mongo_packet *p,
+			mongo_async_request_type type, gint32 fail_flags,
+			gboolean check_ok, gpointer callback,
+			gpointer user_data)
+{
+  mongo_async_request *req;
+
+  if (!p)
+    return FALSE;
+
+  req = g_new0 (mongo_async_request, 1);
+  req->type = type;
+  req->fail_flags = fail_flags;
+  req->check_ok = check_ok;
+  req->callback.reply = (mongo_async_reply_callback)callback;
+  req->user_data = user_data;
+  req->rid = _mongo_async_packet_queue (conn, p);
+
+  g_queue_push_tail (conn->replies, req);
+  return TRUE;
+}
+
+/** @internal Get the next request ID of a connection. */
+static inline gint32
+_mongo_async_next_id (const mongo_async_connection *conn)
+{
+  return conn->super.request_id + 1;
+}
+
+gboolean
+mongo_async_cmd_query (mongo_async_connection *conn, const gchar *ns,
+		       gint32 flags, gint32 skip, gint32 ret,
+		       const bson *query, const bson *sel,
+		       mongo_async_reply_callback callback,
+		       gpointer user_data)
+{
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+
+  return _mongo_async_cmd_queue
+    (conn, mongo_wire_cmd_query (_mongo_async_next_id (conn), ns, flags,
+				 skip, ret, query, sel),
+     MONGO_ASYNC_REQUEST_REPLY, MONGO_REPLY_FLAG_QUERY_FAIL, FALSE,
+     (gpointer)callback, user_data);
+}
+
+gboolean
+mongo_async_cmd_get_more (mongo_async_connection *conn, const gchar *ns,
+			  gint32 ret, gint64 cursor_id,
+			  mongo_async_reply_callback callback,
+			  gpointer user_data)
+{
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+
+  return _mongo_async_cmd_queue
+    (conn, mongo_wire_cmd_get_more (_mongo_async_next_id (conn), ns, ret,
+				    cursor_id),
+     MONGO_ASYNC_REQUEST_REPLY, MONGO_REPLY_FLAG_NO_CURSOR, FALSE,
+     (gpointer)callback, user_data);
+}
+
+gboolean
+mongo_async_cmd_custom (mongo_async_connection *conn, const gchar *db,
+			const bson *command,
+			mongo_async_reply_callback callback,
+			gpointer user_data)
+{
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+
+  return _mongo_async_cmd_queue
+    (conn, mongo_wire_cmd_custom (_mongo_async_next_id (conn), db, 0,
+				  command),
+     MONGO_ASYNC_REQUEST_REPLY, MONGO_REPLY_FLAG_QUERY_FAIL, TRUE,
+     (gpointer)callback, user_data);
+}
+
+gboolean
+mongo_async_cmd_count (mongo_async_connection *conn, const gchar *db,
+		       const gchar *coll, const bson *query,
+		       mongo_async_count_callback callback,
+		       gpointer user_data)
+{
+  bson *cmd;
+  gboolean res;
+
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+  if (!db || !coll)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  cmd = bson_new_sized (bson_size (query) + 32);
+  bson_append_string (cmd, "count", coll, -1);
+  if (query)
+    bson_append_document (cmd, "query", query);
+  bson_finish (cmd);
+
+  res = _mongo_async_cmd_queue
+    (conn, mongo_wire_cmd_custom (_mongo_async_next_id (conn), db, 0, cmd),
+     MONGO_ASYNC_REQUEST_COUNT, MONGO_REPLY_FLAG_QUERY_FAIL, TRUE,
+     (gpointer)callback, user_data);
+  bson_free (cmd);
+
+  return res;
+}
+
+/** @internal Queue a write command, and arrange for its completion.
+ *
+ * In safe mode, a getLastError command is queued after the write,
+ * and the write completes with its reply. Otherwise, the write
+ * completes once it is flushed, or right away if there is no
+ * callback.
+ *
+ * @param conn is the connection to queue on.
+ * @param ns is the namespace of the write.
+ * @param p is the packet of the write. It is freed.
+ * @param callback is the completion callback, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_mongo_async_write_queue (mongo_async_connection *conn, const gchar *ns,
+			  mongo_packet *p,
+			  mongo_async_write_callback callback,
+			  gpointer user_data)
+{
+  mongo_async_request *req;
+  const gchar *dot;
+  gchar *db;
+  bson *cmd;
+  gboolean res;
+
+  if (!p)
+    return FALSE;
+
+  _mongo_async_packet_queue (conn, p);
+
+  if (!conn->safe_mode)
+    {
+      if (!callback)
+	return TRUE;
+
+      req = g_new0 (mongo_async_request, 1);
+      req->type = MONGO_ASYNC_REQUEST_WRITE;
+      req->end = conn->out_base + conn->out->len;
+      req->callback.write = callback;
+      req->user_data = user_data;
+      g_queue_push_tail (conn->flushes, req);
+      return TRUE;
+    }
+
+  dot = strchr (ns, '.');
+  db = (dot) ? g_strndup (ns, dot - ns) : g_strdup (ns);
+
+  cmd = bson_new_sized (64);
+  bson_append_int32 (cmd, "getlasterror", 1);
+  bson_finish (cmd);
+
+  conn->super.stats.get_last_error_calls++;
+  res = _mongo_async_cmd_queue
+    (conn, mongo_wire_cmd_custom (_mongo_async_next_id (conn), db, 0, cmd),
+     MONGO_ASYNC_REQUEST_WRITE, MONGO_REPLY_FLAG_QUERY_FAIL, TRUE,
+     (gpointer)callback, user_data);
+  bson_free (cmd);
+  g_free (db);
+
+  return res;
+}
+
+gboolean
+mongo_async_cmd_insert_n (mongo_async_connection *conn, const gchar *ns,
+			  gint32 n, const bson **docs,
+			  mongo_async_write_callback callback,
+			  gpointer user_data)
+{
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+  if (!ns)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  /* The documents are copied into the output buffer right away, so
+     there is no need to copy them into the packet first. */
+  return _mongo_async_write_queue
+    (conn, ns, mongo_wire_cmd_insert_n_ref (_mongo_async_next_id (conn),
+					    ns, n, docs),
+     callback, user_data);
+}
+
+gboolean
+mongo_async_cmd_update (mongo_async_connection *conn, const gchar *ns,
+			gint32 flags, const bson *selector,
+			const bson *update,
+			mongo_async_write_callback callback,
+			gpointer user_data)
+{
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+  if (!ns)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  return _mongo_async_write_queue
+    (conn, ns, mongo_wire_cmd_update_ref (_mongo_async_next_id (conn),
+					  ns, flags, selector, update),
+     callback, user_data);
+}
+
+gboolean
+mongo_async_cmd_delete (mongo_async_connection *conn, const gchar *ns,
+			gint32 flags, const bson *sel,
+			mongo_async_write_callback callback,
+			gpointer user_data)
+{
+  if (!_mongo_async_check_conn (conn))
+    return FALSE;
+  if (!ns)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  return _mongo_async_write_queue
+    (conn, ns, mongo_wire_cmd_delete (_mongo_async_next_id (conn),
+				      ns, flags, sel),
+     callback, user_data);
+}
+
+void
+mongo_async_disconnect (mongo_async_connection *conn)
+{
+  if (!conn || conn->freed)
+    return;
+
+  conn->busy++;
+  _mongo_async_fail (conn, ECANCELED);
+  conn->busy--;
+
+  conn->freed = TRUE;
+  if (conn->busy == 0)
+    _mongo_async_free (conn);
+
+  errno = 0;
+}
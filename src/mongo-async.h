@@ -0,0 +1,300 @@
+/* mongo-async.h - libmongo-client asynchronous, callback based API
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_ASYNC_H
+#define LIBMONGO_ASYNC_H 1
+
+#include <glib.h>
+#include <bson.h>
+#include <mongo-wire.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup mongo_async_api Mongo Async API
+ *
+ * The asynchronous API is the non-blocking counterpart of mongo-sync:
+ * commands return as soon as they are queued, and their result is
+ * delivered to a completion callback later.
+ *
+ * Connections live on a GLib main context, which may be shared by any
+ * number of them. Their sockets are non-blocking, and are only read
+ * and written when the main context reports them ready, so a single
+ * thread running the context can have thousands of commands in
+ * flight. Commands queued between two iterations of the context are
+ * written to the network together.
+ *
+ * Callbacks are always called from the main context, never from
+ * within the function that queued the command. Each of them receives
+ * an error code, which is zero on success, and an errno value
+ * otherwise. When the connection breaks, every command waiting for
+ * completion fails with the same error, and the connection can not be
+ * used anymore, it must be disconnected.
+ *
+ * Unlike mongo-sync, asynchronous connections do not follow replica
+ * set changes, and do not reconnect.
+ *
+ * @addtogroup mongo_async_api
+ * @{
+ */
+
+/** Opaque asynchronous connection object. */
+typedef struct _mongo_async_connection mongo_async_connection;
+
+/** Completion callback of commands that return a reply.
+ *
+ * @param conn is the connection the command was sent on.
+ * @param reply is the reply of the server, or NULL on error. It is
+ * owned by the callback, and must be freed with
+ * mongo_wire_packet_free().
+ * @param error is zero on success, an errno value otherwise.
+ * @param user_data is the data passed along with the command.
+ */
+typedef void (*mongo_async_reply_callback) (mongo_async_connection *conn,
+					    mongo_packet *reply,
+					    gint error, gpointer user_data);
+
+/** Completion callback of count commands.
+ *
+ * @param conn is the connection the command was sent on.
+ * @param count is the number of matching documents, or -1 on error.
+ * @param error is zero on success, an errno value otherwise.
+ * @param user_data is the data passed along with the command.
+ */
+typedef void (*mongo_async_count_callback) (mongo_async_connection *conn,
+					    gdouble count, gint error,
+					    gpointer user_data);
+
+/** Completion callback of insert, update and delete commands.
+ *
+ * In safe mode, the callback is called once the getLastError command
+ * sent after the write returns. Otherwise, it is called as soon as
+ * the write was handed to the network.
+ *
+ * @param conn is the connection the command was sent on.
+ * @param error is zero on success, an errno value otherwise. If the
+ * server reported an error, it is EPROTO, and the error message is
+ * available through mongo_async_conn_get_last_error().
+ * @param user_data is the data passed along with the command.
+ */
+typedef void (*mongo_async_write_callback) (mongo_async_connection *conn,
+					    gint error, gpointer user_data);
+
+/** Start connecting to a MongoDB server.
+ *
+ * The function returns as soon as the connection is initiated,
+ * commands can be queued right away, and are sent once the connection
+ * is established. If it can not be, they fail with the error of the
+ * connection attempt.
+ *
+ * @param host is the address of the server, or the path of a Unix
+ * domain socket, see mongo_connect().
+ * @param port is the port to connect to, ignored for socket paths.
+ * @param context is the main context to attach the connection to, or
+ * NULL for the default one.
+ *
+ * @returns A newly allocated connection, or NULL on error. It must be
+ * freed with mongo_async_disconnect().
+ */
+mongo_async_connection *mongo_async_connect (const gchar *host, gint port,
+					     GMainContext *context);
+
+/** Set the safe mode of an asynchronous connection.
+ *
+ * @param conn is the connection to configure.
+ * @param safe_mode signals whether writes are to be followed by a
+ * getLastError command, and only completed once it returns.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_async_conn_set_safe_mode (mongo_async_connection *conn,
+					 gboolean safe_mode);
+
+/** Get the safe mode of an asynchronous connection.
+ *
+ * @param conn is the connection to query.
+ *
+ * @returns TRUE if safe mode is on, FALSE otherwise and on errors.
+ */
+gboolean mongo_async_conn_get_safe_mode (const mongo_async_connection *conn);
+
+/** Get the last error reported by the server on a connection.
+ *
+ * @param conn is the connection to query.
+ *
+ * @returns The last error message, owned by the connection, or NULL
+ * if there is none.
+ */
+const gchar *mongo_async_conn_get_last_error (mongo_async_connection *conn);
+
+/** Get the number of commands waiting for completion.
+ *
+ * @param conn is the connection to query.
+ *
+ * @returns The number of commands whose callback was not called yet,
+ * or -1 on error.
+ */
+gint32 mongo_async_conn_get_pending (const mongo_async_connection *conn);
+
+/** Queue a query command.
+ *
+ * The reply is checked the same way mongo_sync_cmd_query() checks
+ * it.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to query.
+ * @param flags are the query flags, see mongo_wire_cmd_query().
+ * @param skip is the number of documents to skip.
+ * @param ret is the number of documents to return.
+ * @param query is the query to run.
+ * @param sel is the optional field selector.
+ * @param callback is the callback to call with the reply, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_query (mongo_async_connection *conn,
+				const gchar *ns, gint32 flags,
+				gint32 skip, gint32 ret, const bson *query,
+				const bson *sel,
+				mongo_async_reply_callback callback,
+				gpointer user_data);
+
+/** Queue a get more command.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace the cursor belongs to.
+ * @param ret is the number of documents to return.
+ * @param cursor_id is the ID of the cursor.
+ * @param callback is the callback to call with the reply, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_get_more (mongo_async_connection *conn,
+				   const gchar *ns, gint32 ret,
+				   gint64 cursor_id,
+				   mongo_async_reply_callback callback,
+				   gpointer user_data);
+
+/** Queue a custom command.
+ *
+ * The reply is checked the same way mongo_sync_cmd_custom() checks
+ * it.
+ *
+ * @param conn is the connection to work with.
+ * @param db is the database to run the command on.
+ * @param command is the command to run.
+ * @param callback is the callback to call with the reply, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_custom (mongo_async_connection *conn,
+				 const gchar *db, const bson *command,
+				 mongo_async_reply_callback callback,
+				 gpointer user_data);
+
+/** Queue a count command.
+ *
+ * @param conn is the connection to work with.
+ * @param db is the database the collection is in.
+ * @param coll is the collection to count the documents of.
+ * @param query is the optional query the documents must match.
+ * @param callback is the callback to call with the count.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_count (mongo_async_connection *conn,
+				const gchar *db, const gchar *coll,
+				const bson *query,
+				mongo_async_count_callback callback,
+				gpointer user_data);
+
+/** Queue an insert command.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to insert into.
+ * @param n is the number of documents to insert.
+ * @param docs is the array of documents to insert. They are copied,
+ * and can be freed once the function returns.
+ * @param callback is the callback to call on completion, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_insert_n (mongo_async_connection *conn,
+				   const gchar *ns, gint32 n,
+				   const bson **docs,
+				   mongo_async_write_callback callback,
+				   gpointer user_data);
+
+/** Queue an update command.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to update in.
+ * @param flags are the update flags, see mongo_wire_cmd_update().
+ * @param selector is the selector of the documents to update.
+ * @param update is the update to apply.
+ * @param callback is the callback to call on completion, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_update (mongo_async_connection *conn,
+				 const gchar *ns, gint32 flags,
+				 const bson *selector, const bson *update,
+				 mongo_async_write_callback callback,
+				 gpointer user_data);
+
+/** Queue a delete command.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to delete from.
+ * @param flags are the delete flags, see mongo_wire_cmd_delete().
+ * @param sel is the selector of the documents to delete.
+ * @param callback is the callback to call on completion, or NULL.
+ * @param user_data is passed to the callback.
+ *
+ * @returns TRUE if the command was queued, FALSE otherwise.
+ */
+gboolean mongo_async_cmd_delete (mongo_async_connection *conn,
+				 const gchar *ns, gint32 flags,
+				 const bson *sel,
+				 mongo_async_write_callback callback,
+				 gpointer user_data);
+
+/** Close and free an asynchronous connection.
+ *
+ * Commands waiting for completion fail with ECANCELED, their
+ * callbacks are called before the function returns. Output not
+ * written yet is discarded.
+ *
+ * May be called from a callback of the connection itself.
+ *
+ * @param conn is the connection to free.
+ */
+void mongo_async_disconnect (mongo_async_connection *conn);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,14 +25,26 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/time.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+
+#ifdef IOV_MAX
+/** @internal Maximum number of buffers to pass to sendmsg() at once. */
+#define MONGO_IOV_MAX IOV_MAX
+#else
+#define MONGO_IOV_MAX 1024
+#endif
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
@@ -40,6 +52,25 @@
 
 static const int one = 1;
 
+static int
+set_nonblock (int fd)
+{
+  int val;
+
+  val = fcntl (fd, F_GETFL, 0);
+  if (val < 0)
+    return -1;
+
+  if (val & O_NONBLOCK)
+    return 0;
+
+  val |= O_NONBLOCK;
+  if (fcntl (fd, F_SETFL, val) == -1)
+    return -1;
+
+  return 0;
+}
+
 static int
 unset_nonblock (int fd)
 {
@@ -59,22 +90,143 @@ unset_nonblock (int fd)
   return 0;
 }
 
-mongo_connection *
-mongo_connect (const char *host, int port)
+/** @internal Wait for a non-blocking connect to finish.
+ *
+ * @param fd is the socket the connect is in progress on.
+ * @param deadline is the monotonic time (in microseconds) until which
+ * to wait.
+ *
+ * @returns Zero if the connection was established, -1 otherwise, with
+ * errno set to ETIMEDOUT if the deadline passed.
+ */
+static int
+_mongo_connect_wait (int fd, gint64 deadline)
 {
-  struct addrinfo *res = NULL, *r;
-  struct addrinfo hints;
-  int e, fd = -1;
-  gchar *port_s;
-  mongo_connection *conn;
+  struct pollfd pfd;
+  int err = 0;
+  socklen_t len = sizeof (err);
 
-  if (!host)
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+
+  for (;;)
     {
-      errno = EINVAL;
-      return NULL;
+      gint64 left = (deadline - g_get_monotonic_time ()) / 1000;
+      int r;
+
+      if (left <= 0)
+	{
+	  errno = ETIMEDOUT;
+	  return -1;
+	}
+
+      pfd.revents = 0;
+      r = poll (&pfd, 1, (int)left);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r < 0)
+	return -1;
+      if (r > 0)
+	break;
     }
 
-  conn = g_new0 (mongo_connection, 1);
+  if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+    return -1;
+  if (err != 0)
+    {
+      errno = err;
+      return -1;
+    }
+  return 0;
+}
+
+/** @internal Mark a connection as timed out.
+ *
+ * Once a send or receive timed out, the stream can not be trusted
+ * anymore (a late reply, or the rest of a half-sent packet would
+ * confuse the next exchange), so the connection is shut down.
+ */
+static void
+_mongo_connection_timed_out (mongo_connection *conn)
+{
+  shutdown (conn->fd, SHUT_RDWR);
+  errno = ETIMEDOUT;
+}
+
+/** @internal A resolved address. */
+typedef struct
+{
+  struct sockaddr_storage addr; /**< The address itself. */
+  socklen_t addrlen; /**< Length of the address. */
+  gint family; /**< Address family. */
+  gint socktype; /**< Socket type. */
+  gint protocol; /**< Protocol. */
+} mongo_resolver_addr;
+
+/** @internal Resolver cache entry. */
+typedef struct
+{
+  GArray *addrs; /**< The addresses, or NULL for a failed lookup. */
+  gint64 expires; /**< Monotonic time the entry expires at, zero if
+		     it never does. */
+  gboolean resolving; /**< Whether a lookup is in progress. */
+} mongo_resolver_entry;
+
+/** @internal Transport of new connections. */
+static gint _mongo_transport_default = MONGO_TRANSPORT_SOCKET;
+
+static GMutex _mongo_resolver_lock;
+static GCond _mongo_resolver_cond;
+static GHashTable *_mongo_resolver_cache;
+static gint _mongo_resolver_ttl = 30;
+static gint _mongo_resolver_negative_ttl = 5;
+
+static void
+_mongo_resolver_entry_free (gpointer data)
+{
+  mongo_resolver_entry *entry = (mongo_resolver_entry *)data;
+
+  if (entry->addrs)
+    g_array_free (entry->addrs, TRUE);
+  g_free (entry);
+}
+
+/** @internal Get a resolver cache entry, creating it if need be.
+ *
+ * Must be called with the resolver lock held.
+ */
+static mongo_resolver_entry *
+_mongo_resolver_entry_get (const gchar *key)
+{
+  mongo_resolver_entry *entry;
+
+  if (!_mongo_resolver_cache)
+    _mongo_resolver_cache =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+			     _mongo_resolver_entry_free);
+
+  entry = (mongo_resolver_entry *)g_hash_table_lookup (_mongo_resolver_cache,
+						       key);
+  if (!entry)
+    {
+      entry = g_new0 (mongo_resolver_entry, 1);
+      g_hash_table_insert (_mongo_resolver_cache, g_strdup (key), entry);
+    }
+  return entry;
+}
+
+/** @internal Resolve a host, without the cache.
+ *
+ * @returns A newly allocated array of addresses, or NULL on error.
+ */
+static GArray *
+_mongo_resolver_lookup (const gchar *host, gint port)
+{
+  struct addrinfo *res = NULL, *r;
+  struct addrinfo hints;
+  gchar *port_s;
+  GArray *addrs;
+  int e;
 
   memset (&hints, 0, sizeof (hints));
   hints.ai_socktype = SOCK_STREAM;
@@ -85,35 +237,332 @@ mongo_connect (const char *host, int port)
 
   port_s = g_strdup_printf ("%d", port);
   e = getaddrinfo (host, port_s, &hints, &res);
+  g_free (port_s);
   if (e != 0)
+    return NULL;
+
+  addrs = g_array_new (FALSE, TRUE, sizeof (mongo_resolver_addr));
+  for (r = res; r != NULL; r = r->ai_next)
     {
-      int err = errno;
+      mongo_resolver_addr a;
 
-      g_free (conn);
-      g_free (port_s);
-      errno = err;
+      if (r->ai_addrlen > sizeof (a.addr))
+	continue;
+
+      memset (&a, 0, sizeof (a));
+      memcpy (&a.addr, r->ai_addr, r->ai_addrlen);
+      a.addrlen = r->ai_addrlen;
+      a.family = r->ai_family;
+      a.socktype = r->ai_socktype;
+      a.protocol = r->ai_protocol;
+      g_array_append_val (addrs, a);
+    }
+  freeaddrinfo (res);
+
+  if (addrs->len == 0)
+    {
+      g_array_free (addrs, TRUE);
       return NULL;
     }
-  g_free (port_s);
+  return addrs;
+}
 
-  for (r = res; r != NULL; r = r->ai_next)
+/** @internal Copy an array of addresses. */
+static GArray *
+_mongo_resolver_addrs_copy (const GArray *addrs)
+{
+  GArray *copy;
+
+  copy = g_array_sized_new (FALSE, FALSE, sizeof (mongo_resolver_addr),
+			    addrs->len);
+  g_array_append_vals (copy, addrs->data, addrs->len);
+  return copy;
+}
+
+/** @internal Resolve a Unix domain socket path.
+ *
+ * Paths need no lookup, so they bypass the resolver cache.
+ *
+ * @returns A newly allocated array of a single address, or NULL with
+ * errno set to ENAMETOOLONG if the path does not fit in a socket
+ * address.
+ */
+static GArray *
+_mongo_resolve_unix (const gchar *path)
+{
+  struct sockaddr_un *sa;
+  mongo_resolver_addr a;
+  GArray *addrs;
+  size_t len;
+
+  len = strlen (path);
+  if (len >= sizeof (sa->sun_path))
     {
-      fd = socket (r->ai_family, r->ai_socktype, r->ai_protocol);
-      if (fd != -1 && connect (fd, r->ai_addr, r->ai_addrlen) == 0)
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+
+  memset (&a, 0, sizeof (a));
+  sa = (struct sockaddr_un *)&a.addr;
+  sa->sun_family = AF_UNIX;
+  memcpy (sa->sun_path, path, len + 1);
+  a.addrlen = offsetof (struct sockaddr_un, sun_path) + len + 1;
+  a.family = AF_UNIX;
+  a.socktype = SOCK_STREAM;
+  a.protocol = 0;
+
+  addrs = g_array_sized_new (FALSE, FALSE, sizeof (mongo_resolver_addr), 1);
+  g_array_append_val (addrs, a);
+  return addrs;
+}
+
+/** @internal Resolve a host, through the resolver cache.
+ *
+ * Hosts starting with a slash are Unix domain socket paths, and are
+ * not looked up, the port is ignored for them.
+ *
+ * @param host is the host to resolve.
+ * @param port is the port to connect to.
+ *
+ * @returns A newly allocated array of mongo_resolver_addr elements,
+ * or NULL on error, with errno set to EADDRNOTAVAIL.
+ */
+static GArray *
+_mongo_resolve (const gchar *host, gint port)
+{
+  mongo_resolver_entry *entry;
+  GArray *addrs;
+  gchar *key;
+  gint ttl;
+
+  if (host[0] == '/')
+    return _mongo_resolve_unix (host);
+
+  key = g_strdup_printf ("%s:%d", host, port);
+
+  g_mutex_lock (&_mongo_resolver_lock);
+  for (;;)
+    {
+      entry = (_mongo_resolver_cache) ?
+	(mongo_resolver_entry *)g_hash_table_lookup (_mongo_resolver_cache,
+						     key) : NULL;
+      if (!entry)
 	break;
-      if (fd != -1)
+      if (entry->resolving)
 	{
-	  close (fd);
-	  fd = -1;
+	  g_cond_wait (&_mongo_resolver_cond, &_mongo_resolver_lock);
+	  continue;
 	}
+      if (entry->expires != 0 && entry->expires <= g_get_monotonic_time ())
+	break;
+
+      addrs = (entry->addrs) ? _mongo_resolver_addrs_copy (entry->addrs) :
+	NULL;
+      g_mutex_unlock (&_mongo_resolver_lock);
+      g_free (key);
+
+      if (!addrs)
+	errno = EADDRNOTAVAIL;
+      return addrs;
     }
-  freeaddrinfo (res);
 
-  if (fd == -1)
+  if (_mongo_resolver_ttl == 0 && _mongo_resolver_negative_ttl == 0)
     {
-      g_free (conn);
+      g_mutex_unlock (&_mongo_resolver_lock);
+      g_free (key);
 
-      errno = EADDRNOTAVAIL;
+      addrs = _mongo_resolver_lookup (host, port);
+      if (!addrs)
+	errno = EADDRNOTAVAIL;
+      return addrs;
+    }
+
+  _mongo_resolver_entry_get (key)->resolving = TRUE;
+  g_mutex_unlock (&_mongo_resolver_lock);
+
+  addrs = _mongo_resolver_lookup (host, port);
+
+  g_mutex_lock (&_mongo_resolver_lock);
+  entry = _mongo_resolver_entry_get (key);
+  entry->resolving = FALSE;
+  ttl = (addrs) ? _mongo_resolver_ttl : _mongo_resolver_negative_ttl;
+  if (entry->expires == 0 && entry->addrs)
+    {
+      /* Addresses were pinned with mongo_resolver_add() while the
+	 lookup was in progress: those win over the lookup. */
+      if (addrs)
+	g_array_free (addrs, TRUE);
+      addrs = _mongo_resolver_addrs_copy (entry->addrs);
+    }
+  else if (ttl > 0)
+    {
+      if (entry->addrs)
+	g_array_free (entry->addrs, TRUE);
+      entry->addrs = (addrs) ? _mongo_resolver_addrs_copy (addrs) : NULL;
+      entry->expires = g_get_monotonic_time () + ttl * G_TIME_SPAN_SECOND;
+    }
+  else
+    g_hash_table_remove (_mongo_resolver_cache, key);
+  g_cond_broadcast (&_mongo_resolver_cond);
+  g_mutex_unlock (&_mongo_resolver_lock);
+
+  g_free (key);
+
+  if (!addrs)
+    errno = EADDRNOTAVAIL;
+  return addrs;
+}
+
+gboolean
+mongo_resolver_set_ttl (gint ttl, gint negative_ttl)
+{
+  if (ttl < 0 || negative_ttl < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  g_mutex_lock (&_mongo_resolver_lock);
+  _mongo_resolver_ttl = ttl;
+  _mongo_resolver_negative_ttl = negative_ttl;
+  g_mutex_unlock (&_mongo_resolver_lock);
+
+  return TRUE;
+}
+
+gboolean
+mongo_resolver_add (const gchar *host, gint port,
+		    const struct sockaddr *addr, socklen_t addrlen)
+{
+  mongo_resolver_entry *entry;
+  mongo_resolver_addr a;
+  gchar *key;
+
+  /* Unix domain socket paths are never looked up, so pinning an
+     address for them would have no effect. */
+  if (!host || !addr || host[0] == '/')
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (addrlen == 0 || addrlen > sizeof (a.addr))
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  memset (&a, 0, sizeof (a));
+  memcpy (&a.addr, addr, addrlen);
+  a.addrlen = addrlen;
+  a.family = addr->sa_family;
+  a.socktype = SOCK_STREAM;
+  a.protocol = 0;
+
+  key = g_strdup_printf ("%s:%d", host, port);
+
+  g_mutex_lock (&_mongo_resolver_lock);
+  entry = _mongo_resolver_entry_get (key);
+  if (entry->expires != 0 || !entry->addrs)
+    {
+      /* Pre-resolved addresses replace whatever was looked up. */
+      if (entry->addrs)
+	g_array_free (entry->addrs, TRUE);
+      entry->addrs = g_array_new (FALSE, TRUE, sizeof (mongo_resolver_addr));
+      entry->expires = 0;
+    }
+  g_array_append_val (entry->addrs, a);
+  g_mutex_unlock (&_mongo_resolver_lock);
+
+  g_free (key);
+  return TRUE;
+}
+
+void
+mongo_resolver_flush (void)
+{
+  g_mutex_lock (&_mongo_resolver_lock);
+  if (_mongo_resolver_cache)
+    g_hash_table_remove_all (_mongo_resolver_cache);
+  g_cond_broadcast (&_mongo_resolver_cond);
+  g_mutex_unlock (&_mongo_resolver_lock);
+}
+
+mongo_connection *
+mongo_connect_timeout (const char *host, int port, gint timeout)
+{
+  GArray *addrs;
+  mongo_resolver_addr *r;
+  guint i;
+  int e, fd = -1;
+  mongo_connection *conn;
+  mongo_uring *uring = NULL;
+  gint64 deadline = 0;
+  gboolean timed_out = FALSE;
+
+  if (!host)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (timeout < 0)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  addrs = _mongo_resolve (host, port);
+  if (!addrs)
+    return NULL;
+
+  if (timeout > 0)
+    deadline = g_get_monotonic_time () + (gint64)timeout * 1000;
+
+  if (g_atomic_int_get (&_mongo_transport_default) ==
+      MONGO_TRANSPORT_IO_URING)
+    uring = _mongo_uring_new ();
+
+  for (i = 0; i < addrs->len; i++)
+    {
+      r = &g_array_index (addrs, mongo_resolver_addr, i);
+
+      fd = socket (r->family, r->socktype, r->protocol);
+      if (fd == -1)
+	continue;
+
+      if (uring)
+	{
+	  if (_mongo_uring_connect (uring, fd, (struct sockaddr *)&r->addr,
+				    r->addrlen, deadline) == 0)
+	    break;
+	}
+      else if (timeout == 0)
+	{
+	  if (connect (fd, (struct sockaddr *)&r->addr, r->addrlen) == 0)
+	    break;
+	}
+      else if (set_nonblock (fd) == 0)
+	{
+	  if (connect (fd, (struct sockaddr *)&r->addr, r->addrlen) == 0 ||
+	      (errno == EINPROGRESS && _mongo_connect_wait (fd, deadline) == 0))
+	    break;
+	}
+
+      e = errno;
+      close (fd);
+      fd = -1;
+
+      if (e == ETIMEDOUT)
+	{
+	  timed_out = TRUE;
+	  break;
+	}
+    }
+  g_array_free (addrs, TRUE);
+
+  if (fd == -1)
+    {
+      _mongo_uring_free (uring);
+      errno = (timed_out) ? ETIMEDOUT : EADDRNOTAVAIL;
       return NULL;
     }
 
@@ -123,13 +572,111 @@ mongo_connect (const char *host, int port)
     {
       int err = errno;
 
-      g_free (conn);
+      _mongo_uring_free (uring);
       close (fd);
       errno = err;
       return NULL;
     }
 
+  conn = g_new0 (mongo_connection, 1);
   conn->fd = fd;
+  if (uring)
+    {
+      _mongo_uring_attach (uring, fd);
+      conn->uring = uring;
+    }
+
+  if (timeout > 0)
+    mongo_connection_set_timeout (conn, timeout);
+
+  return conn;
+}
+
+mongo_connection *
+mongo_connect (const char *host, int port)
+{
+  return mongo_connect_timeout (host, port, 0);
+}
+
+gint
+mongo_connect_nonblock (const char *host, int port)
+{
+  GArray *addrs;
+  mongo_resolver_addr *r;
+  guint i;
+  int fd = -1;
+
+  if (!host)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  addrs = _mongo_resolve (host, port);
+  if (!addrs)
+    return -1;
+
+  for (i = 0; i < addrs->len; i++)
+    {
+      r = &g_array_index (addrs, mongo_resolver_addr, i);
+
+      fd = socket (r->family, r->socktype, r->protocol);
+      if (fd == -1)
+	continue;
+
+      if (set_nonblock (fd) == 0 &&
+	  (connect (fd, (struct sockaddr *)&r->addr, r->addrlen) == 0 ||
+	   errno == EINPROGRESS))
+	break;
+
+      close (fd);
+      fd = -1;
+    }
+  g_array_free (addrs, TRUE);
+
+  if (fd == -1)
+    {
+      errno = EADDRNOTAVAIL;
+      return -1;
+    }
+
+  return fd;
+}
+
+mongo_connection *
+mongo_connect_nonblock_finish (gint fd)
+{
+  mongo_connection *conn;
+  int err = 0;
+  socklen_t len = sizeof (err);
+
+  if (fd < 0)
+    {
+      errno = EBADF;
+      return NULL;
+    }
+
+  if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+    err = errno;
+  if (err == 0 && unset_nonblock (fd) != 0)
+    err = errno;
+
+  if (err != 0)
+    {
+      close (fd);
+      errno = err;
+      return NULL;
+    }
+
+  setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof (one));
+
+  conn = g_new0 (mongo_connection, 1);
+  conn->fd = fd;
+
+  if (g_atomic_int_get (&_mongo_transport_default) ==
+      MONGO_TRANSPORT_IO_URING &&
+      (conn->uring = _mongo_uring_new ()) != NULL)
+    _mongo_uring_attach (conn->uring, fd);
 
   return conn;
 }
@@ -143,6 +690,7 @@ mongo_disconnect (mongo_connection *conn)
       return;
     }
 
+  _mongo_uring_free (conn->uring);
   if (conn->fd >= 0)
     close (conn->fd);
 
@@ -151,20 +699,328 @@ mongo_disconnect (mongo_connection *conn)
 }
 
 gboolean
-mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
+mongo_transport_set_default (mongo_transport transport)
+{
+  if (transport != MONGO_TRANSPORT_SOCKET &&
+      transport != MONGO_TRANSPORT_IO_URING)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  g_atomic_int_set (&_mongo_transport_default, transport);
+  return TRUE;
+}
+
+mongo_transport
+mongo_transport_get_default (void)
+{
+  return (mongo_transport)g_atomic_int_get (&_mongo_transport_default);
+}
+
+gint
+mongo_connection_get_transport (const mongo_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+
+  return (conn->uring) ? MONGO_TRANSPORT_IO_URING : MONGO_TRANSPORT_SOCKET;
+}
+
+/** @internal Lock of the trace handler and its data, held for
+ * reading while the handler is called. */
+static GRWLock _mongo_trace_lock;
+/** @internal The registered trace handler, if any. */
+static mongo_trace_func _mongo_trace_func;
+/** @internal User data passed to the trace handler. */
+static gpointer _mongo_trace_data;
+
+void
+mongo_trace_set_handler (mongo_trace_func func, gpointer user_data)
+{
+  g_rw_lock_writer_lock (&_mongo_trace_lock);
+  _mongo_trace_data = user_data;
+  g_atomic_pointer_set (&_mongo_trace_func, func);
+  g_rw_lock_writer_unlock (&_mongo_trace_lock);
+}
+
+/** @internal Check whether a trace handler is set, without
+ * locking. */
+#define _mongo_trace_enabled() \
+  (G_UNLIKELY (g_atomic_pointer_get (&_mongo_trace_func) != NULL))
+
+/** @internal Fill in the packet related fields of a trace event.
+ *
+ * @param info is the event to fill in.
+ * @param p is the packet the event is about.
+ */
+static void
+_mongo_trace_fill (mongo_trace_info *info, const mongo_packet *p)
 {
-  const guint8 *data;
-  gint32 data_size;
   mongo_packet_header h;
-  struct iovec iov[2];
+  const guint8 *data;
+  const mongo_wire_segment *segments;
+  gint32 size;
+
+  if (!p || !mongo_wire_packet_get_header (p, &h))
+    return;
+
+  info->opcode = h.opcode;
+  info->request_id = h.id;
+  info->response_to = h.resp_to;
+  info->size = h.length;
+
+  /* Every request that has a namespace has it right after the first
+     32-bit field. */
+  switch (h.opcode)
+    {
+    case 2001:
+    case 2002:
+    case 2004:
+    case 2005:
+    case 2006:
+      if (mongo_wire_packet_get_segments (p, &data, &size, &segments) < 0)
+	break;
+      if (size > (gint32)sizeof (gint32) &&
+	  memchr (data + sizeof (gint32), 0, size - sizeof (gint32)))
+	info->ns = (const gchar *)data + sizeof (gint32);
+      break;
+    default:
+      break;
+    }
+}
+
+/** @internal Call the trace handler, if it is still set, preserving
+ * errno. */
+static inline void
+_mongo_trace (const mongo_trace_info *info)
+{
+  int e = errno;
+
+  g_rw_lock_reader_lock (&_mongo_trace_lock);
+  if (_mongo_trace_func)
+    _mongo_trace_func (info, _mongo_trace_data);
+  g_rw_lock_reader_unlock (&_mongo_trace_lock);
+  errno = e;
+}
+
+static gboolean _mongo_packet_send (mongo_connection *conn,
+				    const mongo_packet *p);
+static gboolean _mongo_packet_send_n (mongo_connection *conn,
+				      const mongo_packet **packets,
+				      gint32 n);
+static mongo_packet *_mongo_packet_recv (mongo_connection *conn,
+					guint8 *buffer, gint32 buffer_size);
+
+/** @internal Send a packet, with tracing. */
+static gboolean
+_mongo_packet_send_traced (mongo_connection *conn, const mongo_packet *p)
+{
+  mongo_trace_info info;
+  gboolean res;
+
+  memset (&info, 0, sizeof (info));
+  info.event = MONGO_TRACE_SEND_START;
+  info.conn = conn;
+  _mongo_trace_fill (&info, p);
+  _mongo_trace (&info);
+
+  res = _mongo_packet_send (conn, p);
+
+  info.event = MONGO_TRACE_SEND_END;
+  info.success = res;
+  info.error = (res) ? 0 : errno;
+  _mongo_trace (&info);
+
+  return res;
+}
+
+/** @internal Receive a packet, with tracing. */
+static mongo_packet *
+_mongo_packet_recv_traced (mongo_connection *conn, guint8 *buffer,
+			   gint32 buffer_size)
+{
+  mongo_trace_info info;
+  mongo_packet *p;
+
+  memset (&info, 0, sizeof (info));
+  info.event = MONGO_TRACE_RECV_START;
+  info.conn = conn;
+  _mongo_trace (&info);
+
+  p = _mongo_packet_recv (conn, buffer, buffer_size);
+
+  info.event = MONGO_TRACE_RECV_END;
+  info.success = (p != NULL);
+  info.error = (p) ? 0 : errno;
+  _mongo_trace_fill (&info, p);
+  _mongo_trace (&info);
+
+  return p;
+}
+
+/** @internal Send multiple packets, with tracing. */
+static gboolean
+_mongo_packet_send_n_traced (mongo_connection *conn,
+			     const mongo_packet **packets, gint32 n)
+{
+  mongo_trace_info info;
+  gboolean res;
+  gint32 i;
+
+  for (i = 0; packets && i < n; i++)
+    {
+      memset (&info, 0, sizeof (info));
+      info.event = MONGO_TRACE_SEND_START;
+      info.conn = conn;
+      _mongo_trace_fill (&info, packets[i]);
+      _mongo_trace (&info);
+    }
+
+  res = _mongo_packet_send_n (conn, packets, n);
+
+  for (i = 0; packets && i < n; i++)
+    {
+      memset (&info, 0, sizeof (info));
+      info.event = MONGO_TRACE_SEND_END;
+      info.conn = conn;
+      info.success = res;
+      info.error = (res) ? 0 : errno;
+      _mongo_trace_fill (&info, packets[i]);
+      _mongo_trace (&info);
+    }
+
+  return res;
+}
+
+gboolean
+mongo_packet_send_n (mongo_connection *conn, const mongo_packet **packets,
+		     gint32 n)
+{
+  if (_mongo_trace_enabled ())
+    return _mongo_packet_send_n_traced (conn, packets, n);
+  return _mongo_packet_send_n (conn, packets, n);
+}
+
+gboolean
+mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
+{
+  if (_mongo_trace_enabled ())
+    return _mongo_packet_send_traced (conn, p);
+  return _mongo_packet_send (conn, p);
+}
+
+mongo_packet *
+mongo_packet_recv (mongo_connection *conn)
+{
+  if (_mongo_trace_enabled ())
+    return _mongo_packet_recv_traced (conn, NULL, 0);
+  return _mongo_packet_recv (conn, NULL, 0);
+}
+
+mongo_packet *
+mongo_packet_recv_into (mongo_connection *conn, guint8 *buffer,
+			gint32 size)
+{
+  if (!buffer || size <= 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (_mongo_trace_enabled ())
+    return _mongo_packet_recv_traced (conn, buffer, size);
+  return _mongo_packet_recv (conn, buffer, size);
+}
+
+/** @internal Send a list of buffers on a connection.
+ *
+ * Sends all of the buffers, with as few sendmsg() calls as possible:
+ * at most #MONGO_IOV_MAX of them at a time, and retrying after
+ * partial writes.
+ *
+ * @param conn is the connection to send on.
+ * @param iov is the list of buffers. It is modified to track
+ * progress.
+ * @param n is the number of buffers.
+ * @param reply is whether the server replies to what is sent.
+ *
+ * @returns The number of bytes sent, or -1 on error.
+ */
+static gssize
+_mongo_send_iov (mongo_connection *conn, struct iovec *iov, gsize n,
+		 gboolean reply)
+{
   struct msghdr msg;
+  gssize total = 0;
+
+  while (n > 0)
+    {
+      ssize_t sent;
+
+      if (iov->iov_len == 0)
+	{
+	  iov++;
+	  n--;
+	  continue;
+	}
+
+      memset (&msg, 0, sizeof (struct msghdr));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = MIN (n, MONGO_IOV_MAX);
+
+      if (conn->uring)
+	sent = _mongo_uring_sendmsg (conn->uring, &msg, conn->timeout,
+				     reply && n <= MONGO_IOV_MAX);
+      else
+	sent = sendmsg (conn->fd, &msg, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+	continue;
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+	  _mongo_connection_timed_out (conn);
+	  return -1;
+	}
+      if (sent <= 0)
+	return -1;
+
+      total += sent;
+      while (sent > 0)
+	{
+	  if ((size_t)sent < iov->iov_len)
+	    {
+	      iov->iov_base = (guint8 *)iov->iov_base + sent;
+	      iov->iov_len -= sent;
+	      break;
+	    }
+	  sent -= iov->iov_len;
+	  iov++;
+	  n--;
+	}
+    }
+  return total;
+}
+
+static gboolean
+_mongo_packet_send_n (mongo_connection *conn, const mongo_packet **packets,
+		      gint32 n)
+{
+  const guint8 *data;
+  const mongo_wire_segment *segments;
+  gint32 data_size, n_segments, i, j, n_iov = 0, opcode;
+  mongo_packet_header h_static[4], *h;
+  struct iovec iov_static[16], *iov;
+  gssize sent;
 
   if (!conn)
     {
       errno = ENOTCONN;
       return FALSE;
     }
-  if (!p)
+  if (!packets || n <= 0)
     {
       errno = EINVAL;
       return FALSE;
@@ -176,37 +1032,134 @@ mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
       return FALSE;
     }
 
-  if (!mongo_wire_packet_get_header_raw (p, &h))
-    return FALSE;
+  for (i = 0; i < n; i++)
+    {
+      if (!packets[i])
+	{
+	  errno = EINVAL;
+	  return FALSE;
+	}
+      n_segments = mongo_wire_packet_get_segments (packets[i], &data,
+						   &data_size, &segments);
+      if (n_segments == -1)
+	return FALSE;
+      n_iov += n_segments + 2;
+    }
+
+  h = (n <= (gint32)G_N_ELEMENTS (h_static)) ? h_static :
+    g_new (mongo_packet_header, n);
+  iov = (n_iov <= (gint32)G_N_ELEMENTS (iov_static)) ? iov_static :
+    g_new (struct iovec, n_iov);
+
+  n_iov = 0;
+  for (i = 0; i < n; i++)
+    {
+      mongo_wire_packet_get_header_raw (packets[i], &h[i]);
+      n_segments = mongo_wire_packet_get_segments (packets[i], &data,
+						   &data_size, &segments);
 
-  data_size = mongo_wire_packet_get_data (p, &data);
+      iov[n_iov].iov_base = (void *)&h[i];
+      iov[n_iov++].iov_len = sizeof (mongo_packet_header);
+      iov[n_iov].iov_base = (void *)data;
+      iov[n_iov++].iov_len = data_size;
+      for (j = 0; j < n_segments; j++)
+	{
+	  iov[n_iov].iov_base = (void *)segments[j].data;
+	  iov[n_iov++].iov_len = segments[j].size;
+	}
+    }
 
-  if (data_size == -1)
-    return FALSE;
+  /* Queries and getMores are answered, and with io_uring, the
+     answer can be received along with the send, unless the caller
+     reads it later. */
+  opcode = GINT32_FROM_LE (h[n - 1].opcode);
+  sent = _mongo_send_iov (conn, iov, n_iov,
+			  !conn->defer_reply &&
+			  (opcode == 2004 /* query */ ||
+			   opcode == 2005 /* getMore */));
 
-  iov[0].iov_base = (void *)&h;
-  iov[0].iov_len = sizeof (h);
-  iov[1].iov_base = (void *)data;
-  iov[1].iov_len = data_size;
+  if (sent >= 0)
+    {
+      for (i = 0; i < n; i++)
+	conn->stats.ops[_mongo_connection_stats_op
+			(GINT32_FROM_LE (h[i].opcode))]++;
+      conn->stats.packets_sent += n;
+      conn->stats.bytes_sent += sent;
+      conn->request_id = h[n - 1].id;
+      conn->last_send = g_get_monotonic_time ();
+    }
+
+  if (iov != iov_static || h != h_static)
+    {
+      int e = errno;
+
+      if (iov != iov_static)
+	g_free (iov);
+      if (h != h_static)
+	g_free (h);
+      errno = e;
+    }
+
+  return (sent >= 0);
+}
+
+static gboolean
+_mongo_packet_send (mongo_connection *conn, const mongo_packet *p)
+{
+  if (!p)
+    {
+      errno = (conn) ? EINVAL : ENOTCONN;
+      return FALSE;
+    }
+  return _mongo_packet_send_n (conn, &p, 1);
+}
 
-  memset (&msg, 0, sizeof (struct msghdr));
-  msg.msg_iov = iov;
-  msg.msg_iovlen = 2;
+/** @internal Receive a given amount of data from a connection.
+ *
+ * @param conn is the connection to receive from.
+ * @param buf is the buffer to receive into.
+ * @param size is the number of bytes to receive.
+ *
+ * @returns TRUE if all of the data was received, FALSE otherwise.
+ */
+static gboolean
+_mongo_recv_all (mongo_connection *conn, void *buf, guint32 size)
+{
+  guint32 got = 0;
 
-  if (sendmsg (conn->fd, &msg, MSG_NOSIGNAL) != (gint32)sizeof (h) + data_size)
-    return FALSE;
+  while (got < size)
+    {
+      ssize_t n;
 
-  conn->request_id = h.id;
+      if (conn->uring)
+	n = _mongo_uring_recv (conn->uring, (guint8 *)buf + got, size - got,
+			       conn->timeout);
+      else
+	n = recv (conn->fd, (guint8 *)buf + got, size - got, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+	  _mongo_connection_timed_out (conn);
+	  return FALSE;
+	}
+      if (n == 0)
+	errno = ECONNRESET;
+      if (n <= 0)
+	return FALSE;
 
+      got += n;
+    }
   return TRUE;
 }
 
-mongo_packet *
-mongo_packet_recv (mongo_connection *conn)
+static mongo_packet *
+_mongo_packet_recv (mongo_connection *conn, guint8 *buffer,
+		    gint32 buffer_size)
 {
   mongo_packet *p;
   guint8 *data;
-  guint32 size;
+  gint32 size;
   mongo_packet_header h;
 
   if (!conn)
@@ -222,17 +1175,20 @@ mongo_packet_recv (mongo_connection *conn)
     }
 
   memset (&h, 0, sizeof (h));
-  if (recv (conn->fd, &h, sizeof (mongo_packet_header), MSG_NOSIGNAL) !=
-      sizeof (mongo_packet_header))
-    {
-      return NULL;
-    }
+  if (!_mongo_recv_all (conn, &h, sizeof (mongo_packet_header)))
+    return NULL;
 
   h.length = GINT32_FROM_LE (h.length);
   h.id = GINT32_FROM_LE (h.id);
   h.resp_to = GINT32_FROM_LE (h.resp_to);
   h.opcode = GINT32_FROM_LE (h.opcode);
 
+  if (h.length < (gint32)sizeof (mongo_packet_header))
+    {
+      errno = EPROTO;
+      return NULL;
+    }
+
   p = mongo_wire_packet_new ();
 
   if (!mongo_wire_packet_set_header_raw (p, &h))
@@ -244,30 +1200,29 @@ mongo_packet_recv (mongo_connection *conn)
       return NULL;
     }
 
+  /* Receive straight into the packet (or the caller's buffer), so
+     the payload is copied exactly once, from the kernel. */
   size = h.length - sizeof (mongo_packet_header);
-  data = g_new0 (guint8, size);
-  if ((guint32)recv (conn->fd, data, size, MSG_NOSIGNAL) != size)
+  data = _mongo_wire_packet_prepare_data (p, size, buffer, buffer_size);
+  if (!data || !_mongo_recv_all (conn, data, size))
     {
       int e = errno;
 
-      g_free (data);
       mongo_wire_packet_free (p);
       errno = e;
       return NULL;
     }
 
-  if (!mongo_wire_packet_set_data (p, data, size))
+  conn->stats.packets_received++;
+  conn->stats.bytes_received += h.length;
+  if (h.resp_to == conn->request_id && conn->last_send)
     {
-      int e = errno;
-
-      g_free (data);
-      mongo_wire_packet_free (p);
-      errno = e;
-      return NULL;
+      conn->stats.round_trips++;
+      mongo_histogram_record (&conn->stats.latency,
+			      g_get_monotonic_time () - conn->last_send);
+      conn->last_send = 0;
     }
 
-  g_free (data);
-
   return p;
 }
 
@@ -282,3 +1237,104 @@ mongo_connection_get_requestid (const mongo_connection *conn)
 
   return conn->request_id;
 }
+
+gboolean
+mongo_connection_set_timeout (mongo_connection *conn, gint timeout)
+{
+  struct timeval tv;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (timeout < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  if (conn->fd >= 0)
+    {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+
+      if (setsockopt (conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) ||
+	  setsockopt (conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)))
+	return FALSE;
+    }
+
+  conn->timeout = timeout;
+  errno = 0;
+  return TRUE;
+}
+
+gint
+mongo_connection_get_timeout (const mongo_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+
+  return conn->timeout;
+}
+
+gboolean
+mongo_connection_get_stats (const mongo_connection *conn,
+			    mongo_connection_stats *stats)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!stats)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  memcpy (stats, &conn->stats, sizeof (mongo_connection_stats));
+  return TRUE;
+}
+
+gboolean
+mongo_connection_reset_stats (mongo_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  memset (&conn->stats, 0, sizeof (mongo_connection_stats));
+  return TRUE;
+}
+
+gboolean
+mongo_connection_stats_merge (mongo_connection_stats *dest,
+			      const mongo_connection_stats *src)
+{
+  gint i;
+
+  if (!dest || !src)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  for (i = 0; i < MONGO_CONNECTION_STATS_OP_MAX; i++)
+    dest->ops[i] += src->ops[i];
+  dest->packets_sent += src->packets_sent;
+  dest->packets_received += src->packets_received;
+  dest->bytes_sent += src->bytes_sent;
+  dest->bytes_received += src->bytes_received;
+  dest->round_trips += src->round_trips;
+  dest->reconnects += src->reconnects;
+  dest->is_master_checks += src->is_master_checks;
+  dest->get_last_error_calls += src->get_last_error_calls;
+
+  return mongo_histogram_merge (&dest->latency, &src->latency);
+}
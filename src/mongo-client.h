@@ -19,8 +19,10 @@
 
 #include <bson.h>
 #include <mongo-wire.h>
+#include <mongo-utils.h>
 
 #include <glib.h>
+#include <sys/socket.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,7 +41,11 @@ typedef struct _mongo_connection mongo_connection;
  *
  * Connects to a single MongoDB server.
  *
- * @param host is the IP address of the server.
+ * A @a host starting with "/" is the path of a Unix domain socket,
+ * like the one a local mongod or mongos listens on. The @a port is
+ * ignored then.
+ *
+ * @param host is the IP address of the server, or a socket path.
  * @param port is the port to connect to.
  *
  * @returns A newly allocated mongo_connection object or NULL on
@@ -48,6 +54,26 @@ typedef struct _mongo_connection mongo_connection;
  */
 mongo_connection *mongo_connect (const char *host, int port);
 
+/** Connect to a MongoDB server, with a timeout.
+ *
+ * Works like mongo_connect(), except that it gives up if the
+ * connection can not be established within @a timeout
+ * milliseconds. The timeout is then kept as the send and receive
+ * timeout of the connection, see mongo_connection_set_timeout().
+ *
+ * @param host is the IP address of the server, or a socket path.
+ * @param port is the port to connect to.
+ * @param timeout is the time limit, in milliseconds. Zero means no
+ * limit.
+ *
+ * @returns A newly allocated mongo_connection object or NULL on
+ * error, with errno set to ETIMEDOUT if the time limit was
+ * reached. It is the responsibility of the caller to free it once it
+ * is not used anymore.
+ */
+mongo_connection *mongo_connect_timeout (const char *host, int port,
+					 gint timeout);
+
 /** Disconnect from a MongoDB server.
  *
  * @param conn is the connection object to disconnect from.
@@ -66,6 +92,22 @@ void mongo_disconnect (mongo_connection *conn);
  */
 gboolean mongo_packet_send (mongo_connection *conn, const mongo_packet *p);
 
+/** Send multiple assembled packets to MongoDB at once.
+ *
+ * The packets are sent back to back, with as few system calls as
+ * possible, which is considerably cheaper than sending them one by
+ * one.
+ *
+ * @param conn is the connection to use for sending.
+ * @param packets is the array of packets to send.
+ * @param n is the number of packets in the array.
+ *
+ * @returns TRUE on success, when all packets were sent, FALSE
+ * otherwise. On failure, any number of packets may have been sent.
+ */
+gboolean mongo_packet_send_n (mongo_connection *conn,
+			      const mongo_packet **packets, gint32 n);
+
 /** Receive a packet from MongoDB.
  *
  * @param conn is the connection to use for receiving.
@@ -74,6 +116,26 @@ gboolean mongo_packet_send (mongo_connection *conn, const mongo_packet *p);
  */
 mongo_packet *mongo_packet_recv (mongo_connection *conn);
 
+/** Receive a packet from MongoDB into a caller-supplied buffer.
+ *
+ * The payload of the packet is received directly into @a buffer, and
+ * the packet borrows it: it is not freed with the packet, and must
+ * outlive it. Combined with mongo_wire_reply_packet_get_nth_document_view(),
+ * a reply of any size costs a single copy, from the kernel into
+ * @a buffer, and the same buffer can be reused for every reply.
+ *
+ * If the payload does not fit into @a buffer, the packet is received
+ * into a buffer of its own, like with mongo_packet_recv().
+ *
+ * @param conn is the connection to use for receiving.
+ * @param buffer is the buffer to receive the payload into.
+ * @param size is the size of @a buffer.
+ *
+ * @returns A response packet, or NULL upon error.
+ */
+mongo_packet *mongo_packet_recv_into (mongo_connection *conn,
+				      guint8 *buffer, gint32 size);
+
 /** Get the last requestID from a connection object.
  *
  * @param conn is the connection to get the requestID from.
@@ -82,6 +144,254 @@ mongo_packet *mongo_packet_recv (mongo_connection *conn);
  */
 gint32 mongo_connection_get_requestid (const mongo_connection *conn);
 
+/** Set the send and receive timeout of a connection.
+ *
+ * Once set, mongo_packet_send() and mongo_packet_recv() will give up
+ * if the network does not make progress for @a timeout milliseconds,
+ * and fail with errno set to ETIMEDOUT.
+ *
+ * @note Since the stream can not be trusted anymore after a timeout,
+ * the connection is shut down when one happens, and must be
+ * reconnected.
+ *
+ * @param conn is the connection to set the timeout on.
+ * @param timeout is the timeout in milliseconds, zero disables it.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_connection_set_timeout (mongo_connection *conn, gint timeout);
+
+/** Get the send and receive timeout of a connection.
+ *
+ * @param conn is the connection to get the timeout from.
+ *
+ * @returns The timeout in milliseconds, zero if there is none, or -1
+ * on error.
+ */
+gint mongo_connection_get_timeout (const mongo_connection *conn);
+
+/** Operation types counted by connection statistics. */
+typedef enum
+{
+  MONGO_CONNECTION_STATS_OP_UPDATE = 0, /**< OP_UPDATE */
+  MONGO_CONNECTION_STATS_OP_INSERT, /**< OP_INSERT */
+  MONGO_CONNECTION_STATS_OP_QUERY, /**< OP_QUERY, including commands. */
+  MONGO_CONNECTION_STATS_OP_GET_MORE, /**< OP_GET_MORE */
+  MONGO_CONNECTION_STATS_OP_DELETE, /**< OP_DELETE */
+  MONGO_CONNECTION_STATS_OP_KILL_CURSORS, /**< OP_KILL_CURSORS */
+  MONGO_CONNECTION_STATS_OP_OTHER, /**< Any other opcode. */
+
+  MONGO_CONNECTION_STATS_OP_MAX /**< Number of operation types. */
+} mongo_connection_stats_op;
+
+/** Connection statistics.
+ *
+ * Every connection keeps a set of counters, updated as packets are
+ * sent and received. They cost a few additions per packet, and can be
+ * retrieved with mongo_connection_get_stats().
+ */
+typedef struct
+{
+  guint64 ops[MONGO_CONNECTION_STATS_OP_MAX]; /**< Packets sent, by
+						 operation type. */
+  guint64 packets_sent; /**< Number of packets sent. */
+  guint64 packets_received; /**< Number of packets received. */
+  guint64 bytes_sent; /**< Number of bytes sent. */
+  guint64 bytes_received; /**< Number of bytes received. */
+  guint64 round_trips; /**< Number of replies received to the last
+			  request sent. */
+  guint64 reconnects; /**< Number of successful reconnects. */
+  guint64 is_master_checks; /**< Number of ismaster commands run. */
+  guint64 get_last_error_calls; /**< Number of getLastError commands
+				   run. */
+  mongo_histogram latency; /**< Round trip times, in microseconds. */
+} mongo_connection_stats;
+
+/** Get a snapshot of the statistics of a connection.
+ *
+ * @param conn is the connection to get the statistics of.
+ * @param stats is where the statistics are copied to.
+ *
+ * @note The statistics are updated without locking, a snapshot taken
+ * from a thread other than the one using the connection may be
+ * slightly inconsistent.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_connection_get_stats (const mongo_connection *conn,
+				     mongo_connection_stats *stats);
+
+/** Reset the statistics of a connection.
+ *
+ * @param conn is the connection whose statistics to reset.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_connection_reset_stats (mongo_connection *conn);
+
+/** Add one set of connection statistics to another.
+ *
+ * Useful to aggregate the statistics of multiple connections.
+ *
+ * @param dest is the statistics to add to.
+ * @param src is the statistics to add.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_connection_stats_merge (mongo_connection_stats *dest,
+				       const mongo_connection_stats *src);
+
+/** Events reported to trace handlers. */
+typedef enum
+{
+  MONGO_TRACE_SEND_START, /**< A packet is about to be sent. */
+  MONGO_TRACE_SEND_END, /**< Sending a packet finished. */
+  MONGO_TRACE_RECV_START, /**< Waiting for a packet starts. */
+  MONGO_TRACE_RECV_END /**< Receiving a packet finished. */
+} mongo_trace_event;
+
+/** Information passed to trace handlers. */
+typedef struct
+{
+  mongo_trace_event event; /**< The event being reported. */
+  const mongo_connection *conn; /**< The connection of the event. */
+
+  gint32 opcode; /**< The opcode of the packet, zero if not known
+		    yet. */
+  gint32 request_id; /**< The request ID of the packet. */
+  gint32 response_to; /**< The request ID the packet responds to. */
+  const gchar *ns; /**< The namespace of the request, if it has one,
+		      NULL otherwise. Only valid during the call. */
+  gint32 size; /**< The size of the whole packet, in bytes. */
+
+  gboolean success; /**< Whether the operation succeeded, for end
+		       events. */
+  int error; /**< The errno value of a failed operation, for end
+		events. */
+} mongo_trace_info;
+
+/** Trace handler type.
+ *
+ * @param info describes the event.
+ * @param user_data is the pointer passed to
+ * mongo_trace_set_handler().
+ */
+typedef void (*mongo_trace_func) (const mongo_trace_info *info,
+				  gpointer user_data);
+
+/** Set the process-wide trace handler.
+ *
+ * Once set, the handler is called at the start and end of every
+ * mongo_packet_send() and mongo_packet_recv() call, on every
+ * connection. The handler is called from the thread doing the I/O,
+ * and must not use the connection it is called for. Without a
+ * handler, tracing costs a single, well-predicted branch.
+ *
+ * @param func is the handler, or NULL to disable tracing.
+ * @param user_data is an arbitrary pointer passed to @a func.
+ *
+ * @note The handler can be changed at any time: the handler and its
+ * @a user_data are always switched together, and once this function
+ * returns, the previous handler is neither running, nor called
+ * again. It must not be called from a trace handler.
+ */
+void mongo_trace_set_handler (mongo_trace_func func, gpointer user_data);
+
+/** Set the lifetime of resolver cache entries.
+ *
+ * Host names are resolved once, and the addresses are shared by every
+ * connection, pool and reconnect attempt in the process, until the
+ * entry expires. Failed lookups are remembered too, for a separate,
+ * usually shorter time. Concurrent lookups of the same name wait for
+ * a single resolution.
+ *
+ * By default, addresses are kept for 30 seconds, and failures for 5.
+ *
+ * @param ttl is the lifetime of successful lookups, in seconds. Zero
+ * disables caching them.
+ * @param negative_ttl is the lifetime of failed lookups, in
+ * seconds. Zero disables caching them.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_resolver_set_ttl (gint ttl, gint negative_ttl);
+
+/** Add a pre-resolved address to the resolver cache.
+ *
+ * Connections to @a host and @a port will use the given address,
+ * without ever consulting the system resolver. Entries added this
+ * way do not expire, and adding more addresses for the same host and
+ * port makes all of them candidates, in the order they were added.
+ *
+ * Unix domain socket paths (hosts starting with a slash) are not
+ * looked up, and cannot be given addresses this way.
+ *
+ * @param host is the host name.
+ * @param port is the port.
+ * @param addr is the address to connect to, including the port.
+ * @param addrlen is the length of @a addr.
+ *
+ * @returns TRUE on success, FALSE otherwise, with errno set to EINVAL
+ * if @a host is a Unix domain socket path.
+ */
+gboolean mongo_resolver_add (const gchar *host, gint port,
+			     const struct sockaddr *addr, socklen_t addrlen);
+
+/** Drop every entry from the resolver cache.
+ *
+ * Pre-resolved addresses added with mongo_resolver_add() are dropped
+ * too.
+ */
+void mongo_resolver_flush (void);
+
+/** Transports connections can do their I/O through. */
+typedef enum
+{
+  MONGO_TRANSPORT_SOCKET = 0, /**< Plain socket system calls. */
+  MONGO_TRANSPORT_IO_URING /**< Linux io_uring. */
+} mongo_transport;
+
+/** Set the transport of new connections.
+ *
+ * The transport is picked when a connection is made, by
+ * mongo_connect(), mongo_connect_timeout() and
+ * mongo_connect_nonblock_finish(), and is used for the lifetime of
+ * the connection. Higher layers, such as mongo-sync and connection
+ * pools, inherit it.
+ *
+ * With #MONGO_TRANSPORT_IO_URING, connects, sends and receives are
+ * submitted through an io_uring instance shared by every connection
+ * of the calling thread. A query or getMore is submitted together
+ * with the receive of its reply, which is read ahead into a buffer of
+ * the connection, so that a round trip takes a single system
+ * call. Where io_uring is not available (other systems, kernels
+ * older than 5.7, or io_uring being disabled), connections silently
+ * fall back to #MONGO_TRANSPORT_SOCKET.
+ *
+ * The asynchronous API always uses plain sockets.
+ *
+ * @param transport is the transport to use for new connections. The
+ * default is #MONGO_TRANSPORT_SOCKET.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_transport_set_default (mongo_transport transport);
+
+/** Get the transport of new connections.
+ *
+ * @returns The transport set with mongo_transport_set_default().
+ */
+mongo_transport mongo_transport_get_default (void);
+
+/** Get the transport a connection uses.
+ *
+ * @param conn is the connection to query.
+ *
+ * @returns The transport of the connection, which may differ from
+ * the one requested if it was not available, or -1 on error.
+ */
+gint mongo_connection_get_transport (const mongo_connection *conn);
+
 /** @} */
 
 #ifdef __cplusplus
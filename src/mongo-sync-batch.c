@@ -0,0 +1,295 @@
+/* mongo-sync-batch.c - libmongo-client write batch implementation
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-batch.c
+ * MongoDB write batch API implementation.
+ */
+
+#include "config.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+
+/** @internal Write batch object. */
+struct _mongo_sync_batch
+{
+  mongo_sync_connection *conn; /**< The connection to send on. */
+
+  GPtrArray *packets; /**< The pending operations. */
+  gint32 size; /**< The size of the pending operations, in bytes. */
+  gint64 first; /**< Monotonic time the oldest pending operation was
+		   added at. */
+  gchar *db; /**< Database of the last operation, for
+		getLastError. */
+
+  gint32 max_size; /**< Size limit, in bytes. */
+  gint32 max_ops; /**< Operation count limit. */
+  gint max_delay; /**< Delay limit, in milliseconds. */
+};
+
+mongo_sync_batch *
+mongo_sync_batch_new (mongo_sync_connection *conn)
+{
+  mongo_sync_batch *batch;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  batch = g_new0 (mongo_sync_batch, 1);
+  batch->conn = conn;
+  batch->packets = g_ptr_array_new ();
+  batch->max_size = 1024 * 1024;
+  batch->max_ops = 1000;
+
+  return batch;
+}
+
+gboolean
+mongo_sync_batch_set_limits (mongo_sync_batch *batch, gint32 max_size,
+			     gint32 max_ops, gint max_delay)
+{
+  if (!batch)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (max_size <= 0 || max_ops <= 0 || max_delay < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  batch->max_size = max_size;
+  batch->max_ops = max_ops;
+  batch->max_delay = max_delay;
+
+  return TRUE;
+}
+
+gint32
+mongo_sync_batch_get_pending (const mongo_sync_batch *batch)
+{
+  if (!batch)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+  return batch->packets->len;
+}
+
+/** @internal Drop all pending operations of a batch. */
+static void
+_mongo_sync_batch_clear (mongo_sync_batch *batch)
+{
+  guint i;
+
+  for (i = 0; i < batch->packets->len; i++)
+    mongo_wire_packet_free ((mongo_packet *)
+			    g_ptr_array_index (batch->packets, i));
+  g_ptr_array_set_size (batch->packets, 0);
+  batch->size = 0;
+  batch->first = 0;
+}
+
+/** @internal Add an operation to a batch.
+ *
+ * Flushes the batch if any of its limits is reached.
+ *
+ * @param batch is the batch to add to.
+ * @param ns is the namespace of the operation.
+ * @param p is the packet of the operation, owned by the batch from
+ * now on.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_mongo_sync_batch_add (mongo_sync_batch *batch, const gchar *ns,
+		       mongo_packet *p)
+{
+  mongo_packet_header h;
+  const gchar *dot;
+  gsize len;
+
+  if (!p)
+    return FALSE;
+
+  mongo_wire_packet_get_header (p, &h);
+
+  dot = strchr (ns, '.');
+  len = (dot) ? (gsize)(dot - ns) : strlen (ns);
+  if (!batch->db || strlen (batch->db) != len ||
+      strncmp (batch->db, ns, len) != 0)
+    {
+      g_free (batch->db);
+      batch->db = g_strndup (ns, len);
+    }
+
+  if (batch->packets->len == 0)
+    batch->first = g_get_monotonic_time ();
+  g_ptr_array_add (batch->packets, p);
+  batch->size += h.length;
+
+  if (batch->size >= batch->max_size ||
+      (gint32)batch->packets->len >= batch->max_ops ||
+      (batch->max_delay > 0 &&
+       g_get_monotonic_time () - batch->first >=
+       (gint64)batch->max_delay * 1000))
+    return mongo_sync_batch_flush (batch);
+
+  return TRUE;
+}
+
+gboolean
+mongo_sync_batch_insert (mongo_sync_batch *batch, const gchar *ns,
+			 const bson *doc)
+{
+  if (!batch)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!ns)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  return _mongo_sync_batch_add
+    (batch, ns, mongo_wire_cmd_insert_n (0, ns, 1, &doc));
+}
+
+gboolean
+mongo_sync_batch_update (mongo_sync_batch *batch, const gchar *ns,
+			 gint32 flags, const bson *selector,
+			 const bson *update)
+{
+  if (!batch)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!ns)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  return _mongo_sync_batch_add
+    (batch, ns, mongo_wire_cmd_update (0, ns, flags, selector, update));
+}
+
+gboolean
+mongo_sync_batch_delete (mongo_sync_batch *batch, const gchar *ns,
+			 gint32 flags, const bson *sel)
+{
+  if (!batch)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!ns)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  return _mongo_sync_batch_add
+    (batch, ns, mongo_wire_cmd_delete (0, ns, flags, sel));
+}
+
+gboolean
+mongo_sync_batch_flush (mongo_sync_batch *batch)
+{
+  mongo_sync_connection *conn;
+  mongo_packet *p;
+  gchar *error = NULL;
+  gint32 rid;
+  gboolean res;
+
+  if (!batch)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (batch->packets->len == 0)
+    return TRUE;
+
+  conn = batch->conn;
+
+  if (conn->safe_mode)
+    {
+      bson *cmd;
+
+      cmd = bson_new_sized (64);
+      bson_append_int32 (cmd, "getlasterror", 1);
+      bson_finish (cmd);
+      g_ptr_array_add (batch->packets,
+		       mongo_wire_cmd_custom (0, batch->db, 0, cmd));
+      bson_free (cmd);
+    }
+
+  /* The operations are numbered when they are sent, after anything
+     the connection may need to send first. */
+  res = _mongo_sync_packet_send_n
+    (conn, (mongo_packet **)batch->packets->pdata,
+     batch->packets->len, TRUE, TRUE);
+  if (!res)
+    {
+      int e = errno;
+
+      _mongo_sync_batch_clear (batch);
+      errno = e;
+      return FALSE;
+    }
+  _mongo_sync_batch_clear (batch);
+  if (!conn->safe_mode)
+    return TRUE;
+
+  conn->super.stats.get_last_error_calls++;
+
+  rid = mongo_connection_get_requestid ((mongo_connection *)conn);
+  p = _mongo_sync_packet_recv (conn, rid, MONGO_REPLY_FLAG_QUERY_FAIL);
+  p = _mongo_sync_packet_check_error (conn, p, TRUE);
+  if (!p)
+    return FALSE;
+  if (!_mongo_sync_packet_get_last_error (conn, p, &error))
+    return FALSE;
+
+  if (error)
+    {
+      g_free (error);
+      errno = EPROTO;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+void
+mongo_sync_batch_free (mongo_sync_batch *batch)
+{
+  if (!batch)
+    return;
+
+  _mongo_sync_batch_clear (batch);
+  g_ptr_array_free (batch->packets, TRUE);
+  g_free (batch->db);
+  g_free (batch);
+}
@@ -0,0 +1,167 @@
+/* mongo-sync-batch.h - libmongo-client write batch API on top of Sync
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_SYNC_BATCH_H
+#define LIBMONGO_SYNC_BATCH_H 1
+
+#include <glib.h>
+#include <mongo-sync.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup mongo_sync_batch_api Mongo Sync Batch API
+ *
+ * A write batch collects insert, update and delete operations, on
+ * any number of namespaces, and sends them to the server together,
+ * as consecutive messages, with a single system call.
+ *
+ * A batch is flushed when it grows over its size or operation count
+ * limit, when its oldest operation is older than the delay limit, or
+ * when mongo_sync_batch_flush() is called explicitly. If the
+ * connection is in safe mode, a single getLastError command is sent
+ * along with every flush, and its result is checked.
+ *
+ * @note The delay limit is only checked when an operation is added
+ * to the batch, there is no timer running in the background. An
+ * application that may go idle should call mongo_sync_batch_flush()
+ * on its own.
+ *
+ * @addtogroup mongo_sync_batch_api
+ * @{
+ */
+
+/** Opaque write batch object. */
+typedef struct _mongo_sync_batch mongo_sync_batch;
+
+/** Create a new write batch.
+ *
+ * The batch starts out with a size limit of one megabyte, an
+ * operation count limit of 1000, and no delay limit.
+ *
+ * @param conn is the connection to send the operations on.
+ *
+ * @returns A newly allocated batch, or NULL on error. It must be freed
+ * with mongo_sync_batch_free().
+ */
+mongo_sync_batch *mongo_sync_batch_new (mongo_sync_connection *conn);
+
+/** Set the limits of a write batch.
+ *
+ * @param batch is the batch to configure.
+ * @param max_size is the number of bytes pending operations may take
+ * up, before the batch is flushed.
+ * @param max_ops is the number of operations that may be pending,
+ * before the batch is flushed.
+ * @param max_delay is the age of the oldest pending operation, in
+ * milliseconds, after which the batch is flushed. Zero disables the
+ * delay limit. The age is only evaluated when an operation is added:
+ * a batch that stops receiving operations is not flushed on its own,
+ * however old its pending operations get.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_batch_set_limits (mongo_sync_batch *batch,
+				      gint32 max_size, gint32 max_ops,
+				      gint max_delay);
+
+/** Get the number of pending operations in a batch.
+ *
+ * @param batch is the batch to query.
+ *
+ * @returns The number of operations waiting to be flushed, or -1 on
+ * error.
+ */
+gint32 mongo_sync_batch_get_pending (const mongo_sync_batch *batch);
+
+/** Add an insert to a write batch.
+ *
+ * @param batch is the batch to add to.
+ * @param ns is the namespace to insert into.
+ * @param doc is the document to insert. It is copied, and can be
+ * freed once the function returns.
+ *
+ * Adding an operation is what checks the limits of the batch, the
+ * delay limit included, and flushes it if any of them is reached.
+ *
+ * @returns TRUE on success, FALSE otherwise. If adding the operation
+ * triggered a flush, and that failed, FALSE is returned too.
+ */
+gboolean mongo_sync_batch_insert (mongo_sync_batch *batch, const gchar *ns,
+				  const bson *doc);
+
+/** Add an update to a write batch.
+ *
+ * @param batch is the batch to add to.
+ * @param ns is the namespace to update.
+ * @param flags are the update flags, see mongo_sync_cmd_update().
+ * @param selector is the selector document.
+ * @param update is the update document.
+ *
+ * The documents are copied, and can be freed once the function
+ * returns.
+ *
+ * @returns TRUE on success, FALSE otherwise. If adding the operation
+ * triggered a flush, and that failed, FALSE is returned too.
+ */
+gboolean mongo_sync_batch_update (mongo_sync_batch *batch, const gchar *ns,
+				  gint32 flags, const bson *selector,
+				  const bson *update);
+
+/** Add a delete to a write batch.
+ *
+ * @param batch is the batch to add to.
+ * @param ns is the namespace to delete from.
+ * @param flags are the delete flags, see mongo_sync_cmd_delete().
+ * @param sel is the selector document. It is copied, and can be
+ * freed once the function returns.
+ *
+ * @returns TRUE on success, FALSE otherwise. If adding the operation
+ * triggered a flush, and that failed, FALSE is returned too.
+ */
+gboolean mongo_sync_batch_delete (mongo_sync_batch *batch, const gchar *ns,
+				  gint32 flags, const bson *sel);
+
+/** Flush a write batch.
+ *
+ * Sends all pending operations to the server, with a getLastError
+ * command at the end if the connection is in safe mode.
+ *
+ * @param batch is the batch to flush.
+ *
+ * @returns TRUE on success, FALSE otherwise. The pending operations
+ * are dropped either way: on failure, any number of them may have
+ * reached the server.
+ */
+gboolean mongo_sync_batch_flush (mongo_sync_batch *batch);
+
+/** Free a write batch.
+ *
+ * Pending operations are dropped, without being sent. To keep them,
+ * call mongo_sync_batch_flush() first.
+ *
+ * @param batch is the batch to free.
+ */
+void mongo_sync_batch_free (mongo_sync_batch *batch);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,762 @@
+/* mongo-sync-cursor.c - libmongo-client cursor API on top of Sync
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-cursor.c
+ * MongoDB Cursor API implementation.
+ */
+
+#include "config.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+/** @internal Initial delay before re-querying a tailable collection
+ * that had nothing to return, in milliseconds. */
+#define MONGO_SYNC_CURSOR_TAIL_BACKOFF_MIN 50
+/** @internal Maximum delay between re-queries of a tailable
+ * collection that had nothing to return, in milliseconds. */
+#define MONGO_SYNC_CURSOR_TAIL_BACKOFF_MAX 1000
+
+/** @internal A synchronous cursor object. */
+struct _mongo_sync_cursor
+{
+  mongo_sync_connection *conn; /**< The connection the cursor belongs
+				  to. */
+  gchar *ns; /**< The namespace of the cursor. */
+  gint64 cursor_id; /**< The server side cursor ID, zero if the
+		       server has no more results. */
+  gint32 batch_size; /**< Number of documents to request with a
+			getMore. */
+  gint32 pending_rid; /**< Request ID of the getMore in flight, zero
+			 if there is none. */
+  gboolean exhaust; /**< Whether the server streams the batches on
+		       its own, without getMore requests. */
+  gint32 reply_id; /**< Request ID of the last reply of an exhaust
+		      stream, which the next one must respond to. */
+
+  mongo_packet *results; /**< The current batch. */
+  const guint8 *data; /**< The documents of the current batch. */
+  const gint32 *offsets; /**< The index of the current batch, owned
+			    by the packet. */
+  gint32 n_offsets; /**< Number of documents in the index. */
+  gint32 returned; /**< Number of documents in the current batch. */
+  gint32 offset; /**< Index of the current document within the
+		    batch, -1 if the cursor is before the first. */
+  gint32 pos; /**< Byte position of the current document. */
+  bson view; /**< The current document, as handed out by
+		mongo_sync_cursor_get_data_view(). */
+
+  guint8 *buffer; /**< Buffer the batches after the first are
+		     received into, reused for each of them. */
+  gint32 buffer_size; /**< Size of the receive buffer. */
+};
+
+/** @internal Reads out the 32-bit document size from a bytestream.
+ */
+#define _DOC_SIZE(doc,pos) GINT32_FROM_LE (*(gint32 *)(&doc[pos]))
+
+/** @internal Send out the getMore request for the next batch.
+ *
+ * Sends a getMore for the cursor, without waiting for the reply. If
+ * the server side cursor is exhausted, or a request is already in
+ * flight, does nothing.
+ */
+static gboolean
+_mongo_sync_cursor_prefetch (mongo_sync_cursor *cursor)
+{
+  mongo_packet *p;
+  gint32 rid;
+  gboolean sent;
+
+  if (cursor->cursor_id == 0 || cursor->pending_rid != 0 ||
+      cursor->exhaust)
+    return TRUE;
+
+  rid = mongo_connection_get_requestid ((mongo_connection *)cursor->conn) + 1;
+
+  p = mongo_wire_cmd_get_more (rid, cursor->ns, cursor->batch_size,
+			       cursor->cursor_id);
+  if (!p)
+    return FALSE;
+
+  /* The reply is read once the current batch is used up. */
+  cursor->conn->super.defer_reply = TRUE;
+  sent = _mongo_sync_packet_send (cursor->conn, p, FALSE, FALSE);
+  cursor->conn->super.defer_reply = FALSE;
+  if (!sent)
+    return FALSE;
+
+  cursor->pending_rid = rid;
+  return TRUE;
+}
+
+/** @internal Make a reply packet the current batch of a cursor.
+ *
+ * Frees the previous batch, and positions the cursor before the first
+ * document of the new one. If the server has more results, the
+ * request for the next batch is sent out immediately.
+ */
+static gboolean
+_mongo_sync_cursor_set_results (mongo_sync_cursor *cursor,
+				mongo_packet *p)
+{
+  mongo_reply_packet_header rh;
+  const guint8 *data;
+  const gint32 *offsets;
+  gint32 n;
+
+  if (!mongo_wire_reply_packet_get_header (p, &rh))
+    return FALSE;
+  if (rh.returned < 0)
+    {
+      errno = EPROTO;
+      return FALSE;
+    }
+
+  /* Index the batch once, stepping through it is constant time
+     then. */
+  n = mongo_wire_reply_packet_get_offsets (p, &offsets);
+  if (n < 0 || !mongo_wire_reply_packet_get_data (p, &data))
+    {
+      errno = EPROTO;
+      return FALSE;
+    }
+
+  mongo_wire_packet_free (cursor->results);
+  cursor->results = p;
+  cursor->data = data;
+  cursor->offsets = offsets;
+  cursor->n_offsets = n;
+  cursor->returned = rh.returned;
+  cursor->cursor_id = rh.cursor_id;
+  cursor->offset = -1;
+  cursor->pos = 0;
+
+  /* A failed prefetch is not fatal: the request will be retried
+     synchronously once the batch is exhausted. */
+  if (!_mongo_sync_cursor_prefetch (cursor))
+    cursor->pending_rid = 0;
+
+  return TRUE;
+}
+
+/** @internal Drop the current batch of a cursor.
+ *
+ * The batch may live in the receive buffer of the cursor, so it must
+ * be dropped before the next one is received.
+ */
+static void
+_mongo_sync_cursor_release (mongo_sync_cursor *cursor)
+{
+  mongo_wire_packet_free (cursor->results);
+  cursor->results = NULL;
+  cursor->data = NULL;
+  cursor->offsets = NULL;
+  cursor->n_offsets = 0;
+  cursor->returned = 0;
+  cursor->offset = -1;
+  cursor->pos = 0;
+}
+
+/** @internal Receive a batch for a cursor.
+ *
+ * The reply must be a response to the request @a rid. The replies of
+ * an exhaust query are streamed by the server without being asked,
+ * each one a response to the previous reply, so for those, @a rid is
+ * the request ID of the last reply received.
+ *
+ * Empty batches are not errors for tailable cursors: the cursor ID
+ * of the reply is recorded in either case, so that the caller can
+ * tell whether the cursor is still alive.
+ *
+ * The reply is received into the buffer of the cursor. If it does
+ * not fit, it is received into a buffer of its own, and the buffer of
+ * the cursor is grown to fit the next one.
+ */
+static mongo_packet *
+_mongo_sync_cursor_recv (mongo_sync_cursor *cursor, gint32 rid)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  mongo_reply_packet_header rh;
+  gint32 size;
+
+  p = mongo_packet_recv_into ((mongo_connection *)cursor->conn,
+			      cursor->buffer, cursor->buffer_size);
+  if (!p)
+    return NULL;
+
+  if (!mongo_wire_packet_get_header_raw (p, &h) ||
+      !mongo_wire_reply_packet_get_header (p, &rh))
+    {
+      int e = errno;
+
+      mongo_wire_packet_free (p);
+      errno = e;
+      return NULL;
+    }
+
+  size = GINT32_FROM_LE (h.length) - sizeof (mongo_packet_header);
+  if (size > cursor->buffer_size)
+    {
+      _mongo_free (cursor->buffer);
+      cursor->buffer_size = size;
+      cursor->buffer = (guint8 *)_mongo_malloc (cursor->buffer_size);
+    }
+
+  if (GINT32_FROM_LE (h.resp_to) != rid)
+    {
+      mongo_wire_packet_free (p);
+      errno = EPROTO;
+      return NULL;
+    }
+  cursor->reply_id = GINT32_FROM_LE (h.id);
+
+  if (rh.flags & MONGO_REPLY_FLAG_NO_CURSOR)
+    {
+      mongo_wire_packet_free (p);
+      cursor->cursor_id = 0;
+      errno = EPROTO;
+      return NULL;
+    }
+
+  if (rh.returned == 0)
+    {
+      mongo_wire_packet_free (p);
+      cursor->cursor_id = rh.cursor_id;
+      errno = ENOENT;
+      return NULL;
+    }
+
+  return _mongo_sync_packet_check_error (cursor->conn, p, FALSE);
+}
+
+/** @internal Wait for the next batch of a cursor.
+ *
+ * Reads the reply of the getMore in flight, or if there is none,
+ * sends one and waits for its reply. If the reply is empty, but the
+ * cursor is still alive, as is the case with tailable cursors, the
+ * next getMore is sent right away.
+ */
+static mongo_packet *
+_mongo_sync_cursor_fetch (mongo_sync_cursor *cursor)
+{
+  mongo_packet *p;
+  gint32 rid;
+
+  if (cursor->pending_rid == 0 && !_mongo_sync_cursor_prefetch (cursor))
+    return NULL;
+
+  rid = (cursor->exhaust) ? cursor->reply_id : cursor->pending_rid;
+  cursor->pending_rid = 0;
+
+  p = _mongo_sync_cursor_recv (cursor, rid);
+  if (!p && errno == ENOENT && cursor->cursor_id != 0)
+    {
+      if (!_mongo_sync_cursor_prefetch (cursor))
+	return NULL;
+      errno = EAGAIN;
+    }
+  return p;
+}
+
+static mongo_sync_cursor *
+_mongo_sync_cursor_new (mongo_sync_connection *conn, const gchar *ns,
+			mongo_packet *packet, gboolean exhaust,
+			gint32 batch_size)
+{
+  mongo_sync_cursor *c;
+  mongo_packet_header h;
+  mongo_reply_packet_header rh;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+  if (!ns || !packet)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (!mongo_wire_packet_get_header (packet, &h) ||
+      !mongo_wire_reply_packet_get_header (packet, &rh))
+    return NULL;
+
+  c = _mongo_new0 (mongo_sync_cursor, 1);
+  c->conn = conn;
+  c->ns = g_strdup (ns);
+  /* Unless told otherwise, keep the batch size of the query. */
+  c->batch_size = (batch_size < 0) ? rh.returned : batch_size;
+  c->exhaust = exhaust;
+  c->reply_id = h.id;
+  /* Later batches are likely to be about the size of the first. */
+  c->buffer_size = h.length - sizeof (mongo_packet_header);
+  c->buffer = (guint8 *)_mongo_malloc (c->buffer_size);
+
+  if (!_mongo_sync_cursor_set_results (c, packet))
+    {
+      int e = errno;
+
+      _mongo_free (c->buffer);
+      g_free (c->ns);
+      _mongo_free (c);
+      errno = e;
+      return NULL;
+    }
+
+  return c;
+}
+
+mongo_sync_cursor *
+mongo_sync_cursor_new (mongo_sync_connection *conn, const gchar *ns,
+		       mongo_packet *packet)
+{
+  return _mongo_sync_cursor_new (conn, ns, packet, FALSE, -1);
+}
+
+mongo_sync_cursor *
+mongo_sync_cursor_new_exhaust (mongo_sync_connection *conn,
+			       const gchar *ns, gint32 flags,
+			       gint32 skip, gint32 ret,
+			       const bson *query, const bson *sel)
+{
+  mongo_sync_cursor *c;
+  mongo_packet *p;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  p = mongo_sync_cmd_query (conn, ns, flags | MONGO_WIRE_FLAG_QUERY_EXHAUST,
+			    skip, ret, query, sel);
+  if (!p)
+    return NULL;
+
+  c = _mongo_sync_cursor_new (conn, ns, p, TRUE, -1);
+  if (!c)
+    {
+      int e = errno;
+
+      mongo_wire_packet_free (p);
+      shutdown (conn->super.fd, SHUT_RDWR);
+      errno = e;
+      return NULL;
+    }
+  return c;
+}
+
+gboolean
+mongo_sync_cursor_next (mongo_sync_cursor *cursor)
+{
+  mongo_packet *p;
+
+  if (!cursor)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (cursor->offset + 1 >= cursor->returned)
+    {
+      if (cursor->cursor_id == 0)
+	{
+	  errno = ENOENT;
+	  return FALSE;
+	}
+
+      _mongo_sync_cursor_release (cursor);
+      p = _mongo_sync_cursor_fetch (cursor);
+      if (!p)
+	return FALSE;
+      if (!_mongo_sync_cursor_set_results (cursor, p))
+	{
+	  int e = errno;
+
+	  mongo_wire_packet_free (p);
+	  errno = e;
+	  return FALSE;
+	}
+    }
+
+  /* The index stops at the first document that does not fit into
+     the packet. */
+  if (cursor->offset + 1 >= cursor->n_offsets)
+    {
+      errno = EPROTO;
+      return FALSE;
+    }
+
+  cursor->offset++;
+  cursor->pos = cursor->offsets[cursor->offset];
+  return TRUE;
+}
+
+bson *
+mongo_sync_cursor_get_data (mongo_sync_cursor *cursor)
+{
+  bson *b;
+
+  if (!cursor)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (cursor->offset < 0 || cursor->offset >= cursor->returned)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  b = bson_new_from_data (cursor->data + cursor->pos,
+			  _DOC_SIZE (cursor->data, cursor->pos) - 1);
+  if (!b)
+    {
+      errno = EPROTO;
+      return NULL;
+    }
+  bson_finish (b);
+  return b;
+}
+
+const bson *
+mongo_sync_cursor_get_data_view (mongo_sync_cursor *cursor)
+{
+  gint32 size;
+
+  if (!cursor)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (cursor->offset < 0 || cursor->offset >= cursor->returned)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  size = _DOC_SIZE (cursor->data, cursor->pos);
+  if (size < 5 || cursor->data[cursor->pos + size - 1] != 0)
+    {
+      errno = EPROTO;
+      return NULL;
+    }
+
+  _bson_view_init (&cursor->view, cursor->data + cursor->pos, size);
+  return &cursor->view;
+}
+
+void
+mongo_sync_cursor_free (mongo_sync_cursor *cursor)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  mongo_reply_packet_header rh;
+
+  if (!cursor)
+    return;
+
+  /* The rest of an exhaust stream can be arbitrarily long, and there
+     is no way to stop the server sending it, other than dropping the
+     connection. */
+  if (cursor->exhaust && cursor->cursor_id != 0)
+    {
+      shutdown (cursor->conn->super.fd, SHUT_RDWR);
+      cursor->cursor_id = 0;
+    }
+
+  /* Drain the reply of the getMore in flight, so that the connection
+     can be used again, and learn whether the cursor is still alive. */
+  if (cursor->pending_rid != 0)
+    {
+      p = mongo_packet_recv ((mongo_connection *)cursor->conn);
+      if (p && mongo_wire_packet_get_header_raw (p, &h) &&
+	  GINT32_FROM_LE (h.resp_to) == cursor->pending_rid &&
+	  mongo_wire_reply_packet_get_header (p, &rh) &&
+	  !(rh.flags & MONGO_REPLY_FLAG_NO_CURSOR))
+	cursor->cursor_id = rh.cursor_id;
+      else
+	cursor->cursor_id = 0;
+      mongo_wire_packet_free (p);
+    }
+
+  if (cursor->cursor_id != 0)
+    {
+      gint32 rid;
+
+      rid = mongo_connection_get_requestid ((mongo_connection *)cursor->conn)
+	+ 1;
+      p = mongo_wire_cmd_kill_cursors (rid, 1, cursor->cursor_id);
+      if (p)
+	_mongo_sync_packet_send (cursor->conn, p, FALSE, FALSE);
+    }
+
+  mongo_wire_packet_free (cursor->results);
+  _mongo_free (cursor->buffer);
+  g_free (cursor->ns);
+  _mongo_free (cursor);
+}
+
+/** @internal Build the query of a tailing cursor.
+ *
+ * Copies @a query, and if a document was seen already, restricts the
+ * results to documents whose @a key is greater than that of @a last.
+ */
+static bson *
+_mongo_sync_cursor_tail_query (const bson *query, const gchar *key,
+			       const bson *last)
+{
+  bson *q, *gt;
+  bson_cursor *c;
+  gboolean ok;
+
+  if (query)
+    {
+      q = bson_new_from_data (bson_data (query), bson_size (query) - 1);
+      if (!q)
+	{
+	  errno = EINVAL;
+	  return NULL;
+	}
+    }
+  else
+    q = bson_new ();
+
+  if (!last)
+    {
+      bson_finish (q);
+      return q;
+    }
+
+  c = bson_find (last, key);
+  if (!c)
+    {
+      bson_free (q);
+      errno = ENOENT;
+      return NULL;
+    }
+
+  gt = bson_new ();
+  switch (bson_cursor_type (c))
+    {
+    case BSON_TYPE_OID:
+      {
+	const guint8 *oid;
+
+	ok = bson_cursor_get_oid (c, &oid) &&
+	  bson_append_oid (gt, "$gt", oid);
+	break;
+      }
+    case BSON_TYPE_INT32:
+      {
+	gint32 i;
+
+	ok = bson_cursor_get_int32 (c, &i) &&
+	  bson_append_int32 (gt, "$gt", i);
+	break;
+      }
+    case BSON_TYPE_INT64:
+      {
+	gint64 i;
+
+	ok = bson_cursor_get_int64 (c, &i) &&
+	  bson_append_int64 (gt, "$gt", i);
+	break;
+      }
+    case BSON_TYPE_DOUBLE:
+      {
+	gdouble d;
+
+	ok = bson_cursor_get_double (c, &d) &&
+	  bson_append_double (gt, "$gt", d);
+	break;
+      }
+    case BSON_TYPE_UTC_DATETIME:
+      {
+	gint64 ts;
+
+	ok = bson_cursor_get_utc_datetime (c, &ts) &&
+	  bson_append_utc_datetime (gt, "$gt", ts);
+	break;
+      }
+    case BSON_TYPE_TIMESTAMP:
+      {
+	gint64 ts;
+
+	ok = bson_cursor_get_timestamp (c, &ts) &&
+	  bson_append_timestamp (gt, "$gt", ts);
+	break;
+      }
+    case BSON_TYPE_STRING:
+      {
+	const gchar *str;
+
+	ok = bson_cursor_get_string (c, &str) &&
+	  bson_append_string (gt, "$gt", str, -1);
+	break;
+      }
+    default:
+      ok = FALSE;
+      break;
+    }
+  bson_cursor_free (c);
+  bson_finish (gt);
+
+  if (!ok)
+    {
+      bson_free (gt);
+      bson_free (q);
+      errno = EINVAL;
+      return NULL;
+    }
+
+  bson_append_document (q, key, gt);
+  bson_free (gt);
+  bson_finish (q);
+
+  return q;
+}
+
+gboolean
+mongo_sync_cursor_tail (mongo_sync_connection *conn, const gchar *ns,
+			const bson *query, const gchar *key,
+			mongo_sync_cursor_tail_callback callback,
+			gpointer user_data)
+{
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+  bson *q, *last = NULL;
+  gint backoff = MONGO_SYNC_CURSOR_TAIL_BACKOFF_MIN;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!ns || !key || !callback)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  for (;;)
+    {
+      gboolean seen = FALSE;
+
+      q = _mongo_sync_cursor_tail_query (query, key, last);
+      if (!q)
+	{
+	  int e = errno;
+
+	  bson_free (last);
+	  errno = e;
+	  return FALSE;
+	}
+
+      p = mongo_sync_cmd_query (conn, ns,
+				MONGO_WIRE_FLAG_QUERY_TAILABLE_CURSOR |
+				MONGO_WIRE_FLAG_QUERY_AWAIT_DATA,
+				0, 0, q, NULL);
+      bson_free (q);
+
+      cursor = NULL;
+      if (p)
+	{
+	  /* Let the server pick the batch size of the getMores, the
+	     first batch says nothing about the rate of new data. */
+	  cursor = _mongo_sync_cursor_new (conn, ns, p, FALSE, 0);
+	  if (!cursor)
+	    mongo_wire_packet_free (p);
+	}
+      else if (errno != ENOENT)
+	{
+	  int e = errno;
+
+	  bson_free (last);
+	  errno = e;
+	  return FALSE;
+	}
+
+      while (cursor)
+	{
+	  bson *doc;
+	  gboolean cont;
+
+	  if (!mongo_sync_cursor_next (cursor))
+	    {
+	      int e = errno;
+	      gboolean broken;
+
+	      /* Await-data timed out, the next getMore is already in
+		 flight. */
+	      if (e == EAGAIN)
+		continue;
+
+	      /* If the cursor is still alive, it was not lost, the
+		 connection broke: do not try to talk to the server
+		 over it, but reconnect and re-query, if allowed. */
+	      broken = (cursor->cursor_id != 0);
+	      if (broken)
+		{
+		  cursor->pending_rid = 0;
+		  cursor->cursor_id = 0;
+		}
+	      mongo_sync_cursor_free (cursor);
+	      cursor = NULL;
+
+	      if (broken && (!conn->auto_reconnect ||
+			     !mongo_sync_reconnect (conn, !conn->slaveok)))
+		{
+		  bson_free (last);
+		  errno = e;
+		  return FALSE;
+		}
+	      break;
+	    }
+
+	  doc = mongo_sync_cursor_get_data (cursor);
+	  if (!doc)
+	    continue;
+	  seen = TRUE;
+
+	  cont = callback (doc, user_data);
+	  bson_free (last);
+	  last = doc;
+
+	  if (!cont)
+	    {
+	      mongo_sync_cursor_free (cursor);
+	      bson_free (last);
+	      return TRUE;
+	    }
+	}
+
+      /* The cursor is dead. If it delivered anything, re-query right
+	 away, otherwise the collection had nothing to offer, so back
+	 off a little. */
+      if (seen)
+	backoff = MONGO_SYNC_CURSOR_TAIL_BACKOFF_MIN;
+      else
+	{
+	  g_usleep (backoff * 1000);
+	  backoff = MIN (backoff * 2, MONGO_SYNC_CURSOR_TAIL_BACKOFF_MAX);
+	}
+    }
+}
@@ -0,0 +1,225 @@
+/* mongo-sync-cursor.h - libmongo-client cursor API on top of Sync
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_SYNC_CURSOR_H
+#define LIBMONGO_SYNC_CURSOR_H 1
+
+#include <glib.h>
+#include <mongo-sync.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup mongo_sync_cursor_api Mongo Sync Cursor API
+ *
+ * The cursor API is a thin layer on top of mongo_sync_cmd_query() and
+ * mongo_sync_cmd_get_more(), that lets one iterate over the results
+ * of a query document by document, without having to care about
+ * batches and cursor IDs.
+ *
+ * The cursor keeps the request for the next batch in flight while
+ * the application is processing the current one: as soon as a batch
+ * arrives that is not the last, the getMore for the following batch
+ * is sent out, and its reply is only read once the current batch is
+ * exhausted. This way, network latency and processing overlap.
+ *
+ * @note Because a request may be in flight at any time, the
+ * connection a cursor is created on MUST NOT be used for anything
+ * else until the cursor is freed.
+ *
+ * @addtogroup mongo_sync_cursor_api
+ * @{
+ */
+
+/** Opaque synchronous cursor object. */
+typedef struct _mongo_sync_cursor mongo_sync_cursor;
+
+/** Create a new cursor.
+ *
+ * Wraps the reply of a query into a cursor object, and sends out the
+ * request for the next batch right away, if the server has more
+ * results to offer.
+ *
+ * The number of documents requested by subsequent getMore commands
+ * is the same as the number of documents in @a packet.
+ *
+ * @param conn is the connection the query was sent on.
+ * @param ns is the namespace the query was run against.
+ * @param packet is the reply packet of the query, as returned by
+ * mongo_sync_cmd_query().
+ *
+ * @note The cursor takes ownership of @a packet, it must not be freed
+ * by the caller once the function returned successfully.
+ *
+ * @returns A newly allocated cursor object, or NULL on error. The
+ * cursor must be freed with mongo_sync_cursor_free() when not needed
+ * anymore.
+ */
+mongo_sync_cursor *mongo_sync_cursor_new (mongo_sync_connection *conn,
+					  const gchar *ns,
+					  mongo_packet *packet);
+
+/** Run a query in exhaust mode, and return a cursor over the results.
+ *
+ * Sends a query with the #MONGO_WIRE_FLAG_QUERY_EXHAUST flag set, in
+ * which case the server streams all batches of the result, one after
+ * the other, without waiting for getMore requests. This is the
+ * fastest way to read through a large result set.
+ *
+ * @param conn is the connection to run the query on.
+ * @param ns is the namespace to query.
+ * @param flags are the query flags, see mongo_sync_cmd_query().
+ * @param skip is the number of documents to skip.
+ * @param ret is the number of documents to return in a batch.
+ * @param query is the query to run.
+ * @param sel is an optional field selector.
+ *
+ * @note The server keeps streaming until the results are exhausted,
+ * and there is no way to stop it other than dropping the
+ * connection. If the cursor is freed before all results have been
+ * read, the connection is shut down. If auto-reconnect is enabled,
+ * the next command will reconnect, otherwise mongo_sync_reconnect()
+ * must be called before the connection can be used again.
+ *
+ * @returns A newly allocated cursor object, or NULL on error. The
+ * cursor must be freed with mongo_sync_cursor_free() when not needed
+ * anymore.
+ */
+mongo_sync_cursor *mongo_sync_cursor_new_exhaust (mongo_sync_connection *conn,
+						  const gchar *ns,
+						  gint32 flags,
+						  gint32 skip, gint32 ret,
+						  const bson *query,
+						  const bson *sel);
+
+/** Step the cursor to the next document.
+ *
+ * Advances the cursor to the next document of the current batch, or
+ * if the batch is exhausted, waits for the next one to arrive.
+ *
+ * A freshly created cursor is positioned before the first document,
+ * so this function must be called before retrieving any data.
+ *
+ * @param cursor is the cursor to advance.
+ *
+ * @returns TRUE if the cursor points to a valid document, FALSE if
+ * there are no more documents (in which case errno is set to ENOENT),
+ * or on error. For tailable cursors, FALSE with errno set to EAGAIN
+ * means that no new data arrived yet, but the cursor is still alive,
+ * and mongo_sync_cursor_next() can be called again.
+ */
+gboolean mongo_sync_cursor_next (mongo_sync_cursor *cursor);
+
+/** Retrieve the document the cursor points to.
+ *
+ * @param cursor is the cursor to get the data from.
+ *
+ * @returns A newly allocated, finished BSON object, or NULL on
+ * error. It is the responsibility of the caller to free the BSON
+ * object once it is no longer needed.
+ */
+bson *mongo_sync_cursor_get_data (mongo_sync_cursor *cursor);
+
+/** Look at the document the cursor points to, without copying it.
+ *
+ * The returned object points into the batch the cursor holds, see
+ * bson_new_view(). Batches after the first one are received into a
+ * buffer the cursor reuses, so iterating with this function costs a
+ * single copy per document, from the kernel.
+ *
+ * @param cursor is the cursor to get the data from.
+ *
+ * @returns A finished BSON object owned by the cursor, or NULL on
+ * error. It must not be freed, and is only valid until the next
+ * mongo_sync_cursor_next() or mongo_sync_cursor_free() call on
+ * @a cursor.
+ */
+const bson *mongo_sync_cursor_get_data_view (mongo_sync_cursor *cursor);
+
+/** Free a cursor.
+ *
+ * Reads the reply of the request in flight, if any, and if the
+ * server side cursor is still alive, kills it.
+ *
+ * @param cursor is the cursor to free.
+ *
+ * @note The connection of the cursor is not closed, it can be used
+ * again once the cursor is freed. The exception is an exhaust cursor
+ * freed before reaching the end of the results, see
+ * mongo_sync_cursor_new_exhaust().
+ */
+void mongo_sync_cursor_free (mongo_sync_cursor *cursor);
+
+/** Callback type for mongo_sync_cursor_tail().
+ *
+ * @param doc is the document that arrived. It is freed once the
+ * callback returns.
+ * @param user_data is the pointer passed to mongo_sync_cursor_tail().
+ *
+ * @returns TRUE to keep tailing, FALSE to stop.
+ */
+typedef gboolean (*mongo_sync_cursor_tail_callback) (const bson *doc,
+						     gpointer user_data);
+
+/** Tail a capped collection.
+ *
+ * Runs a tailable, await-data query, and delivers every document
+ * that matches it to @a callback, as soon as it arrives. A getMore
+ * is kept in flight at all times, so new documents are delivered
+ * without any polling delay.
+ *
+ * When the server side cursor is lost (for example because the
+ * collection was empty, or the cursor fell behind the capped
+ * collection's end), the query is re-run, restricted to documents
+ * whose @a key is greater than that of the last document seen. If
+ * the re-run query returns nothing, the next attempt is delayed, with
+ * an exponentially growing delay of at most a second.
+ *
+ * If the connection breaks, and auto-reconnect is enabled, the
+ * function reconnects, and continues from the last document seen.
+ *
+ * @param conn is the connection to use.
+ * @param ns is the namespace of the capped collection.
+ * @param query is an optional query to filter the documents with. It
+ * must not contain a condition on @a key.
+ * @param key is the name of the field that identifies the position
+ * within the collection, such as "_id". It must be present in every
+ * document, its value must increase in insertion order, and be an
+ * ObjectID, integer, double, UTC datetime, timestamp or string.
+ * @param callback is the function to call for each document.
+ * @param user_data is an arbitrary pointer passed to @a callback.
+ *
+ * @note The function only returns once @a callback returns FALSE, or
+ * an error occurs. Stopping may take as long as the await-data
+ * timeout of the server, as the getMore in flight must be answered
+ * first.
+ *
+ * @returns TRUE if @a callback asked to stop, FALSE on error.
+ */
+gboolean mongo_sync_cursor_tail (mongo_sync_connection *conn,
+				 const gchar *ns, const bson *query,
+				 const gchar *key,
+				 mongo_sync_cursor_tail_callback callback,
+				 gpointer user_data);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
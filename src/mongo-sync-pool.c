@@ -99,7 +99,7 @@ mongo_sync_pool_new (const gchar *host,
   for (i = 0; i < pool->nslaves; i++)
     {
       mongo_sync_pool_connection *c;
-      gchar *shost = NULL;
+      const gchar *shost = NULL;
       gint sport = 27017;
       GList *l;
       gboolean found = FALSE;
@@ -111,10 +111,15 @@ mongo_sync_pool_new (const gchar *host,
       do
 	{
 	  j++;
-	  if (l && mongo_util_parse_addr ((gchar *)l->data, &shost, &sport))
+	  if (l)
 	    {
-	      if (sport != port || strcmp (host, shost) != 0)
+	      mongo_sync_server *server = (mongo_sync_server *)l->data;
+
+	      if (server->info.port != port ||
+		  strcmp (host, server->info.host) != 0)
 		{
+		  shost = server->info.host;
+		  sport = server->info.port;
 		  found = TRUE;
 		  break;
 		}
@@ -263,3 +268,53 @@ mongo_sync_pool_return (mongo_sync_pool *pool,
   errno = ENOENT;
   return FALSE;
 }
+
+gboolean
+mongo_sync_pool_get_stats (mongo_sync_pool *pool,
+			   mongo_connection_stats *stats)
+{
+  GList *l;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!stats)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  memset (stats, 0, sizeof (mongo_connection_stats));
+  for (l = pool->masters; l; l = g_list_next (l))
+    mongo_connection_stats_merge
+      (stats, &((mongo_connection *)l->data)->stats);
+  for (l = pool->slaves; l; l = g_list_next (l))
+    mongo_connection_stats_merge
+      (stats, &((mongo_connection *)l->data)->stats);
+
+  return TRUE;
+}
+
+gboolean
+mongo_sync_pool_set_topology_monitor (mongo_sync_pool *pool,
+				      mongo_sync_topology_monitor *monitor)
+{
+  GList *l;
+
+  if (!pool)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  for (l = pool->masters; l; l = g_list_next (l))
+    mongo_sync_conn_set_topology_monitor ((mongo_sync_connection *)l->data,
+					  monitor);
+  for (l = pool->slaves; l; l = g_list_next (l))
+    mongo_sync_conn_set_topology_monitor ((mongo_sync_connection *)l->data,
+					  monitor);
+
+  return TRUE;
+}
@@ -18,6 +18,7 @@
 #define LIBMONGO_POOL_H 1
 
 #include <mongo-sync.h>
+#include <mongo-sync-topology.h>
 #include <glib.h>
 
 #ifdef __cplusplus
@@ -54,8 +55,9 @@ typedef struct _mongo_sync_pool mongo_sync_pool;
  * Sets up a connection pool towards a given MongoDB server, and all
  * its secondaries (if any).
  *
- * @param host is the address of the server.
- * @param port is the port to connect to.
+ * @param host is the address of the server, or the path of a Unix
+ * domain socket, see mongo_connect().
+ * @param port is the port to connect to, ignored for socket paths.
  * @param nmasters is the number of connections to make towards the
  * master.
  * @param nslaves is the number of connections to make towards the
@@ -119,6 +121,32 @@ mongo_sync_pool_connection *mongo_sync_pool_pick (mongo_sync_pool *pool,
 gboolean mongo_sync_pool_return (mongo_sync_pool *pool,
 				 mongo_sync_pool_connection *conn);
 
+/** Get the aggregated statistics of a synchronous connection pool.
+ *
+ * Sums up the statistics of every connection in the pool, see
+ * mongo_connection_get_stats().
+ *
+ * @param pool is the pool to get the statistics of.
+ * @param stats is where the statistics are stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_pool_get_stats (mongo_sync_pool *pool,
+				    mongo_connection_stats *stats);
+
+/** Subscribe every connection of a pool to a topology monitor.
+ *
+ * See mongo_sync_conn_set_topology_monitor().
+ *
+ * @param pool is the pool to subscribe.
+ * @param monitor is the monitor to subscribe to, or NULL to
+ * unsubscribe.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_pool_set_topology_monitor (mongo_sync_pool *pool,
+					       mongo_sync_topology_monitor *monitor);
+
 /** @} */
 
 #ifdef __cplusplus
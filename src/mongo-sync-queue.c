@@ -0,0 +1,528 @@
+/* mongo-sync-queue.c - libmongo-client write-behind queue implementation
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-queue.c
+ * MongoDB write-behind queue API implementation.
+ */
+
+#include "config.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/** @internal A slot of the write-behind ring.
+ *
+ * The sequence number tells the state of the slot: when it equals
+ * the position a producer wants to write, the slot is free; when it
+ * is one more than that, the slot holds a document the consumer can
+ * take.
+ */
+typedef struct
+{
+  gint seq; /**< Sequence number of the slot. */
+  bson *doc; /**< The document in the slot. */
+} mongo_sync_write_queue_cell;
+
+/** @internal Write-behind queue object. */
+struct _mongo_sync_write_queue
+{
+  mongo_sync_connection *conn; /**< The connection to insert on. */
+  gchar *ns; /**< The namespace to insert into. */
+
+  mongo_sync_write_queue_cell *cells; /**< The ring. */
+  guint mask; /**< Capacity of the ring, minus one. */
+  gint tail; /**< Next position to push to, shared by producers. */
+  guint head; /**< Next position to pop from, owned by the I/O
+		 thread. */
+  gint done; /**< Number of documents the I/O thread finished
+		with. */
+  gint sleeping; /**< Whether the I/O thread waits for work. */
+  gint32 max_size; /**< The maximum size of a batch, and the limit
+		      documents must stay below. */
+
+  GMutex lock; /**< Protects the statistics, and the conditions. */
+  GCond wake; /**< Signalled when there is work for the I/O
+		 thread. */
+  GCond drained; /**< Signalled when the I/O thread finished a
+		    batch. */
+  gboolean stop; /**< Whether the I/O thread shall stop once the
+		    ring is empty. */
+  gboolean discard; /**< Whether the I/O thread shall stop right
+		       away. */
+  GThread *thread; /**< The I/O thread. */
+
+  mongo_sync_write_queue_backpressure policy; /**< Backpressure
+						 policy. */
+  gint spill_fd; /**< The spill file, or -1. */
+
+  mongo_sync_write_queue_stats stats; /**< Statistics, pending is
+					 unused. */
+  gint error; /**< The errno of the last failed insert, or zero. */
+  guint64 reported; /**< The number of failed documents at the end of
+		       the last flush. */
+};
+
+/** @internal Push a document to the ring.
+ *
+ * @returns TRUE on success, FALSE if the ring is full.
+ */
+static gboolean
+_mongo_sync_write_queue_ring_push (mongo_sync_write_queue *queue, bson *doc)
+{
+  mongo_sync_write_queue_cell *cell;
+  guint pos;
+  gint diff;
+
+  pos = (guint)g_atomic_int_get (&queue->tail);
+  for (;;)
+    {
+      cell = &queue->cells[pos & queue->mask];
+      diff = (gint)((guint)g_atomic_int_get (&cell->seq) - pos);
+
+      if (diff == 0)
+	{
+	  if (g_atomic_int_compare_and_exchange (&queue->tail, (gint)pos,
+						 (gint)(pos + 1)))
+	    break;
+	}
+      else if (diff < 0)
+	return FALSE;
+      pos = (guint)g_atomic_int_get (&queue->tail);
+    }
+
+  cell->doc = doc;
+  g_atomic_int_set (&cell->seq, (gint)(pos + 1));
+  return TRUE;
+}
+
+/** @internal Check whether the ring has a document ready to pop. */
+static inline gboolean
+_mongo_sync_write_queue_ring_ready (mongo_sync_write_queue *queue)
+{
+  mongo_sync_write_queue_cell *cell = &queue->cells[queue->head & queue->mask];
+
+  return (guint)g_atomic_int_get (&cell->seq) == queue->head + 1;
+}
+
+/** @internal Get the next document of the ring, without popping it.
+ *
+ * Must only be called from the I/O thread.
+ *
+ * @returns The document, or NULL if the ring is empty.
+ */
+static inline bson *
+_mongo_sync_write_queue_ring_peek (mongo_sync_write_queue *queue)
+{
+  if (!_mongo_sync_write_queue_ring_ready (queue))
+    return NULL;
+  return queue->cells[queue->head & queue->mask].doc;
+}
+
+/** @internal Pop a document from the ring.
+ *
+ * Must only be called from the I/O thread, or once it stopped.
+ *
+ * @returns The document, or NULL if the ring is empty.
+ */
+static bson *
+_mongo_sync_write_queue_ring_pop (mongo_sync_write_queue *queue)
+{
+  mongo_sync_write_queue_cell *cell;
+  bson *doc;
+
+  if (!_mongo_sync_write_queue_ring_ready (queue))
+    return NULL;
+
+  cell = &queue->cells[queue->head & queue->mask];
+  doc = cell->doc;
+  cell->doc = NULL;
+  g_atomic_int_set (&cell->seq, (gint)(queue->head + queue->mask + 1));
+  queue->head++;
+
+  return doc;
+}
+
+/** @internal Mark documents as done, and wake up whoever waits. */
+static void
+_mongo_sync_write_queue_done (mongo_sync_write_queue *queue, gint32 n,
+			      gboolean success, gint error)
+{
+  g_mutex_lock (&queue->lock);
+  if (success)
+    queue->stats.written += n;
+  else
+    {
+      queue->stats.failed += n;
+      queue->error = (error) ? error : EIO;
+    }
+  g_atomic_int_add (&queue->done, n);
+  g_cond_broadcast (&queue->drained);
+  g_mutex_unlock (&queue->lock);
+}
+
+/** @internal The I/O thread of a write-behind queue. */
+static gpointer
+_mongo_sync_write_queue_thread (gpointer data)
+{
+  mongo_sync_write_queue *queue = (mongo_sync_write_queue *)data;
+  GPtrArray *docs;
+  bson *doc;
+  gint32 n, i, size;
+  gboolean res;
+  gint e;
+
+  docs = g_ptr_array_new ();
+
+  for (;;)
+    {
+      if (g_atomic_int_get (&queue->discard))
+	break;
+
+      /* Stop before the batch would grow past the limit, the
+	 document that did not fit starts the next one. */
+      size = 0;
+      while ((doc = _mongo_sync_write_queue_ring_peek (queue)) != NULL &&
+	     (docs->len == 0 || size + bson_size (doc) <= queue->max_size))
+	{
+	  _mongo_sync_write_queue_ring_pop (queue);
+	  g_ptr_array_add (docs, doc);
+	  size += bson_size (doc);
+	}
+
+      n = docs->len;
+      if (n > 0)
+	{
+	  res = mongo_sync_cmd_insert_n (queue->conn, queue->ns, n,
+					 (const bson **)docs->pdata);
+	  e = errno;
+	  for (i = 0; i < n; i++)
+	    bson_free ((bson *)g_ptr_array_index (docs, i));
+	  g_ptr_array_set_size (docs, 0);
+	  _mongo_sync_write_queue_done (queue, n, res, e);
+	  continue;
+	}
+
+      g_mutex_lock (&queue->lock);
+      if (queue->stop)
+	{
+	  g_mutex_unlock (&queue->lock);
+	  break;
+	}
+      g_atomic_int_set (&queue->sleeping, 1);
+      if (!_mongo_sync_write_queue_ring_ready (queue))
+	g_cond_wait_until (&queue->wake, &queue->lock,
+			   g_get_monotonic_time () +
+			   100 * G_TIME_SPAN_MILLISECOND);
+      g_atomic_int_set (&queue->sleeping, 0);
+      g_mutex_unlock (&queue->lock);
+    }
+
+  g_ptr_array_free (docs, TRUE);
+  return NULL;
+}
+
+/** @internal Wake up the I/O thread, if it is waiting for work. */
+static inline void
+_mongo_sync_write_queue_wake (mongo_sync_write_queue *queue)
+{
+  if (!g_atomic_int_get (&queue->sleeping))
+    return;
+
+  g_mutex_lock (&queue->lock);
+  g_cond_signal (&queue->wake);
+  g_mutex_unlock (&queue->lock);
+}
+
+mongo_sync_write_queue *
+mongo_sync_write_queue_new (mongo_sync_connection *conn, const gchar *ns,
+			    gint32 capacity)
+{
+  mongo_sync_write_queue *queue;
+  guint size = 1, i;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+  if (!ns)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (capacity <= 0 || capacity > (1 << 30))
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  while (size < (guint)capacity)
+    size <<= 1;
+
+  queue = g_new0 (mongo_sync_write_queue, 1);
+  queue->conn = conn;
+  queue->ns = g_strdup (ns);
+  queue->cells = g_new0 (mongo_sync_write_queue_cell, size);
+  for (i = 0; i < size; i++)
+    queue->cells[i].seq = (gint)i;
+  queue->mask = size - 1;
+  queue->spill_fd = -1;
+  queue->max_size = mongo_sync_conn_get_max_insert_size (conn);
+
+  g_mutex_init (&queue->lock);
+  g_cond_init (&queue->wake);
+  g_cond_init (&queue->drained);
+
+  queue->thread = g_thread_new ("mongo-write-queue",
+				_mongo_sync_write_queue_thread, queue);
+
+  return queue;
+}
+
+gboolean
+mongo_sync_write_queue_set_backpressure (mongo_sync_write_queue *queue,
+					 mongo_sync_write_queue_backpressure policy,
+					 const gchar *spill_path)
+{
+  gint fd = -1;
+
+  if (!queue)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  switch (policy)
+    {
+    case MONGO_SYNC_WRITE_QUEUE_BLOCK:
+    case MONGO_SYNC_WRITE_QUEUE_DROP:
+      break;
+    case MONGO_SYNC_WRITE_QUEUE_SPILL:
+      if (!spill_path)
+	{
+	  errno = EINVAL;
+	  return FALSE;
+	}
+      fd = open (spill_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+      if (fd == -1)
+	return FALSE;
+      break;
+    default:
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (queue->spill_fd != -1)
+    close (queue->spill_fd);
+  queue->spill_fd = fd;
+  queue->policy = policy;
+
+  return TRUE;
+}
+
+/** @internal Append a document to the spill file of a queue. */
+static gboolean
+_mongo_sync_write_queue_spill (mongo_sync_write_queue *queue,
+			       const bson *doc)
+{
+  const guint8 *data = bson_data (doc);
+  gint32 size = bson_size (doc), off = 0;
+  gssize n;
+  int e = 0;
+
+  g_mutex_lock (&queue->lock);
+  while (off < size)
+    {
+      n = write (queue->spill_fd, data + off, size - off);
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  e = errno;
+	  break;
+	}
+      off += n;
+    }
+  if (off == size)
+    queue->stats.spilled++;
+  else
+    queue->stats.dropped++;
+  g_mutex_unlock (&queue->lock);
+
+  if (off != size)
+    {
+      errno = e;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+gboolean
+mongo_sync_write_queue_push (mongo_sync_write_queue *queue, const bson *doc)
+{
+  bson *copy;
+
+  if (!queue)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!doc || bson_size (doc) < 0)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (bson_size (doc) >= queue->max_size)
+    {
+      errno = EMSGSIZE;
+      return FALSE;
+    }
+
+  copy = bson_new_from_data (bson_data (doc), bson_size (doc) - 1);
+  bson_finish (copy);
+
+  if (!_mongo_sync_write_queue_ring_push (queue, copy))
+    {
+      switch (queue->policy)
+	{
+	case MONGO_SYNC_WRITE_QUEUE_DROP:
+	  bson_free (copy);
+	  g_mutex_lock (&queue->lock);
+	  queue->stats.dropped++;
+	  g_mutex_unlock (&queue->lock);
+	  errno = ENOBUFS;
+	  return FALSE;
+	case MONGO_SYNC_WRITE_QUEUE_SPILL:
+	  {
+	    gboolean res = _mongo_sync_write_queue_spill (queue, copy);
+
+	    bson_free (copy);
+	    return res;
+	  }
+	default:
+	  g_mutex_lock (&queue->lock);
+	  while (!_mongo_sync_write_queue_ring_push (queue, copy))
+	    g_cond_wait_until (&queue->drained, &queue->lock,
+			       g_get_monotonic_time () +
+			       10 * G_TIME_SPAN_MILLISECOND);
+	  g_mutex_unlock (&queue->lock);
+	  break;
+	}
+    }
+
+  _mongo_sync_write_queue_wake (queue);
+  return TRUE;
+}
+
+gboolean
+mongo_sync_write_queue_flush (mongo_sync_write_queue *queue)
+{
+  guint target;
+  gint e = 0;
+
+  if (!queue)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  target = (guint)g_atomic_int_get (&queue->tail);
+
+  g_mutex_lock (&queue->lock);
+  g_cond_signal (&queue->wake);
+  while ((gint)((guint)g_atomic_int_get (&queue->done) - target) < 0)
+    {
+      /* A stopping I/O thread may never get to the documents. */
+      if (queue->stop || g_atomic_int_get (&queue->discard))
+	{
+	  e = ECANCELED;
+	  break;
+	}
+      g_cond_wait_until (&queue->drained, &queue->lock,
+			 g_get_monotonic_time () +
+			 100 * G_TIME_SPAN_MILLISECOND);
+    }
+  if (e == 0 && queue->stats.failed != queue->reported)
+    e = queue->error;
+  queue->reported = queue->stats.failed;
+  g_mutex_unlock (&queue->lock);
+
+  if (e)
+    {
+      errno = e;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+gboolean
+mongo_sync_write_queue_get_stats (mongo_sync_write_queue *queue,
+				  mongo_sync_write_queue_stats *stats)
+{
+  if (!queue)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!stats)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  g_mutex_lock (&queue->lock);
+  *stats = queue->stats;
+  stats->pending = (guint)g_atomic_int_get (&queue->tail) -
+    (guint)g_atomic_int_get (&queue->done);
+  g_mutex_unlock (&queue->lock);
+
+  return TRUE;
+}
+
+void
+mongo_sync_write_queue_free (mongo_sync_write_queue *queue, gboolean drain)
+{
+  bson *doc;
+
+  if (!queue)
+    return;
+
+  g_mutex_lock (&queue->lock);
+  queue->stop = TRUE;
+  if (!drain)
+    g_atomic_int_set (&queue->discard, TRUE);
+  g_cond_signal (&queue->wake);
+  g_mutex_unlock (&queue->lock);
+
+  g_thread_join (queue->thread);
+
+  while ((doc = _mongo_sync_write_queue_ring_pop (queue)) != NULL)
+    bson_free (doc);
+
+  if (queue->spill_fd != -1)
+    close (queue->spill_fd);
+
+  g_cond_clear (&queue->drained);
+  g_cond_clear (&queue->wake);
+  g_mutex_clear (&queue->lock);
+
+  g_free (queue->cells);
+  g_free (queue->ns);
+  g_free (queue);
+}
@@ -0,0 +1,167 @@
+/* mongo-sync-queue.h - libmongo-client write-behind queue on top of Sync
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_SYNC_QUEUE_H
+#define LIBMONGO_SYNC_QUEUE_H 1
+
+#include <glib.h>
+#include <mongo-sync.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup mongo_sync_queue_api Mongo Sync Write Queue API
+ *
+ * A write-behind queue takes documents from any number of threads,
+ * and inserts them into a single namespace from a dedicated I/O
+ * thread, without the callers ever waiting on the network.
+ *
+ * Documents are passed to the I/O thread through a bounded,
+ * lock-free ring. The I/O thread takes as many documents off the ring
+ * as fit into the maximum insert size of the connection, and inserts
+ * them with mongo_sync_cmd_insert_n().
+ *
+ * The queue is meant for fire-and-forget writes, such as logging:
+ * errors reported by the server are not propagated back to the
+ * callers, they only show up in the statistics of the queue.
+ *
+ * @note The connection is used by the I/O thread exclusively while
+ * the queue exists, the application must not use it for anything
+ * else until the queue is freed.
+ *
+ * @addtogroup mongo_sync_queue_api
+ * @{
+ */
+
+/** Opaque write-behind queue object. */
+typedef struct _mongo_sync_write_queue mongo_sync_write_queue;
+
+/** What to do with a document when the queue is full. */
+typedef enum
+{
+  /** Wait until the I/O thread makes room. This is the default. */
+  MONGO_SYNC_WRITE_QUEUE_BLOCK,
+  /** Drop the document. */
+  MONGO_SYNC_WRITE_QUEUE_DROP,
+  /** Append the document to a spill file. */
+  MONGO_SYNC_WRITE_QUEUE_SPILL
+} mongo_sync_write_queue_backpressure;
+
+/** Write-behind queue statistics. */
+typedef struct
+{
+  guint64 written; /**< Documents inserted successfully. */
+  guint64 failed; /**< Documents whose insert failed. */
+  guint64 dropped; /**< Documents dropped because the queue was
+		      full. */
+  guint64 spilled; /**< Documents written to the spill file. */
+  guint64 pending; /**< Documents queued, but not written yet. */
+} mongo_sync_write_queue_stats;
+
+/** Create a new write-behind queue, and start its I/O thread.
+ *
+ * @param conn is the connection to insert on.
+ * @param ns is the namespace to insert into.
+ * @param capacity is the number of documents the queue can hold. It
+ * is rounded up to the next power of two.
+ *
+ * @returns A newly allocated queue, or NULL on error. It must be
+ * freed with mongo_sync_write_queue_free().
+ */
+mongo_sync_write_queue *mongo_sync_write_queue_new (mongo_sync_connection *conn,
+						    const gchar *ns,
+						    gint32 capacity);
+
+/** Set the backpressure policy of a write-behind queue.
+ *
+ * @param queue is the queue to configure.
+ * @param policy is what to do with documents that do not fit into
+ * the queue.
+ * @param spill_path is the file to append spilled documents to,
+ * required for #MONGO_SYNC_WRITE_QUEUE_SPILL, and ignored
+ * otherwise. Documents are appended as raw BSON, one after the
+ * other, which is the format mongorestore reads.
+ *
+ * @note Must not be called while other threads push documents.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_write_queue_set_backpressure
+  (mongo_sync_write_queue *queue,
+   mongo_sync_write_queue_backpressure policy,
+   const gchar *spill_path);
+
+/** Push a document to a write-behind queue.
+ *
+ * Safe to call from any number of threads at the same time.
+ *
+ * @param queue is the queue to push to.
+ * @param doc is the document to insert. It is copied, and can be
+ * freed once the function returns.
+ *
+ * @returns TRUE if the document was queued or spilled, FALSE
+ * otherwise. A document dropped due to a full queue sets errno to
+ * ENOBUFS, one not smaller than the maximum insert size of the
+ * connection to EMSGSIZE.
+ */
+gboolean mongo_sync_write_queue_push (mongo_sync_write_queue *queue,
+				      const bson *doc);
+
+/** Wait until a write-behind queue has processed every document.
+ *
+ * Returns once every document pushed before the call was handed to
+ * the server, or failed to.
+ *
+ * @param queue is the queue to flush.
+ *
+ * @returns TRUE on success, FALSE otherwise. If an insert failed
+ * since the previous flush, errno is set to its error. If the queue is being
+ * freed, the function returns right away, with errno set to
+ * ECANCELED.
+ */
+gboolean mongo_sync_write_queue_flush (mongo_sync_write_queue *queue);
+
+/** Get the statistics of a write-behind queue.
+ *
+ * @param queue is the queue to query.
+ * @param stats is where the statistics are stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_write_queue_get_stats (mongo_sync_write_queue *queue,
+					   mongo_sync_write_queue_stats *stats);
+
+/** Stop and free a write-behind queue.
+ *
+ * No documents may be pushed while the queue is being freed. The
+ * connection is not closed, and can be used again once this function
+ * returns.
+ *
+ * @param queue is the queue to free.
+ * @param drain signals whether to write the documents still in the
+ * queue before stopping, or to discard them.
+ */
+void mongo_sync_write_queue_free (mongo_sync_write_queue *queue,
+				  gboolean drain);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
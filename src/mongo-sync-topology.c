@@ -0,0 +1,1069 @@
+/* mongo-sync-topology.c - libmongo-client replica set topology table
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-sync-topology.c
+ * MongoDB replica set topology table implementation.
+ */
+
+#include "config.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @internal Lock protecting the topology table and its entries. */
+static GRWLock _mongo_topology_lock;
+/** @internal The topology table, "host:port" -> mongo_sync_server. */
+static GHashTable *_mongo_topology_table;
+
+/** @internal Look up a server, with the lock held. */
+static mongo_sync_server *
+_mongo_sync_server_find (const gchar *addr)
+{
+  if (!_mongo_topology_table)
+    return NULL;
+  return (mongo_sync_server *)g_hash_table_lookup (_mongo_topology_table,
+						   addr);
+}
+
+mongo_sync_server *
+_mongo_sync_server_get (const gchar *host, gint port)
+{
+  mongo_sync_server *server;
+  gchar *addr;
+
+  if (!host)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  /* Ports mean nothing for Unix socket paths, the same socket must
+     map to the same server however it was named. */
+  if (host[0] == '/')
+    port = 0;
+
+  addr = g_strdup_printf ("%s:%d", host, port);
+
+  g_rw_lock_reader_lock (&_mongo_topology_lock);
+  server = _mongo_sync_server_find (addr);
+  g_rw_lock_reader_unlock (&_mongo_topology_lock);
+  if (server)
+    {
+      g_free (addr);
+      return server;
+    }
+
+  g_rw_lock_writer_lock (&_mongo_topology_lock);
+  server = _mongo_sync_server_find (addr);
+  if (!server)
+    {
+      if (!_mongo_topology_table)
+	_mongo_topology_table = g_hash_table_new (g_str_hash, g_str_equal);
+
+      server = g_new0 (mongo_sync_server, 1);
+      server->addr = addr;
+      server->info.host = g_strdup (host);
+      server->info.port = port;
+      server->info.role = MONGO_SYNC_SERVER_UNKNOWN;
+      server->info.config_version = -1;
+      server->info.rtt = -1;
+      g_hash_table_insert (_mongo_topology_table, server->addr, server);
+      addr = NULL;
+    }
+  g_rw_lock_writer_unlock (&_mongo_topology_lock);
+
+  g_free (addr);
+  return server;
+}
+
+mongo_sync_server *
+_mongo_sync_server_parse (const gchar *addr)
+{
+  mongo_sync_server *server;
+  gchar *host;
+  gint port = 27017;
+
+  if (!mongo_util_parse_addr (addr, &host, &port))
+    return NULL;
+
+  server = _mongo_sync_server_get (host, port);
+  g_free (host);
+  return server;
+}
+
+void
+_mongo_sync_server_get_info (const mongo_sync_server *server,
+			     mongo_sync_server_info *info)
+{
+  g_rw_lock_reader_lock (&_mongo_topology_lock);
+  *info = server->info;
+  g_rw_lock_reader_unlock (&_mongo_topology_lock);
+}
+
+/** @internal Forget the primary of a replica set, with the write
+ * lock held.
+ *
+ * @param set_name is the name of the replica set.
+ * @param except is the server that is the primary now, or NULL.
+ */
+static void
+_mongo_sync_server_demote (const gchar *set_name,
+			   const mongo_sync_server *except)
+{
+  GHashTableIter iter;
+  mongo_sync_server *server;
+
+  g_hash_table_iter_init (&iter, _mongo_topology_table);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&server))
+    {
+      if (server != except && server->info.set_name == set_name &&
+	  server->info.role == MONGO_SYNC_SERVER_PRIMARY)
+	server->info.role = MONGO_SYNC_SERVER_UNKNOWN;
+    }
+}
+
+/** @internal Get a boolean field of a document, FALSE if missing. */
+static gboolean
+_mongo_sync_server_flag (const bson *res, const gchar *name)
+{
+  bson_cursor *c;
+  gboolean b = FALSE;
+
+  c = bson_find (res, name);
+  bson_cursor_get_boolean (c, &b);
+  bson_cursor_free (c);
+
+  return b;
+}
+
+void
+_mongo_sync_server_seen (mongo_sync_server *server, const bson *res,
+			 gint64 rtt)
+{
+  mongo_sync_server *primary = NULL;
+  mongo_sync_server_role role;
+  const gchar *set_name = NULL, *s;
+  gint32 version = -1;
+  bson_cursor *c;
+
+  if (!server || !res)
+    return;
+
+  if (_mongo_sync_server_flag (res, "ismaster"))
+    role = MONGO_SYNC_SERVER_PRIMARY;
+  else if (_mongo_sync_server_flag (res, "secondary"))
+    role = MONGO_SYNC_SERVER_SECONDARY;
+  else if (_mongo_sync_server_flag (res, "arbiterOnly"))
+    role = MONGO_SYNC_SERVER_ARBITER;
+  else
+    role = MONGO_SYNC_SERVER_OTHER;
+
+  c = bson_find (res, "setName");
+  if (bson_cursor_get_string (c, &s))
+    set_name = g_intern_string (s);
+  bson_cursor_free (c);
+
+  c = bson_find (res, "setVersion");
+  bson_cursor_get_int32 (c, &version);
+  bson_cursor_free (c);
+
+  if (role != MONGO_SYNC_SERVER_PRIMARY)
+    {
+      c = bson_find (res, "primary");
+      if (bson_cursor_get_string (c, &s))
+	primary = _mongo_sync_server_parse (s);
+      bson_cursor_free (c);
+    }
+
+  g_rw_lock_writer_lock (&_mongo_topology_lock);
+
+  server->info.role = role;
+  server->info.set_name = set_name;
+  server->info.config_version = version;
+  server->info.rtt = rtt;
+  server->info.last_seen = g_get_monotonic_time ();
+
+  /* A server claiming to be the primary, or pointing at one, makes
+     any other primary of the same set we know about stale. */
+  if (set_name && role == MONGO_SYNC_SERVER_PRIMARY)
+    _mongo_sync_server_demote (set_name, server);
+  else if (set_name && primary)
+    _mongo_sync_server_demote (set_name, primary);
+
+  g_rw_lock_writer_unlock (&_mongo_topology_lock);
+}
+
+void
+_mongo_sync_server_down (mongo_sync_server *server)
+{
+  if (!server)
+    return;
+
+  g_rw_lock_writer_lock (&_mongo_topology_lock);
+  server->info.role = MONGO_SYNC_SERVER_UNKNOWN;
+  g_rw_lock_writer_unlock (&_mongo_topology_lock);
+}
+
+/** @internal A reconnect candidate being ranked. */
+typedef struct
+{
+  mongo_sync_server *server; /**< The server. */
+  gint rank; /**< The rank of the server, lower is better. */
+  gint64 rtt; /**< The last round-trip time of the server. */
+  gint index; /**< The position of the server in the original list. */
+} _mongo_sync_server_rank;
+
+/** @internal Order reconnect candidates by rank, then by round-trip
+ * time, then by their original position.
+ */
+static gint
+_mongo_sync_server_rank_cmp (gconstpointer a, gconstpointer b)
+{
+  const _mongo_sync_server_rank *x = (const _mongo_sync_server_rank *)a;
+  const _mongo_sync_server_rank *y = (const _mongo_sync_server_rank *)b;
+
+  if (x->rank != y->rank)
+    return x->rank - y->rank;
+  if (x->rtt != y->rtt)
+    {
+      if (x->rtt < 0)
+	return 1;
+      if (y->rtt < 0)
+	return -1;
+      return (x->rtt < y->rtt) ? -1 : 1;
+    }
+  return x->index - y->index;
+}
+
+GList *
+_mongo_sync_server_candidates (const mongo_sync_connection *conn)
+{
+  _mongo_sync_server_rank *ranks;
+  GList *servers = NULL, *l;
+  gint i, n;
+
+  if (conn->rs.primary)
+    servers = g_list_append (servers, conn->rs.primary);
+  for (l = conn->rs.hosts; l; l = g_list_next (l))
+    {
+      if (l->data && !g_list_find (servers, l->data))
+	servers = g_list_append (servers, l->data);
+    }
+
+  n = g_list_length (servers);
+  if (n < 2)
+    return servers;
+
+  ranks = g_new0 (_mongo_sync_server_rank, n);
+
+  g_rw_lock_reader_lock (&_mongo_topology_lock);
+  for (i = 0, l = servers; l; i++, l = g_list_next (l))
+    {
+      mongo_sync_server *server = (mongo_sync_server *)l->data;
+
+      ranks[i].server = server;
+      ranks[i].rtt = server->info.rtt;
+      ranks[i].index = i;
+
+      /* Known primaries first, then the primary this connection was
+	 told about, then secondaries, and everything else last. */
+      switch (server->info.role)
+	{
+	case MONGO_SYNC_SERVER_PRIMARY:
+	  ranks[i].rank = 0;
+	  break;
+	case MONGO_SYNC_SERVER_SECONDARY:
+	  ranks[i].rank = 2;
+	  break;
+	case MONGO_SYNC_SERVER_ARBITER:
+	  ranks[i].rank = 4;
+	  break;
+	default:
+	  ranks[i].rank = 3;
+	  break;
+	}
+      if (server == conn->rs.primary && ranks[i].rank > 1)
+	ranks[i].rank = 1;
+    }
+  g_rw_lock_reader_unlock (&_mongo_topology_lock);
+
+  qsort (ranks, n, sizeof (_mongo_sync_server_rank),
+	 _mongo_sync_server_rank_cmp);
+
+  for (i = 0, l = servers; l; i++, l = g_list_next (l))
+    l->data = ranks[i].server;
+  g_free (ranks);
+
+  return servers;
+}
+
+gboolean
+mongo_sync_server_lookup (const gchar *host, gint port,
+			  mongo_sync_server_info *info)
+{
+  mongo_sync_server *server;
+  gchar *addr;
+
+  if (!host || !info)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (host[0] == '/')
+    port = 0;
+
+  addr = g_strdup_printf ("%s:%d", host, port);
+
+  g_rw_lock_reader_lock (&_mongo_topology_lock);
+  server = _mongo_sync_server_find (addr);
+  if (server)
+    *info = server->info;
+  g_rw_lock_reader_unlock (&_mongo_topology_lock);
+
+  g_free (addr);
+
+  if (!server)
+    {
+      errno = ENOENT;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+gint32
+mongo_sync_conn_get_servers (mongo_sync_connection *conn,
+			     mongo_sync_server_info **servers)
+{
+  GList *l, *cands;
+  gint32 i, n;
+
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+  if (!servers)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  cands = _mongo_sync_server_candidates (conn);
+  n = g_list_length (cands);
+
+  *servers = g_new0 (mongo_sync_server_info, n);
+  for (i = 0, l = cands; l; i++, l = g_list_next (l))
+    _mongo_sync_server_get_info ((mongo_sync_server *)l->data,
+				 &(*servers)[i]);
+  g_list_free (cands);
+
+  return n;
+}
+
+/** @internal Topology snapshot object. */
+struct _mongo_sync_topology_snapshot
+{
+  gint ref_count; /**< Reference count. */
+  gint generation; /**< Generation of the snapshot. */
+  gint32 n; /**< Number of members. */
+  mongo_sync_server **members; /**< The members, in the table. */
+  mongo_sync_server_info *servers; /**< What was known about the
+				      members, when the snapshot was
+				      taken. */
+  gint32 primary; /**< Index of the primary, or -1. */
+};
+
+/** @internal A member watched by a topology monitor. */
+typedef struct
+{
+  mongo_sync_topology_monitor *monitor; /**< The monitor. */
+  mongo_sync_server *server; /**< The member being watched. */
+  mongo_connection *conn; /**< The polling connection, or NULL. */
+  GThread *thread; /**< The polling thread. */
+  gboolean retired; /**< Whether the member left the set, and its
+		       thread shall stop. */
+  gint finished; /**< Whether the polling thread returned. */
+} _mongo_sync_topology_member;
+
+/** @internal Topology monitor object. */
+struct _mongo_sync_topology_monitor
+{
+  GMutex lock; /**< Lock protecting everything below. */
+  GCond changed; /**< Signalled when a snapshot is published, or the
+		    monitor is stopping. */
+  GPtrArray *members; /**< The members being watched. */
+  GPtrArray *retired; /**< Members that left the set, whose threads
+			 were not joined yet. */
+  mongo_sync_topology_snapshot *current; /**< The current snapshot,
+					    replaced atomically, so that
+					    readers need no lock. */
+  gint readers; /**< Number of readers between loading the current
+		   snapshot, and taking a reference to it. */
+  gint generation; /**< Generation of the current snapshot, readable
+		      without the lock. */
+  gint interval; /**< Polling interval, in milliseconds. */
+  gboolean stop; /**< Whether the monitor is stopping. */
+};
+
+/** @internal Take a snapshot of the members of a monitor, with the
+ * lock held.
+ */
+static mongo_sync_topology_snapshot *
+_mongo_sync_topology_snapshot_new (mongo_sync_topology_monitor *monitor)
+{
+  mongo_sync_topology_snapshot *snapshot;
+  gint32 i;
+
+  snapshot = g_new0 (mongo_sync_topology_snapshot, 1);
+  snapshot->ref_count = 1;
+  snapshot->n = monitor->members->len;
+  snapshot->members = g_new0 (mongo_sync_server *, snapshot->n);
+  snapshot->servers = g_new0 (mongo_sync_server_info, snapshot->n);
+  snapshot->primary = -1;
+
+  for (i = 0; i < snapshot->n; i++)
+    {
+      _mongo_sync_topology_member *m =
+	(_mongo_sync_topology_member *)g_ptr_array_index (monitor->members, i);
+
+      snapshot->members[i] = m->server;
+      _mongo_sync_server_get_info (m->server, &snapshot->servers[i]);
+      if (snapshot->primary < 0 &&
+	  snapshot->servers[i].role == MONGO_SYNC_SERVER_PRIMARY)
+	snapshot->primary = i;
+    }
+
+  return snapshot;
+}
+
+/** @internal Check whether two snapshots describe the same topology,
+ * ignoring round-trip and last seen times.
+ */
+static gboolean
+_mongo_sync_topology_snapshot_equal (const mongo_sync_topology_snapshot *a,
+				     const mongo_sync_topology_snapshot *b)
+{
+  gint32 i;
+
+  if (a->n != b->n || a->primary != b->primary)
+    return FALSE;
+
+  for (i = 0; i < a->n; i++)
+    {
+      if (a->members[i] != b->members[i] ||
+	  a->servers[i].role != b->servers[i].role ||
+	  a->servers[i].config_version != b->servers[i].config_version ||
+	  a->servers[i].set_name != b->servers[i].set_name)
+	return FALSE;
+    }
+  return TRUE;
+}
+
+/** @internal Publish a new snapshot, if the topology changed, with the
+ * lock held.
+ */
+static void
+_mongo_sync_topology_publish (mongo_sync_topology_monitor *monitor)
+{
+  mongo_sync_topology_snapshot *snapshot, *old;
+
+  snapshot = _mongo_sync_topology_snapshot_new (monitor);
+  old = monitor->current;
+
+  if (old && _mongo_sync_topology_snapshot_equal (old, snapshot))
+    {
+      mongo_sync_topology_snapshot_unref (snapshot);
+      return;
+    }
+
+  /* Readers that still hold the old snapshot keep it alive, everyone
+     else sees the new one from now on. */
+  snapshot->generation = (old) ? old->generation + 1 : 1;
+  g_atomic_pointer_set (&monitor->current, snapshot);
+  g_atomic_int_set (&monitor->generation, snapshot->generation);
+  g_cond_broadcast (&monitor->changed);
+
+  if (!old)
+    return;
+
+  /* A reader may have loaded the old pointer before the swap, without
+     having taken its reference yet: wait for those to finish, before
+     dropping ours. Readers arriving from now on see the new one. */
+  while (g_atomic_int_get (&monitor->readers) > 0)
+    g_thread_yield ();
+  mongo_sync_topology_snapshot_unref (old);
+}
+
+/** @internal Send an ismaster command to a member, and wait for the
+ * reply.
+ *
+ * @returns The finished reply, or NULL on error.
+ */
+static bson *
+_mongo_sync_topology_member_ask (_mongo_sync_topology_member *member,
+				 gint timeout, gint64 *rtt)
+{
+  mongo_packet_header h;
+  mongo_packet *p;
+  bson *cmd, *res;
+  gint32 rid;
+  gint64 start;
+
+  if (!member->conn)
+    {
+      member->conn = mongo_connect_timeout (member->server->info.host,
+					    member->server->info.port,
+					    timeout);
+      if (!member->conn)
+	return NULL;
+    }
+
+  cmd = bson_new_sized (32);
+  bson_append_int32 (cmd, "ismaster", 1);
+  bson_finish (cmd);
+
+  rid = mongo_connection_get_requestid (member->conn) + 1;
+  p = mongo_wire_cmd_custom (rid, "system", MONGO_WIRE_FLAG_QUERY_SLAVE_OK,
+			     cmd);
+  bson_free (cmd);
+
+  start = g_get_monotonic_time ();
+  if (!mongo_packet_send (member->conn, p))
+    {
+      mongo_wire_packet_free (p);
+      return NULL;
+    }
+  mongo_wire_packet_free (p);
+
+  p = mongo_packet_recv (member->conn);
+  if (!p)
+    return NULL;
+  *rtt = g_get_monotonic_time () - start;
+
+  if (!mongo_wire_packet_get_header (p, &h) || h.resp_to != rid ||
+      !mongo_wire_reply_packet_get_nth_document (p, 1, &res))
+    {
+      mongo_wire_packet_free (p);
+      return NULL;
+    }
+  mongo_wire_packet_free (p);
+  bson_finish (res);
+
+  return res;
+}
+
+static gpointer _mongo_sync_topology_member_thread (gpointer data);
+
+/** @internal Start watching a server, with the lock held. */
+static void
+_mongo_sync_topology_member_add (mongo_sync_topology_monitor *monitor,
+				 mongo_sync_server *server)
+{
+  _mongo_sync_topology_member *member;
+  guint i;
+
+  if (monitor->stop)
+    return;
+
+  for (i = 0; i < monitor->members->len; i++)
+    {
+      member = (_mongo_sync_topology_member *)
+	g_ptr_array_index (monitor->members, i);
+      if (member->server == server)
+	return;
+    }
+
+  member = g_new0 (_mongo_sync_topology_member, 1);
+  member->monitor = monitor;
+  member->server = server;
+  g_ptr_array_add (monitor->members, member);
+
+  member->thread = g_thread_new ("mongo-topology",
+				 _mongo_sync_topology_member_thread, member);
+}
+
+/** @internal Stop watching the members a primary does not list
+ * anymore, with the lock held.
+ *
+ * Their threads stop on their own, and are joined later, see
+ * _mongo_sync_topology_reap().
+ */
+static void
+_mongo_sync_topology_retire (mongo_sync_topology_monitor *monitor,
+			     GPtrArray *listed)
+{
+  _mongo_sync_topology_member *member;
+  guint i, j;
+
+  for (i = 0; i < monitor->members->len; )
+    {
+      member = (_mongo_sync_topology_member *)
+	g_ptr_array_index (monitor->members, i);
+
+      for (j = 0; j < listed->len; j++)
+	if (g_ptr_array_index (listed, j) == member->server)
+	  break;
+      if (j < listed->len)
+	{
+	  i++;
+	  continue;
+	}
+
+      member->retired = TRUE;
+      g_ptr_array_remove_index (monitor->members, i);
+      g_ptr_array_add (monitor->retired, member);
+    }
+}
+
+/** @internal Join the threads of retired members that returned. */
+static void
+_mongo_sync_topology_reap (mongo_sync_topology_monitor *monitor)
+{
+  _mongo_sync_topology_member *member;
+  GPtrArray *done;
+  guint i;
+
+  done = g_ptr_array_new ();
+
+  g_mutex_lock (&monitor->lock);
+  for (i = 0; i < monitor->retired->len; )
+    {
+      member = (_mongo_sync_topology_member *)
+	g_ptr_array_index (monitor->retired, i);
+      if (g_atomic_int_get (&member->finished))
+	{
+	  g_ptr_array_remove_index_fast (monitor->retired, i);
+	  g_ptr_array_add (done, member);
+	}
+      else
+	i++;
+    }
+  g_mutex_unlock (&monitor->lock);
+
+  for (i = 0; i < done->len; i++)
+    {
+      member = (_mongo_sync_topology_member *)g_ptr_array_index (done, i);
+      g_thread_join (member->thread);
+      if (member->conn)
+	mongo_disconnect (member->conn);
+      g_free (member);
+    }
+  g_ptr_array_free (done, TRUE);
+}
+
+/** @internal Poll a member once, and publish the results. */
+static void
+_mongo_sync_topology_member_check (_mongo_sync_topology_member *member)
+{
+  mongo_sync_topology_monitor *monitor = member->monitor;
+  GPtrArray *discovered;
+  bson_cursor *c;
+  bson *res, *hosts;
+  gint64 rtt = 0;
+  gboolean primary = FALSE;
+  guint i;
+
+  discovered = g_ptr_array_new ();
+
+  res = _mongo_sync_topology_member_ask
+    (member, MIN (monitor->interval, MONGO_SYNC_DEFAULT_RECONNECT_TIMEOUT),
+     &rtt);
+  if (res)
+    {
+      _mongo_sync_server_seen (member->server, res, rtt);
+      primary = _mongo_sync_server_flag (res, "ismaster");
+
+      c = bson_find (res, "hosts");
+      if (bson_cursor_get_array (c, &hosts))
+	{
+	  bson_cursor *h;
+
+	  bson_finish (hosts);
+	  h = bson_cursor_new (hosts);
+	  while (bson_cursor_next (h))
+	    {
+	      mongo_sync_server *server;
+	      const gchar *s;
+
+	      if (bson_cursor_get_string (h, &s) &&
+		  (server = _mongo_sync_server_parse (s)) != NULL)
+		g_ptr_array_add (discovered, server);
+	    }
+	  bson_cursor_free (h);
+	  bson_free (hosts);
+	}
+      bson_cursor_free (c);
+      bson_free (res);
+    }
+  else
+    {
+      _mongo_sync_server_down (member->server);
+      if (member->conn)
+	mongo_disconnect (member->conn);
+      member->conn = NULL;
+    }
+
+  g_mutex_lock (&monitor->lock);
+  /* A stopping monitor owns its member lists: leave them be. */
+  if (!member->retired && !monitor->stop)
+    {
+      for (i = 0; i < discovered->len; i++)
+	_mongo_sync_topology_member_add
+	  (monitor, (mongo_sync_server *)g_ptr_array_index (discovered, i));
+
+      /* The primary has the final say on who is in the set. */
+      if (primary && discovered->len > 0)
+	_mongo_sync_topology_retire (monitor, discovered);
+      _mongo_sync_topology_publish (monitor);
+    }
+  g_mutex_unlock (&monitor->lock);
+
+  g_ptr_array_free (discovered, TRUE);
+
+  _mongo_sync_topology_reap (monitor);
+}
+
+/** @internal The polling thread of a member.
+ *
+ * Polls the member every interval, or more often while there is no
+ * primary. A new snapshot published by any other member triggers a
+ * poll right away, so that changes are confirmed quickly.
+ */
+static gpointer
+_mongo_sync_topology_member_thread (gpointer data)
+{
+  _mongo_sync_topology_member *member = (_mongo_sync_topology_member *)data;
+  mongo_sync_topology_monitor *monitor = member->monitor;
+
+  for (;;)
+    {
+      gint64 deadline;
+      gint generation, interval;
+
+      g_mutex_lock (&monitor->lock);
+      if (monitor->stop || member->retired)
+	{
+	  g_mutex_unlock (&monitor->lock);
+	  break;
+	}
+      g_mutex_unlock (&monitor->lock);
+
+      _mongo_sync_topology_member_check (member);
+
+      g_mutex_lock (&monitor->lock);
+      if (member->retired)
+	{
+	  g_mutex_unlock (&monitor->lock);
+	  break;
+	}
+      generation = monitor->current->generation;
+      interval = monitor->interval;
+      if (monitor->current->primary < 0)
+	interval = MIN (interval, MONGO_SYNC_TOPOLOGY_MIN_INTERVAL);
+      deadline = g_get_monotonic_time () + (gint64)interval * 1000;
+
+      while (!monitor->stop && monitor->current->generation == generation)
+	if (!g_cond_wait_until (&monitor->changed, &monitor->lock, deadline))
+	  break;
+      g_mutex_unlock (&monitor->lock);
+    }
+
+  g_atomic_int_set (&member->finished, TRUE);
+  return NULL;
+}
+
+mongo_sync_topology_monitor *
+mongo_sync_topology_monitor_new (const gchar *host, gint port,
+				 gint interval)
+{
+  mongo_sync_topology_monitor *monitor;
+
+  if (!host || port < 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (interval <= 0)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  monitor = g_new0 (mongo_sync_topology_monitor, 1);
+  g_mutex_init (&monitor->lock);
+  g_cond_init (&monitor->changed);
+  monitor->members = g_ptr_array_new ();
+  monitor->retired = g_ptr_array_new ();
+  monitor->interval = interval;
+
+  g_mutex_lock (&monitor->lock);
+  _mongo_sync_topology_member_add (monitor,
+				   _mongo_sync_server_get (host, port));
+  _mongo_sync_topology_publish (monitor);
+  g_mutex_unlock (&monitor->lock);
+
+  return monitor;
+}
+
+gboolean
+mongo_sync_topology_monitor_seed_add (mongo_sync_topology_monitor *monitor,
+				      const gchar *host, gint port)
+{
+  if (!monitor)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (!host || port < 0)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  g_mutex_lock (&monitor->lock);
+  _mongo_sync_topology_member_add (monitor,
+				   _mongo_sync_server_get (host, port));
+  _mongo_sync_topology_publish (monitor);
+  g_mutex_unlock (&monitor->lock);
+
+  return TRUE;
+}
+
+mongo_sync_topology_snapshot *
+mongo_sync_topology_monitor_get_snapshot (mongo_sync_topology_monitor *monitor)
+{
+  mongo_sync_topology_snapshot *snapshot;
+
+  if (!monitor)
+    {
+      errno = ENOTCONN;
+      return NULL;
+    }
+
+  /* Publishers wait for readers in here before dropping the snapshot
+     they replaced, so the one loaded stays alive until referenced. */
+  g_atomic_int_inc (&monitor->readers);
+  snapshot = (mongo_sync_topology_snapshot *)
+    g_atomic_pointer_get (&monitor->current);
+  g_atomic_int_inc (&snapshot->ref_count);
+  g_atomic_int_add (&monitor->readers, -1);
+
+  return snapshot;
+}
+
+gboolean
+mongo_sync_topology_monitor_wait (mongo_sync_topology_monitor *monitor,
+				  gint generation, gint timeout)
+{
+  gint64 deadline;
+  gboolean newer;
+
+  if (!monitor)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (timeout < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  deadline = g_get_monotonic_time () + (gint64)timeout * 1000;
+
+  g_mutex_lock (&monitor->lock);
+  while (!monitor->stop && monitor->current->generation <= generation)
+    if (!g_cond_wait_until (&monitor->changed, &monitor->lock, deadline))
+      break;
+  newer = (monitor->current->generation > generation);
+  g_mutex_unlock (&monitor->lock);
+
+  if (!newer)
+    {
+      errno = ETIMEDOUT;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+void
+mongo_sync_topology_monitor_free (mongo_sync_topology_monitor *monitor)
+{
+  GPtrArray *members, *retired;
+  guint i;
+
+  if (!monitor)
+    return;
+
+  /* Once the monitor is stopping, members are neither added nor
+     retired, so the list taken here is final. */
+  g_mutex_lock (&monitor->lock);
+  monitor->stop = TRUE;
+  members = monitor->members;
+  monitor->members = g_ptr_array_new ();
+  g_cond_broadcast (&monitor->changed);
+  g_mutex_unlock (&monitor->lock);
+
+  for (i = 0; i < members->len; i++)
+    {
+      _mongo_sync_topology_member *member =
+	(_mongo_sync_topology_member *)g_ptr_array_index (members, i);
+
+      g_thread_join (member->thread);
+      if (member->conn)
+	mongo_disconnect (member->conn);
+      g_free (member);
+    }
+  g_ptr_array_free (members, TRUE);
+  g_ptr_array_free (monitor->members, TRUE);
+
+  /* Retired members that are still around may be reaping each
+     other: take the list from under them. */
+  g_mutex_lock (&monitor->lock);
+  retired = monitor->retired;
+  monitor->retired = g_ptr_array_new ();
+  g_mutex_unlock (&monitor->lock);
+
+  for (i = 0; i < retired->len; i++)
+    {
+      _mongo_sync_topology_member *member =
+	(_mongo_sync_topology_member *)g_ptr_array_index (retired, i);
+
+      g_thread_join (member->thread);
+      if (member->conn)
+	mongo_disconnect (member->conn);
+      g_free (member);
+    }
+  g_ptr_array_free (retired, TRUE);
+  g_ptr_array_free (monitor->retired, TRUE);
+
+  mongo_sync_topology_snapshot_unref (monitor->current);
+  g_cond_clear (&monitor->changed);
+  g_mutex_clear (&monitor->lock);
+  g_free (monitor);
+}
+
+gint
+mongo_sync_topology_snapshot_get_generation
+  (const mongo_sync_topology_snapshot *snapshot)
+{
+  if (!snapshot)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  return snapshot->generation;
+}
+
+gint32
+mongo_sync_topology_snapshot_get_servers
+  (const mongo_sync_topology_snapshot *snapshot,
+   const mongo_sync_server_info **servers)
+{
+  if (!snapshot || !servers)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  *servers = snapshot->servers;
+  return snapshot->n;
+}
+
+const mongo_sync_server_info *
+mongo_sync_topology_snapshot_get_primary
+  (const mongo_sync_topology_snapshot *snapshot)
+{
+  if (!snapshot)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (snapshot->primary < 0)
+    {
+      errno = ENOENT;
+      return NULL;
+    }
+  return &snapshot->servers[snapshot->primary];
+}
+
+void
+mongo_sync_topology_snapshot_unref (mongo_sync_topology_snapshot *snapshot)
+{
+  if (!snapshot)
+    return;
+  if (!g_atomic_int_dec_and_test (&snapshot->ref_count))
+    return;
+
+  g_free (snapshot->members);
+  g_free (snapshot->servers);
+  g_free (snapshot);
+}
+
+mongo_sync_server *
+_mongo_sync_topology_refresh (mongo_sync_connection *conn)
+{
+  mongo_sync_topology_snapshot *snapshot;
+  gint32 i;
+
+  if (!conn->topology.monitor)
+    return NULL;
+
+  snapshot = conn->topology.snapshot;
+  if (!snapshot || snapshot->generation !=
+      g_atomic_int_get (&conn->topology.monitor->generation))
+    {
+      mongo_sync_topology_snapshot_unref (snapshot);
+      snapshot = mongo_sync_topology_monitor_get_snapshot
+	(conn->topology.monitor);
+      conn->topology.snapshot = snapshot;
+
+      for (i = 0; i < snapshot->n; i++)
+	{
+	  if (!g_list_find (conn->rs.hosts, snapshot->members[i]))
+	    conn->rs.hosts = g_list_append (conn->rs.hosts,
+					    snapshot->members[i]);
+	}
+      if (snapshot->primary >= 0)
+	conn->rs.primary = snapshot->members[snapshot->primary];
+    }
+
+  if (snapshot->primary < 0)
+    return NULL;
+  return snapshot->members[snapshot->primary];
+}
+
+gboolean
+mongo_sync_conn_set_topology_monitor (mongo_sync_connection *conn,
+				      mongo_sync_topology_monitor *monitor)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+
+  mongo_sync_topology_snapshot_unref (conn->topology.snapshot);
+  conn->topology.snapshot = NULL;
+  conn->topology.monitor = monitor;
+
+  _mongo_sync_topology_refresh (conn);
+  return TRUE;
+}
@@ -0,0 +1,265 @@
+/* mongo-sync-topology.h - libmongo-client replica set topology table
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_SYNC_TOPOLOGY_H
+#define LIBMONGO_SYNC_TOPOLOGY_H 1
+
+#include <glib.h>
+#include <mongo-sync.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup mongo_sync_topology_api Mongo Sync Topology API
+ *
+ * Every server a synchronous connection learns about, either as a
+ * seed or from the reply of an ismaster command, is recorded in a
+ * table shared by all connections of the process. The table keeps
+ * the role each server had when it was last heard from, along with
+ * the round-trip time of that ismaster and the replica set
+ * configuration version it reported.
+ *
+ * Reconnects use the table to decide where to go: when a server is
+ * known to be suitable, it is tried on its own first, and the rest of
+ * the replica set is only probed if that fails. Since the table is
+ * shared, a failover discovered on one connection benefits every
+ * other connection too.
+ *
+ * A topology monitor takes this further: it watches a replica set
+ * from background threads, one per member, each polling its member
+ * on its own schedule. Whenever the membership or the roles change,
+ * the monitor publishes a new, immutable snapshot of the set, by
+ * swapping a single pointer. Connections (and pools) subscribed to a
+ * monitor learn about primary changes from the snapshots, without
+ * sending ismaster commands of their own.
+ *
+ * @addtogroup mongo_sync_topology_api
+ * @{
+ */
+
+/** The role of a server, as of its last ismaster reply. */
+typedef enum
+{
+  /** Never heard from, or unreachable the last time it was tried. */
+  MONGO_SYNC_SERVER_UNKNOWN,
+  /** A primary, or a standalone server. */
+  MONGO_SYNC_SERVER_PRIMARY,
+  /** A secondary. */
+  MONGO_SYNC_SERVER_SECONDARY,
+  /** An arbiter. */
+  MONGO_SYNC_SERVER_ARBITER,
+  /** Any other replica set member, such as one still recovering. */
+  MONGO_SYNC_SERVER_OTHER
+} mongo_sync_server_role;
+
+/** A server in the topology table. */
+typedef struct
+{
+  const gchar *host; /**< The host name of the server. */
+  gint port; /**< The port of the server. */
+  const gchar *set_name; /**< The name of the replica set the server
+			    belongs to, or NULL. */
+  mongo_sync_server_role role; /**< The role of the server. */
+  gint32 config_version; /**< The replica set configuration version
+			    the server reported, or -1. */
+  gint64 rtt; /**< The round-trip time of the last ismaster command,
+		 in microseconds, or -1. */
+  gint64 last_seen; /**< The monotonic time (see
+		       g_get_monotonic_time()) of the last ismaster
+		       reply from the server, or 0. */
+} mongo_sync_server_info;
+
+/** Look up a server in the topology table.
+ *
+ * @param host is the host name of the server.
+ * @param port is the port of the server, ignored for Unix socket
+ * paths.
+ * @param info is where the information about the server is stored.
+ *
+ * @note The strings in @a info are owned by the library, and stay
+ * valid for the lifetime of the process.
+ *
+ * @returns TRUE on success, FALSE otherwise. If the server is not in
+ * the table, errno is set to ENOENT.
+ */
+gboolean mongo_sync_server_lookup (const gchar *host, gint port,
+				   mongo_sync_server_info *info);
+
+/** Get the servers a connection would reconnect to.
+ *
+ * @param conn is the connection to query.
+ * @param servers is a pointer to a variable where a newly allocated
+ * array of servers is stored, in the order a reconnect would consider
+ * them. It must be freed with g_free().
+ *
+ * @returns The number of servers, or -1 on error.
+ */
+gint32 mongo_sync_conn_get_servers (mongo_sync_connection *conn,
+				    mongo_sync_server_info **servers);
+
+/** Default polling interval of a topology monitor, in milliseconds. */
+#define MONGO_SYNC_TOPOLOGY_DEFAULT_INTERVAL 10000
+
+/** Polling interval of a topology monitor while the primary is not
+ * known, in milliseconds. */
+#define MONGO_SYNC_TOPOLOGY_MIN_INTERVAL 500
+
+/** Opaque topology monitor object. */
+typedef struct _mongo_sync_topology_monitor mongo_sync_topology_monitor;
+
+/** Opaque, immutable topology snapshot object. */
+typedef struct _mongo_sync_topology_snapshot mongo_sync_topology_snapshot;
+
+/** Create a new topology monitor, and start watching a replica set.
+ *
+ * The members of the set are discovered from the host lists the
+ * servers report, each of them gets its own polling thread. Members
+ * the primary does not list anymore are dropped, and their threads
+ * stopped.
+ *
+ * @param host is the host name of the seed to start from.
+ * @param port is the port of the seed.
+ * @param interval is the time between two polls of the same member,
+ * in milliseconds. While the primary is not known, members are polled
+ * every #MONGO_SYNC_TOPOLOGY_MIN_INTERVAL milliseconds, if that is
+ * shorter.
+ *
+ * @returns A newly allocated monitor, or NULL on error. It must be
+ * freed with mongo_sync_topology_monitor_free().
+ */
+mongo_sync_topology_monitor *mongo_sync_topology_monitor_new (const gchar *host,
+							      gint port,
+							      gint interval);
+
+/** Add a seed to a topology monitor.
+ *
+ * @param monitor is the monitor to add the seed to.
+ * @param host is the host name of the seed.
+ * @param port is the port of the seed.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_topology_monitor_seed_add (mongo_sync_topology_monitor *monitor,
+					       const gchar *host, gint port);
+
+/** Get the current snapshot of a topology monitor.
+ *
+ * Safe to call from any thread. Takes no lock, so readers never wait
+ * for the monitor publishing a snapshot, nor for each other.
+ *
+ * @param monitor is the monitor to query.
+ *
+ * @returns The current snapshot, or NULL on error. It must be
+ * released with mongo_sync_topology_snapshot_unref().
+ */
+mongo_sync_topology_snapshot *mongo_sync_topology_monitor_get_snapshot
+  (mongo_sync_topology_monitor *monitor);
+
+/** Wait for a topology monitor to publish a new snapshot.
+ *
+ * @param monitor is the monitor to wait on.
+ * @param generation is the generation of the snapshot the caller
+ * already has.
+ * @param timeout is the time limit, in milliseconds.
+ *
+ * @returns TRUE if a snapshot newer than @a generation is available,
+ * FALSE otherwise. If the time limit was reached, errno is set to
+ * ETIMEDOUT.
+ */
+gboolean mongo_sync_topology_monitor_wait (mongo_sync_topology_monitor *monitor,
+					   gint generation, gint timeout);
+
+/** Stop and free a topology monitor.
+ *
+ * @param monitor is the monitor to free.
+ *
+ * @note Connections and pools must be unsubscribed from the monitor
+ * (or freed) before it is freed. Snapshots taken from the monitor
+ * remain valid until they are released.
+ */
+void mongo_sync_topology_monitor_free (mongo_sync_topology_monitor *monitor);
+
+/** Get the generation of a topology snapshot.
+ *
+ * Generations start at one, and grow with every snapshot a monitor
+ * publishes.
+ *
+ * @param snapshot is the snapshot to query.
+ *
+ * @returns The generation of the snapshot, or -1 on error.
+ */
+gint mongo_sync_topology_snapshot_get_generation
+  (const mongo_sync_topology_snapshot *snapshot);
+
+/** Get the members in a topology snapshot.
+ *
+ * @param snapshot is the snapshot to query.
+ * @param servers is a pointer to a variable where a pointer to the
+ * members is stored. They belong to the snapshot, and must not be
+ * freed.
+ *
+ * @note The round-trip time and last seen time of the members are as
+ * of the publication of the snapshot, use mongo_sync_server_lookup()
+ * to get the latest values.
+ *
+ * @returns The number of members, or -1 on error.
+ */
+gint32 mongo_sync_topology_snapshot_get_servers
+  (const mongo_sync_topology_snapshot *snapshot,
+   const mongo_sync_server_info **servers);
+
+/** Get the primary in a topology snapshot.
+ *
+ * @param snapshot is the snapshot to query.
+ *
+ * @returns The primary, owned by the snapshot, or NULL if there is
+ * none, in which case errno is set to ENOENT.
+ */
+const mongo_sync_server_info *mongo_sync_topology_snapshot_get_primary
+  (const mongo_sync_topology_snapshot *snapshot);
+
+/** Release a topology snapshot.
+ *
+ * @param snapshot is the snapshot to release.
+ */
+void mongo_sync_topology_snapshot_unref (mongo_sync_topology_snapshot *snapshot);
+
+/** Subscribe a connection to a topology monitor.
+ *
+ * Once subscribed, a connection that needs a primary trusts the
+ * snapshots of the monitor instead of sending an ismaster command
+ * first, and reconnects straight to the new primary when the monitor
+ * reports a change (provided auto-reconnect is enabled). Members
+ * discovered by the monitor are added to the host list of the
+ * connection.
+ *
+ * @param conn is the connection to subscribe.
+ * @param monitor is the monitor to subscribe to, or NULL to
+ * unsubscribe.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_conn_set_topology_monitor (mongo_sync_connection *conn,
+					       mongo_sync_topology_monitor *monitor);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,39 +22,65 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 
 #if ENABLE_AUTH
 #include <openssl/md5.h>
 #endif
 
-mongo_sync_connection *
-mongo_sync_connect (const gchar *host, int port,
-		    gboolean slaveok)
+/** @internal Turn a connection into a synchronous one.
+ *
+ * @param c is the connection to extend. It will be reallocated.
+ * @param seed is the server the connection was made to.
+ * @param slaveok signals whether queries made against a slave are
+ * acceptable.
+ *
+ * @returns The new synchronous connection object.
+ */
+static mongo_sync_connection *
+_mongo_sync_connection_new (mongo_connection *c, mongo_sync_server *seed,
+			    gboolean slaveok)
 {
   mongo_sync_connection *s;
-  mongo_connection *c;
 
-  c = mongo_connect (host, port);
-  if (!c)
-    return NULL;
   s = g_realloc (c, sizeof (mongo_sync_connection));
 
   s->slaveok = slaveok;
   s->safe_mode = FALSE;
   s->auto_reconnect = FALSE;
-  s->rs.seeds = g_list_append (NULL, g_strdup_printf ("%s:%d", host, port));
+  s->rs.seeds = g_list_append (NULL, seed);
   s->rs.hosts = NULL;
   s->rs.primary = NULL;
+  s->server = seed;
+  s->topology.monitor = NULL;
+  s->topology.snapshot = NULL;
   s->last_error = NULL;
   s->max_insert_size = MONGO_SYNC_DEFAULT_MAX_INSERT_SIZE;
+  s->reconnect_timeout = MONGO_SYNC_DEFAULT_RECONNECT_TIMEOUT;
 
   return s;
 }
 
+mongo_sync_connection *
+mongo_sync_connect (const gchar *host, int port,
+		    gboolean slaveok)
+{
+  mongo_connection *c;
+
+  c = mongo_connect (host, port);
+  if (!c)
+    return NULL;
+
+  return _mongo_sync_connection_new (c, _mongo_sync_server_get (host, port),
+				     slaveok);
+}
+
 gboolean
 mongo_sync_conn_seed_add (mongo_sync_connection *conn,
 			  const gchar *host, gint port)
 {
+  mongo_sync_server *server;
+
   if (!conn)
     {
       errno = ENOTCONN;
@@ -66,10 +92,9 @@ mongo_sync_conn_seed_add (mongo_sync_connection *conn,
       return FALSE;
     }
 
-  conn->rs.seeds = g_list_append (conn->rs.seeds,
-				  g_strdup_printf ("%s:%d", host, port));
-  conn->rs.hosts = g_list_prepend (conn->rs.hosts,
-				   g_strdup_printf ("%s:%d", host, port));
+  server = _mongo_sync_server_get (host, port);
+  conn->rs.seeds = g_list_append (conn->rs.seeds, server);
+  conn->rs.hosts = g_list_prepend (conn->rs.hosts, server);
   return TRUE;
 }
 
@@ -82,163 +107,50 @@ _mongo_sync_connect_replace (mongo_sync_connection *old,
   if (!old || !new)
     return;
 
-  g_free (old->rs.primary);
-
-  /* Delete the host list. */
-  l = old->rs.hosts;
-  while (l)
+  /* Keep the members we know of, and make sure the seeds are among
+     them. */
+  for (l = old->rs.seeds; l; l = g_list_next (l))
     {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
-  old->rs.hosts = NULL;
-
-  /* Repopulate it with the seed list */
-  l = old->rs.seeds;
-  while (l)
-    {
-      old->rs.hosts = g_list_append (old->rs.hosts, g_strdup (l->data));
-      l = g_list_next (l);
+      if (!g_list_find (old->rs.hosts, l->data))
+	old->rs.hosts = g_list_append (old->rs.hosts, l->data);
     }
 
   if (old->super.fd)
     close (old->super.fd);
 
   old->super.fd = new->super.fd;
+  _mongo_uring_free (old->super.uring);
+  old->super.uring = new->super.uring;
   old->super.request_id = -1;
+  old->super.last_send = 0;
+  mongo_connection_stats_merge (&old->super.stats, &new->super.stats);
+  mongo_connection_set_timeout ((mongo_connection *)old, old->super.timeout);
   old->slaveok = new->slaveok;
   old->rs.primary = NULL;
+  old->server = new->server;
   g_free (old->last_error);
   old->last_error = NULL;
 
   /* Free the replicaset struct in the new connection. These aren't
      copied, in order to avoid infinite loops. */
-  l = new->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
-  l = new->rs.seeds;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
-  g_free (new->rs.primary);
+  g_list_free (new->rs.hosts);
+  g_list_free (new->rs.seeds);
   g_free (new->last_error);
   g_free (new);
 }
 
-mongo_sync_connection *
-mongo_sync_reconnect (mongo_sync_connection *conn,
-		      gboolean force_master)
-{
-  gboolean ping = FALSE;
-  guint i;
-  mongo_sync_connection *nc;
-  gchar *host;
-  gint port;
-
-  if (!conn)
-    {
-      errno = ENOTCONN;
-      return NULL;
-    }
-
-  ping = mongo_sync_cmd_ping (conn);
-
-  if (ping)
-    {
-      if (!force_master)
-	return conn;
-      if (force_master && mongo_sync_cmd_is_master (conn))
-	return conn;
-
-      /* Force refresh the host list. */
-      mongo_sync_cmd_is_master (conn);
-    }
-
-  /* We either didn't ping, or we're not master, and have to
-   * reconnect.
-   *
-   * First, check if we have a primary, and if we can connect there.
-   */
-
-  if (conn->rs.primary)
-    {
-      if (mongo_util_parse_addr (conn->rs.primary, &host, &port))
-	{
-	  nc = mongo_sync_connect (host, port, conn->slaveok);
-	  g_free (host);
-	  if (nc)
-	    {
-	      int e;
-
-	      /* We can call ourselves here, since connect does not set
-		 conn->rs, thus, we won't end up in an infinite loop. */
-	      nc = mongo_sync_reconnect (nc, force_master);
-	      e = errno;
-	      _mongo_sync_connect_replace (conn, nc);
-	      errno = e;
-	      return conn;
-	    }
-	}
-    }
-
-  /* No primary found, or we couldn't connect, try the rest of the
-     hosts. */
-
-  for (i = 0; i < g_list_length (conn->rs.hosts); i++)
-    {
-      gchar *addr = (gchar *)g_list_nth_data (conn->rs.hosts, i);
-      int e;
-
-      if (!mongo_util_parse_addr (addr, &host, &port))
-	continue;
-
-      nc = mongo_sync_connect (host, port, conn->slaveok);
-      g_free (host);
-      if (!nc)
-	continue;
-
-      nc = mongo_sync_reconnect (nc, force_master);
-      e = errno;
-      _mongo_sync_connect_replace (conn, nc);
-      errno = e;
-      return conn;
-    }
-
-  errno = EHOSTUNREACH;
-  return NULL;
-}
-
 void
 mongo_sync_disconnect (mongo_sync_connection *conn)
 {
-  GList *l;
-
   if (!conn)
     return;
 
-  g_free (conn->rs.primary);
   g_free (conn->last_error);
+  mongo_sync_topology_snapshot_unref (conn->topology.snapshot);
 
-  /* Delete the host list. */
-  l = conn->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
-
-  /* Delete the seed list. */
-  l = conn->rs.seeds;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
+  /* The servers themselves belong to the topology table. */
+  g_list_free (conn->rs.hosts);
+  g_list_free (conn->rs.seeds);
 
   mongo_disconnect ((mongo_connection *)conn);
 }
@@ -274,6 +186,37 @@ mongo_sync_conn_set_max_insert_size (mongo_sync_connection *conn,
   return TRUE;
 }
 
+gint
+mongo_sync_conn_get_reconnect_timeout (const mongo_sync_connection *conn)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return -1;
+    }
+  return conn->reconnect_timeout;
+}
+
+gboolean
+mongo_sync_conn_set_reconnect_timeout (mongo_sync_connection *conn,
+				       gint timeout)
+{
+  if (!conn)
+    {
+      errno = ENOTCONN;
+      return FALSE;
+    }
+  if (timeout <= 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  errno = 0;
+  conn->reconnect_timeout = timeout;
+  return TRUE;
+}
+
 gboolean
 mongo_sync_conn_get_safe_mode (const mongo_sync_connection *conn)
 {
@@ -371,6 +314,17 @@ _mongo_cmd_ensure_conn (mongo_sync_connection *conn,
 
   if (force_master || !conn->slaveok)
     {
+      mongo_sync_server *primary;
+
+      /* With a topology monitor, we know where the primary is without
+	 asking. */
+      primary = _mongo_sync_topology_refresh (conn);
+      if (primary && primary == conn->server)
+	return TRUE;
+
+      /* Without a monitor, or if the connection was made to the
+	 primary under another name than the one the set uses, ask the
+	 server. */
       errno = 0;
       if (!mongo_sync_cmd_is_master (conn))
 	{
@@ -435,7 +389,7 @@ _mongo_cmd_verify_slaveok (mongo_sync_connection *conn)
   return TRUE;
 }
 
-static inline gboolean
+gboolean
 _mongo_sync_packet_send (mongo_sync_connection *conn,
 			 mongo_packet *p,
 			 gboolean force_master,
@@ -476,7 +430,59 @@ _mongo_sync_packet_send (mongo_sync_connection *conn,
   return TRUE;
 }
 
-static inline mongo_packet *
+/** @internal Number packets after the last request of a connection. */
+static void
+_mongo_sync_packets_number (mongo_sync_connection *conn,
+			    mongo_packet **packets, gint32 n)
+{
+  mongo_packet_header h;
+  gint32 rid, i;
+
+  if (!conn)
+    return;
+
+  rid = mongo_connection_get_requestid ((mongo_connection *)conn);
+  for (i = 0; i < n; i++)
+    {
+      mongo_wire_packet_get_header (packets[i], &h);
+      h.id = ++rid;
+      mongo_wire_packet_set_header (packets[i], &h);
+    }
+}
+
+gboolean
+_mongo_sync_packet_send_n (mongo_sync_connection *conn,
+			   mongo_packet **packets, gint32 n,
+			   gboolean force_master, gboolean auto_reconnect)
+{
+  gboolean out = FALSE;
+
+  if (force_master)
+    if (!_mongo_cmd_ensure_conn (conn, force_master))
+      return FALSE;
+
+  for (;;)
+    {
+      int e;
+
+      _mongo_sync_packets_number (conn, packets, n);
+      if (mongo_packet_send_n ((mongo_connection *)conn,
+			       (const mongo_packet **)packets, n))
+	break;
+
+      e = errno;
+      if (!auto_reconnect || (conn && !conn->auto_reconnect) || out ||
+	  !mongo_sync_reconnect (conn, force_master))
+	{
+	  errno = e;
+	  return FALSE;
+	}
+      out = TRUE;
+    }
+  return TRUE;
+}
+
+mongo_packet *
 _mongo_sync_packet_recv (mongo_sync_connection *conn, gint32 rid, gint32 flags)
 {
   mongo_packet *p;
@@ -529,7 +535,7 @@ _mongo_sync_packet_recv (mongo_sync_connection *conn, gint32 rid, gint32 flags)
   return p;
 }
 
-static gboolean
+gboolean
 _mongo_sync_check_ok (bson *b)
 {
   bson_cursor *c;
@@ -553,7 +559,7 @@ _mongo_sync_check_ok (bson *b)
   return (d == 1);
 }
 
-static gboolean
+gboolean
 _mongo_sync_get_error (const bson *rep, gchar **error)
 {
   bson_cursor *c;
@@ -591,46 +597,43 @@ _mongo_sync_get_error (const bson *rep, gchar **error)
   return FALSE;
 }
 
-static mongo_packet *
+mongo_packet *
 _mongo_sync_packet_check_error (mongo_sync_connection *conn, mongo_packet *p,
 				gboolean check_ok)
 {
-  bson *b;
+  bson b;
   gboolean error;
 
   if (!p)
     return NULL;
 
-  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &b))
+  /* The reply is checked in place, the document is not copied. */
+  if (!_mongo_wire_reply_packet_get_nth_view (p, 1, &b))
     {
       mongo_wire_packet_free (p);
       errno = EPROTO;
       return NULL;
     }
-  bson_finish (b);
 
   if (check_ok)
     {
-      if (!_mongo_sync_check_ok (b))
+      if (!_mongo_sync_check_ok (&b))
 	{
 	  int e = errno;
 
 	  g_free (conn->last_error);
 	  conn->last_error = NULL;
-	  _mongo_sync_get_error (b, &conn->last_error);
-	  bson_free (b);
+	  _mongo_sync_get_error (&b, &conn->last_error);
 	  mongo_wire_packet_free (p);
 	  errno = e;
 	  return NULL;
 	}
-      bson_free (b);
       return p;
     }
 
   g_free (conn->last_error);
   conn->last_error = NULL;
-  error = _mongo_sync_get_error (b, &conn->last_error);
-  bson_free (b);
+  error = _mongo_sync_get_error (&b, &conn->last_error);
 
   if (error)
     {
@@ -677,7 +680,7 @@ mongo_sync_cmd_update (mongo_sync_connection *conn,
 
   rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
 
-  p = mongo_wire_cmd_update (rid, ns, flags, selector, update);
+  p = mongo_wire_cmd_update_ref (rid, ns, flags, selector, update);
   if (!p)
     return FALSE;
 
@@ -687,10 +690,49 @@ mongo_sync_cmd_update (mongo_sync_connection *conn,
   return _mongo_sync_cmd_verify_result (conn, ns);
 }
 
-gboolean
-mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
-			 const gchar *ns, gint32 n,
-			 const bson **docs)
+/** @internal Size of a document as it will be sent in an insert.
+ *
+ * @param doc is the document to size.
+ * @param with_ids signals whether an _id will be added to the
+ * document if it does not have one.
+ *
+ * @returns The size of the document on the wire.
+ */
+static gint32
+_mongo_sync_insert_doc_size (const bson *doc, gboolean with_ids)
+{
+  bson_cursor *c;
+
+  if (!with_ids)
+    return bson_size (doc);
+
+  c = bson_find (doc, "_id");
+  if (c)
+    {
+      bson_cursor_free (c);
+      return bson_size (doc);
+    }
+  return bson_size (doc) + MONGO_WIRE_ID_ELEMENT_SIZE;
+}
+
+/** @internal Send an insert command, split into chunks.
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to work in.
+ * @param n is the number of documents to insert.
+ * @param docs is the array the documents to insert.
+ * @param with_ids signals whether to give documents without an _id
+ * one, see mongo_wire_cmd_insert_n_with_ids().
+ * @param ids is the optional array to store the _id of each document
+ * in, when @a with_ids is set.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
+			  const gchar *ns, gint32 n,
+			  const bson **docs, gboolean with_ids,
+			  guint8 *ids)
 {
   mongo_packet *p;
   gint32 rid;
@@ -716,7 +758,8 @@ mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
 
   for (i = 0; i < n; i++)
     {
-      if (bson_size (docs[i]) >= conn->max_insert_size)
+      if (_mongo_sync_insert_doc_size (docs[i], with_ids) >=
+	  conn->max_insert_size)
 	{
 	  errno = EMSGSIZE;
 	  return FALSE;
@@ -730,7 +773,7 @@ mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
 
       while (i < n && size < conn->max_insert_size)
 	{
-	  size += bson_size (docs[i++]);
+	  size += _mongo_sync_insert_doc_size (docs[i++], with_ids);
 	  c++;
 	}
       size = 0;
@@ -739,7 +782,11 @@ mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
 
       rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
 
-      p = mongo_wire_cmd_insert_n (rid, ns, c, &docs[pos]);
+      if (with_ids)
+	p = mongo_wire_cmd_insert_n_with_ids (rid, ns, c, &docs[pos],
+					      (ids) ? ids + pos * 12 : NULL);
+      else
+	p = mongo_wire_cmd_insert_n_ref (rid, ns, c, &docs[pos]);
       if (!p)
 	return FALSE;
 
@@ -755,6 +802,22 @@ mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
   return TRUE;
 }
 
+gboolean
+mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
+			 const gchar *ns, gint32 n,
+			 const bson **docs)
+{
+  return _mongo_sync_cmd_insert_n (conn, ns, n, docs, FALSE, NULL);
+}
+
+gboolean
+mongo_sync_cmd_insert_n_with_ids (mongo_sync_connection *conn,
+				  const gchar *ns, gint32 n,
+				  const bson **docs, guint8 *ids)
+{
+  return _mongo_sync_cmd_insert_n (conn, ns, n, docs, TRUE, ids);
+}
+
 gboolean
 mongo_sync_cmd_insert (mongo_sync_connection *conn,
 		       const char *ns, ...)
@@ -941,7 +1004,7 @@ mongo_sync_cmd_count (mongo_sync_connection *conn,
 		      const bson *query)
 {
   mongo_packet *p;
-  bson *cmd;
+  bson *cmd, res;
   bson_cursor *c;
   gdouble d;
 
@@ -962,7 +1025,7 @@ mongo_sync_cmd_count (mongo_sync_connection *conn,
     }
   bson_free (cmd);
 
-  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &cmd))
+  if (!_mongo_wire_reply_packet_get_nth_view (p, 1, &res))
     {
       int e = errno;
 
@@ -970,25 +1033,23 @@ mongo_sync_cmd_count (mongo_sync_connection *conn,
       errno = e;
       return -1;
     }
-  mongo_wire_packet_free (p);
-  bson_finish (cmd);
 
-  c = bson_find (cmd, "n");
+  c = bson_find (&res, "n");
   if (!c)
     {
-      bson_free (cmd);
+      mongo_wire_packet_free (p);
       errno = ENOENT;
       return -1;
     }
   if (!bson_cursor_get_double (c, &d))
     {
-      bson_free (cmd);
+      mongo_wire_packet_free (p);
       bson_cursor_free (c);
       errno = EINVAL;
       return -1;
     }
   bson_cursor_free (c);
-  bson_free (cmd);
+  mongo_wire_packet_free (p);
 
   return d;
 }
@@ -1019,6 +1080,42 @@ mongo_sync_cmd_drop (mongo_sync_connection *conn,
   return TRUE;
 }
 
+gboolean
+_mongo_sync_packet_get_last_error (mongo_sync_connection *conn,
+				   mongo_packet *p, gchar **error)
+{
+  bson doc;
+
+  if (!_mongo_wire_reply_packet_get_nth_view (p, 1, &doc))
+    {
+      int e = errno;
+
+      mongo_wire_packet_free (p);
+      errno = e;
+      return FALSE;
+    }
+
+  if (!_mongo_sync_get_error (&doc, error))
+    {
+      int e = errno;
+
+      mongo_wire_packet_free (p);
+      errno = e;
+      return FALSE;
+    }
+  mongo_wire_packet_free (p);
+
+  if (*error == NULL)
+    *error = g_strdup (conn->last_error);
+  else
+    {
+      g_free (conn->last_error);
+      conn->last_error = NULL;
+    }
+
+  return TRUE;
+}
+
 gboolean
 mongo_sync_cmd_get_last_error (mongo_sync_connection *conn,
 			       const gchar *db, gchar **error)
@@ -1037,6 +1134,8 @@ mongo_sync_cmd_get_last_error (mongo_sync_connection *conn,
       return FALSE;
     }
 
+  conn->super.stats.get_last_error_calls++;
+
   cmd = bson_new_sized (64);
   bson_append_int32 (cmd, "getlasterror", 1);
   bson_finish (cmd);
@@ -1052,36 +1151,7 @@ mongo_sync_cmd_get_last_error (mongo_sync_connection *conn,
     }
   bson_free (cmd);
 
-  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &cmd))
-    {
-      int e = errno;
-
-      mongo_wire_packet_free (p);
-      errno = e;
-      return FALSE;
-    }
-  mongo_wire_packet_free (p);
-  bson_finish (cmd);
-
-  if (!_mongo_sync_get_error (cmd, error))
-    {
-      int e = errno;
-
-      bson_free (cmd);
-      errno = e;
-      return FALSE;
-    }
-  bson_free (cmd);
-
-  if (*error == NULL)
-    *error = g_strdup (conn->last_error);
-  else
-    {
-      g_free (conn->last_error);
-      conn->last_error = NULL;
-    }
-
-  return TRUE;
+  return _mongo_sync_packet_get_last_error (conn, p, error);
 }
 
 gboolean
@@ -1115,19 +1185,105 @@ mongo_sync_cmd_reset_error (mongo_sync_connection *conn,
   return TRUE;
 }
 
+/** @internal Process the reply of an ismaster command.
+ *
+ * Updates the replica set information of the connection (the primary
+ * and the list of hosts) from the reply. The servers themselves are
+ * looked up in, or added to, the topology table.
+ *
+ * @param conn is the connection the reply was received on.
+ * @param res is the (finished) reply document.
+ *
+ * @returns TRUE if the replying node is a master, FALSE otherwise and
+ * on errors.
+ */
+static gboolean
+_mongo_sync_is_master_update (mongo_sync_connection *conn, const bson *res)
+{
+  bson *hosts;
+  bson_cursor *c;
+  gboolean b;
+
+  c = bson_find (res, "ismaster");
+  if (!bson_cursor_get_boolean (c, &b))
+    {
+      bson_cursor_free (c);
+      errno = EPROTO;
+      return FALSE;
+    }
+  bson_cursor_free (c);
+
+  if (b)
+    conn->rs.primary = conn->server;
+  else
+    {
+      const gchar *s;
+
+      /* We're not the master, so we should have a 'primary' key in
+	 the response. */
+      c = bson_find (res, "primary");
+      if (bson_cursor_get_string (c, &s))
+	conn->rs.primary = _mongo_sync_server_parse (s);
+      bson_cursor_free (c);
+    }
+
+  /* Find all the members of the set, and cache them. */
+  c = bson_find (res, "hosts");
+  if (!c)
+    {
+      errno = 0;
+      return b;
+    }
+
+  if (!bson_cursor_get_array (c, &hosts))
+    {
+      bson_cursor_free (c);
+      errno = 0;
+      return b;
+    }
+  bson_cursor_free (c);
+  bson_finish (hosts);
+
+  /* Replace the old host list. Unparsable addresses are dropped
+     right away. */
+  g_list_free (conn->rs.hosts);
+  conn->rs.hosts = NULL;
+
+  c = bson_cursor_new (hosts);
+  while (bson_cursor_next (c))
+    {
+      mongo_sync_server *server;
+      const gchar *s;
+
+      if (!bson_cursor_get_string (c, &s))
+	continue;
+      server = _mongo_sync_server_parse (s);
+      if (server)
+	conn->rs.hosts = g_list_append (conn->rs.hosts, server);
+    }
+  bson_cursor_free (c);
+  bson_free (hosts);
+
+  errno = 0;
+  return b;
+}
+
 gboolean
 mongo_sync_cmd_is_master (mongo_sync_connection *conn)
 {
-  bson *cmd, *res, *hosts;
+  bson *cmd, *res;
   mongo_packet *p;
-  bson_cursor *c;
   gboolean b;
-  GList *l;
+  gint64 start;
+
+  if (conn)
+    conn->super.stats.is_master_checks++;
 
   cmd = bson_new_sized (32);
   bson_append_int32 (cmd, "ismaster", 1);
   bson_finish (cmd);
 
+  start = g_get_monotonic_time ();
   p = _mongo_sync_cmd_custom (conn, "system", cmd, FALSE, FALSE);
   if (!p)
     {
@@ -1150,73 +1306,369 @@ mongo_sync_cmd_is_master (mongo_sync_connection *conn)
   mongo_wire_packet_free (p);
   bson_finish (res);
 
-  c = bson_find (res, "ismaster");
-  if (!bson_cursor_get_boolean (c, &b))
+  _mongo_sync_server_seen (conn->server, res,
+			   g_get_monotonic_time () - start);
+  b = _mongo_sync_is_master_update (conn, res);
+  if (errno)
     {
-      bson_cursor_free (c);
+      int e = errno;
+
       bson_free (res);
-      errno = EPROTO;
+      errno = e;
       return FALSE;
     }
-  bson_cursor_free (c);
+  bson_free (res);
+
+  errno = 0;
+  return b;
+}
+
+/** @internal A host being tried during a parallel reconnect. */
+typedef struct
+{
+  mongo_sync_server *server; /**< The server being tried. */
+  gint fd; /**< The socket of the pending connection, or -1. */
+  mongo_sync_connection *conn; /**< The established connection, once
+				  the TCP connect finished. */
+  gint32 rid; /**< The requestID of the ismaster command sent. */
+  gint64 asked; /**< Monotonic time the ismaster command was sent
+		   at. */
+} _mongo_sync_candidate;
+
+/** @internal Drop a candidate from a parallel reconnect. */
+static void
+_mongo_sync_candidate_drop (_mongo_sync_candidate *cand)
+{
+  if (cand->conn)
+    mongo_sync_disconnect (cand->conn);
+  else if (cand->fd >= 0)
+    close (cand->fd);
+  cand->conn = NULL;
+  cand->fd = -1;
+}
+
+/** @internal Send an ismaster command on a freshly connected
+ * candidate, without waiting for the reply.
+ */
+static gboolean
+_mongo_sync_candidate_ask (_mongo_sync_candidate *cand)
+{
+  mongo_packet *p;
+  bson *cmd;
+  gboolean res;
+
+  cmd = bson_new_sized (32);
+  bson_append_int32 (cmd, "ismaster", 1);
+  bson_finish (cmd);
+
+  cand->rid = mongo_connection_get_requestid
+    ((mongo_connection *)cand->conn) + 1;
+  p = mongo_wire_cmd_custom (cand->rid, "system", _SLAVE_FLAG (cand->conn),
+			     cmd);
+  bson_free (cmd);
+  if (!p)
+    return FALSE;
+
+  cand->asked = g_get_monotonic_time ();
+  cand->conn->super.defer_reply = TRUE;
+  res = _mongo_sync_packet_send (cand->conn, p, FALSE, FALSE);
+  cand->conn->super.defer_reply = FALSE;
+  return res;
+}
+
+/** @internal Read the ismaster reply of a candidate.
+ *
+ * Only the start of the reply is known to have arrived, so the read
+ * is bound by the time left until @a deadline.
+ *
+ * @returns The finished reply document, or NULL on error.
+ */
+static bson *
+_mongo_sync_candidate_answer (_mongo_sync_candidate *cand, gint64 deadline)
+{
+  mongo_packet *p;
+  bson *res;
+  gint64 left;
 
-  if (!b)
+  left = (deadline - g_get_monotonic_time ()) / 1000;
+  if (left <= 0 ||
+      !mongo_connection_set_timeout ((mongo_connection *)cand->conn,
+				     (gint)left))
     {
-      const gchar *s;
+      errno = ETIMEDOUT;
+      return NULL;
+    }
 
-      /* We're not the master, so we should have a 'primary' key in
-	 the response. */
-      c = bson_find (res, "primary");
-      if (bson_cursor_get_string (c, &s))
+  p = _mongo_sync_packet_recv (cand->conn, cand->rid,
+			       MONGO_REPLY_FLAG_QUERY_FAIL);
+  p = _mongo_sync_packet_check_error (cand->conn, p, TRUE);
+  if (!p)
+    return NULL;
+
+  if (!mongo_wire_reply_packet_get_nth_document (p, 1, &res))
+    {
+      mongo_wire_packet_free (p);
+      return NULL;
+    }
+  mongo_wire_packet_free (p);
+  bson_finish (res);
+
+  _mongo_sync_server_seen (cand->server, res,
+			   g_get_monotonic_time () - cand->asked);
+
+  return res;
+}
+
+/** @internal Connect to any of a list of hosts, in parallel.
+ *
+ * Starts a non-blocking connect towards each host in @a addrs, sends
+ * an ismaster command to every one that succeeds, and keeps the first
+ * that answers (positively, if @a force_master is set).
+ *
+ * @param addrs is the list of servers to try.
+ * @param slaveok is the SLAVE_OK flag of the new connection.
+ * @param force_master signals whether only a primary is acceptable.
+ * @param deadline is the monotonic time the attempt must finish by.
+ * @param reply is a pointer to a variable where the winner's ismaster
+ * reply will be stored.
+ * @param hint is a pointer to a variable where the primary advertised
+ * by secondaries (if any) will be stored, when no suitable host was
+ * found.
+ *
+ * Hosts that cannot be reached are marked as such in the topology
+ * table. If @a deadline has passed already, no host is tried.
+ *
+ * @returns A new connection, or NULL if none of the hosts were
+ * suitable.
+ */
+static mongo_sync_connection *
+_mongo_sync_connect_parallel (GList *addrs, gboolean slaveok,
+			      gboolean force_master, gint64 deadline,
+			      bson **reply, mongo_sync_server **hint)
+{
+  _mongo_sync_candidate *cands;
+  struct pollfd *pfds;
+  mongo_sync_connection *winner = NULL;
+  gint i, n = 0, pending = 0;
+  GList *l;
+
+  /* Out of time already: do not start, nor blame the hosts. */
+  if (g_get_monotonic_time () >= deadline)
+    return NULL;
+
+  cands = g_new0 (_mongo_sync_candidate, g_list_length (addrs));
+  pfds = g_new0 (struct pollfd, g_list_length (addrs));
+
+  for (l = addrs; l; l = g_list_next (l))
+    {
+      mongo_sync_server *server = (mongo_sync_server *)l->data;
+
+      cands[n].server = server;
+      cands[n].fd = mongo_connect_nonblock (server->info.host,
+					    server->info.port);
+      if (cands[n].fd < 0)
 	{
-	  g_free (conn->rs.primary);
-	  conn->rs.primary = g_strdup (s);
+	  _mongo_sync_server_down (server);
+	  continue;
 	}
-      bson_cursor_free (c);
+
+      n++;
+      pending++;
     }
 
-  /* Find all the members of the set, and cache them. */
-  c = bson_find (res, "hosts");
-  if (!c)
+  while (pending > 0 && !winner)
     {
-      bson_free (res);
-      errno = 0;
-      return b;
+      gint64 left = (deadline - g_get_monotonic_time ()) / 1000;
+
+      if (left <= 0)
+	break;
+
+      for (i = 0; i < n; i++)
+	{
+	  pfds[i].fd = cands[i].fd;
+	  pfds[i].events = (cands[i].conn) ? POLLIN : POLLOUT;
+	  pfds[i].revents = 0;
+	}
+
+      if (poll (pfds, n, (int)left) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+
+      for (i = 0; i < n && !winner; i++)
+	{
+	  bson *res;
+	  gboolean master;
+
+	  if (cands[i].fd < 0 || pfds[i].revents == 0)
+	    continue;
+
+	  if (!cands[i].conn)
+	    {
+	      mongo_connection *c;
+
+	      /* The TCP connect finished, one way or the other. */
+	      c = mongo_connect_nonblock_finish (cands[i].fd);
+	      if (!c)
+		{
+		  _mongo_sync_server_down (cands[i].server);
+		  cands[i].fd = -1;
+		  pending--;
+		  continue;
+		}
+	      cands[i].conn = _mongo_sync_connection_new (c, cands[i].server,
+							  slaveok);
+	      mongo_connection_set_timeout
+		((mongo_connection *)cands[i].conn, (gint)left);
+	      if (!_mongo_sync_candidate_ask (&cands[i]))
+		{
+		  _mongo_sync_server_down (cands[i].server);
+		  _mongo_sync_candidate_drop (&cands[i]);
+		  pending--;
+		}
+	      continue;
+	    }
+
+	  /* The ismaster reply arrived. */
+	  res = _mongo_sync_candidate_answer (&cands[i], deadline);
+	  if (!res)
+	    {
+	      _mongo_sync_server_down (cands[i].server);
+	      _mongo_sync_candidate_drop (&cands[i]);
+	      pending--;
+	      continue;
+	    }
+
+	  master = _mongo_sync_is_master_update (cands[i].conn, res);
+	  if (master || (!force_master && errno == 0))
+	    {
+	      winner = cands[i].conn;
+	      cands[i].conn = NULL;
+	      cands[i].fd = -1;
+	      *reply = res;
+	      break;
+	    }
+
+	  if (hint && !*hint && cands[i].conn->rs.primary)
+	    *hint = cands[i].conn->rs.primary;
+	  bson_free (res);
+	  _mongo_sync_candidate_drop (&cands[i]);
+	  pending--;
+	}
     }
 
-  if (!bson_cursor_get_array (c, &hosts))
+  for (i = 0; i < n; i++)
     {
-      bson_cursor_free (c);
-      bson_free (res);
-      errno = 0;
-      return b;
+      /* Nobody answered in time: whoever is still pending is not
+	 worth trying first next time. */
+      if (!winner && cands[i].fd >= 0)
+	_mongo_sync_server_down (cands[i].server);
+      _mongo_sync_candidate_drop (&cands[i]);
     }
-  bson_cursor_free (c);
-  bson_free (res);
-  bson_finish (hosts);
+  g_free (cands);
+  g_free (pfds);
 
-  /* Delete the old host list. */
-  l = conn->rs.hosts;
-  while (l)
+  return winner;
+}
+
+mongo_sync_connection *
+mongo_sync_reconnect (mongo_sync_connection *conn,
+		      gboolean force_master)
+{
+  gboolean ping = FALSE;
+  mongo_sync_connection *nc = NULL;
+  mongo_sync_server *hint = NULL, *primary;
+  mongo_sync_server_info best;
+  GList *addrs;
+  bson *res = NULL;
+  gint timeout;
+  gint64 deadline;
+
+  if (!conn)
     {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
+      errno = ENOTCONN;
+      return NULL;
     }
-  conn->rs.hosts = NULL;
 
-  c = bson_cursor_new (hosts);
-  while (bson_cursor_next (c))
+  /* All the attempts below share a single time limit. */
+  timeout = (conn->reconnect_timeout > 0) ? conn->reconnect_timeout :
+    MONGO_SYNC_DEFAULT_RECONNECT_TIMEOUT;
+  deadline = g_get_monotonic_time () + (gint64)timeout * 1000;
+
+  primary = _mongo_sync_topology_refresh (conn);
+  ping = mongo_sync_cmd_ping (conn);
+
+  if (ping)
     {
-      const gchar *s;
+      if (!force_master)
+	return conn;
+      /* The topology monitor knows who the primary is, but the
+	 connection may have been made to it under another name. */
+      if (primary && primary == conn->server)
+	return conn;
+      if (mongo_sync_cmd_is_master (conn))
+	return conn;
 
-      if (bson_cursor_get_string (c, &s))
-	conn->rs.hosts = g_list_append (conn->rs.hosts, g_strdup (s));
+      /* Force refresh the host list. */
+      if (!primary)
+	mongo_sync_cmd_is_master (conn);
     }
-  bson_cursor_free (c);
-  bson_free (hosts);
+
+  /* We either didn't ping, or we're not master, and have to
+   * reconnect.
+   */
+  addrs = _mongo_sync_server_candidates (conn);
+
+  /* If the topology table already knows a suitable host, go straight
+     to it, without bothering the rest of the set. */
+  if (addrs)
+    {
+      _mongo_sync_server_get_info ((mongo_sync_server *)addrs->data, &best);
+      if (best.role == MONGO_SYNC_SERVER_PRIMARY ||
+	  (!force_master && best.role == MONGO_SYNC_SERVER_SECONDARY))
+	{
+	  GList *h = g_list_append (NULL, addrs->data);
+
+	  nc = _mongo_sync_connect_parallel (h, conn->slaveok, force_master,
+					     deadline, &res, &hint);
+	  g_list_free (h);
+	  if (!nc)
+	    addrs = g_list_delete_link (addrs, addrs);
+	}
+    }
+
+  /* Otherwise, try all the hosts we know of, at the same time. */
+  if (!nc && addrs)
+    nc = _mongo_sync_connect_parallel (addrs, conn->slaveok, force_master,
+				       deadline, &res, &hint);
+
+  /* If none of the hosts we know of were suitable, but one of them
+     told us where the primary is, try that too. */
+  if (!nc && hint && !g_list_find (addrs, hint))
+    {
+      GList *h = g_list_append (NULL, hint);
+
+      nc = _mongo_sync_connect_parallel (h, conn->slaveok, force_master,
+					 deadline, &res, NULL);
+      g_list_free (h);
+    }
+  g_list_free (addrs);
+
+  if (!nc)
+    {
+      errno = EHOSTUNREACH;
+      return NULL;
+    }
+
+  _mongo_sync_connect_replace (conn, nc);
+  _mongo_sync_is_master_update (conn, res);
+  bson_free (res);
+  conn->super.stats.reconnects++;
 
   errno = 0;
-  return b;
+  return conn;
 }
 
 gboolean
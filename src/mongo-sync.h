@@ -37,6 +37,12 @@ extern "C" {
  */
 #define MONGO_SYNC_DEFAULT_MAX_INSERT_SIZE 4 * 1000 * 1000
 
+/** Default time limit for a single reconnect attempt.
+ *
+ * Defaults to five seconds, expressed in milliseconds.
+ */
+#define MONGO_SYNC_DEFAULT_RECONNECT_TIMEOUT 5000
+
 /** @defgroup mongo_sync Mongo Sync API
  *
  * These commands provide wrappers for the most often used MongoDB
@@ -58,8 +64,9 @@ typedef struct _mongo_sync_connection mongo_sync_connection;
  *
  * Sets up a synchronous connection to a MongoDB server.
  *
- * @param host is the address of the server.
- * @param port is the port to connect to.
+ * @param host is the address of the server, or the path of a Unix
+ * domain socket, see mongo_connect().
+ * @param port is the port to connect to, ignored for socket paths.
  * @param slaveok signals whether queries made against a slave are
  * acceptable.
  *
@@ -88,8 +95,17 @@ gboolean mongo_sync_conn_seed_add (mongo_sync_connection *conn,
 /** Attempt to connect to another member of a replica set.
  *
  * Given an existing connection, this function will try to connect to
- * an available node (enforcing that it's a primary, if asked to) by
- * trying all known hosts until it finds one available.
+ * an available node (enforcing that it's a primary, if asked to).
+ *
+ * If the topology table (see @ref mongo_sync_topology_api) knows of a
+ * suitable host, that one is tried first, on its own. Otherwise, or
+ * if that fails, all known hosts are tried at the same time:
+ * connections are initiated towards each of them without blocking,
+ * and the first one to answer an ismaster command (with a positive
+ * answer, if a primary was requested) is kept, the rest are
+ * closed. The reconnect as a whole, including every one of these
+ * attempts, is bound by the reconnect timeout of the connection, see
+ * mongo_sync_conn_set_reconnect_timeout().
  *
  * @param conn is an existing MongoDB connection.
  * @param force_master signals whether a primary node should be found.
@@ -202,6 +218,28 @@ gint32 mongo_sync_conn_get_max_insert_size (mongo_sync_connection *conn);
 gboolean mongo_sync_conn_set_max_insert_size (mongo_sync_connection *conn,
 					      gint32 max_size);
 
+/** Get the time limit of a reconnect attempt.
+ *
+ * @param conn is the connection to get the timeout from.
+ *
+ * @returns The timeout in milliseconds, or -1 on failiure.
+ */
+gint mongo_sync_conn_get_reconnect_timeout (const mongo_sync_connection *conn);
+
+/** Set the time limit of a reconnect attempt.
+ *
+ * When reconnecting, the library will wait at most this long in
+ * total for any of the known hosts to become available, before giving
+ * up.
+ *
+ * @param conn is the connection to set the timeout for.
+ * @param timeout is the time limit, in milliseconds.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_conn_set_reconnect_timeout (mongo_sync_connection *conn,
+						gint timeout);
+
 /** Send an update command to MongoDB.
  *
  * Constructs and sends an update command to MongoDB.
@@ -252,6 +290,26 @@ gboolean mongo_sync_cmd_insert_n (mongo_sync_connection *conn,
 				  const gchar *ns, gint32 n,
 				  const bson **docs);
 
+/** Send an insert command to MongoDB, giving each document an _id.
+ *
+ * Works like mongo_sync_cmd_insert_n(), except that documents without
+ * an _id get a freshly generated ObjectID, as the packet is built. See
+ * mongo_wire_cmd_insert_n_with_ids().
+ *
+ * @param conn is the connection to work with.
+ * @param ns is the namespace to work in.
+ * @param n is the number of documents to insert.
+ * @param docs is the array the documents to insert. There must be at
+ * least @a n documents in the array.
+ * @param ids is an optional array of @a n times 12 bytes, where the
+ * _id of each document is stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_sync_cmd_insert_n_with_ids (mongo_sync_connection *conn,
+					   const gchar *ns, gint32 n,
+					   const bson **docs, guint8 *ids);
+
 /** Send a query command to MongoDB.
  *
  * @param conn is the connection to work with.
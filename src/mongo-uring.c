@@ -0,0 +1,646 @@
+/* mongo-uring.c - libmongo-client io_uring transport
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file src/mongo-uring.c
+ * io_uring transport of mongo_connection.
+ *
+ * Each thread has a small ring of its own, set up with the raw system
+ * calls, so that no library beyond the kernel headers is needed, and
+ * shared by every connection the thread does I/O on. A request that
+ * expects a reply is submitted together with the receive of the
+ * reply, as a linked pair, into the read-ahead buffer of the
+ * connection: a round trip whose reply fits into the buffer takes a
+ * single system call, where the socket path needs three.
+ */
+
+#include "config.h"
+#include "mongo-client.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+#if HAVE_IO_URING
+
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/** @internal Number of submission queue entries of a ring: a send
+ * and a receive, each with its timeout, with room to spare. */
+#define MONGO_URING_ENTRIES 8
+/** @internal Size of the read-ahead buffer. Reads at least this large
+ * go straight to their destination, and only requests no larger than
+ * this are linked to the receive of their reply. */
+#define MONGO_URING_BUFFER_SIZE (64 * 1024)
+
+/** @internal Tags of the entries in a submission. */
+enum
+  {
+    MONGO_URING_TAG_OP, /**< The operation. */
+    MONGO_URING_TAG_TIMEOUT, /**< The timeout of the operation. */
+    MONGO_URING_TAG_RECV, /**< The receive linked to a send. */
+    MONGO_URING_TAG_RECV_TIMEOUT, /**< The timeout of that receive. */
+    MONGO_URING_TAGS /**< Number of tags. */
+  };
+
+/** @internal An io_uring instance, shared by the connections of a
+ * thread. */
+typedef struct
+{
+  gint fd; /**< The ring itself. */
+
+  void *rings; /**< Mapping of the submission and completion
+		  rings. */
+  gsize rings_size; /**< Size of the ring mapping. */
+  struct io_uring_sqe *sqes; /**< Mapping of the submission queue
+				entries. */
+  gsize sqes_size; /**< Size of the entry mapping. */
+
+  guint32 *sq_head; /**< Submission ring head, owned by the kernel. */
+  guint32 *sq_tail; /**< Submission ring tail, owned by us. */
+  guint32 *sq_mask; /**< Submission ring index mask. */
+  guint32 *sq_array; /**< Submission ring, indexes into sqes. */
+  guint32 *cq_head; /**< Completion ring head, owned by us. */
+  guint32 *cq_tail; /**< Completion ring tail, owned by the kernel. */
+  guint32 *cq_mask; /**< Completion ring index mask. */
+  struct io_uring_cqe *cqes; /**< Completion ring entries. */
+
+  guint32 n_prepared; /**< Number of entries prepared, but not yet
+			 submitted. */
+  gboolean broken; /**< Whether the ring failed, and must not be used
+		      anymore. */
+} mongo_uring_ring;
+
+/** @internal The io_uring state of a connection. */
+struct _mongo_uring
+{
+  gint fd; /**< The socket, or -1 until attached. */
+
+  guint8 *buffer; /**< The read-ahead buffer, or NULL until
+		     attached. */
+  guint32 buffer_pos; /**< Start of the unread data in the buffer. */
+  guint32 buffer_len; /**< End of the unread data in the buffer. */
+
+  gboolean deferred; /**< Whether the receive linked to the last send
+			failed, and the next receive has to report
+			it. */
+  gint deferred_res; /**< The result of that receive. */
+};
+
+static int
+_mongo_uring_sys_setup (guint32 entries, struct io_uring_params *params)
+{
+  return (int)syscall (__NR_io_uring_setup, entries, params);
+}
+
+static int
+_mongo_uring_sys_enter (int fd, guint32 to_submit, guint32 min_complete,
+			guint32 flags)
+{
+  return (int)syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+/** @internal Set up a ring. */
+static mongo_uring_ring *
+_mongo_uring_ring_new (void)
+{
+  struct io_uring_params params;
+  mongo_uring_ring *ring;
+  gsize sq_size, cq_size;
+  guint8 *rings;
+  void *sqes;
+  int fd, e;
+
+  memset (&params, 0, sizeof (params));
+  fd = _mongo_uring_sys_setup (MONGO_URING_ENTRIES, &params);
+  if (fd < 0)
+    return NULL;
+
+  /* Both rings in one mapping, and sockets polled by the kernel
+     instead of blocking a worker thread, as in Linux 5.7. */
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_FAST_POLL))
+    {
+      close (fd);
+      errno = ENOSYS;
+      return NULL;
+    }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof (guint32);
+  cq_size = params.cq_off.cqes +
+    params.cq_entries * sizeof (struct io_uring_cqe);
+  sq_size = MAX (sq_size, cq_size);
+
+  rings = mmap (NULL, sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED)
+    {
+      e = errno;
+      close (fd);
+      errno = e;
+      return NULL;
+    }
+
+  sqes = mmap (NULL, params.sq_entries * sizeof (struct io_uring_sqe),
+	       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	       IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    {
+      e = errno;
+      munmap (rings, sq_size);
+      close (fd);
+      errno = e;
+      return NULL;
+    }
+
+  ring = g_new0 (mongo_uring_ring, 1);
+  ring->fd = fd;
+
+  ring->rings = rings;
+  ring->rings_size = sq_size;
+  ring->sqes = (struct io_uring_sqe *)sqes;
+  ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  ring->sq_head = (guint32 *)(rings + params.sq_off.head);
+  ring->sq_tail = (guint32 *)(rings + params.sq_off.tail);
+  ring->sq_mask = (guint32 *)(rings + params.sq_off.ring_mask);
+  ring->sq_array = (guint32 *)(rings + params.sq_off.array);
+  ring->cq_head = (guint32 *)(rings + params.cq_off.head);
+  ring->cq_tail = (guint32 *)(rings + params.cq_off.tail);
+  ring->cq_mask = (guint32 *)(rings + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+
+  return ring;
+}
+
+static void
+_mongo_uring_ring_free (gpointer data)
+{
+  mongo_uring_ring *ring = (mongo_uring_ring *)data;
+
+  munmap (ring->sqes, ring->sqes_size);
+  munmap (ring->rings, ring->rings_size);
+  close (ring->fd);
+  g_free (ring);
+}
+
+/** @internal The ring of the current thread. */
+static GPrivate _mongo_uring_ring_key =
+  G_PRIVATE_INIT (_mongo_uring_ring_free);
+
+/** @internal Get the ring of the current thread, setting it up if
+ * needed.
+ *
+ * @returns The ring, or NULL if it cannot be set up, or it broke.
+ */
+static mongo_uring_ring *
+_mongo_uring_ring_get (void)
+{
+  mongo_uring_ring *ring = g_private_get (&_mongo_uring_ring_key);
+
+  if (G_UNLIKELY (!ring))
+    {
+      ring = _mongo_uring_ring_new ();
+      if (ring)
+	g_private_set (&_mongo_uring_ring_key, ring);
+    }
+  if (G_UNLIKELY (ring && ring->broken))
+    {
+      errno = EIO;
+      return NULL;
+    }
+  return ring;
+}
+
+mongo_uring *
+_mongo_uring_new (void)
+{
+  mongo_uring *r;
+
+  if (!_mongo_uring_ring_get ())
+    return NULL;
+
+  r = g_new0 (mongo_uring, 1);
+  r->fd = -1;
+  return r;
+}
+
+void
+_mongo_uring_attach (mongo_uring *r, gint fd)
+{
+  if (!r)
+    return;
+
+  r->fd = fd;
+  r->buffer = g_malloc (MONGO_URING_BUFFER_SIZE);
+}
+
+void
+_mongo_uring_free (mongo_uring *r)
+{
+  if (!r)
+    return;
+
+  g_free (r->buffer);
+  g_free (r);
+}
+
+/** @internal Get the next free submission queue entry, cleared, and
+ * put it on the submission ring. */
+static struct io_uring_sqe *
+_mongo_uring_get_sqe (mongo_uring_ring *ring, guint64 tag)
+{
+  guint32 idx = (*ring->sq_tail + ring->n_prepared++) & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+  ring->sq_array[idx] = idx;
+  sqe->user_data = tag;
+  return sqe;
+}
+
+/** @internal Prepare an operation on the socket of a connection. */
+static struct io_uring_sqe *
+_mongo_uring_prep_socket_op (mongo_uring_ring *ring, mongo_uring *r,
+			     guint8 opcode, guint64 tag)
+{
+  struct io_uring_sqe *sqe = _mongo_uring_get_sqe (ring, tag);
+
+  sqe->opcode = opcode;
+  sqe->fd = r->fd;
+  return sqe;
+}
+
+/** @internal Link a timeout to the prepared operation.
+ *
+ * @param ring is the ring.
+ * @param op is the operation to time out.
+ * @param ts is where to store the timeout, it must stay valid until
+ * the operation is submitted.
+ * @param usec is the timeout in microseconds, zero for none.
+ * @param tag is the tag of the timeout.
+ *
+ * @returns The last entry of the operation: the timeout, or @a op if
+ * there is none.
+ */
+static struct io_uring_sqe *
+_mongo_uring_prep_timeout (mongo_uring_ring *ring, struct io_uring_sqe *op,
+			   struct __kernel_timespec *ts, gint64 usec,
+			   guint64 tag)
+{
+  struct io_uring_sqe *sqe;
+
+  if (usec <= 0)
+    return op;
+
+  ts->tv_sec = usec / G_USEC_PER_SEC;
+  ts->tv_nsec = (usec % G_USEC_PER_SEC) * 1000;
+
+  op->flags |= IOSQE_IO_LINK;
+  sqe = _mongo_uring_get_sqe (ring, tag);
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (guint64)(guintptr)ts;
+  sqe->len = 1;
+  return sqe;
+}
+
+/** @internal Submit the prepared entries, and wait for all of them
+ * to complete.
+ *
+ * @param ring is the ring.
+ * @param res is where to store the results, by tag: non-negative on
+ * success, a negated errno value otherwise. Entries that were not
+ * submitted are left at -ECANCELED.
+ *
+ * @returns Zero on success, a negated errno value if the ring
+ * failed. A failed ring is not used again, the connections of the
+ * thread fall back to plain system calls.
+ */
+static gint
+_mongo_uring_run (mongo_uring_ring *ring, gint res[MONGO_URING_TAGS])
+{
+  guint32 head, tail, pending = ring->n_prepared;
+  struct pollfd pfd;
+  gint i, e = 0;
+
+  for (i = 0; i < MONGO_URING_TAGS; i++)
+    res[i] = -ECANCELED;
+
+  __atomic_store_n (ring->sq_tail, *ring->sq_tail + ring->n_prepared,
+		    __ATOMIC_RELEASE);
+  ring->n_prepared = 0;
+
+  while (pending > 0)
+    {
+      tail = *ring->sq_tail - __atomic_load_n (ring->sq_head,
+					       __ATOMIC_ACQUIRE);
+      if (e == 0 &&
+	  _mongo_uring_sys_enter (ring->fd, tail, pending,
+				  IORING_ENTER_GETEVENTS) < 0 &&
+	  errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	{
+	  /* The entries the kernel did not take are dropped, but the
+	     ones it did may still use the memory of the caller, which
+	     must outlive them: wait for them without entering the ring
+	     again, and never use it after. */
+	  e = errno;
+	  ring->broken = TRUE;
+	  head = __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+	  pending -= *ring->sq_tail - head;
+	  __atomic_store_n (ring->sq_tail, head, __ATOMIC_RELEASE);
+	}
+
+      head = *ring->cq_head;
+      tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+      while (head != tail)
+	{
+	  struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+	  if (cqe->user_data < MONGO_URING_TAGS)
+	    res[cqe->user_data] = cqe->res;
+	  head++;
+	  pending--;
+	}
+      __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+
+      if (e != 0 && pending > 0)
+	{
+	  pfd.fd = ring->fd;
+	  pfd.events = POLLIN;
+	  poll (&pfd, 1, -1);
+	}
+    }
+
+  return -e;
+}
+
+/** @internal Turn the result of an operation into a system call
+ * style return value.
+ *
+ * An operation cancelled by its timeout fails with EAGAIN, like a
+ * socket operation timing out does.
+ */
+static gssize
+_mongo_uring_result (gint res)
+{
+  if (res >= 0)
+    return res;
+
+  errno = (res == -ECANCELED) ? EAGAIN : -res;
+  return -1;
+}
+
+gint
+_mongo_uring_connect (mongo_uring *r G_GNUC_UNUSED, gint fd,
+		      const struct sockaddr *addr, socklen_t addrlen,
+		      gint64 deadline)
+{
+  mongo_uring_ring *ring;
+  struct __kernel_timespec ts;
+  struct io_uring_sqe *sqe;
+  gint res[MONGO_URING_TAGS];
+  gint64 left = 0;
+  gint e;
+
+  if (deadline > 0)
+    {
+      left = deadline - g_get_monotonic_time ();
+      if (left <= 0)
+	{
+	  errno = ETIMEDOUT;
+	  return -1;
+	}
+    }
+
+  ring = _mongo_uring_ring_get ();
+  if (!ring)
+    return -1;
+
+  sqe = _mongo_uring_get_sqe (ring, MONGO_URING_TAG_OP);
+  sqe->opcode = IORING_OP_CONNECT;
+  sqe->fd = fd;
+  sqe->addr = (guint64)(guintptr)addr;
+  sqe->off = addrlen;
+  _mongo_uring_prep_timeout (ring, sqe, &ts, left, MONGO_URING_TAG_TIMEOUT);
+
+  e = _mongo_uring_run (ring, res);
+  if (e == 0)
+    e = res[MONGO_URING_TAG_OP];
+  if (e == -ECANCELED)
+    {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  if (e < 0)
+    {
+      errno = -e;
+      return -1;
+    }
+  return 0;
+}
+
+/** @internal Get the number of bytes in a message. */
+static gsize
+_mongo_uring_msg_size (const struct msghdr *msg)
+{
+  gsize size = 0, i;
+
+  for (i = 0; i < msg->msg_iovlen; i++)
+    size += msg->msg_iov[i].iov_len;
+  return size;
+}
+
+gssize
+_mongo_uring_sendmsg (mongo_uring *r, const struct msghdr *msg,
+		      gint timeout, gboolean reply)
+{
+  mongo_uring_ring *ring;
+  struct __kernel_timespec ts[2];
+  struct io_uring_sqe *sqe;
+  gint res[MONGO_URING_TAGS], e;
+  gsize size;
+  gboolean link;
+
+  /* A connection may be used on a thread that cannot set up a ring
+     of its own, the socket has the timeouts set, too. */
+  ring = _mongo_uring_ring_get ();
+  if (!ring)
+    return sendmsg (r->fd, msg, MSG_NOSIGNAL);
+
+  size = _mongo_uring_msg_size (msg);
+  link = reply && !r->deferred && r->buffer_pos == r->buffer_len &&
+    size <= MONGO_URING_BUFFER_SIZE;
+
+  sqe = _mongo_uring_prep_socket_op (ring, r, IORING_OP_SENDMSG,
+				     MONGO_URING_TAG_OP);
+  sqe->addr = (guint64)(guintptr)msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL | ((link) ? MSG_WAITALL : 0);
+  sqe = _mongo_uring_prep_timeout (ring, sqe, &ts[0],
+				   (gint64)timeout * 1000,
+				   MONGO_URING_TAG_TIMEOUT);
+
+  /* The reply is received in the same go. With MSG_WAITALL, a short
+     send breaks the link, instead of leaving the receive waiting for
+     the reply to a request the server did not get in full. */
+  if (link)
+    {
+      sqe->flags |= IOSQE_IO_LINK;
+      sqe = _mongo_uring_prep_socket_op (ring, r, IORING_OP_RECV,
+					 MONGO_URING_TAG_RECV);
+      sqe->addr = (guint64)(guintptr)r->buffer;
+      sqe->len = MONGO_URING_BUFFER_SIZE;
+      sqe->msg_flags = MSG_NOSIGNAL;
+      _mongo_uring_prep_timeout (ring, sqe, &ts[1], (gint64)timeout * 1000,
+				 MONGO_URING_TAG_RECV_TIMEOUT);
+    }
+
+  e = _mongo_uring_run (ring, res);
+  if (e < 0)
+    return _mongo_uring_result (e);
+
+  if (link && res[MONGO_URING_TAG_OP] == (gint)size)
+    {
+      e = res[MONGO_URING_TAG_RECV];
+      if (e > 0)
+	{
+	  r->buffer_pos = 0;
+	  r->buffer_len = e;
+	}
+      /* Unless the receive was cancelled because the send broke the
+	 link, the next receive reports what happened to it. */
+      else if (e != -ECANCELED ||
+	       res[MONGO_URING_TAG_RECV_TIMEOUT] == -ETIME)
+	{
+	  r->deferred = TRUE;
+	  r->deferred_res = e;
+	}
+    }
+
+  return _mongo_uring_result (res[MONGO_URING_TAG_OP]);
+}
+
+gssize
+_mongo_uring_recv (mongo_uring *r, void *buf, gsize size, gint timeout)
+{
+  mongo_uring_ring *ring;
+  struct __kernel_timespec ts;
+  struct io_uring_sqe *sqe;
+  gint res[MONGO_URING_TAGS], e;
+
+  if (r->buffer_pos == r->buffer_len)
+    {
+      if (r->deferred)
+	{
+	  r->deferred = FALSE;
+	  return _mongo_uring_result (r->deferred_res);
+	}
+
+      ring = _mongo_uring_ring_get ();
+      if (!ring)
+	return recv (r->fd, buf, size, MSG_NOSIGNAL);
+
+      if (size >= MONGO_URING_BUFFER_SIZE)
+	{
+	  /* Large reads go straight to the destination. */
+	  sqe = _mongo_uring_prep_socket_op (ring, r, IORING_OP_RECV,
+					     MONGO_URING_TAG_OP);
+	  sqe->addr = (guint64)(guintptr)buf;
+	  sqe->len = size;
+	  sqe->msg_flags = MSG_NOSIGNAL;
+	  _mongo_uring_prep_timeout (ring, sqe, &ts, (gint64)timeout * 1000,
+				     MONGO_URING_TAG_TIMEOUT);
+
+	  e = _mongo_uring_run (ring, res);
+	  return _mongo_uring_result ((e < 0) ? e : res[MONGO_URING_TAG_OP]);
+	}
+
+      sqe = _mongo_uring_prep_socket_op (ring, r, IORING_OP_RECV,
+					 MONGO_URING_TAG_OP);
+      sqe->addr = (guint64)(guintptr)r->buffer;
+      sqe->len = MONGO_URING_BUFFER_SIZE;
+      sqe->msg_flags = MSG_NOSIGNAL;
+      _mongo_uring_prep_timeout (ring, sqe, &ts, (gint64)timeout * 1000,
+				 MONGO_URING_TAG_TIMEOUT);
+
+      e = _mongo_uring_run (ring, res);
+      if (e == 0)
+	e = res[MONGO_URING_TAG_OP];
+      if (e <= 0)
+	return _mongo_uring_result (e);
+
+      r->buffer_pos = 0;
+      r->buffer_len = e;
+    }
+
+  size = MIN (size, r->buffer_len - r->buffer_pos);
+  memcpy (buf, r->buffer + r->buffer_pos, size);
+  r->buffer_pos += size;
+  return size;
+}
+
+#else
+
+mongo_uring *
+_mongo_uring_new (void)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+void
+_mongo_uring_attach (mongo_uring *r G_GNUC_UNUSED, gint fd G_GNUC_UNUSED)
+{
+}
+
+void
+_mongo_uring_free (mongo_uring *r G_GNUC_UNUSED)
+{
+}
+
+gint
+_mongo_uring_connect (mongo_uring *r G_GNUC_UNUSED, gint fd G_GNUC_UNUSED,
+		      const struct sockaddr *addr G_GNUC_UNUSED,
+		      socklen_t addrlen G_GNUC_UNUSED,
+		      gint64 deadline G_GNUC_UNUSED)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+gssize
+_mongo_uring_sendmsg (mongo_uring *r G_GNUC_UNUSED,
+		      const struct msghdr *msg G_GNUC_UNUSED,
+		      gint timeout G_GNUC_UNUSED, gboolean reply G_GNUC_UNUSED)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+gssize
+_mongo_uring_recv (mongo_uring *r G_GNUC_UNUSED, void *buf G_GNUC_UNUSED,
+		   gsize size G_GNUC_UNUSED, gint timeout G_GNUC_UNUSED)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
@@ -16,6 +16,9 @@
 
 #include <glib.h>
 
+#include "mongo-utils.h"
+#include "libmongo-private.h"
+
 #include <sys/types.h>
 #include <string.h>
 #include <stdlib.h>
@@ -23,13 +26,18 @@
 #include <unistd.h>
 #include <errno.h>
 
-static guint32 machine_id = 0;
-static gint16 pid = 0;
+/** @internal The machine ID and PID parts of ObjectIDs, published by
+ * setting oid_initialized. */
+static guint8 oid_machine_pid[5];
+static gint oid_initialized = 0;
+static gint oid_seq = 0;
 
 void
 mongo_util_oid_init (gint32 mid)
 {
   pid_t p = getpid ();
+  guint32 machine_id;
+  gint16 pid;
 
   if (mid == 0)
     {
@@ -45,34 +53,65 @@ mongo_util_oid_init (gint32 mid)
    */
   if (sizeof (pid_t) > 2)
     {
-      machine_id ^= pid >> 16;
+      machine_id ^= p >> 16;
     }
   pid = (gint16)p;
+
+  /* Machine ID, then PID; byte order doesn't matter for either. */
+  memcpy (oid_machine_pid, &machine_id, 3);
+  memcpy (oid_machine_pid + 3, &pid, 2);
+
+  g_atomic_int_set (&oid_seq, rand ());
+  /* Readers check the flag first, so the parts above are complete by
+     the time they see it set. */
+  g_atomic_int_set (&oid_initialized, 1);
+}
+
+/** @internal Write the static parts of ObjectIDs into a buffer.
+ *
+ * @param prefix is where the first nine bytes of the ObjectIDs, the
+ * timestamp, the machine ID and the PID are stored.
+ * @param ts is the timestamp to use.
+ */
+static inline void
+_mongo_util_oid_prefix (guint8 *prefix, gint32 ts)
+{
+  gint32 t = GINT32_TO_BE (ts);
+
+  /* First four bytes: the time, BE byte order */
+  memcpy (prefix, &t, 4);
+  /* Machine ID, 3 bytes, and PID, 2 bytes */
+  memcpy (prefix + 4, oid_machine_pid, 5);
+}
+
+/** @internal Write an ObjectID into a buffer.
+ *
+ * @param oid is the buffer to write to, 12 bytes long.
+ * @param prefix is the static part, made by _mongo_util_oid_prefix().
+ * @param seq is the sequence number, of which the last 3 bytes are
+ * used, in BE byte order.
+ */
+static inline void
+_mongo_util_oid_write (guint8 *oid, const guint8 *prefix, guint32 seq)
+{
+  memcpy (oid, prefix, 9);
+  oid[9] = (seq >> 16) & 0xff;
+  oid[10] = (seq >> 8) & 0xff;
+  oid[11] = seq & 0xff;
 }
 
 guint8 *
 mongo_util_oid_new_with_time (gint32 ts, gint32 seq)
 {
   guint8 *oid;
-  time_t t = GINT32_TO_BE (ts);
-  gint32 tmp = GINT32_TO_BE (seq);
+  guint8 prefix[9];
 
-  if (machine_id == 0 || pid == 0)
+  if (!g_atomic_int_get (&oid_initialized))
     return NULL;
 
   oid = (guint8 *)g_new0 (guint8, 12);
-
-  /* Sequence number, last 3 bytes
-   * For simplicity's sake, we put this in first, and overwrite the
-   * first byte later.
-   */
-  memcpy (oid + 4 + 2 + 2, &tmp, 4);
-  /* First four bytes: the time, BE byte order */
-  memcpy (oid, &t, 4);
-  /* Machine ID, byte order doesn't matter, 3 bytes */
-  memcpy (oid + 4, &machine_id, 3);
-  /* PID, byte order doesn't matter, 2 bytes */
-  memcpy (oid + 4 + 3, &pid, 2);
+  _mongo_util_oid_prefix (prefix, ts);
+  _mongo_util_oid_write (oid, prefix, seq);
 
   return oid;
 }
@@ -83,6 +122,41 @@ mongo_util_oid_new (gint32 seq)
   return mongo_util_oid_new_with_time (time (NULL), seq);
 }
 
+gboolean
+mongo_util_oid_fill (guint8 *buf, gint32 n)
+{
+  guint8 prefix[9];
+  guint32 seq;
+  gint32 i;
+
+  if (!buf || n <= 0)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (!g_atomic_int_get (&oid_initialized))
+    {
+      errno = EAGAIN;
+      return FALSE;
+    }
+
+  /* Only the low 3 bytes of the sequence are used, so it may as well
+     wrap around. */
+  seq = (guint32)g_atomic_int_add (&oid_seq, n);
+  _mongo_util_oid_prefix (prefix, time (NULL));
+
+  for (i = 0; i < n; i++)
+    _mongo_util_oid_write (buf + (gsize)i * 12, prefix, seq + (guint32)i);
+
+  return TRUE;
+}
+
+gboolean
+mongo_util_oid_generate (guint8 *oid)
+{
+  return mongo_util_oid_fill (oid, 1);
+}
+
 gboolean
 mongo_util_parse_addr (const gchar *addr, gchar **host, gint *port)
 {
@@ -99,6 +173,13 @@ mongo_util_parse_addr (const gchar *addr, gchar **host, gint *port)
       return FALSE;
     }
 
+  /* Unix socket paths have no port, and may contain colons. */
+  if (addr[0] == '/')
+    {
+      *host = g_strdup (addr);
+      return TRUE;
+    }
+
   /* Split up to host:port */
   port_s = g_strrstr (addr, ":");
   if (!port_s)
@@ -145,3 +226,246 @@ mongo_util_parse_addr (const gchar *addr, gchar **host, gint *port)
     }
   return TRUE;
 }
+
+static gpointer
+_mongo_default_malloc (gsize n_bytes, gpointer user_data G_GNUC_UNUSED)
+{
+  return g_malloc (n_bytes);
+}
+
+static gpointer
+_mongo_default_realloc (gpointer mem, gsize n_bytes,
+			gpointer user_data G_GNUC_UNUSED)
+{
+  return g_realloc (mem, n_bytes);
+}
+
+static void
+_mongo_default_free (gpointer mem, gpointer user_data G_GNUC_UNUSED)
+{
+  g_free (mem);
+}
+
+/** @internal The allocator in use. */
+static mongo_allocator _mongo_allocator =
+  {
+    _mongo_default_malloc,
+    _mongo_default_realloc,
+    _mongo_default_free,
+    NULL
+  };
+
+gboolean
+mongo_util_set_allocator (const mongo_allocator *allocator)
+{
+  if (!allocator)
+    {
+      _mongo_allocator.malloc = _mongo_default_malloc;
+      _mongo_allocator.realloc = _mongo_default_realloc;
+      _mongo_allocator.free = _mongo_default_free;
+      _mongo_allocator.user_data = NULL;
+      return TRUE;
+    }
+  if (!allocator->malloc || !allocator->realloc || !allocator->free)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  _mongo_allocator = *allocator;
+  return TRUE;
+}
+
+gboolean
+mongo_util_get_allocator (mongo_allocator *allocator)
+{
+  if (!allocator)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  *allocator = _mongo_allocator;
+  return TRUE;
+}
+
+gpointer
+_mongo_malloc (gsize n_bytes)
+{
+  gpointer mem;
+
+  if (n_bytes == 0)
+    return NULL;
+
+  mem = _mongo_allocator.malloc (n_bytes, _mongo_allocator.user_data);
+  if (!mem)
+    g_error ("%s: failed to allocate %" G_GSIZE_FORMAT " bytes",
+	     G_STRLOC, n_bytes);
+  return mem;
+}
+
+gpointer
+_mongo_malloc0 (gsize n_bytes)
+{
+  gpointer mem = _mongo_malloc (n_bytes);
+
+  if (mem)
+    memset (mem, 0, n_bytes);
+  return mem;
+}
+
+gpointer
+_mongo_realloc (gpointer mem, gsize n_bytes)
+{
+  if (n_bytes == 0)
+    {
+      _mongo_free (mem);
+      return NULL;
+    }
+
+  mem = _mongo_allocator.realloc (mem, n_bytes, _mongo_allocator.user_data);
+  if (!mem)
+    g_error ("%s: failed to allocate %" G_GSIZE_FORMAT " bytes",
+	     G_STRLOC, n_bytes);
+  return mem;
+}
+
+void
+_mongo_free (gpointer mem)
+{
+  if (mem)
+    _mongo_allocator.free (mem, _mongo_allocator.user_data);
+}
+
+/** @internal Number of values counted exactly. */
+#define HISTOGRAM_LINEAR 32
+/** @internal Number of sub-buckets per power of two. */
+#define HISTOGRAM_SUB_BITS 4
+/** @internal The magnitude of the smallest non-linear bucket. */
+#define HISTOGRAM_MIN_MAGNITUDE 5
+/** @internal The magnitude beyond which values are clamped. */
+#define HISTOGRAM_MAX_MAGNITUDE 40
+
+static inline gint
+_histogram_index (guint64 v)
+{
+  gint k;
+
+  if (v < HISTOGRAM_LINEAR)
+    return (gint)v;
+  if (v >> HISTOGRAM_MAX_MAGNITUDE)
+    return MONGO_HISTOGRAM_BUCKETS - 1;
+
+#ifdef __GNUC__
+  k = 63 - __builtin_clzll (v);
+#else
+  for (k = HISTOGRAM_MAX_MAGNITUDE - 1; !(v >> k); k--)
+    ;
+#endif
+  return HISTOGRAM_LINEAR +
+    ((k - HISTOGRAM_MIN_MAGNITUDE) << HISTOGRAM_SUB_BITS) +
+    (gint)((v >> (k - HISTOGRAM_SUB_BITS)) &
+	   ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+static inline guint64
+_histogram_bucket_max (gint idx)
+{
+  gint k, sub;
+
+  if (idx < HISTOGRAM_LINEAR)
+    return idx;
+
+  idx -= HISTOGRAM_LINEAR;
+  k = HISTOGRAM_MIN_MAGNITUDE + (idx >> HISTOGRAM_SUB_BITS);
+  sub = idx & ((1 << HISTOGRAM_SUB_BITS) - 1);
+
+  return ((guint64)1 << k) +
+    ((guint64)(sub + 1) << (k - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+gboolean
+mongo_histogram_record (mongo_histogram *hist, gint64 value)
+{
+  if (!hist)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (value < 0)
+    {
+      errno = ERANGE;
+      return FALSE;
+    }
+
+  if (hist->count == 0 || (guint64)value < hist->min)
+    hist->min = value;
+  if ((guint64)value > hist->max)
+    hist->max = value;
+  hist->count++;
+  hist->sum += value;
+  hist->buckets[_histogram_index (value)]++;
+
+  return TRUE;
+}
+
+gint64
+mongo_histogram_percentile (const mongo_histogram *hist,
+			    gdouble percentile)
+{
+  guint64 target, seen = 0;
+  gint i;
+
+  if (!hist)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if (percentile < 0 || percentile > 100)
+    {
+      errno = ERANGE;
+      return -1;
+    }
+  if (hist->count == 0)
+    {
+      errno = ENOENT;
+      return -1;
+    }
+
+  target = (guint64)(percentile / 100.0 * hist->count + 0.5);
+  if (target < 1)
+    target = 1;
+
+  for (i = 0; i < MONGO_HISTOGRAM_BUCKETS; i++)
+    {
+      seen += hist->buckets[i];
+      if (seen >= target)
+	return (gint64)MIN (_histogram_bucket_max (i), hist->max);
+    }
+  return (gint64)hist->max;
+}
+
+gboolean
+mongo_histogram_merge (mongo_histogram *dest, const mongo_histogram *src)
+{
+  gint i;
+
+  if (!dest || !src)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (src->count == 0)
+    return TRUE;
+
+  if (dest->count == 0 || src->min < dest->min)
+    dest->min = src->min;
+  if (src->max > dest->max)
+    dest->max = src->max;
+  dest->count += src->count;
+  dest->sum += src->sum;
+  for (i = 0; i < MONGO_HISTOGRAM_BUCKETS; i++)
+    dest->buckets[i] += src->buckets[i];
+
+  return TRUE;
+}
@@ -39,6 +39,10 @@ extern "C" {
  * This function needs to be called once, before any OIDs are
  * generated. It is also a good idea to call it whenever the calling
  * program's PID might change.
+ *
+ * @note Once it returned, ObjectIDs can be generated from any
+ * thread. Calling it again, after a fork for example, is not thread
+ * safe: it must not be done while other threads generate ObjectIDs.
  */
 void mongo_util_oid_init (gint32 machine_id);
 
@@ -82,11 +86,44 @@ guint8 *mongo_util_oid_new (gint32 seq);
  */
 guint8 *mongo_util_oid_new_with_time (gint32 time, gint32 seq);
 
+/** Generate a new ObjectID into caller supplied storage.
+ *
+ * Unlike mongo_util_oid_new(), the sequence number comes from a
+ * counter maintained by the library, which is safe to use from
+ * multiple threads at the same time, without any locking on the
+ * caller's side.
+ *
+ * @param oid is where the ObjectID is stored, 12 bytes long.
+ *
+ * @returns TRUE on success, FALSE otherwise. Fails with EAGAIN if
+ * mongo_util_oid_init() was not called yet.
+ */
+gboolean mongo_util_oid_generate (guint8 *oid);
+
+/** Generate a number of ObjectIDs into caller supplied storage.
+ *
+ * The ObjectIDs share a single timestamp, and take consecutive
+ * sequence numbers from the library's counter, reserved with a
+ * single atomic operation. Safe to use from multiple threads.
+ *
+ * @param buf is where the ObjectIDs are stored, one after the other,
+ * @a n times 12 bytes long.
+ * @param n is the number of ObjectIDs to generate.
+ *
+ * @returns TRUE on success, FALSE otherwise. Fails with EAGAIN if
+ * mongo_util_oid_init() was not called yet.
+ */
+gboolean mongo_util_oid_fill (guint8 *buf, gint32 n);
+
 /** Parse a HOST:IP pair.
  *
  * Given a HOST:IP pair, split it up into a host and a port. IPv6
  * addresses supported, the function cuts at the last ":".
  *
+ * Addresses starting with "/" are Unix domain socket paths: the whole
+ * address is the host, and the port is left alone, like when no port
+ * is specified.
+ *
  * @param addr is the address to split.
  * @param host is a pointer to a string where the host part will be
  * stored.
@@ -100,6 +137,106 @@ guint8 *mongo_util_oid_new_with_time (gint32 time, gint32 seq);
 gboolean mongo_util_parse_addr (const gchar *addr, gchar **host,
 				gint *port);
 
+/** Memory allocator.
+ *
+ * A set of functions the library uses to allocate BSON buffers, wire
+ * packets and cursors with, instead of the GLib allocator. Every
+ * function receives the @a user_data of the allocator as its last
+ * argument.
+ *
+ * Like g_malloc(), the functions must not fail: if they return NULL
+ * for a non-zero size, the library aborts.
+ */
+typedef struct
+{
+  /** Allocate @a n_bytes of memory. */
+  gpointer (*malloc) (gsize n_bytes, gpointer user_data);
+  /** Resize @a mem to @a n_bytes, @a mem may be NULL. */
+  gpointer (*realloc) (gpointer mem, gsize n_bytes, gpointer user_data);
+  /** Free @a mem, which is never NULL. */
+  void (*free) (gpointer mem, gpointer user_data);
+  /** Arbitrary pointer passed to all the functions. */
+  gpointer user_data;
+} mongo_allocator;
+
+/** Set the memory allocator of the library.
+ *
+ * @param allocator is the allocator to use, or NULL to restore the
+ * default, GLib based one. The structure is copied.
+ *
+ * @note The allocator must be set before any BSON object, packet or
+ * cursor is created, and must not be changed while any of them are
+ * alive, as memory allocated by one allocator will be freed by the
+ * other. This includes packets kept in the packet cache, see
+ * mongo_wire_packet_cache_flush().
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_util_set_allocator (const mongo_allocator *allocator);
+
+/** Get the memory allocator of the library.
+ *
+ * @param allocator is where the current allocator will be stored.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_util_get_allocator (mongo_allocator *allocator);
+
+/** Number of buckets in a #mongo_histogram. */
+#define MONGO_HISTOGRAM_BUCKETS 592
+
+/** Latency histogram.
+ *
+ * A log-linear histogram in the spirit of HdrHistogram: values below
+ * 32 are counted exactly, larger values are grouped into buckets that
+ * split each power of two into 16, so that the error of any
+ * percentile is below 6.25%. Values up to 2^40 can be recorded,
+ * larger ones are counted in the last bucket.
+ *
+ * The histogram is a plain structure, a zero-filled one is empty, and
+ * it can be copied around freely.
+ */
+typedef struct
+{
+  guint64 count; /**< Number of values recorded. */
+  guint64 sum; /**< Sum of the recorded values. */
+  guint64 min; /**< The smallest value recorded. */
+  guint64 max; /**< The largest value recorded. */
+  guint64 buckets[MONGO_HISTOGRAM_BUCKETS]; /**< The buckets. */
+} mongo_histogram;
+
+/** Record a value in a histogram.
+ *
+ * @param hist is the histogram to record into.
+ * @param value is the value to record.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_histogram_record (mongo_histogram *hist, gint64 value);
+
+/** Get a percentile from a histogram.
+ *
+ * @param hist is the histogram to query.
+ * @param percentile is the percentile to get, between 0 and 100.
+ *
+ * @returns The highest value that is equivalent to the requested
+ * percentile (that is, the upper bound of the bucket it falls into,
+ * capped by the largest recorded value), or -1 on error. If the
+ * histogram is empty, errno is set to ENOENT.
+ */
+gint64 mongo_histogram_percentile (const mongo_histogram *hist,
+				   gdouble percentile);
+
+/** Add the values of one histogram to another.
+ *
+ * @param dest is the histogram to add to.
+ * @param src is the histogram to add.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_histogram_merge (mongo_histogram *dest,
+				const mongo_histogram *src);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -21,6 +21,7 @@
 
 #include "bson.h"
 #include "mongo-wire.h"
+#include "libmongo-private.h"
 
 /** @file src/mongo-wire.c
  * Implementation of the MongoDB Wire Protocol.
@@ -40,6 +41,15 @@ struct _mongo_packet
   mongo_packet_header header; /**< The packet header. */
   guint8 *data; /**< The actual data of the packet. */
   gint32 data_size; /**< Size of the data payload. */
+  gint32 data_alloc; /**< Allocated size of the data buffer. */
+
+  mongo_wire_segment *segments; /**< Referenced payload, sent after
+				   the data. */
+  gint32 n_segments; /**< Number of referenced segments. */
+
+  gint32 *offsets; /**< Offsets of the documents of a reply, relative
+		      to its data, or NULL until first needed. */
+  gint32 n_offsets; /**< Number of valid documents in the reply. */
 };
 
 /** @internal Mongo command opcodes. */
@@ -56,10 +66,273 @@ typedef enum
     OP_KILL_CURSORS = 2007 /**< Message is a kill cursors command. */
   } mongo_wire_opcode;
 
+/** @internal Smallest cached buffer size, as a power of two. */
+#define MONGO_WIRE_CACHE_MIN_SHIFT 6
+/** @internal Number of buffer size classes, 64 bytes to 64 KiB. */
+#define MONGO_WIRE_CACHE_CLASSES 11
+/** @internal Maximum number of items cached per size class. */
+#define MONGO_WIRE_CACHE_DEPTH 16
+/** @internal Largest buffer kept for reuse above the size classes.
+ * Larger ones are rare enough to be worth mapping afresh. */
+#define MONGO_WIRE_CACHE_LARGE_MAX (4 * 1024 * 1024)
+/** @internal Time after which an unused large buffer is released, in
+ * microseconds. */
+#define MONGO_WIRE_CACHE_LARGE_IDLE (5 * G_USEC_PER_SEC)
+
+/** @internal Per-thread cache of packets and payload buffers.
+ *
+ * Free items are kept on singly linked lists, the link being stored
+ * in the first bytes of the item itself: in the data pointer for
+ * packets, and at the start of the buffer for payloads.
+ */
+typedef struct
+{
+  mongo_packet *packets; /**< Free packet objects. */
+  guint n_packets; /**< Number of free packet objects. */
+
+  gpointer buffers[MONGO_WIRE_CACHE_CLASSES]; /**< Free buffers, by
+						 size class. */
+  guint n_buffers[MONGO_WIRE_CACHE_CLASSES]; /**< Number of free
+						buffers, by size
+						class. */
+
+  guint8 *large; /**< A free buffer larger than the size classes, or
+		    NULL. */
+  gint32 large_alloc; /**< Allocated size of the large buffer. */
+  gint64 large_since; /**< Monotonic time the large buffer was last
+			 released. */
+} mongo_wire_cache;
+
+static void _mongo_wire_cache_free (gpointer data);
+
+/** @internal The cache of the current thread. */
+static GPrivate _mongo_wire_cache_key =
+  G_PRIVATE_INIT (_mongo_wire_cache_free);
+
+/** @internal Get the cache of the current thread, creating it if
+ * needed. */
+static inline mongo_wire_cache *
+_mongo_wire_cache_get (void)
+{
+  mongo_wire_cache *cache = g_private_get (&_mongo_wire_cache_key);
+
+  if (G_UNLIKELY (!cache))
+    {
+      cache = g_new0 (mongo_wire_cache, 1);
+      g_private_set (&_mongo_wire_cache_key, cache);
+    }
+  return cache;
+}
+
+/** @internal Release everything held by a cache. */
+static void
+_mongo_wire_cache_clear (mongo_wire_cache *cache)
+{
+  gint i;
+
+  while (cache->packets)
+    {
+      mongo_packet *p = cache->packets;
+
+      cache->packets = (mongo_packet *)p->data;
+      _mongo_free (p);
+    }
+  cache->n_packets = 0;
+
+  for (i = 0; i < MONGO_WIRE_CACHE_CLASSES; i++)
+    {
+      while (cache->buffers[i])
+	{
+	  gpointer b = cache->buffers[i];
+
+	  cache->buffers[i] = *(gpointer *)b;
+	  _mongo_free (b);
+	}
+      cache->n_buffers[i] = 0;
+    }
+
+  _mongo_free (cache->large);
+  cache->large = NULL;
+  cache->large_alloc = 0;
+}
+
+static void
+_mongo_wire_cache_free (gpointer data)
+{
+  _mongo_wire_cache_clear ((mongo_wire_cache *)data);
+  g_free (data);
+}
+
+void
+mongo_wire_packet_cache_flush (void)
+{
+  mongo_wire_cache *cache = g_private_get (&_mongo_wire_cache_key);
+
+  if (cache)
+    _mongo_wire_cache_clear (cache);
+}
+
+/** @internal Find the size class of a buffer size.
+ *
+ * @returns The size class, or -1 if buffers of this size are not
+ * cached.
+ */
+static inline gint
+_mongo_wire_cache_class (gint32 size)
+{
+  gint c = 0;
+
+  if (size > (1 << (MONGO_WIRE_CACHE_MIN_SHIFT +
+		    MONGO_WIRE_CACHE_CLASSES - 1)))
+    return -1;
+
+  while ((1 << (MONGO_WIRE_CACHE_MIN_SHIFT + c)) < size)
+    c++;
+  return c;
+}
+
+/** @internal Get a zero-filled packet object, from the cache if
+ * possible. */
+static mongo_packet *
+_mongo_wire_packet_alloc (void)
+{
+  mongo_wire_cache *cache = _mongo_wire_cache_get ();
+  mongo_packet *p = cache->packets;
+
+  if (!p)
+    return _mongo_new0 (mongo_packet, 1);
+
+  cache->packets = (mongo_packet *)p->data;
+  cache->n_packets--;
+  memset (p, 0, sizeof (mongo_packet));
+  return p;
+}
+
+/** @internal Return a payload buffer to the cache.
+ *
+ * Buffers with an allocated size of zero are borrowed from the
+ * caller, and are left alone. Of the buffers larger than the size
+ * classes, the largest one is kept, so that batches of large replies
+ * do not need to map fresh memory for each packet. It is released
+ * once the thread has gone on with smaller packets for a while, see
+ * _mongo_wire_cache_expire(). Other buffers that
+ * do not belong to a size class, or whose class is full, are freed.
+ *
+ * @param cache is the cache of the current thread.
+ * @param data is the buffer to release.
+ * @param alloc is the allocated size of the buffer.
+ */
+static void
+_mongo_wire_buffer_release (mongo_wire_cache *cache, guint8 *data,
+			    gint32 alloc)
+{
+  gint c;
+
+  if (alloc == 0)
+    return;
+
+  c = _mongo_wire_cache_class (alloc);
+  if (c < 0 && alloc <= MONGO_WIRE_CACHE_LARGE_MAX)
+    {
+      if (cache->large_alloc >= alloc)
+	{
+	  _mongo_free (data);
+	  return;
+	}
+      _mongo_free (cache->large);
+      cache->large = data;
+      cache->large_alloc = alloc;
+      cache->large_since = g_get_monotonic_time ();
+      return;
+    }
+
+  if (c < 0 || (1 << (MONGO_WIRE_CACHE_MIN_SHIFT + c)) != alloc ||
+      cache->n_buffers[c] >= MONGO_WIRE_CACHE_DEPTH)
+    {
+      _mongo_free (data);
+      return;
+    }
+
+  *(gpointer *)data = cache->buffers[c];
+  cache->buffers[c] = data;
+  cache->n_buffers[c]++;
+}
+
+/** @internal Release the large buffer of a cache, if it has not been
+ * used for MONGO_WIRE_CACHE_LARGE_IDLE. */
+static inline void
+_mongo_wire_cache_expire (mongo_wire_cache *cache)
+{
+  if (cache->large &&
+      g_get_monotonic_time () - cache->large_since >
+      MONGO_WIRE_CACHE_LARGE_IDLE)
+    {
+      _mongo_free (cache->large);
+      cache->large = NULL;
+      cache->large_alloc = 0;
+    }
+}
+
+/** @internal Allocate the data buffer of a packet.
+ *
+ * Reuses the existing buffer of the packet if it is large enough,
+ * otherwise releases it, and takes one from the cache, or allocates a
+ * new one, rounded up to its size class. A borrowed buffer is never
+ * reused, as it must not be written to.
+ *
+ * @param p is the packet to allocate a buffer for.
+ * @param size is the required size.
+ */
+static void
+_mongo_wire_packet_alloc_data (mongo_packet *p, gint32 size)
+{
+  mongo_wire_cache *cache;
+  gint c;
+
+  if (p->data && p->data_alloc >= size)
+    return;
+
+  cache = _mongo_wire_cache_get ();
+  if (p->data)
+    {
+      _mongo_wire_buffer_release (cache, p->data, p->data_alloc);
+      p->data = NULL;
+      p->data_alloc = 0;
+    }
+
+  c = _mongo_wire_cache_class (size);
+  if (c >= 0)
+    _mongo_wire_cache_expire (cache);
+  if (c < 0 && cache->large && cache->large_alloc >= size)
+    {
+      p->data = cache->large;
+      p->data_alloc = cache->large_alloc;
+      cache->large = NULL;
+      cache->large_alloc = 0;
+      return;
+    }
+  if (c < 0)
+    {
+      p->data = (guint8 *)_mongo_malloc (size);
+      p->data_alloc = size;
+      return;
+    }
+
+  p->data_alloc = 1 << (MONGO_WIRE_CACHE_MIN_SHIFT + c);
+  if (cache->buffers[c])
+    {
+      p->data = (guint8 *)cache->buffers[c];
+      cache->buffers[c] = *(gpointer *)p->data;
+      cache->n_buffers[c]--;
+    }
+  else
+    p->data = (guint8 *)_mongo_malloc (p->data_alloc);
+}
+
 mongo_packet *
 mongo_wire_packet_new (void)
 {
-  mongo_packet *p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  mongo_packet *p = _mongo_wire_packet_alloc ();
 
   p->header.length = GINT32_TO_LE (sizeof (mongo_packet_header));
   return p;
@@ -146,6 +419,46 @@ mongo_wire_packet_set_header_raw (mongo_packet *p,
   return TRUE;
 }
 
+gboolean
+mongo_wire_packet_flatten (mongo_packet *p)
+{
+  guint8 *old;
+  gint32 old_alloc, size, i;
+
+  if (!p || !p->data)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+  if (p->n_segments == 0)
+    return TRUE;
+
+  old = p->data;
+  old_alloc = p->data_alloc;
+  size = p->data_size;
+  for (i = 0; i < p->n_segments; i++)
+    size += p->segments[i].size;
+
+  p->data = NULL;
+  p->data_alloc = 0;
+  _mongo_wire_packet_alloc_data (p, size);
+
+  memcpy (p->data, old, p->data_size);
+  for (i = 0; i < p->n_segments; i++)
+    {
+      memcpy (p->data + p->data_size, p->segments[i].data,
+	      p->segments[i].size);
+      p->data_size += p->segments[i].size;
+    }
+
+  _mongo_wire_buffer_release (_mongo_wire_cache_get (), old, old_alloc);
+  _mongo_free (p->segments);
+  p->segments = NULL;
+  p->n_segments = 0;
+
+  return TRUE;
+}
+
 gint32
 mongo_wire_packet_get_data (const mongo_packet *p, const guint8 **data)
 {
@@ -160,10 +473,33 @@ mongo_wire_packet_get_data (const mongo_packet *p, const guint8 **data)
       return -1;
     }
 
+  if (p->n_segments > 0)
+    {
+      errno = ENOTSUP;
+      return -1;
+    }
+
   *data = (const guint8 *)p->data;
   return p->data_size;
 }
 
+gint32
+mongo_wire_packet_get_segments (const mongo_packet *p,
+				const guint8 **data, gint32 *size,
+				const mongo_wire_segment **segments)
+{
+  if (!p || !data || !size || !segments || !p->data)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  *data = p->data;
+  *size = p->data_size;
+  *segments = p->segments;
+  return p->n_segments;
+}
+
 gboolean
 mongo_wire_packet_set_data (mongo_packet *p, const guint8 *data, gint32 size)
 {
@@ -173,11 +509,16 @@ mongo_wire_packet_set_data (mongo_packet *p, const guint8 *data, gint32 size)
       return FALSE;
     }
 
-  if (p->data)
-    g_free (p->data);
-  p->data = g_malloc (size);
+  _mongo_wire_packet_alloc_data (p, size);
   memcpy (p->data, data, size);
 
+  _mongo_free (p->segments);
+  p->segments = NULL;
+  p->n_segments = 0;
+  _mongo_free (p->offsets);
+  p->offsets = NULL;
+  p->n_offsets = 0;
+
   p->data_size = size;
   p->header.length =
     GINT32_TO_LE (p->data_size + sizeof (mongo_packet_header));
@@ -185,18 +526,66 @@ mongo_wire_packet_set_data (mongo_packet *p, const guint8 *data, gint32 size)
   return TRUE;
 }
 
+guint8 *
+_mongo_wire_packet_prepare_data (mongo_packet *p, gint32 size,
+				 guint8 *buffer, gint32 buffer_size)
+{
+  if (!p || size <= 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (buffer && buffer_size >= size)
+    {
+      _mongo_wire_buffer_release (_mongo_wire_cache_get (), p->data,
+				  p->data_alloc);
+      p->data = buffer;
+      p->data_alloc = 0;
+    }
+  else
+    _mongo_wire_packet_alloc_data (p, size);
+
+  _mongo_free (p->segments);
+  p->segments = NULL;
+  p->n_segments = 0;
+  _mongo_free (p->offsets);
+  p->offsets = NULL;
+  p->n_offsets = 0;
+
+  p->data_size = size;
+  p->header.length =
+    GINT32_TO_LE (p->data_size + sizeof (mongo_packet_header));
+
+  return p->data;
+}
+
 void
 mongo_wire_packet_free (mongo_packet *p)
 {
+  mongo_wire_cache *cache;
+
   if (!p)
     {
       errno = EINVAL;
       return;
     }
 
+  cache = _mongo_wire_cache_get ();
+
   if (p->data)
-    g_free (p->data);
-  g_free (p);
+    _mongo_wire_buffer_release (cache, p->data, p->data_alloc);
+  _mongo_free (p->segments);
+  _mongo_free (p->offsets);
+
+  if (cache->n_packets < MONGO_WIRE_CACHE_DEPTH)
+    {
+      p->data = (guint8 *)cache->packets;
+      cache->packets = p;
+      cache->n_packets++;
+    }
+  else
+    _mongo_free (p);
 }
 
 mongo_packet *
@@ -220,7 +609,7 @@ mongo_wire_cmd_update (gint32 id, const gchar *ns, gint32 flags,
       return NULL;
     }
 
-  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p = _mongo_wire_packet_alloc ();
   p->header.id = GINT32_TO_LE (id);
   p->header.opcode = GINT32_TO_LE (OP_UPDATE);
 
@@ -228,7 +617,7 @@ mongo_wire_cmd_update (gint32 id, const gchar *ns, gint32 flags,
   p->data_size = bson_size (selector) + bson_size (update) +
     sizeof (gint32) * 2 + nslen;
 
-  p->data = g_malloc (p->data_size);
+  _mongo_wire_packet_alloc_data (p, p->data_size);
 
   memcpy (p->data, (void *)&zero, sizeof (gint32));
   memcpy (p->data + sizeof (gint32), (void *)ns, nslen);
@@ -274,13 +663,13 @@ mongo_wire_cmd_insert_n (gint32 id, const gchar *ns, gint32 n,
       dsize += bson_size (docs[i]);
     }
 
-  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p = _mongo_wire_packet_alloc ();
   p->header.id = GINT32_TO_LE (id);
   p->header.opcode = GINT32_TO_LE (OP_INSERT);
 
   pos = sizeof (gint32) + strlen (ns) + 1;
   p->data_size = pos + dsize;
-  p->data = (guint8 *)g_malloc (p->data_size);
+  _mongo_wire_packet_alloc_data (p, p->data_size);
 
   memcpy (p->data, (void *)&zero, sizeof (gint32));
   memcpy (p->data + sizeof (gint32), (void *)ns, strlen (ns) + 1);
@@ -296,6 +685,224 @@ mongo_wire_cmd_insert_n (gint32 id, const gchar *ns, gint32 n,
   return p;
 }
 
+mongo_packet *
+mongo_wire_cmd_update_ref (gint32 id, const gchar *ns, gint32 flags,
+			   const bson *selector, const bson *update)
+{
+  mongo_packet *p;
+  gint32 t_flags = GINT32_TO_LE (flags);
+  gint nslen;
+
+  if (!ns || !selector || !update)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (bson_size (selector) < 0 ||
+      bson_size (update) < 0)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  p = _mongo_wire_packet_alloc ();
+  p->header.id = GINT32_TO_LE (id);
+  p->header.opcode = GINT32_TO_LE (OP_UPDATE);
+
+  nslen = strlen (ns) + 1;
+  p->data_size = sizeof (gint32) * 2 + nslen;
+  _mongo_wire_packet_alloc_data (p, p->data_size);
+
+  memcpy (p->data, (void *)&zero, sizeof (gint32));
+  memcpy (p->data + sizeof (gint32), (void *)ns, nslen);
+  memcpy (p->data + sizeof (gint32) + nslen, (void *)&t_flags,
+	  sizeof (gint32));
+
+  p->segments = _mongo_new0 (mongo_wire_segment, 2);
+  p->n_segments = 2;
+  p->segments[0].data = bson_data (selector);
+  p->segments[0].size = bson_size (selector);
+  p->segments[1].data = bson_data (update);
+  p->segments[1].size = bson_size (update);
+
+  p->header.length = GINT32_TO_LE (sizeof (p->header) + p->data_size +
+				   bson_size (selector) + bson_size (update));
+
+  return p;
+}
+
+mongo_packet *
+mongo_wire_cmd_insert_n_ref (gint32 id, const gchar *ns, gint32 n,
+			     const bson **docs)
+{
+  mongo_packet *p;
+  gint32 dsize = 0;
+  gint32 i;
+
+  if (!ns || !docs)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (n <= 0)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (bson_size (docs[i]) <= 0)
+	{
+	  errno = EINVAL;
+	  return NULL;
+	}
+      dsize += bson_size (docs[i]);
+    }
+
+  p = _mongo_wire_packet_alloc ();
+  p->header.id = GINT32_TO_LE (id);
+  p->header.opcode = GINT32_TO_LE (OP_INSERT);
+
+  p->data_size = sizeof (gint32) + strlen (ns) + 1;
+  _mongo_wire_packet_alloc_data (p, p->data_size);
+
+  memcpy (p->data, (void *)&zero, sizeof (gint32));
+  memcpy (p->data + sizeof (gint32), (void *)ns, strlen (ns) + 1);
+
+  p->segments = _mongo_new0 (mongo_wire_segment, n);
+  p->n_segments = n;
+  for (i = 0; i < n; i++)
+    {
+      p->segments[i].data = bson_data (docs[i]);
+      p->segments[i].size = bson_size (docs[i]);
+    }
+
+  p->header.length = GINT32_TO_LE (sizeof (p->header) + p->data_size +
+				   dsize);
+
+  return p;
+}
+
+mongo_packet *
+mongo_wire_cmd_insert_n_with_ids (gint32 id, const gchar *ns, gint32 n,
+				  const bson **docs, guint8 *ids)
+{
+  mongo_packet *p;
+  gboolean *has_id;
+  guint8 *oids;
+  gint32 pos, dsize = 0, len, i, n_new = 0, next = 0;
+  bson_cursor *c;
+
+  if (!ns || !docs)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (n <= 0)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+
+  has_id = g_new0 (gboolean, n);
+  for (i = 0; i < n; i++)
+    {
+      if (bson_size (docs[i]) <= 0)
+	{
+	  g_free (has_id);
+	  errno = EINVAL;
+	  return NULL;
+	}
+      dsize += bson_size (docs[i]);
+
+      c = bson_find (docs[i], "_id");
+      if (c)
+	{
+	  const guint8 *oid;
+
+	  has_id[i] = TRUE;
+	  if (ids)
+	    {
+	      if (bson_cursor_get_oid (c, &oid))
+		memcpy (ids + i * 12, oid, 12);
+	      else
+		memset (ids + i * 12, 0, 12);
+	    }
+	  bson_cursor_free (c);
+	}
+      else
+	{
+	  dsize += MONGO_WIRE_ID_ELEMENT_SIZE;
+	  n_new++;
+	}
+    }
+
+  oids = NULL;
+  if (n_new > 0)
+    {
+      oids = g_new (guint8, n_new * 12);
+      if (!mongo_util_oid_fill (oids, n_new))
+	{
+	  int e = errno;
+
+	  g_free (oids);
+	  g_free (has_id);
+	  errno = e;
+	  return NULL;
+	}
+    }
+
+  p = _mongo_wire_packet_alloc ();
+  p->header.id = GINT32_TO_LE (id);
+  p->header.opcode = GINT32_TO_LE (OP_INSERT);
+
+  pos = sizeof (gint32) + strlen (ns) + 1;
+  p->data_size = pos + dsize;
+  _mongo_wire_packet_alloc_data (p, p->data_size);
+
+  memcpy (p->data, (void *)&zero, sizeof (gint32));
+  memcpy (p->data + sizeof (gint32), (void *)ns, strlen (ns) + 1);
+
+  for (i = 0; i < n; i++)
+    {
+      if (has_id[i])
+	{
+	  memcpy (p->data + pos, bson_data (docs[i]), bson_size (docs[i]));
+	  pos += bson_size (docs[i]);
+	  continue;
+	}
+
+      /* The new length, then the _id element, then the rest of the
+	 original document, past its own length. */
+      len = GINT32_TO_LE (bson_size (docs[i]) + MONGO_WIRE_ID_ELEMENT_SIZE);
+      memcpy (p->data + pos, &len, sizeof (gint32));
+      pos += sizeof (gint32);
+      p->data[pos++] = BSON_TYPE_OID;
+      memcpy (p->data + pos, "_id", 4);
+      pos += 4;
+      memcpy (p->data + pos, oids + next * 12, 12);
+      pos += 12;
+      memcpy (p->data + pos, bson_data (docs[i]) + sizeof (gint32),
+	      bson_size (docs[i]) - sizeof (gint32));
+      pos += bson_size (docs[i]) - sizeof (gint32);
+
+      if (ids)
+	memcpy (ids + i * 12, oids + next * 12, 12);
+      next++;
+    }
+
+  p->header.length = GINT32_TO_LE (sizeof (p->header) + p->data_size);
+
+  g_free (oids);
+  g_free (has_id);
+
+  return p;
+}
+
 mongo_packet *
 mongo_wire_cmd_insert (gint32 id, const gchar *ns, ...)
 {
@@ -352,7 +959,7 @@ mongo_wire_cmd_query (gint32 id, const gchar *ns, gint32 flags,
       return NULL;
     }
 
-  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p = _mongo_wire_packet_alloc ();
   p->header.id = GINT32_TO_LE (id);
   p->header.opcode = GINT32_TO_LE (OP_QUERY);
 
@@ -362,7 +969,7 @@ mongo_wire_cmd_query (gint32 id, const gchar *ns, gint32 flags,
 
   if (sel)
     p->data_size += bson_size (sel);
-  p->data = g_malloc (p->data_size);
+  _mongo_wire_packet_alloc_data (p, p->data_size);
 
   tmp = GINT32_TO_LE (flags);
   memcpy (p->data, (void *)&tmp, sizeof (gint32));
@@ -399,7 +1006,7 @@ mongo_wire_cmd_get_more (gint32 id, const gchar *ns,
       return NULL;
     }
 
-  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p = _mongo_wire_packet_alloc ();
   p->header.id = GINT32_TO_LE (id);
   p->header.opcode = GINT32_TO_LE (OP_GET_MORE);
 
@@ -408,7 +1015,7 @@ mongo_wire_cmd_get_more (gint32 id, const gchar *ns,
 
   nslen = strlen (ns) + 1;
   p->data_size = sizeof (gint32) + nslen + sizeof (gint32) + sizeof (gint64);
-  p->data = g_malloc (p->data_size);
+  _mongo_wire_packet_alloc_data (p, p->data_size);
 
   memcpy (p->data, (void *)&zero, sizeof (gint32));
   memcpy (p->data + sizeof (gint32), (void *)ns, nslen);
@@ -440,13 +1047,13 @@ mongo_wire_cmd_delete (gint32 id, const gchar *ns,
       return NULL;
     }
 
-  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p = _mongo_wire_packet_alloc ();
   p->header.id = GINT32_TO_LE (id);
   p->header.opcode = GINT32_TO_LE (OP_DELETE);
 
   nslen = strlen (ns) + 1;
   p->data_size = sizeof (gint32) + nslen + sizeof (gint32) + bson_size (sel);
-  p->data = g_malloc (p->data_size);
+  _mongo_wire_packet_alloc_data (p, p->data_size);
 
   t_flags = GINT32_TO_LE (flags);
 
@@ -469,12 +1076,12 @@ mongo_wire_cmd_kill_cursors_va (gint32 id, gint32 n, va_list ap)
   gint32 i, t_n, pos;
   gint64 t_cid;
 
-  p = (mongo_packet *)g_new0 (mongo_packet, 1);
+  p = _mongo_wire_packet_alloc ();
   p->header.id = GINT32_TO_LE (id);
   p->header.opcode = GINT32_TO_LE (OP_KILL_CURSORS);
 
   p->data_size = sizeof (gint32) + sizeof (gint32) + sizeof (gint64)* n;
-  p->data = g_malloc (p->data_size);
+  _mongo_wire_packet_alloc_data (p, p->data_size);
 
   t_n = GINT32_TO_LE (n);
   pos = sizeof (gint32) * 2;
@@ -606,17 +1213,95 @@ mongo_wire_reply_packet_get_data (const mongo_packet *p,
  */
 #define _DOC_SIZE(doc,pos) GINT32_FROM_LE (*(gint32 *)(&doc[pos]))
 
-gboolean
-mongo_wire_reply_packet_get_nth_document (const mongo_packet *p,
-					  gint32 n,
-					  bson **doc)
+/** @internal Index the documents of a reply packet.
+ *
+ * Walks the documents once, recording where each of them starts, so
+ * that any of them can be found without walking the ones before it
+ * again. Documents are not decoded, only their sizes are checked
+ * against the size of the packet: the index stops at the first
+ * document that does not fit.
+ *
+ * @param p is the reply packet to index.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+static gboolean
+_mongo_wire_reply_packet_index (const mongo_packet *p)
 {
+  mongo_packet *rp = (mongo_packet *)p;
+  mongo_reply_packet_header h;
   const guint8 *d;
+  gint32 size, pos = 0, i, n, ds;
+
+  if (p->offsets)
+    return TRUE;
+
+  if (mongo_wire_packet_get_data (p, &d) == -1)
+    return FALSE;
+  if (p->data_size < (gint32)sizeof (mongo_reply_packet_header))
+    {
+      errno = EPROTO;
+      return FALSE;
+    }
+  if (!mongo_wire_reply_packet_get_header (p, &h))
+    return FALSE;
+
+  d += sizeof (mongo_reply_packet_header);
+  size = p->data_size - sizeof (mongo_reply_packet_header);
+
+  /* The number of documents comes from the wire: never index more
+     than the smallest possible documents (5 bytes each) that fit. One
+     extra slot, so that even an empty reply gets an index. */
+  n = MIN (MAX (h.returned, 0), size / 5);
+  rp->offsets = (gint32 *)_mongo_malloc (sizeof (gint32) * (n + 1));
+  for (i = 0; i < n; i++)
+    {
+      if (size - pos < (gint32)sizeof (gint32))
+	break;
+      ds = _DOC_SIZE (d, pos);
+      if (ds < 5 || ds > size - pos)
+	break;
+      rp->offsets[i] = pos;
+      pos += ds;
+    }
+  rp->n_offsets = i;
+
+  return TRUE;
+}
+
+gint32
+mongo_wire_reply_packet_get_offsets (const mongo_packet *p,
+				     const gint32 **offsets)
+{
+  if (!p || !offsets)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (p->header.opcode != OP_REPLY)
+    {
+      errno = EPROTO;
+      return -1;
+    }
+
+  if (!_mongo_wire_reply_packet_index (p))
+    return -1;
+
+  *offsets = p->offsets;
+  return p->n_offsets;
+}
+
+gboolean
+mongo_wire_reply_packet_get_nth_document_data (const mongo_packet *p,
+					       gint32 n,
+					       const guint8 **data,
+					       gint32 *size)
+{
   mongo_reply_packet_header h;
-  gint32 i;
-  gint32 pos = 0;
+  const guint8 *d;
 
-  if (!p || !doc || n <= 0)
+  if (!p || !data || n <= 0)
     {
       errno = EINVAL;
       return FALSE;
@@ -628,21 +1313,86 @@ mongo_wire_reply_packet_get_nth_document (const mongo_packet *p,
       return FALSE;
     }
 
-  if (!mongo_wire_reply_packet_get_header (p, &h))
+  if (!_mongo_wire_reply_packet_index (p))
     return FALSE;
 
-  if (h.returned < n)
+  if (n > p->n_offsets)
     {
-      errno = ERANGE;
+      mongo_wire_reply_packet_get_header (p, &h);
+      errno = (n > h.returned) ? ERANGE : EPROTO;
+      return FALSE;
+    }
+
+  mongo_wire_reply_packet_get_data (p, &d);
+  *data = d + p->offsets[n - 1];
+  if (size)
+    *size = _DOC_SIZE (*data, 0);
+  return TRUE;
+}
+
+gboolean
+_mongo_wire_reply_packet_get_nth_view (const mongo_packet *p, gint32 n,
+				       bson *view)
+{
+  const guint8 *d;
+  gint32 size;
+
+  if (!view)
+    {
+      errno = EINVAL;
       return FALSE;
     }
 
-  if (!mongo_wire_reply_packet_get_data (p, &d))
+  if (!mongo_wire_reply_packet_get_nth_document_data (p, n, &d, &size))
     return FALSE;
 
-  for (i = 1; i < n; i++)
-    pos += _DOC_SIZE (d, pos);
+  _bson_view_init (view, d, size);
+  return TRUE;
+}
+
+gboolean
+mongo_wire_reply_packet_get_nth_document (const mongo_packet *p,
+					  gint32 n,
+					  bson **doc)
+{
+  const guint8 *d;
+  gint32 size;
 
-  *doc = bson_new_from_data (d + pos, _DOC_SIZE (d, pos) - 1);
+  if (!doc)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (!mongo_wire_reply_packet_get_nth_document_data (p, n, &d, &size))
+    return FALSE;
+
+  *doc = bson_new_from_data (d, size - 1);
+  return TRUE;
+}
+
+gboolean
+mongo_wire_reply_packet_get_nth_document_view (const mongo_packet *p,
+					       gint32 n,
+					       bson **doc)
+{
+  const guint8 *d;
+  gint32 size;
+
+  if (!doc)
+    {
+      errno = EINVAL;
+      return FALSE;
+    }
+
+  if (!mongo_wire_reply_packet_get_nth_document_data (p, n, &d, &size))
+    return FALSE;
+
+  *doc = bson_new_view (d, size);
+  if (!*doc)
+    {
+      errno = EPROTO;
+      return FALSE;
+    }
   return TRUE;
 }
@@ -120,10 +120,28 @@ gboolean mongo_wire_packet_set_header (mongo_packet *p,
  * @note The @a data parameter will point to an internal structure,
  * which shall not be freed or written to.
  *
+ * @note Packets that reference documents instead of holding a copy
+ * (see mongo_wire_cmd_insert_n_ref()) have no contiguous data, until
+ * they are flattened with mongo_wire_packet_flatten(). The function
+ * fails for them with ENOTSUP, and never modifies the packet.
+ *
  * @returns The size of the data, or -1 on error.
  */
 gint32 mongo_wire_packet_get_data (const mongo_packet *p, const guint8 **data);
 
+/** Copy the documents a packet references into the packet.
+ *
+ * Turns a packet built by one of the referencing constructors, like
+ * mongo_wire_cmd_insert_n_ref(), into one that holds all of its data,
+ * so that mongo_wire_packet_get_data() can return it. Packets that
+ * hold their data already are left as they are.
+ *
+ * @param p is the packet to flatten.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_wire_packet_flatten (mongo_packet *p);
+
 /** Set the data part of a packet.
  *
  * Overrides the data part of a packet, adjusting the packet length in
@@ -149,6 +167,22 @@ gboolean mongo_wire_packet_set_data (mongo_packet *p, const guint8 *data,
  */
 void mongo_wire_packet_free (mongo_packet *p);
 
+/** Release the packets cached by the calling thread.
+ *
+ * Freed packets and their payload buffers are not returned to the
+ * allocator right away, but kept in a small, per-thread cache, so
+ * that building the next packet can reuse them. Buffers are cached
+ * in power-of-two size classes, from 64 bytes up to 64 KiB. Of the
+ * larger ones, a single buffer of up to 4 MiB is kept, until the
+ * thread has not needed it for five seconds; the rest are freed. The
+ * cache of a thread is released when the thread exits, or when this
+ * function is called.
+ *
+ * @note Packets can be freed from any thread, they end up in the
+ * cache of the thread that freed them.
+ */
+void mongo_wire_packet_cache_flush (void);
+
 /** @} */
 
 /** @defgroup mongo_wire_reply Reply handling
@@ -232,6 +266,67 @@ gboolean mongo_wire_reply_packet_get_nth_document (const mongo_packet *p,
 						   gint32 n,
 						   bson **doc);
 
+/** Get the offsets of the documents in a reply packet.
+ *
+ * The documents of a reply are not parsed when the packet is
+ * received. The first time any of them is asked for, the packet is
+ * walked once to find where each document starts, and only the sizes
+ * of the documents are checked. Documents are never copied or decoded
+ * unless requested.
+ *
+ * @param p is the packet to get the offsets of.
+ * @param offsets is a pointer to a variable where a pointer to the
+ * offsets is stored. The offsets are relative to the data returned by
+ * mongo_wire_reply_packet_get_data(), and are owned by the packet.
+ *
+ * @returns The number of documents in the packet, or -1 on error. If
+ * a document does not fit into the packet, it and the ones after it
+ * are left out.
+ */
+gint32 mongo_wire_reply_packet_get_offsets (const mongo_packet *p,
+					    const gint32 **offsets);
+
+/** Get the raw data of the Nth document of a reply packet.
+ *
+ * Unlike mongo_wire_reply_packet_get_nth_document(), this does not
+ * copy the document.
+ *
+ * @param p is the packet to retrieve a document from.
+ * @param n is the number of the document to retrieve.
+ * @param data is a pointer to a variable where a pointer to the
+ * document is stored. It points into the packet, and is only valid as
+ * long as the packet is.
+ * @param size is an optional pointer to a variable where the size of
+ * the document is stored.
+ *
+ * @returns TRUE on success, FALSE otherwise. If the packet has fewer
+ * than @a n documents, errno is set to ERANGE; if the document does
+ * not fit into the packet, to EPROTO.
+ */
+gboolean mongo_wire_reply_packet_get_nth_document_data (const mongo_packet *p,
+							gint32 n,
+							const guint8 **data,
+							gint32 *size);
+
+/** Get the Nth document of a reply packet as a view.
+ *
+ * Like mongo_wire_reply_packet_get_nth_document(), but the document
+ * is not copied: the returned object is a view into the packet, see
+ * bson_new_view().
+ *
+ * @param p is the packet to retrieve a document from.
+ * @param n is the number of the document to retrieve.
+ * @param doc is a pointer to a variable to hold the BSON document.
+ *
+ * @note The @a doc variable will be a newly allocated object, which
+ * must be freed with bson_free(), at the latest when the packet is.
+ *
+ * @returns TRUE on success, FALSE otherwise.
+ */
+gboolean mongo_wire_reply_packet_get_nth_document_view (const mongo_packet *p,
+							gint32 n,
+							bson **doc);
+
 /** @}*/
 
 /** @defgroup mongo_wire_cmd Commands
@@ -304,6 +399,87 @@ mongo_packet *mongo_wire_cmd_insert (gint32 id, const gchar *ns, ...) GNUC_SENTI
 mongo_packet *mongo_wire_cmd_insert_n (gint32 id, const gchar *ns, gint32 n,
 				       const bson **docs);
 
+/** Construct an update command, without copying the documents.
+ *
+ * Works like mongo_wire_cmd_update(), except that the packet only
+ * references @a selector and @a update, instead of copying them. When
+ * such a packet is sent, the documents are sent straight from their
+ * own buffers.
+ *
+ * @param id is the sequence id.
+ * @param ns is the namespace, the database and collection name
+ * concatenated, and separated with a single dot.
+ * @param flags are the flags for the update command.
+ * @param selector is the BSON document that will act as the selector.
+ * @param update is the BSON document that contains the updated values.
+ *
+ * @note The documents must not be modified or freed while the packet
+ * is alive. Flattening the packet with mongo_wire_packet_flatten()
+ * copies the documents into it, after which this restriction is
+ * lifted.
+ *
+ * @returns A newly allocated packet, or NULL on error. It is the
+ * responsibility of the caller to free the packet once it is not used
+ * anymore.
+ */
+mongo_packet *mongo_wire_cmd_update_ref (gint32 id, const gchar *ns,
+					 gint32 flags, const bson *selector,
+					 const bson *update);
+
+/** Construct an insert command with N documents, without copying
+ * them.
+ *
+ * Works like mongo_wire_cmd_insert_n(), except that the packet only
+ * references the documents, instead of copying them. When such a
+ * packet is sent, the documents are sent straight from their own
+ * buffers.
+ *
+ * @param id is the sequence id.
+ * @param ns is the namespace, the database and collection name
+ * concatenaded, and separated with a single dot.
+ * @param n is the number of documents to insert.
+ * @param docs is the array containing the bson documents to insert.
+ *
+ * @note The documents must not be modified or freed while the packet
+ * is alive. Flattening the packet with mongo_wire_packet_flatten()
+ * copies the documents into it, after which this restriction is
+ * lifted.
+ *
+ * @returns A newly allocated packet, or NULL on error. It is the
+ * responsibility of the caller to free the packet once it is not used
+ * anymore.
+ */
+mongo_packet *mongo_wire_cmd_insert_n_ref (gint32 id, const gchar *ns,
+					   gint32 n, const bson **docs);
+
+/** Construct an insert command with N documents, giving each of
+ * them an _id.
+ *
+ * Works like mongo_wire_cmd_insert_n(), except that documents without
+ * an _id field get a freshly generated ObjectID as their _id, written
+ * in front of their other fields as the packet is built. The
+ * documents themselves are left unchanged.
+ *
+ * @param id is the sequence id.
+ * @param ns is the namespace, the database and collection name
+ * concatenaded, and separated with a single dot.
+ * @param n is the number of documents to insert.
+ * @param docs is the array containing the bson documents to insert.
+ * @param ids is an optional array of @a n times 12 bytes, where the
+ * _id of each document is stored. Documents that already had a
+ * non-ObjectID _id get all zeroes.
+ *
+ * @note The ObjectIDs are made by mongo_util_oid_fill(), so
+ * mongo_util_oid_init() must have been called before.
+ *
+ * @returns A newly allocated packet, or NULL on error. It is the
+ * responsibility of the caller to free the packet once it is not used
+ * anymore.
+ */
+mongo_packet *mongo_wire_cmd_insert_n_with_ids (gint32 id, const gchar *ns,
+						gint32 n, const bson **docs,
+						guint8 *ids);
+
 /** Flags available for the query command.
  * @see mongo_wire_cmd_query().
  */
@@ -20,6 +20,11 @@
 #include <mongo-utils.h>
 #include <mongo-sync.h>
 #include <mongo-sync-pool.h>
+#include <mongo-sync-cursor.h>
+#include <mongo-sync-batch.h>
+#include <mongo-sync-queue.h>
+#include <mongo-sync-topology.h>
+#include <mongo-async.h>
 
 /** @mainpage libmongo-client
  *
@@ -44,6 +49,18 @@
  *     network aswell, in a synchronous, blocking manner. @see mongo_sync.
  *   - mongo-sync-pool: Simple connection pooling on top of
  *     mongo-sync, @see mongo_sync_pool_api.
+ *   - mongo-sync-cursor: Cursors on top of mongo-sync, that iterate
+ *     over query results across batches, @see mongo_sync_cursor_api.
+ *   - mongo-sync-batch: Write batches on top of mongo-sync, that send
+ *     many writes with a single system call, @see mongo_sync_batch_api.
+ *   - mongo-sync-queue: Write-behind queue on top of mongo-sync, that
+ *     inserts documents from a background thread,
+ *     @see mongo_sync_queue_api.
+ *   - mongo-sync-topology: The replica set topology table shared by
+ *     all mongo-sync connections, @see mongo_sync_topology_api.
+ *   - mongo-async: Non-blocking counterparts of the mongo-sync
+ *     commands, that complete through callbacks called from a GLib
+ *     main context, @see mongo_async_api.
  *
  * The intended way to use the library to work with MongoDB is to
  * first construct the BSON objects, then construct the packets, and
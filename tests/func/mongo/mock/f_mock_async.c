@@ -0,0 +1,240 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define N_INFLIGHT 500
+
+typedef struct
+{
+  gint done;
+  gint failed;
+  gint error;
+  gint32 returned;
+  gint64 cursor_id;
+  gdouble count;
+} async_result;
+
+static void
+_reply_cb (mongo_async_connection *conn, mongo_packet *reply, gint error,
+	   gpointer user_data)
+{
+  async_result *r = (async_result *)user_data;
+  mongo_reply_packet_header rh;
+
+  r->done++;
+  if (error)
+    {
+      r->failed++;
+      r->error = error;
+      return;
+    }
+  mongo_wire_reply_packet_get_header (reply, &rh);
+  r->returned += rh.returned;
+  r->cursor_id = rh.cursor_id;
+  mongo_wire_packet_free (reply);
+}
+
+static void
+_count_cb (mongo_async_connection *conn, gdouble count, gint error,
+	   gpointer user_data)
+{
+  async_result *r = (async_result *)user_data;
+
+  r->done++;
+  r->error = error;
+  r->count = count;
+}
+
+static void
+_write_cb (mongo_async_connection *conn, gint error, gpointer user_data)
+{
+  async_result *r = (async_result *)user_data;
+
+  r->done++;
+  if (error)
+    r->failed++;
+  r->error = error;
+}
+
+static void
+_wait (GMainContext *ctx, async_result *r, gint n)
+{
+  while (r->done < n)
+    g_main_context_iteration (ctx, TRUE);
+}
+
+void
+test_func_mongo_mock_async (void)
+{
+  mock_server *server;
+  mongo_async_connection *conn, *conn2;
+  GMainContext *ctx;
+  async_result r, r2;
+  bson *b, *upd;
+  gint32 i;
+
+  server = mock_server_new ();
+  ctx = g_main_context_new ();
+
+  conn = mongo_async_connect ("127.0.0.1", mock_server_get_port (server),
+			      ctx);
+  ok (conn != NULL,
+      "mongo_async_connect() to the mock server works");
+
+  /* Fire-and-forget inserts, then a count on the same connection. */
+  for (i = 0; i < N_INFLIGHT; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      mongo_async_cmd_insert_n (conn, "test.async", 1, (const bson **)&b,
+				NULL, NULL);
+      bson_free (b);
+    }
+  memset (&r, 0, sizeof (r));
+  mongo_async_cmd_count (conn, "test", "async", NULL, _count_cb, &r);
+  _wait (ctx, &r, 1);
+  cmp_ok (r.error, "==", 0,
+	  "Counting works");
+  ok (r.count == N_INFLIGHT,
+      "Every insert reached the server before the count");
+
+  /* Many queries in flight at once. */
+  memset (&r, 0, sizeof (r));
+  for (i = 0; i < N_INFLIGHT; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      mongo_async_cmd_query (conn, "test.async", 0, 0, 1, b, NULL,
+			     _reply_cb, &r);
+      bson_free (b);
+    }
+  cmp_ok (mongo_async_conn_get_pending (conn), "==", N_INFLIGHT,
+	  "Every query is in flight");
+  _wait (ctx, &r, N_INFLIGHT);
+  cmp_ok (r.failed, "==", 0,
+	  "Every query succeeds");
+  cmp_ok (r.returned, "==", N_INFLIGHT,
+	  "Every query returns its document");
+  cmp_ok (mongo_async_conn_get_pending (conn), "==", 0,
+	  "Nothing is pending afterwards");
+
+  /* Queries with no match fail with ENOENT, like in mongo-sync. */
+  memset (&r, 0, sizeof (r));
+  b = bson_new ();
+  bson_append_int32 (b, "seq", -1);
+  bson_finish (b);
+  mongo_async_cmd_query (conn, "test.async", 0, 0, 1, b, NULL,
+			 _reply_cb, &r);
+  bson_free (b);
+  _wait (ctx, &r, 1);
+  cmp_ok (r.error, "==", ENOENT,
+	  "A query without results fails with ENOENT");
+
+  /* Cursors. */
+  memset (&r, 0, sizeof (r));
+  b = bson_new ();
+  bson_finish (b);
+  mongo_async_cmd_query (conn, "test.async", 0, 0, 10, b, NULL,
+			 _reply_cb, &r);
+  bson_free (b);
+  _wait (ctx, &r, 1);
+  ok (r.returned == 10 && r.cursor_id != 0,
+      "A query returns the first batch and a cursor");
+  mongo_async_cmd_get_more (conn, "test.async", 10, r.cursor_id,
+			    _reply_cb, &r);
+  _wait (ctx, &r, 2);
+  ok (r.failed == 0 && r.returned == 20,
+      "mongo_async_cmd_get_more() returns the next batch");
+
+  /* Custom commands. */
+  memset (&r, 0, sizeof (r));
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+  mongo_async_cmd_custom (conn, "admin", b, _reply_cb, &r);
+  bson_free (b);
+  b = bson_new ();
+  bson_append_int32 (b, "nosuchcommand", 1);
+  bson_finish (b);
+  memset (&r2, 0, sizeof (r2));
+  mongo_async_cmd_custom (conn, "admin", b, _reply_cb, &r2);
+  bson_free (b);
+  _wait (ctx, &r2, 1);
+  ok (r.done == 1 && r.error == 0,
+      "Custom commands work");
+  cmp_ok (r2.error, "==", EPROTO,
+	  "Unknown commands fail with EPROTO");
+
+  /* Safe mode. */
+  mongo_async_conn_set_safe_mode (conn, TRUE);
+  memset (&r, 0, sizeof (r));
+  b = bson_build (BSON_TYPE_INT32, "seq", 3, BSON_TYPE_NONE);
+  bson_finish (b);
+  upd = bson_build (BSON_TYPE_INT32, "seq", 3,
+		    BSON_TYPE_STRING, "updated", "yes", -1,
+		    BSON_TYPE_NONE);
+  bson_finish (upd);
+  mongo_async_cmd_update (conn, "test.async", 0, b, upd, _write_cb, &r);
+  bson_free (upd);
+  upd = bson_build (BSON_TYPE_STRING, "$set", "bogus", -1, BSON_TYPE_NONE);
+  bson_finish (upd);
+  memset (&r2, 0, sizeof (r2));
+  mongo_async_cmd_update (conn, "test.async", 0, b, upd, _write_cb, &r2);
+  bson_free (upd);
+  bson_free (b);
+  _wait (ctx, &r2, 1);
+  ok (r.done == 1 && r.error == 0,
+      "Safe mode writes complete with the getLastError reply");
+  cmp_ok (r2.error, "==", EPROTO,
+	  "Safe mode writes the server refuses fail with EPROTO");
+  is (mongo_async_conn_get_last_error (conn),
+      "update operators are not supported",
+      "The error of the server is available");
+
+  memset (&r, 0, sizeof (r));
+  b = bson_build (BSON_TYPE_INT32, "seq", 4, BSON_TYPE_NONE);
+  bson_finish (b);
+  mongo_async_cmd_delete (conn, "test.async", 0, b, _write_cb, &r);
+  bson_free (b);
+  mongo_async_cmd_count (conn, "test", "async", NULL, _count_cb, &r);
+  _wait (ctx, &r, 2);
+  ok (r.error == 0 && r.count == N_INFLIGHT - 1,
+      "Deleting in safe mode works");
+  mongo_async_conn_set_safe_mode (conn, FALSE);
+
+  /* Two connections on one main context. */
+  conn2 = mongo_async_connect ("127.0.0.1", mock_server_get_port (server),
+			       ctx);
+  memset (&r, 0, sizeof (r));
+  memset (&r2, 0, sizeof (r2));
+  mongo_async_cmd_count (conn, "test", "async", NULL, _count_cb, &r);
+  mongo_async_cmd_count (conn2, "test", "async", NULL, _count_cb, &r2);
+  _wait (ctx, &r, 1);
+  _wait (ctx, &r2, 1);
+  ok (r.count == r2.count && r2.error == 0,
+      "Connections sharing a main context work side by side");
+  mongo_async_disconnect (conn2);
+
+  /* Broken connections fail everything pending. */
+  memset (&r, 0, sizeof (r));
+  mock_server_fail (server, MOCK_SERVER_FAIL_DISCONNECT, 1);
+  for (i = 0; i < 10; i++)
+    mongo_async_cmd_count (conn, "test", "async", NULL, _count_cb, &r);
+  _wait (ctx, &r, 10);
+  cmp_ok (r.error, "==", ECONNRESET,
+	  "Pending commands fail when the server disconnects");
+  ok (mongo_async_cmd_count (conn, "test", "async", NULL,
+			     _count_cb, &r) == FALSE,
+      "A broken connection refuses new commands");
+
+  mongo_async_disconnect (conn);
+  g_main_context_unref (ctx);
+  mock_server_free (server);
+}
+
+RUN_TEST (19, func_mongo_mock_async);
@@ -0,0 +1,136 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+
+static mongo_connection *traced_conn;
+static GArray *traced_ids;
+
+static void
+_record_request_id (const mongo_trace_info *info,
+		    gpointer user_data G_GNUC_UNUSED)
+{
+  /* The mock server answers through the same library, from its own
+     thread; only look at our own connection. */
+  if (traced_conn && info->event == MONGO_TRACE_SEND_START &&
+      info->conn == traced_conn)
+    g_array_append_val (traced_ids, info->request_id);
+}
+
+static gboolean
+_request_ids_distinct (GArray *ids)
+{
+  guint i, j;
+
+  for (i = 0; i < ids->len; i++)
+    for (j = i + 1; j < ids->len; j++)
+      if (g_array_index (ids, gint32, i) == g_array_index (ids, gint32, j))
+	return FALSE;
+  return TRUE;
+}
+
+void
+test_func_mongo_mock_batch (void)
+{
+  mock_server *server;
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  mongo_connection_stats stats;
+  bson *b, *upd;
+  gint32 i;
+
+  server = mock_server_new ();
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (server),
+			     FALSE);
+  mongo_sync_conn_set_safe_mode (conn, TRUE);
+
+  batch = mongo_sync_batch_new (conn);
+  ok (batch != NULL,
+      "mongo_sync_batch_new() works");
+
+  for (i = 0; i < 10; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      mongo_sync_batch_insert (batch, (i % 2) ? "test.odd" : "test.even", b);
+      bson_free (b);
+    }
+  b = bson_new ();
+  bson_append_int32 (b, "seq", 1);
+  bson_finish (b);
+  mongo_sync_batch_delete (batch, "test.odd", 0, b);
+  bson_free (b);
+
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 11,
+	  "Operations are held back until the batch is flushed");
+  cmp_ok (mock_server_get_op_count (server, 2002 /* insert */), "==", 0,
+	  "Nothing reached the server yet");
+
+  traced_conn = (mongo_connection *)conn;
+  traced_ids = g_array_new (FALSE, FALSE, sizeof (gint32));
+  mongo_trace_set_handler (_record_request_id, NULL);
+  ok (mongo_sync_batch_flush (batch),
+      "mongo_sync_batch_flush() works in safe mode");
+  traced_conn = NULL;
+  ok (traced_ids->len >= 12 && _request_ids_distinct (traced_ids),
+      "Batched operations are numbered from the connection's counter");
+  g_array_free (traced_ids, TRUE);
+  cmp_ok (mock_server_get_op_count (server, 2002 /* insert */), "==", 10,
+	  "All inserts reached the server");
+  cmp_ok (mock_server_get_op_count (server, 2006 /* delete */), "==", 1,
+	  "The delete reached the server");
+  ok (mongo_sync_cmd_count (conn, "test", "even", NULL) == 5 &&
+      mongo_sync_cmd_count (conn, "test", "odd", NULL) == 4,
+      "The operations were applied in order, on every namespace");
+  mongo_connection_get_stats ((mongo_connection *)conn, &stats);
+  cmp_ok (stats.get_last_error_calls, "==", 1,
+	  "A single getLastError was sent for the whole batch");
+
+  mongo_sync_batch_set_limits (batch, 1024 * 1024, 4, 0);
+  for (i = 0; i < 6; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", 100 + i);
+      bson_finish (b);
+      mongo_sync_batch_insert (batch, "test.even", b);
+      bson_free (b);
+    }
+  cmp_ok (mock_server_get_op_count (server, 2002 /* insert */), "==", 14,
+	  "Reaching the operation limit flushes the batch");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 2,
+	  "Operations over the limit are kept pending");
+
+  b = bson_new ();
+  bson_append_int32 (b, "seq", 100);
+  bson_finish (b);
+  upd = bson_build (BSON_TYPE_INT32, "$inc", 1, BSON_TYPE_NONE);
+  bson_finish (upd);
+  mongo_sync_batch_update (batch, "test.even", 0, b, upd);
+  bson_free (upd);
+  bson_free (b);
+  ok (mongo_sync_batch_flush (batch) == FALSE,
+      "mongo_sync_batch_flush() reports errors from getLastError");
+  cmp_ok (errno, "==", EPROTO,
+	  "errno is set to EPROTO");
+  mongo_sync_cmd_reset_error (conn, "test");
+
+  b = bson_new ();
+  bson_append_int32 (b, "seq", 200);
+  bson_finish (b);
+  mongo_sync_batch_insert (batch, "test.even", b);
+  bson_free (b);
+  mongo_sync_batch_free (batch);
+  cmp_ok (mock_server_get_op_count (server, 2002 /* insert */), "==", 16,
+	  "mongo_sync_batch_free() drops pending operations unsent");
+
+  mongo_sync_disconnect (conn);
+  mock_server_free (server);
+
+  /* The server threads may be inside a traced call until they are
+     gone. */
+  mongo_trace_set_handler (NULL, NULL);
+}
+
+RUN_TEST (14, func_mongo_mock_batch);
@@ -0,0 +1,163 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <string.h>
+
+void
+test_func_mongo_mock_crud (void)
+{
+  mock_server *server;
+  mongo_sync_connection *conn;
+  mongo_packet *p;
+  bson *b, *upd;
+  bson_cursor *c;
+  gchar *error = NULL;
+  const bson *docs[4];
+  gint32 i, ops;
+
+  server = mock_server_new ();
+  ok (server != NULL,
+      "mock_server_new() works");
+
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (server),
+			     FALSE);
+  ok (conn != NULL,
+      "mongo_sync_connect() to the mock server works");
+  ok (mongo_sync_cmd_ping (conn) == TRUE,
+      "The mock server answers ping");
+  ok (mongo_sync_cmd_is_master (conn) == TRUE,
+      "The mock server is a master by default");
+
+  for (i = 0; i < 10; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_append_string (b, "parity", (i % 2) ? "odd" : "even", -1);
+      bson_finish (b);
+      mongo_sync_cmd_insert (conn, "test.mock", b, NULL);
+      bson_free (b);
+    }
+  ok (mongo_sync_cmd_count (conn, "test", "mock", NULL) == 10,
+      "Counting the whole collection works");
+  cmp_ok (mock_server_get_op_count (server, 2002 /* insert */), "==", 10,
+	  "The mock server counts inserts");
+
+  b = bson_build (BSON_TYPE_STRING, "parity", "odd", -1,
+		  BSON_TYPE_NONE);
+  bson_finish (b);
+  ok (mongo_sync_cmd_count (conn, "test", "mock", b) == 5,
+      "Counting with a query works");
+  bson_free (b);
+
+  upd = bson_build (BSON_TYPE_INT32, "$gte", 7, BSON_TYPE_NONE);
+  bson_finish (upd);
+  b = bson_build (BSON_TYPE_DOCUMENT, "seq", upd, BSON_TYPE_NONE);
+  bson_finish (b);
+  bson_free (upd);
+  p = mongo_sync_cmd_query (conn, "test.mock", 0, 0, 10, b, NULL);
+  bson_free (b);
+  ok (p != NULL,
+      "Querying with an operator works");
+  {
+    mongo_reply_packet_header rh;
+
+    mongo_wire_reply_packet_get_header (p, &rh);
+    cmp_ok (rh.returned, "==", 3,
+	    "The query returns the matching documents only");
+  }
+  mongo_wire_packet_free (p);
+
+  b = bson_build (BSON_TYPE_INT32, "seq", 3, BSON_TYPE_NONE);
+  bson_finish (b);
+  upd = bson_build (BSON_TYPE_INT32, "seq", 3,
+		    BSON_TYPE_STRING, "parity", "updated", -1,
+		    BSON_TYPE_NONE);
+  bson_finish (upd);
+  ok (mongo_sync_cmd_update (conn, "test.mock", 0, b, upd) == TRUE,
+      "Updating works");
+  bson_free (upd);
+
+  p = mongo_sync_cmd_query (conn, "test.mock", 0, 0, 1, b, NULL);
+  mongo_wire_reply_packet_get_nth_document (p, 1, &upd);
+  bson_finish (upd);
+  c = bson_find (upd, "parity");
+  {
+    const gchar *s = NULL;
+
+    bson_cursor_get_string (c, &s);
+    is (s, "updated",
+	"The update replaced the document");
+  }
+  bson_cursor_free (c);
+  bson_free (upd);
+  mongo_wire_packet_free (p);
+
+  ok (mongo_sync_cmd_delete (conn, "test.mock", 0, b) == TRUE,
+      "Deleting works");
+  bson_free (b);
+  ok (mongo_sync_cmd_count (conn, "test", "mock", NULL) == 9,
+      "Deleting removes the document");
+
+  mongo_sync_cmd_get_last_error (conn, "test", &error);
+  ok (error == NULL,
+      "getlasterror reports no error after a successful write");
+  g_free (error);
+
+  mock_server_set_primary (server, FALSE);
+  ok (mongo_sync_cmd_is_master (conn) == FALSE,
+      "The mock server can be turned into a secondary");
+
+  b = bson_build (BSON_TYPE_INT32, "seq", 42, BSON_TYPE_NONE);
+  bson_finish (b);
+  mongo_sync_conn_set_slaveok (conn, TRUE);
+  p = mongo_wire_cmd_insert (1, "test.mock", b, NULL);
+  mongo_packet_send ((mongo_connection *)conn, p);
+  mongo_wire_packet_free (p);
+  ok (mongo_sync_cmd_get_last_error (conn, "test", &error) == TRUE,
+      "A secondary answers getlasterror");
+  is (error, "not master",
+      "A secondary reports the right error");
+  g_free (error);
+  bson_free (b);
+
+  ok (mongo_sync_cmd_count (conn, "test", "mock", NULL) == 9,
+      "A secondary refuses writes");
+
+  mock_server_set_primary (server, TRUE);
+  ok (mongo_sync_cmd_drop (conn, "test", "mock") == TRUE,
+      "Dropping a collection works");
+
+  /* Documents that already have an _id are batched by their own
+     size: two of them fit under the limit. */
+  for (i = 0; i < 4; i++)
+    {
+      guint8 oid[12];
+
+      memset (oid, 0, sizeof (oid));
+      oid[11] = (guint8)i;
+      b = bson_new ();
+      bson_append_oid (b, "_id", oid);
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      docs[i] = b;
+    }
+  mongo_sync_conn_set_max_insert_size (conn, 2 * bson_size (docs[0]) + 1);
+  ops = mock_server_get_op_count (server, 2002 /* insert */);
+  ok (mongo_sync_cmd_insert_n_with_ids (conn, "test.ids", 4, docs, NULL),
+      "mongo_sync_cmd_insert_n_with_ids() works with documents that "
+      "have an _id");
+  mongo_sync_cmd_ping (conn);
+  cmp_ok (mock_server_get_op_count (server, 2002 /* insert */) - ops,
+	  "==", 2,
+	  "Documents with an _id are not sized as if they got a new one");
+  for (i = 0; i < 4; i++)
+    bson_free ((bson *)docs[i]);
+
+  mongo_sync_disconnect (conn);
+  cmp_ok (mock_server_get_connection_count (server), "==", 1,
+	  "The mock server counts connections");
+  mock_server_free (server);
+}
+
+RUN_TEST (22, func_mongo_mock_crud);
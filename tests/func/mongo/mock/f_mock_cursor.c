@@ -0,0 +1,110 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+void
+test_func_mongo_mock_cursor (void)
+{
+  mock_server *server;
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+  bson *b;
+  gint32 i, n;
+  gboolean ordered;
+
+  server = mock_server_new ();
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (server),
+			     FALSE);
+
+  for (i = 0; i < 250; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      mongo_sync_cmd_insert (conn, "test.mock", b, NULL);
+      bson_free (b);
+    }
+
+  b = bson_new ();
+  bson_finish (b);
+
+  p = mongo_sync_cmd_query (conn, "test.mock", 0, 0, 10, b, NULL);
+  cursor = mongo_sync_cursor_new (conn, "test.mock", p);
+  ok (cursor != NULL,
+      "A cursor can be created on a mock server query");
+
+  n = 0;
+  ordered = TRUE;
+  while (mongo_sync_cursor_next (cursor))
+    {
+      bson *d = mongo_sync_cursor_get_data (cursor);
+      bson_cursor *c = bson_find (d, "seq");
+
+      bson_cursor_get_int32 (c, &i);
+      if (i != n)
+	ordered = FALSE;
+      n++;
+      bson_cursor_free (c);
+      bson_free (d);
+    }
+  cmp_ok (n, "==", 250,
+	  "Iterating through the cursor returns every document");
+  ok (ordered == TRUE,
+      "Documents are returned in insertion order");
+  cmp_ok (mock_server_get_op_count (server, 2005 /* getMore */), "==", 24,
+	  "The cursor fetched the rest of the results with getMore");
+  mongo_sync_cursor_free (cursor);
+
+  p = mongo_sync_cmd_query (conn, "test.mock", 0, 0, 10, b, NULL);
+  cursor = mongo_sync_cursor_new (conn, "test.mock", p);
+  n = 0;
+  ordered = TRUE;
+  while (mongo_sync_cursor_next (cursor))
+    {
+      const bson *d = mongo_sync_cursor_get_data_view (cursor);
+      bson_cursor *c = bson_find (d, "seq");
+
+      if (!bson_cursor_get_int32 (c, &i) || i != n)
+	ordered = FALSE;
+      n++;
+      bson_cursor_free (c);
+    }
+  ok (n == 250 && ordered,
+      "Views follow the cursor through batches received into its "
+      "buffer");
+  mongo_sync_cursor_free (cursor);
+
+  p = mongo_sync_cmd_query (conn, "test.mock", 0, 0, 10, b, NULL);
+  cursor = mongo_sync_cursor_new (conn, "test.mock", p);
+  mongo_sync_cursor_next (cursor);
+  mongo_sync_cursor_free (cursor);
+  mongo_sync_cmd_ping (conn);
+  cmp_ok (mock_server_get_op_count (server, 2007 /* kill cursors */), "==",
+	  1,
+	  "Freeing an unfinished cursor kills it");
+
+  cursor = mongo_sync_cursor_new_exhaust (conn, "test.mock", 0, 0, 50,
+					  b, NULL);
+  n = 0;
+  while (mongo_sync_cursor_next (cursor))
+    n++;
+  cmp_ok (n, "==", 250,
+	  "Exhaust cursors return every document");
+  cmp_ok (mock_server_get_op_count (server, 2005 /* getMore */), "==", 49,
+	  "Exhaust cursors do not send getMore requests");
+  mongo_sync_cursor_free (cursor);
+
+  ok (mongo_sync_cmd_ping (conn) == TRUE,
+      "The connection is usable after a finished exhaust cursor");
+
+  p = mongo_sync_cmd_get_more (conn, "test.mock", 10, 12345);
+  ok (p == NULL,
+      "getMore on an unknown cursor fails");
+
+  bson_free (b);
+  mongo_sync_disconnect (conn);
+  mock_server_free (server);
+}
+
+RUN_TEST (10, func_mongo_mock_cursor);
@@ -0,0 +1,87 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+
+void
+test_func_mongo_mock_failover (void)
+{
+  mock_server *primary, *secondary;
+  mongo_sync_connection *conn;
+  const gchar *hosts[3];
+  gint64 start;
+  bson *b;
+
+  primary = mock_server_new ();
+  secondary = mock_server_new ();
+
+  hosts[0] = mock_server_get_address (primary);
+  hosts[1] = mock_server_get_address (secondary);
+  hosts[2] = NULL;
+
+  mock_server_set_replica_set (primary, "mock", hosts[0], hosts);
+  mock_server_set_replica_set (secondary, "mock", hosts[0], hosts);
+  mock_server_set_primary (secondary, FALSE);
+
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (secondary),
+			     TRUE);
+  ok (conn != NULL,
+      "Connecting to a secondary works with slaveok");
+  ok (mongo_sync_cmd_is_master (conn) == FALSE,
+      "The secondary is not a master");
+
+  ok (mongo_sync_reconnect (conn, TRUE) == conn,
+      "Reconnecting to a master works");
+  ok (mongo_sync_cmd_is_master (conn) == TRUE,
+      "Reconnecting found the primary through the secondary");
+  cmp_ok (mock_server_get_connection_count (primary), "==", 1,
+	  "The client connected to the primary");
+
+  b = bson_build (BSON_TYPE_INT32, "f_mock_failover", 1, BSON_TYPE_NONE);
+  bson_finish (b);
+
+  mock_server_fail (primary, MOCK_SERVER_FAIL_DISCONNECT, 1);
+  ok (mongo_sync_cmd_ping (conn) == FALSE,
+      "Injected disconnects break the connection");
+
+  mongo_sync_conn_set_auto_reconnect (conn, TRUE);
+  ok (mongo_sync_cmd_insert (conn, "test.mock", b, NULL) == TRUE,
+      "Auto-reconnect recovers from an injected disconnect");
+  ok (mongo_sync_cmd_ping (conn) == TRUE,
+      "The recovered connection is usable");
+  cmp_ok (mock_server_get_connection_count (primary), "==", 2,
+	  "Recovering required a new connection");
+
+  mongo_connection_set_timeout ((mongo_connection *)conn, 200);
+  mongo_sync_conn_set_auto_reconnect (conn, FALSE);
+  mock_server_fail (primary, MOCK_SERVER_FAIL_HANG, 1);
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_cmd_ping (conn) == FALSE,
+      "A hanging server makes commands time out");
+  ok (g_get_monotonic_time () - start < 2 * G_USEC_PER_SEC,
+      "The timeout is honoured");
+
+  mongo_sync_reconnect (conn, TRUE);
+  mock_server_set_latency (primary, 50000);
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_cmd_ping (conn) == TRUE,
+      "Commands work with injected latency");
+  ok (g_get_monotonic_time () - start >= 50000,
+      "Latency is injected");
+  mock_server_set_latency (primary, 0);
+
+  mock_server_fail (primary, MOCK_SERVER_FAIL_ERROR, -1);
+  ok (mongo_sync_cmd_query (conn, "test.mock", 0, 0, 1, b, NULL) == NULL,
+      "Queries fail when errors are injected");
+  mock_server_fail (primary, MOCK_SERVER_FAIL_NONE, 0);
+  ok (mongo_sync_cmd_ping (conn) == TRUE,
+      "Failures can be turned off");
+
+  bson_free (b);
+  mongo_sync_disconnect (conn);
+  mock_server_free (secondary);
+  mock_server_free (primary);
+}
+
+RUN_TEST (15, func_mongo_mock_failover);
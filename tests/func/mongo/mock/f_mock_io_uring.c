@@ -0,0 +1,128 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <dirent.h>
+
+#define N_DOCS 2000
+#define N_CONNS 4
+
+static gint
+_count_fds (void)
+{
+  DIR *dir;
+  gint n = 0;
+
+  dir = opendir ("/proc/self/fd");
+  if (!dir)
+    return -1;
+  while (readdir (dir))
+    n++;
+  closedir (dir);
+  return n;
+}
+
+void
+test_func_mongo_mock_io_uring (void)
+{
+  mock_server *server;
+  mongo_sync_connection *conn, *conns[N_CONNS];
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+  bson *b, *docs[N_DOCS];
+  gint64 start;
+  gint32 i, n, fds;
+
+  server = mock_server_new ();
+
+  ok (mongo_transport_set_default (MONGO_TRANSPORT_IO_URING),
+      "The io_uring transport can be selected");
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (server),
+			     FALSE);
+  ok (conn != NULL,
+      "Connecting with the io_uring transport works");
+
+  skip (mongo_connection_get_transport ((mongo_connection *)conn) !=
+	MONGO_TRANSPORT_IO_URING, 10, "io_uring is not available");
+
+  /* Enough documents for replies larger than the read-ahead buffer. */
+  for (i = 0; i < N_DOCS; i++)
+    {
+      docs[i] = bson_build (BSON_TYPE_INT32, "seq", i,
+			    BSON_TYPE_STRING, "pad",
+			    "................................................",
+			    -1,
+			    BSON_TYPE_NONE);
+      bson_finish (docs[i]);
+    }
+  ok (mongo_sync_cmd_insert_n (conn, "test.uring", N_DOCS,
+			       (const bson **)docs),
+      "Inserting works");
+  for (i = 0; i < N_DOCS; i++)
+    bson_free (docs[i]);
+
+  ok (mongo_sync_cmd_count (conn, "test", "uring", NULL) == N_DOCS,
+      "Counting works");
+
+  b = bson_new ();
+  bson_finish (b);
+  p = mongo_sync_cmd_query (conn, "test.uring", 0, 0, N_DOCS, b, NULL);
+  bson_free (b);
+  cursor = mongo_sync_cursor_new (conn, "test.uring", p);
+  n = 0;
+  while (mongo_sync_cursor_next (cursor))
+    n++;
+  mongo_sync_cursor_free (cursor);
+  cmp_ok (n, "==", N_DOCS,
+	  "Large batches are received whole");
+
+  for (i = 0; i < 100; i++)
+    if (!mongo_sync_cmd_ping (conn))
+      break;
+  cmp_ok (i, "==", 100,
+	  "Many small round trips work");
+
+  mock_server_fail (server, MOCK_SERVER_FAIL_DISCONNECT, 1);
+  ok (mongo_sync_cmd_ping (conn) == FALSE,
+      "A broken connection is noticed");
+  mongo_sync_conn_set_auto_reconnect (conn, TRUE);
+  b = bson_build (BSON_TYPE_INT32, "seq", -1, BSON_TYPE_NONE);
+  bson_finish (b);
+  ok (mongo_sync_cmd_insert (conn, "test.uring", b, NULL) == TRUE,
+      "Auto-reconnect recovers from a disconnect");
+  bson_free (b);
+  cmp_ok (mongo_connection_get_transport ((mongo_connection *)conn), "==",
+	  MONGO_TRANSPORT_IO_URING,
+	  "The reconnected connection keeps using io_uring");
+
+  mongo_sync_conn_set_auto_reconnect (conn, FALSE);
+  mongo_connection_set_timeout ((mongo_connection *)conn, 200);
+  mock_server_fail (server, MOCK_SERVER_FAIL_HANG, 1);
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_cmd_ping (conn) == FALSE,
+      "A hanging server makes commands time out");
+  ok (g_get_monotonic_time () - start < 2 * G_USEC_PER_SEC,
+      "The timeout is honoured");
+
+  /* The ring of this thread is set up already, further connections
+     only add their socket, and the one the mock server accepted. */
+  fds = _count_fds ();
+  for (i = 0; i < N_CONNS; i++)
+    {
+      conns[i] = mongo_sync_connect ("127.0.0.1",
+				     mock_server_get_port (server), FALSE);
+      mongo_sync_cmd_ping (conns[i]);
+    }
+  cmp_ok (_count_fds () - fds, "==", 2 * N_CONNS,
+	  "Connections share the ring of their thread");
+  for (i = 0; i < N_CONNS; i++)
+    mongo_sync_disconnect (conns[i]);
+
+  endskip;
+
+  mongo_sync_disconnect (conn);
+  mongo_transport_set_default (MONGO_TRANSPORT_SOCKET);
+  mock_server_free (server);
+}
+
+RUN_TEST (12, func_mongo_mock_io_uring);
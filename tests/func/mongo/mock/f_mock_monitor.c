@@ -0,0 +1,151 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <string.h>
+
+/* Wait until the monitor reports the given primary. */
+static const mongo_sync_server_info *
+_wait_for_primary (mongo_sync_topology_monitor *monitor, gint port,
+		   mongo_sync_topology_snapshot **snapshot)
+{
+  const mongo_sync_server_info *primary;
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  *snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  for (;;)
+    {
+      primary = mongo_sync_topology_snapshot_get_primary (*snapshot);
+      if ((primary && primary->port == port) ||
+	  g_get_monotonic_time () > deadline)
+	return primary;
+
+      mongo_sync_topology_monitor_wait
+	(monitor, mongo_sync_topology_snapshot_get_generation (*snapshot),
+	 100);
+      mongo_sync_topology_snapshot_unref (*snapshot);
+      *snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+    }
+}
+
+void
+test_func_mongo_mock_monitor (void)
+{
+  mock_server *primary, *secondary;
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot;
+  const mongo_sync_server_info *servers, *p;
+  mongo_sync_connection *conn, *alias;
+  mongo_connection_stats stats;
+  const gchar *hosts[3];
+  gint pport, sport, i;
+  gint64 deadline;
+  guint inserts;
+  bson *b;
+
+  primary = mock_server_new ();
+  secondary = mock_server_new ();
+  pport = mock_server_get_port (primary);
+  sport = mock_server_get_port (secondary);
+
+  hosts[0] = mock_server_get_address (primary);
+  hosts[1] = mock_server_get_address (secondary);
+  hosts[2] = NULL;
+
+  mock_server_set_replica_set (primary, "mock", hosts[0], hosts);
+  mock_server_set_replica_set (secondary, "mock", hosts[0], hosts);
+  mock_server_set_primary (secondary, FALSE);
+
+  /* Discovery */
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", sport, 200);
+  p = _wait_for_primary (monitor, pport, &snapshot);
+  ok (p != NULL && p->port == pport,
+      "The monitor discovers the primary through a secondary");
+  cmp_ok (mongo_sync_topology_snapshot_get_servers (snapshot, &servers),
+	  "==", 2,
+	  "The monitor discovers every member");
+  ok (servers[0].role == MONGO_SYNC_SERVER_SECONDARY &&
+      strcmp (servers[0].set_name, "mock") == 0 &&
+      servers[0].config_version == 1,
+      "Snapshots carry the role and configuration of the members");
+  mongo_sync_topology_snapshot_unref (snapshot);
+
+  /* Subscribed connections trust the monitor */
+  conn = mongo_sync_connect ("127.0.0.1", pport, FALSE);
+  ok (mongo_sync_conn_set_topology_monitor (conn, monitor),
+      "Subscribing a connection works");
+
+  b = bson_build (BSON_TYPE_INT32, "f_mock_monitor", 1, BSON_TYPE_NONE);
+  bson_finish (b);
+
+  for (i = 0; i < 10; i++)
+    mongo_sync_cmd_insert (conn, "test.mock", b, NULL);
+  mongo_connection_get_stats ((mongo_connection *)conn, &stats);
+  cmp_ok (stats.is_master_checks, "==", 0,
+	  "Writes on a subscribed connection need no ismaster commands");
+  mongo_sync_cmd_ping (conn);
+  cmp_ok (mock_server_get_op_count (primary, 2002 /* insert */), "==", 10,
+	  "The writes went to the primary");
+
+  /* A connection made to the primary under another name */
+  alias = mongo_sync_connect ("localhost", pport, FALSE);
+  mongo_sync_conn_set_topology_monitor (alias, monitor);
+  ok (mongo_sync_cmd_insert (alias, "test.mock", b, NULL),
+      "Writes work on a connection to an alias of the primary");
+  mongo_sync_disconnect (alias);
+
+  /* Failover */
+  mock_server_set_replica_set (primary, "mock", hosts[1], hosts);
+  mock_server_set_replica_set (secondary, "mock", hosts[1], hosts);
+  mock_server_set_primary (primary, FALSE);
+  mock_server_set_primary (secondary, TRUE);
+
+  p = _wait_for_primary (monitor, sport, &snapshot);
+  ok (p != NULL && p->port == sport,
+      "The monitor notices the failover");
+  mongo_sync_topology_snapshot_unref (snapshot);
+
+  inserts = mock_server_get_op_count (primary, 2002 /* insert */);
+  ok (mongo_sync_cmd_insert (conn, "test.mock", b, NULL) == FALSE,
+      "Without auto-reconnect, writes fail once the primary moved");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  mongo_sync_conn_set_auto_reconnect (conn, TRUE);
+  ok (mongo_sync_cmd_insert (conn, "test.mock", b, NULL),
+      "With auto-reconnect, writes follow the primary");
+  mongo_sync_cmd_ping (conn);
+  cmp_ok (mock_server_get_op_count (secondary, 2002 /* insert */), "==", 1,
+	  "The write went to the new primary");
+  cmp_ok (mock_server_get_op_count (primary, 2002 /* insert */), "==", inserts,
+	  "...and not to the old one");
+
+  /* Members removed from the set are dropped */
+  hosts[0] = mock_server_get_address (secondary);
+  hosts[1] = NULL;
+  mock_server_set_replica_set (primary, "mock", hosts[0], hosts);
+  mock_server_set_replica_set (secondary, "mock", hosts[0], hosts);
+  deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  while (mongo_sync_topology_snapshot_get_servers (snapshot, &servers) != 1 &&
+	 g_get_monotonic_time () < deadline)
+    {
+      mongo_sync_topology_monitor_wait
+	(monitor, mongo_sync_topology_snapshot_get_generation (snapshot), 100);
+      mongo_sync_topology_snapshot_unref (snapshot);
+      snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+    }
+  ok (mongo_sync_topology_snapshot_get_servers (snapshot, &servers) == 1 &&
+      servers[0].port == sport,
+      "Members the primary no longer lists are dropped");
+  mongo_sync_topology_snapshot_unref (snapshot);
+
+  bson_free (b);
+  mongo_sync_disconnect (conn);
+  mongo_sync_topology_monitor_free (monitor);
+  mock_server_free (secondary);
+  mock_server_free (primary);
+}
+
+RUN_TEST (14, func_mongo_mock_monitor);
@@ -0,0 +1,79 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#define PRODUCERS 4
+#define DOCS_PER_PRODUCER 250
+
+static gpointer
+_producer (gpointer data)
+{
+  mongo_sync_write_queue *queue = (mongo_sync_write_queue *)data;
+  bson *b;
+  gint i;
+
+  for (i = 0; i < DOCS_PER_PRODUCER; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      mongo_sync_write_queue_push (queue, b);
+      bson_free (b);
+    }
+  return NULL;
+}
+
+void
+test_func_mongo_mock_queue (void)
+{
+  mock_server *server;
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  mongo_sync_write_queue_stats stats;
+  GThread *threads[PRODUCERS];
+  bson *b;
+  gint i;
+
+  server = mock_server_new ();
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (server),
+			     FALSE);
+
+  queue = mongo_sync_write_queue_new (conn, "test.queue", 64);
+  ok (queue != NULL,
+      "mongo_sync_write_queue_new() works");
+
+  for (i = 0; i < PRODUCERS; i++)
+    threads[i] = g_thread_new ("producer", _producer, queue);
+  for (i = 0; i < PRODUCERS; i++)
+    g_thread_join (threads[i]);
+
+  ok (mongo_sync_write_queue_flush (queue),
+      "mongo_sync_write_queue_flush() works");
+  mongo_sync_write_queue_get_stats (queue, &stats);
+  cmp_ok (stats.written, "==", PRODUCERS * DOCS_PER_PRODUCER,
+	  "Every document from every producer was written");
+  ok (stats.failed == 0 && stats.dropped == 0 && stats.pending == 0,
+      "Nothing failed, got dropped, or is left pending");
+  ok (mock_server_get_op_count (server, 2002 /* insert */) <
+      PRODUCERS * DOCS_PER_PRODUCER,
+      "Documents are batched into fewer inserts");
+
+  for (i = 0; i < 10; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+      mongo_sync_write_queue_push (queue, b);
+      bson_free (b);
+    }
+  mongo_sync_write_queue_free (queue, TRUE);
+
+  cmp_ok (mongo_sync_cmd_count (conn, "test", "queue", NULL), "==",
+	  PRODUCERS * DOCS_PER_PRODUCER + 10,
+	  "Freeing a queue drains it, and the connection is usable again");
+
+  mongo_sync_disconnect (conn);
+  mock_server_free (server);
+}
+
+RUN_TEST (6, func_mongo_mock_queue);
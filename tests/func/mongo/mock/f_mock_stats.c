@@ -0,0 +1,83 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+void
+test_func_mongo_mock_stats (void)
+{
+  mock_server *server;
+  mongo_sync_connection *conn;
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *pc;
+  mongo_connection_stats stats;
+  mongo_connection_stats before;
+  const gchar *hosts[2];
+  bson *b;
+
+  server = mock_server_new ();
+  conn = mongo_sync_connect ("127.0.0.1", mock_server_get_port (server),
+			     FALSE);
+  mongo_sync_conn_set_safe_mode (conn, TRUE);
+
+  b = bson_build (BSON_TYPE_INT32, "f_mock_stats", 1, BSON_TYPE_NONE);
+  bson_finish (b);
+
+  mongo_sync_cmd_insert (conn, "test.mock", b, NULL);
+  mongo_sync_cmd_insert (conn, "test.mock", b, NULL);
+  mongo_sync_cmd_is_master (conn);
+
+  mongo_connection_get_stats ((mongo_connection *)conn, &stats);
+  cmp_ok ((gint)stats.ops[MONGO_CONNECTION_STATS_OP_INSERT], "==", 2,
+	  "Inserts are counted");
+  cmp_ok ((gint)stats.get_last_error_calls, "==", 2,
+	  "Safe mode getLastError calls are counted");
+  /* Safe mode inserts without slaveok check for a master first. */
+  cmp_ok ((gint)stats.is_master_checks, "==", 3,
+	  "ismaster checks are counted");
+  cmp_ok ((gint)stats.round_trips, "==", 5,
+	  "Round trips are counted");
+  cmp_ok ((gint)stats.latency.count, "==", 5,
+	  "The latency of every round trip is recorded");
+  ok (stats.bytes_sent > 0 && stats.bytes_received > 0,
+      "Bytes sent and received are counted");
+
+  /* Make the server a single member replica set, so the client knows
+     where to reconnect to. */
+  hosts[0] = mock_server_get_address (server);
+  hosts[1] = NULL;
+  mock_server_set_replica_set (server, "mock", hosts[0], hosts);
+  mongo_sync_cmd_is_master (conn);
+
+  mock_server_fail (server, MOCK_SERVER_FAIL_DISCONNECT, 1);
+  mongo_sync_cmd_ping (conn);
+  mongo_sync_reconnect (conn, FALSE);
+  mongo_connection_get_stats ((mongo_connection *)conn, &stats);
+  cmp_ok ((gint)stats.reconnects, "==", 1,
+	  "Reconnects are counted, and statistics survive them");
+  cmp_ok ((gint)stats.ops[MONGO_CONNECTION_STATS_OP_INSERT], "==", 2,
+	  "Statistics are kept across reconnects");
+
+  mongo_sync_disconnect (conn);
+  bson_free (b);
+
+  pool = mongo_sync_pool_new ("127.0.0.1", mock_server_get_port (server),
+			      2, 0);
+  mongo_sync_pool_get_stats (pool, &before);
+  pc = mongo_sync_pool_pick (pool, TRUE);
+  mongo_sync_cmd_ping ((mongo_sync_connection *)pc);
+  mongo_sync_pool_return (pool, pc);
+  pc = mongo_sync_pool_pick (pool, TRUE);
+  mongo_sync_cmd_ping ((mongo_sync_connection *)pc);
+  mongo_sync_pool_return (pool, pc);
+
+  ok (mongo_sync_pool_get_stats (pool, &stats),
+      "mongo_sync_pool_get_stats() works");
+  cmp_ok ((gint)stats.ops[MONGO_CONNECTION_STATS_OP_QUERY], "==",
+	  (gint)before.ops[MONGO_CONNECTION_STATS_OP_QUERY] + 2,
+	  "Pool statistics sum up the connections of the pool");
+
+  mongo_sync_pool_free (pool);
+  mock_server_free (server);
+}
+
+RUN_TEST (10, func_mongo_mock_stats);
@@ -0,0 +1,102 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_func_mongo_mock_topology (void)
+{
+  mock_server *primary, *secondary;
+  mongo_sync_connection *conn, *other;
+  mongo_sync_server_info info, *servers;
+  const gchar *hosts[3];
+  gint pport, sport;
+  guint pcount, scount;
+
+  primary = mock_server_new ();
+  secondary = mock_server_new ();
+  pport = mock_server_get_port (primary);
+  sport = mock_server_get_port (secondary);
+
+  hosts[0] = mock_server_get_address (primary);
+  hosts[1] = mock_server_get_address (secondary);
+  hosts[2] = NULL;
+
+  mock_server_set_replica_set (primary, "mock", hosts[0], hosts);
+  mock_server_set_replica_set (secondary, "mock", hosts[0], hosts);
+  mock_server_set_primary (secondary, FALSE);
+
+  /* Discovery through a secondary */
+  conn = mongo_sync_connect ("127.0.0.1", sport, TRUE);
+  mongo_sync_cmd_is_master (conn);
+
+  ok (mongo_sync_server_lookup ("127.0.0.1", sport, &info) &&
+      info.role == MONGO_SYNC_SERVER_SECONDARY,
+      "The topology table records the role of a server");
+  ok (strcmp (info.set_name, "mock") == 0 && info.config_version == 1,
+      "The topology table records the replica set configuration");
+  ok (info.rtt >= 0 && info.last_seen > 0,
+      "The topology table records when the server was seen");
+  ok (mongo_sync_server_lookup ("127.0.0.1", pport, &info) &&
+      info.role == MONGO_SYNC_SERVER_UNKNOWN,
+      "Members learned from the host list are in the table too");
+
+  cmp_ok (mongo_sync_conn_get_servers (conn, &servers), "==", 2,
+	  "The connection knows about both members");
+  ok (servers[0].port == pport,
+      "The advertised primary is the first candidate");
+  g_free (servers);
+
+  ok (mongo_sync_reconnect (conn, TRUE) == conn,
+      "Reconnecting to the primary works");
+  ok (mongo_sync_server_lookup ("127.0.0.1", pport, &info) &&
+      info.role == MONGO_SYNC_SERVER_PRIMARY,
+      "The primary is known to the topology table afterwards");
+
+  /* A second connection benefits from what the first learned */
+  other = mongo_sync_connect ("127.0.0.1", sport, TRUE);
+  mongo_sync_cmd_is_master (other);
+
+  pcount = mock_server_get_connection_count (primary);
+  scount = mock_server_get_connection_count (secondary);
+  ok (mongo_sync_reconnect (other, TRUE) == other,
+      "Reconnecting a second connection works");
+  cmp_ok (mock_server_get_connection_count (primary), "==", pcount + 1,
+	  "The second connection went straight to the known primary");
+  cmp_ok (mock_server_get_connection_count (secondary), "==", scount,
+	  "...without probing the rest of the set");
+
+  /* Failover */
+  mock_server_set_replica_set (primary, "mock", hosts[1], hosts);
+  mock_server_set_replica_set (secondary, "mock", hosts[1], hosts);
+  mock_server_set_primary (primary, FALSE);
+  mock_server_set_primary (secondary, TRUE);
+
+  ok (mongo_sync_reconnect (other, TRUE) == other &&
+      mongo_sync_cmd_is_master (other),
+      "Reconnecting after a failover finds the new primary");
+
+  cmp_ok (mongo_sync_conn_get_servers (conn, &servers), "==", 2,
+	  "The first connection still knows about both members");
+  ok (servers[0].port == sport &&
+      servers[0].role == MONGO_SYNC_SERVER_PRIMARY &&
+      servers[1].role != MONGO_SYNC_SERVER_PRIMARY,
+      "The failover seen by one connection is visible to the other");
+  g_free (servers);
+
+  pcount = mock_server_get_connection_count (primary);
+  ok (mongo_sync_reconnect (conn, TRUE) == conn &&
+      mongo_sync_cmd_is_master (conn),
+      "The first connection follows the failover");
+  cmp_ok (mock_server_get_connection_count (primary), "==", pcount,
+	  "...without connecting to the old primary again");
+
+  mongo_sync_disconnect (other);
+  mongo_sync_disconnect (conn);
+  mock_server_free (secondary);
+  mock_server_free (primary);
+}
+
+RUN_TEST (16, func_mongo_mock_topology);
@@ -0,0 +1,103 @@
+#include "test.h"
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#define N_DOCS 100
+
+void
+test_func_mongo_mock_unix (void)
+{
+  mock_server *server;
+  mongo_connection *c;
+  mongo_sync_connection *conn;
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *pc;
+  mongo_sync_server_info info;
+  bson *b, *docs[N_DOCS];
+  gchar *path, *host;
+  const gchar *hosts[2];
+  gint port = 27017;
+  gint32 i;
+
+  path = g_strdup_printf ("/tmp/lmc-mock-%d.sock", (int)getpid ());
+  server = mock_server_new_unix (path);
+
+  ok (mongo_util_parse_addr (mock_server_get_address (server), &host,
+			     &port) &&
+      g_str_equal (host, path),
+      "The address of the server parses as a socket path");
+  g_free (host);
+
+  c = mongo_connect (path, 0);
+  ok (c != NULL,
+      "mongo_connect() to a Unix socket path works");
+  mongo_disconnect (c);
+
+  c = mongo_connect_timeout ("/tmp/lmc-mock-nonexistent.sock", 0, 100);
+  ok (c == NULL,
+      "Connecting to a missing socket fails");
+
+  conn = mongo_sync_connect (path, 0, FALSE);
+  ok (conn != NULL,
+      "mongo_sync_connect() to a Unix socket path works");
+
+  for (i = 0; i < N_DOCS; i++)
+    {
+      docs[i] = bson_build (BSON_TYPE_INT32, "seq", i, BSON_TYPE_NONE);
+      bson_finish (docs[i]);
+    }
+  ok (mongo_sync_cmd_insert_n (conn, "test.unix", N_DOCS,
+			       (const bson **)docs),
+      "Inserting over a Unix socket works");
+  for (i = 0; i < N_DOCS; i++)
+    bson_free (docs[i]);
+  ok (mongo_sync_cmd_count (conn, "test", "unix", NULL) == N_DOCS,
+      "Counting over a Unix socket works");
+
+  mock_server_fail (server, MOCK_SERVER_FAIL_DISCONNECT, 1);
+  ok (mongo_sync_cmd_ping (conn) == FALSE,
+      "A broken connection is noticed");
+  mongo_sync_conn_set_auto_reconnect (conn, TRUE);
+  b = bson_build (BSON_TYPE_INT32, "seq", -1, BSON_TYPE_NONE);
+  bson_finish (b);
+  ok (mongo_sync_cmd_insert (conn, "test.unix", b, NULL) == TRUE,
+      "Auto-reconnect works over a Unix socket");
+  bson_free (b);
+  mongo_sync_disconnect (conn);
+
+  /* A replica set member reporting itself by its socket path. */
+  hosts[0] = path;
+  hosts[1] = NULL;
+  mock_server_set_replica_set (server, "rs0", path, hosts);
+  conn = mongo_sync_connect (path, 0, TRUE);
+  ok (mongo_sync_cmd_is_master (conn),
+      "The primary is found through its socket path");
+  conn = mongo_sync_reconnect (conn, TRUE);
+  ok (conn != NULL,
+      "Reconnecting to a member listed by path works");
+  ok (mongo_sync_server_lookup (path, 27017, &info) &&
+      g_str_equal (info.host, path),
+      "The port of socket paths is ignored in the topology");
+  mongo_sync_disconnect (conn);
+
+  pool = mongo_sync_pool_new (path, 0, 2, 0);
+  ok (pool != NULL,
+      "mongo_sync_pool_new() with a Unix socket path works");
+  pc = mongo_sync_pool_pick (pool, TRUE);
+  ok (pc != NULL &&
+      mongo_sync_cmd_count ((mongo_sync_connection *)pc, "test", "unix",
+			    NULL) == N_DOCS + 1,
+      "Pooled connections work over a Unix socket");
+  mongo_sync_pool_return (pool, pc);
+  mongo_sync_pool_free (pool);
+
+  mock_server_free (server);
+  ok (access (path, F_OK) != 0,
+      "The socket is removed with the server");
+  g_free (path);
+}
+
+RUN_TEST (14, func_mongo_mock_unix);
@@ -0,0 +1,64 @@
+#include "test.h"
+#include <mongo.h>
+
+#include <errno.h>
+
+void
+test_func_mongo_sync_cursor_exhaust (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  bson *b;
+  gint i, n = 0;
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port,
+			     FALSE);
+  mongo_sync_conn_set_auto_reconnect (conn, TRUE);
+
+  b = bson_new ();
+  bson_append_string (b, "test-name", __FILE__, -1);
+  bson_finish (b);
+  mongo_sync_cmd_delete (conn, config.ns, 0, b);
+  bson_free (b);
+
+  b = bson_new ();
+  for (i = 0; i < 40; i++)
+    {
+      bson_reset (b);
+      bson_append_string (b, "test-name", __FILE__, -1);
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+
+      mongo_sync_cmd_insert (conn, config.ns, b, NULL);
+    }
+  bson_free (b);
+
+  b = bson_new ();
+  bson_append_string (b, "test-name", __FILE__, -1);
+  bson_finish (b);
+
+  cursor = mongo_sync_cursor_new_exhaust (conn, config.ns, 0, 0, 3, b, NULL);
+  ok (cursor != NULL,
+      "mongo_sync_cursor_new_exhaust() works");
+
+  while (mongo_sync_cursor_next (cursor))
+    n++;
+  cmp_ok (n, "==", 40,
+	  "An exhaust cursor streams all batches");
+  mongo_sync_cursor_free (cursor);
+
+  ok (mongo_sync_cmd_count (conn, config.db, config.coll, b) == 40,
+      "The connection is usable after a complete exhaust scan");
+
+  cursor = mongo_sync_cursor_new_exhaust (conn, config.ns, 0, 0, 3, b, NULL);
+  mongo_sync_cursor_next (cursor);
+  mongo_sync_cursor_free (cursor);
+
+  ok (mongo_sync_cmd_count (conn, config.db, config.coll, b) == 40,
+      "The connection recovers after stopping an exhaust scan early");
+  bson_free (b);
+
+  mongo_sync_disconnect (conn);
+}
+
+RUN_NET_TEST (4, func_mongo_sync_cursor_exhaust);
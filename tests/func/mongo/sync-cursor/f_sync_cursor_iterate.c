@@ -0,0 +1,88 @@
+#include "test.h"
+#include <mongo.h>
+
+#include <errno.h>
+
+void
+test_func_mongo_sync_cursor_iterate (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+  bson *b;
+  gint i, n = 0;
+  gboolean in_order = TRUE;
+
+  conn = mongo_sync_connect (config.primary_host, config.primary_port,
+			     FALSE);
+
+  b = bson_new ();
+  bson_append_string (b, "test-name", __FILE__, -1);
+  bson_finish (b);
+  mongo_sync_cmd_delete (conn, config.ns, 0, b);
+  bson_free (b);
+
+  b = bson_new ();
+  for (i = 0; i < 40; i++)
+    {
+      bson_reset (b);
+      bson_append_string (b, "test-name", __FILE__, -1);
+      bson_append_int32 (b, "seq", i);
+      bson_finish (b);
+
+      mongo_sync_cmd_insert (conn, config.ns, b, NULL);
+    }
+  bson_free (b);
+
+  b = bson_new ();
+  bson_append_string (b, "test-name", __FILE__, -1);
+  bson_finish (b);
+
+  p = mongo_sync_cmd_query (conn, config.ns, 0, 0, 3, b, NULL);
+  bson_free (b);
+
+  cursor = mongo_sync_cursor_new (conn, config.ns, p);
+  ok (cursor != NULL,
+      "mongo_sync_cursor_new() works with a query result");
+
+  while (mongo_sync_cursor_next (cursor))
+    {
+      bson_cursor *c;
+      gint32 seq;
+
+      b = mongo_sync_cursor_get_data (cursor);
+      c = bson_find (b, "seq");
+      if (!bson_cursor_get_int32 (c, &seq) || seq != n)
+	in_order = FALSE;
+      bson_cursor_free (c);
+      bson_free (b);
+      n++;
+    }
+
+  cmp_ok (errno, "==", ENOENT,
+	  "Iteration ends because there are no more results");
+  cmp_ok (n, "==", 40,
+	  "mongo_sync_cursor_next() iterates over all batches");
+  ok (in_order == TRUE,
+      "The documents arrive in order");
+
+  mongo_sync_cursor_free (cursor);
+
+  /* Stopping early, while a getMore is in flight. */
+  b = bson_new ();
+  bson_append_string (b, "test-name", __FILE__, -1);
+  bson_finish (b);
+  p = mongo_sync_cmd_query (conn, config.ns, 0, 0, 3, b, NULL);
+
+  cursor = mongo_sync_cursor_new (conn, config.ns, p);
+  mongo_sync_cursor_next (cursor);
+  mongo_sync_cursor_free (cursor);
+
+  ok (mongo_sync_cmd_count (conn, config.db, config.coll, b) == 40,
+      "The connection is usable after freeing a cursor early");
+  bson_free (b);
+
+  mongo_sync_disconnect (conn);
+}
+
+RUN_NET_TEST (5, func_mongo_sync_cursor_iterate);
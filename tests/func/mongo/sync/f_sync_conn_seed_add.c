@@ -7,17 +7,11 @@ void
 test_func_mongo_sync_conn_seed_add (void)
 {
   mongo_sync_connection *conn;
-  GList *l;
 
   conn = mongo_sync_connect (config.primary_host, config.primary_port,
 			     FALSE);
   close (conn->super.fd);
-  l = conn->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
+  g_list_free (conn->rs.hosts);
   conn->rs.hosts = NULL;
 
   conn = mongo_sync_reconnect (conn, TRUE);
@@ -27,12 +21,7 @@ test_func_mongo_sync_conn_seed_add (void)
   conn = mongo_sync_connect (config.primary_host, config.primary_port,
 			     FALSE);
   close (conn->super.fd);
-  l = conn->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
+  g_list_free (conn->rs.hosts);
   conn->rs.hosts = NULL;
 
   ok (mongo_sync_conn_seed_add (conn, config.primary_host,
@@ -4,6 +4,10 @@
 
 #include <glib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "libmongo-private.h"
 
@@ -106,6 +110,51 @@ test_mongo_wire_generate_reply (gboolean valid, gint32 nreturn,
   return p;
 }
 
+mongo_packet *
+test_mongo_wire_generate_cursor_reply (gint32 resp_to, gint64 cursor_id,
+				       gint32 start, gint32 nreturn)
+{
+  mongo_reply_packet_header rh;
+  mongo_packet_header h;
+  mongo_packet *p;
+  GByteArray *data;
+  gint32 i;
+
+  data = g_byte_array_new ();
+
+  rh.flags = 0;
+  rh.cursor_id = GINT64_TO_LE (cursor_id);
+  rh.start = GINT32_TO_LE (start);
+  rh.returned = GINT32_TO_LE (nreturn);
+  g_byte_array_append (data, (const guint8 *)&rh,
+		       sizeof (mongo_reply_packet_header));
+
+  for (i = 0; i < nreturn; i++)
+    {
+      bson *b;
+
+      b = bson_new ();
+      bson_append_int32 (b, "seq", start + i);
+      bson_finish (b);
+      g_byte_array_append (data, bson_data (b), bson_size (b));
+      bson_free (b);
+    }
+
+  p = mongo_wire_packet_new ();
+
+  h.opcode = 1;
+  h.id = 1984;
+  h.resp_to = resp_to;
+  h.length = sizeof (mongo_packet_header) + data->len;
+  mongo_wire_packet_set_header (p, &h);
+
+  if (data->len > 0)
+    mongo_wire_packet_set_data (p, data->data, data->len);
+  g_byte_array_free (data, TRUE);
+
+  return p;
+}
+
 mongo_sync_connection *
 test_make_fake_sync_conn (gint fd, gboolean slaveok)
 {
@@ -120,10 +169,37 @@ test_make_fake_sync_conn (gint fd, gboolean slaveok)
   c->safe_mode = FALSE;
   c->auto_reconnect = FALSE;
   c->max_insert_size = MONGO_SYNC_DEFAULT_MAX_INSERT_SIZE;
+  c->reconnect_timeout = MONGO_SYNC_DEFAULT_RECONNECT_TIMEOUT;
 
   return c;
 }
 
+gint
+test_make_listener (gint *port)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof (sa);
+  gint fd;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (fd, (struct sockaddr *)&sa, sizeof (sa)) != 0 ||
+      listen (fd, 16) != 0 ||
+      getsockname (fd, (struct sockaddr *)&sa, &len) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  *port = ntohs (sa.sin_port);
+  return fd;
+}
+
 gboolean
 test_env_setup (void)
 {
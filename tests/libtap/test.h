@@ -66,8 +66,13 @@ bson *test_bson_generate_full (void);
 mongo_packet *test_mongo_wire_generate_reply (gboolean valid,
 					      gint32 nreturn,
 					      gboolean with_docs);
+mongo_packet *test_mongo_wire_generate_cursor_reply (gint32 resp_to,
+						     gint64 cursor_id,
+						     gint32 start,
+						     gint32 nreturn);
 mongo_sync_connection *test_make_fake_sync_conn (gint fd,
 						 gboolean slaveok);
+gint test_make_listener (gint *port);
 
 #define SAVE_OLD_FUNC(n)				\
   static void *(*func_##n)();				\
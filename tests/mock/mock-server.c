@@ -0,0 +1,1524 @@
+/* mock-server.c - In-process MongoDB stand-in for tests and benchmarks
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file tests/mock/mock-server.c
+ * In-process MongoDB stand-in implementation.
+ */
+
+#include "mock-server.h"
+#include "mongo.h"
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/** @internal Number of documents returned when the client does not
+ * ask for a specific number. */
+#define MOCK_SERVER_DEFAULT_BATCH 101
+/** @internal How long an await-data getMore waits for new data, in
+ * milliseconds. */
+#define MOCK_SERVER_AWAIT_TIME 100
+
+/** @internal Read the size of an embedded document. */
+#define MOCK_DOC_SIZE(doc,pos) GINT32_FROM_LE (*(gint32 *)(&(doc)[pos]))
+
+/** @internal Wire protocol opcodes the server understands. */
+enum
+  {
+    MOCK_OP_REPLY = 1,
+    MOCK_OP_UPDATE = 2001,
+    MOCK_OP_INSERT = 2002,
+    MOCK_OP_QUERY = 2004,
+    MOCK_OP_GET_MORE = 2005,
+    MOCK_OP_DELETE = 2006,
+    MOCK_OP_KILL_CURSORS = 2007
+  };
+
+/** @internal A reference counted document in the store. */
+typedef struct
+{
+  gint ref; /**< Reference count. */
+  bson *b; /**< The document itself. */
+} mock_doc;
+
+/** @internal A server side cursor. */
+typedef struct
+{
+  gint64 id; /**< The ID of the cursor. */
+  gchar *ns; /**< The namespace the cursor iterates over. */
+  GPtrArray *docs; /**< The matching documents, as mock_doc
+		      references. */
+  guint pos; /**< Index of the next document to return. */
+  gboolean tailable; /**< Whether the cursor is tailable. */
+  bson *query; /**< The query, for tailable cursors to match new
+		  documents with. */
+  guint seen; /**< Number of documents of the collection a tailable
+		 cursor already looked at. */
+} mock_cursor;
+
+/** @internal A client connection. */
+typedef struct
+{
+  mock_server *server; /**< The server the client is connected to. */
+  mongo_connection conn; /**< The connection to the client. */
+  GThread *thread; /**< The thread serving the client. */
+
+  gchar *last_error; /**< The error of the last write, if any. */
+  gint32 last_n; /**< Number of documents the last write touched. */
+} mock_client;
+
+/** @internal The mock server object. */
+struct _mock_server
+{
+  gint fd; /**< The listening socket. */
+  gint port; /**< The port the server listens on. */
+  gchar *address; /**< The address of the server. */
+  gchar *path; /**< The Unix socket path the server listens on, or
+		  NULL. */
+  int wakeup[2]; /**< Pipe to wake up the acceptor thread with. */
+  GThread *acceptor; /**< The thread accepting connections. */
+
+  GMutex lock; /**< Lock protecting everything below. */
+  GCond data_cond; /**< Signalled whenever data is inserted. */
+  gboolean stopping; /**< Whether the server is shutting down. */
+  GList *clients; /**< List of mock_client objects. */
+  guint connections; /**< Number of connections accepted. */
+  guint op_counts[8]; /**< Request counters, indexed by opcode -
+			 2000. */
+
+  GHashTable *collections; /**< Namespace to GPtrArray of mock_doc
+			      mapping. */
+  GHashTable *cursors; /**< Cursor ID to mock_cursor mapping. */
+  gint64 next_cursor_id; /**< The ID of the next cursor. */
+  gint32 next_reply_id; /**< The request ID of the next reply. */
+
+  gboolean primary; /**< Whether the server is a primary. */
+  gchar *set_name; /**< The name of the replica set, if any. */
+  gchar *set_primary; /**< The primary of the replica set, if known. */
+  gchar **set_hosts; /**< The members of the replica set. */
+
+  gint latency; /**< Injected latency, in microseconds. */
+  mock_server_failure failure; /**< Injected failure mode. */
+  gint failure_count; /**< Number of requests left to fail. */
+};
+
+/*
+ * Store helpers.
+ */
+
+static mock_doc *
+_mock_doc_new (bson *b)
+{
+  mock_doc *d;
+
+  d = g_new (mock_doc, 1);
+  d->ref = 1;
+  d->b = b;
+  return d;
+}
+
+static mock_doc *
+_mock_doc_ref (mock_doc *d)
+{
+  g_atomic_int_inc (&d->ref);
+  return d;
+}
+
+static void
+_mock_doc_unref (gpointer data)
+{
+  mock_doc *d = (mock_doc *)data;
+
+  if (g_atomic_int_dec_and_test (&d->ref))
+    {
+      bson_free (d->b);
+      g_free (d);
+    }
+}
+
+static void
+_mock_cursor_free (gpointer data)
+{
+  mock_cursor *c = (mock_cursor *)data;
+
+  g_free (c->ns);
+  g_ptr_array_free (c->docs, TRUE);
+  bson_free (c->query);
+  g_free (c);
+}
+
+static GPtrArray *
+_mock_collection (mock_server *server, const gchar *ns, gboolean create)
+{
+  GPtrArray *coll;
+
+  coll = g_hash_table_lookup (server->collections, ns);
+  if (!coll && create)
+    {
+      coll = g_ptr_array_new_with_free_func (_mock_doc_unref);
+      g_hash_table_insert (server->collections, g_strdup (ns), coll);
+    }
+  return coll;
+}
+
+/*
+ * Query matching.
+ */
+
+/** @internal Compare two BSON values.
+ *
+ * @returns TRUE if the values are comparable, in which case the
+ * result is stored in @a res, FALSE otherwise.
+ */
+static gboolean
+_mock_compare (const bson_cursor *a, const bson_cursor *b, gint *res)
+{
+  bson_type ta = bson_cursor_type (a), tb = bson_cursor_type (b);
+
+#define _NUMERIC(t) ((t) == BSON_TYPE_INT32 || (t) == BSON_TYPE_INT64 || \
+		     (t) == BSON_TYPE_DOUBLE)
+
+  if (_NUMERIC (ta) && _NUMERIC (tb))
+    {
+      gdouble da = 0, db = 0;
+      gint32 i32;
+      gint64 i64;
+
+      if (ta == BSON_TYPE_INT32 && bson_cursor_get_int32 (a, &i32))
+	da = i32;
+      else if (ta == BSON_TYPE_INT64 && bson_cursor_get_int64 (a, &i64))
+	da = i64;
+      else
+	bson_cursor_get_double (a, &da);
+
+      if (tb == BSON_TYPE_INT32 && bson_cursor_get_int32 (b, &i32))
+	db = i32;
+      else if (tb == BSON_TYPE_INT64 && bson_cursor_get_int64 (b, &i64))
+	db = i64;
+      else
+	bson_cursor_get_double (b, &db);
+
+      *res = (da < db) ? -1 : (da > db) ? 1 : 0;
+      return TRUE;
+    }
+#undef _NUMERIC
+
+  if (ta != tb)
+    return FALSE;
+
+  switch (ta)
+    {
+    case BSON_TYPE_STRING:
+      {
+	const gchar *sa, *sb;
+
+	bson_cursor_get_string (a, &sa);
+	bson_cursor_get_string (b, &sb);
+	*res = strcmp (sa, sb);
+	return TRUE;
+      }
+    case BSON_TYPE_OID:
+      {
+	const guint8 *oa, *ob;
+
+	bson_cursor_get_oid (a, &oa);
+	bson_cursor_get_oid (b, &ob);
+	*res = memcmp (oa, ob, 12);
+	return TRUE;
+      }
+    case BSON_TYPE_BOOLEAN:
+      {
+	gboolean ba, bb;
+
+	bson_cursor_get_boolean (a, &ba);
+	bson_cursor_get_boolean (b, &bb);
+	*res = (!!ba) - (!!bb);
+	return TRUE;
+      }
+    case BSON_TYPE_UTC_DATETIME:
+      {
+	gint64 va, vb;
+
+	bson_cursor_get_utc_datetime (a, &va);
+	bson_cursor_get_utc_datetime (b, &vb);
+	*res = (va < vb) ? -1 : (va > vb) ? 1 : 0;
+	return TRUE;
+      }
+    case BSON_TYPE_TIMESTAMP:
+      {
+	gint64 va, vb;
+
+	bson_cursor_get_timestamp (a, &va);
+	bson_cursor_get_timestamp (b, &vb);
+	*res = (va < vb) ? -1 : (va > vb) ? 1 : 0;
+	return TRUE;
+      }
+    case BSON_TYPE_NULL:
+      *res = 0;
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/** @internal Check a single query condition against a field value.
+ *
+ * @param value is the field of the document, or NULL if missing.
+ * @param cond is the condition.
+ */
+static gboolean
+_mock_match_cond (const bson_cursor *value, const bson_cursor *cond)
+{
+  gint res;
+
+  if (bson_cursor_type (cond) == BSON_TYPE_DOCUMENT)
+    {
+      bson *ops;
+      bson_cursor *op;
+      gboolean matched = TRUE, has_ops = FALSE;
+
+      bson_cursor_get_document (cond, &ops);
+      op = bson_cursor_new (ops);
+      while (matched && bson_cursor_next (op))
+	{
+	  const gchar *name = bson_cursor_key (op);
+
+	  if (name[0] != '$')
+	    break;
+	  has_ops = TRUE;
+
+	  if (strcmp (name, "$ne") == 0)
+	    matched = !value || !_mock_compare (value, op, &res) || res != 0;
+	  else if (!value || !_mock_compare (value, op, &res))
+	    matched = FALSE;
+	  else if (strcmp (name, "$gt") == 0)
+	    matched = res > 0;
+	  else if (strcmp (name, "$gte") == 0)
+	    matched = res >= 0;
+	  else if (strcmp (name, "$lt") == 0)
+	    matched = res < 0;
+	  else if (strcmp (name, "$lte") == 0)
+	    matched = res <= 0;
+	  else
+	    matched = FALSE;
+	}
+      bson_cursor_free (op);
+      bson_free (ops);
+
+      if (has_ops)
+	return matched;
+
+      /* Embedded documents are not compared. */
+      return FALSE;
+    }
+
+  if (!value)
+    return bson_cursor_type (cond) == BSON_TYPE_NULL;
+
+  return _mock_compare (value, cond, &res) && res == 0;
+}
+
+static gboolean
+_mock_match (const bson *doc, const bson *query)
+{
+  bson_cursor *q;
+  gboolean matched = TRUE;
+
+  if (!query)
+    return TRUE;
+
+  q = bson_cursor_new (query);
+  while (matched && bson_cursor_next (q))
+    {
+      bson_cursor *v;
+
+      if (bson_cursor_key (q)[0] == '$')
+	continue;
+
+      v = bson_find (doc, bson_cursor_key (q));
+      matched = _mock_match_cond (v, q);
+      bson_cursor_free (v);
+    }
+  bson_cursor_free (q);
+
+  return matched;
+}
+
+/*
+ * Request parsing.
+ */
+
+/** @internal Sequential reader over the body of a request. */
+typedef struct
+{
+  const guint8 *data; /**< The data to read. */
+  gint32 size; /**< Size of the data. */
+  gint32 pos; /**< Current read position. */
+} mock_reader;
+
+static gboolean
+_mock_read_int32 (mock_reader *r, gint32 *i)
+{
+  if (r->pos + (gint32)sizeof (gint32) > r->size)
+    return FALSE;
+  memcpy (i, r->data + r->pos, sizeof (gint32));
+  *i = GINT32_FROM_LE (*i);
+  r->pos += sizeof (gint32);
+  return TRUE;
+}
+
+static gboolean
+_mock_read_int64 (mock_reader *r, gint64 *i)
+{
+  if (r->pos + (gint32)sizeof (gint64) > r->size)
+    return FALSE;
+  memcpy (i, r->data + r->pos, sizeof (gint64));
+  *i = GINT64_FROM_LE (*i);
+  r->pos += sizeof (gint64);
+  return TRUE;
+}
+
+static gboolean
+_mock_read_cstring (mock_reader *r, const gchar **s)
+{
+  const guint8 *end;
+
+  end = memchr (r->data + r->pos, 0, r->size - r->pos);
+  if (!end)
+    return FALSE;
+  *s = (const gchar *)(r->data + r->pos);
+  r->pos = end - r->data + 1;
+  return TRUE;
+}
+
+static gboolean
+_mock_read_bson (mock_reader *r, bson **b)
+{
+  gint32 size;
+
+  if (r->pos + (gint32)sizeof (gint32) > r->size)
+    return FALSE;
+  size = MOCK_DOC_SIZE (r->data, r->pos);
+  if (size < 5 || size > r->size - r->pos)
+    return FALSE;
+
+  *b = bson_new_from_data (r->data + r->pos, size - 1);
+  bson_finish (*b);
+  r->pos += size;
+  return TRUE;
+}
+
+/*
+ * Replies.
+ */
+
+static GByteArray *
+_mock_reply_new (gint32 flags, gint64 cursor_id, gint32 start)
+{
+  GByteArray *reply;
+  mongo_reply_packet_header rh;
+
+  rh.flags = GINT32_TO_LE (flags);
+  rh.cursor_id = GINT64_TO_LE (cursor_id);
+  rh.start = GINT32_TO_LE (start);
+  rh.returned = 0;
+
+  reply = g_byte_array_new ();
+  g_byte_array_append (reply, (const guint8 *)&rh, sizeof (rh));
+  return reply;
+}
+
+static void
+_mock_reply_add (GByteArray *reply, const bson *b)
+{
+  mongo_reply_packet_header *rh = (mongo_reply_packet_header *)reply->data;
+  gint32 returned;
+
+  g_byte_array_append (reply, bson_data (b), bson_size (b));
+
+  rh = (mongo_reply_packet_header *)reply->data;
+  returned = GINT32_FROM_LE (rh->returned) + 1;
+  rh->returned = GINT32_TO_LE (returned);
+}
+
+/** @internal Send a reply, and free it.
+ *
+ * @returns The request ID of the reply, or -1 on error.
+ */
+static gint32
+_mock_reply_send (mock_client *client, gint32 resp_to, GByteArray *reply)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  gboolean sent;
+
+  h.id = g_atomic_int_add (&client->server->next_reply_id, 1);
+  h.resp_to = resp_to;
+  h.opcode = MOCK_OP_REPLY;
+  h.length = sizeof (mongo_packet_header) + reply->len;
+
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_header (p, &h);
+  mongo_wire_packet_set_data (p, reply->data, reply->len);
+  g_byte_array_free (reply, TRUE);
+
+  sent = mongo_packet_send (&client->conn, p);
+  mongo_wire_packet_free (p);
+
+  return (sent) ? h.id : -1;
+}
+
+static gint32
+_mock_reply_error (mock_client *client, gint32 resp_to, const gchar *error)
+{
+  GByteArray *reply;
+  bson *b;
+
+  b = bson_new ();
+  bson_append_string (b, "$err", error, -1);
+  bson_finish (b);
+
+  reply = _mock_reply_new (MONGO_REPLY_FLAG_QUERY_FAIL, 0, 0);
+  _mock_reply_add (reply, b);
+  bson_free (b);
+
+  return _mock_reply_send (client, resp_to, reply);
+}
+
+static gint32
+_mock_reply_doc (mock_client *client, gint32 resp_to, bson *b)
+{
+  GByteArray *reply;
+
+  bson_finish (b);
+  reply = _mock_reply_new (0, 0, 0);
+  _mock_reply_add (reply, b);
+  bson_free (b);
+
+  return _mock_reply_send (client, resp_to, reply);
+}
+
+/*
+ * Commands.
+ */
+
+static void
+_mock_set_last_error (mock_client *client, const gchar *error, gint32 n)
+{
+  g_free (client->last_error);
+  client->last_error = g_strdup (error);
+  client->last_n = n;
+}
+
+static bson *
+_mock_cmd_is_master (mock_server *server)
+{
+  bson *b;
+
+  b = bson_new ();
+  bson_append_boolean (b, "ismaster", server->primary);
+  bson_append_boolean (b, "secondary", !server->primary);
+  bson_append_int32 (b, "maxBsonObjectSize", 16 * 1024 * 1024);
+
+  if (server->set_name)
+    {
+      bson_append_string (b, "setName", server->set_name, -1);
+      bson_append_int32 (b, "setVersion", 1);
+    }
+  if (server->set_hosts)
+    {
+      bson *hosts;
+      gint i;
+
+      hosts = bson_new ();
+      for (i = 0; server->set_hosts[i]; i++)
+	{
+	  gchar *idx = g_strdup_printf ("%d", i);
+
+	  bson_append_string (hosts, idx, server->set_hosts[i], -1);
+	  g_free (idx);
+	}
+      bson_finish (hosts);
+      bson_append_array (b, "hosts", hosts);
+      bson_free (hosts);
+    }
+  if (server->set_primary)
+    bson_append_string (b, "primary", server->set_primary, -1);
+
+  bson_append_double (b, "ok", 1);
+  return b;
+}
+
+static bson *
+_mock_cmd_count (mock_server *server, const gchar *db, const bson *cmd)
+{
+  bson *b, *query = NULL;
+  bson_cursor *c;
+  const gchar *coll = NULL;
+  GPtrArray *docs;
+  gint32 n = 0;
+  guint i;
+
+  c = bson_find (cmd, "count");
+  bson_cursor_get_string (c, &coll);
+  bson_cursor_free (c);
+
+  c = bson_find (cmd, "query");
+  if (c)
+    bson_cursor_get_document (c, &query);
+  bson_cursor_free (c);
+
+  if (coll)
+    {
+      gchar *ns = g_strconcat (db, ".", coll, NULL);
+
+      docs = _mock_collection (server, ns, FALSE);
+      for (i = 0; docs && i < docs->len; i++)
+	if (_mock_match (((mock_doc *)g_ptr_array_index (docs, i))->b,
+			 query))
+	  n++;
+      g_free (ns);
+    }
+  bson_free (query);
+
+  b = bson_new ();
+  bson_append_double (b, "n", n);
+  bson_append_double (b, "ok", 1);
+  return b;
+}
+
+static bson *
+_mock_cmd_drop (mock_server *server, const gchar *db, const bson *cmd)
+{
+  bson *b;
+  bson_cursor *c;
+  const gchar *coll = NULL;
+  gboolean found = FALSE;
+
+  c = bson_find (cmd, "drop");
+  bson_cursor_get_string (c, &coll);
+  bson_cursor_free (c);
+
+  if (coll)
+    {
+      gchar *ns = g_strconcat (db, ".", coll, NULL);
+
+      found = g_hash_table_remove (server->collections, ns);
+      g_free (ns);
+    }
+
+  b = bson_new ();
+  if (!found)
+    bson_append_string (b, "errmsg", "ns not found", -1);
+  bson_append_double (b, "ok", (found) ? 1 : 0);
+  return b;
+}
+
+static gboolean
+_mock_handle_command (mock_client *client, gint32 rid, const gchar *ns,
+		      const bson *cmd)
+{
+  mock_server *server = client->server;
+  bson_cursor *c;
+  const gchar *name;
+  gchar *db;
+  bson *b;
+
+  c = bson_cursor_new (cmd);
+  if (!bson_cursor_next (c))
+    {
+      bson_cursor_free (c);
+      return _mock_reply_error (client, rid, "empty command") != -1;
+    }
+  name = bson_cursor_key (c);
+  db = g_strndup (ns, strlen (ns) - strlen (".$cmd"));
+
+  g_mutex_lock (&server->lock);
+  if (g_ascii_strcasecmp (name, "ismaster") == 0)
+    b = _mock_cmd_is_master (server);
+  else if (strcmp (name, "ping") == 0)
+    {
+      b = bson_new ();
+      bson_append_double (b, "ok", 1);
+    }
+  else if (g_ascii_strcasecmp (name, "getlasterror") == 0)
+    {
+      b = bson_new ();
+      if (client->last_error)
+	bson_append_string (b, "err", client->last_error, -1);
+      else
+	bson_append_null (b, "err");
+      bson_append_int32 (b, "n", client->last_n);
+      bson_append_double (b, "ok", 1);
+    }
+  else if (g_ascii_strcasecmp (name, "reseterror") == 0)
+    {
+      _mock_set_last_error (client, NULL, 0);
+      b = bson_new ();
+      bson_append_double (b, "ok", 1);
+    }
+  else if (strcmp (name, "count") == 0)
+    b = _mock_cmd_count (server, db, cmd);
+  else if (strcmp (name, "drop") == 0)
+    b = _mock_cmd_drop (server, db, cmd);
+  else
+    {
+      b = bson_new ();
+      bson_append_string (b, "errmsg", "no such cmd", -1);
+      bson_append_double (b, "ok", 0);
+    }
+  g_mutex_unlock (&server->lock);
+
+  bson_cursor_free (c);
+  g_free (db);
+
+  return _mock_reply_doc (client, rid, b) != -1;
+}
+
+/*
+ * Operations.
+ */
+
+/** @internal Fill a reply with the next batch of a cursor.
+ *
+ * Must be called with the server lock held.
+ */
+static void
+_mock_cursor_fill (mock_server *server, mock_cursor *cursor, gint32 n,
+		   GByteArray *reply)
+{
+  gint32 i;
+
+  if (cursor->tailable)
+    {
+      GPtrArray *coll = _mock_collection (server, cursor->ns, FALSE);
+      guint j;
+
+      for (j = cursor->seen; coll && j < coll->len; j++)
+	{
+	  mock_doc *d = g_ptr_array_index (coll, j);
+
+	  if (_mock_match (d->b, cursor->query))
+	    g_ptr_array_add (cursor->docs, _mock_doc_ref (d));
+	}
+      if (coll)
+	cursor->seen = coll->len;
+    }
+
+  for (i = 0; i < n && cursor->pos < cursor->docs->len; i++)
+    {
+      mock_doc *d = g_ptr_array_index (cursor->docs, cursor->pos++);
+
+      _mock_reply_add (reply, d->b);
+    }
+}
+
+/** @internal Build the next reply for a cursor.
+ *
+ * Must be called with the server lock held. Drops the cursor if it
+ * is exhausted.
+ */
+static GByteArray *
+_mock_cursor_reply (mock_server *server, mock_cursor *cursor, gint32 n,
+		    gboolean single)
+{
+  GByteArray *reply;
+  gint32 start = cursor->pos;
+  gboolean done;
+
+  reply = _mock_reply_new (0, cursor->id, start);
+  _mock_cursor_fill (server, cursor, n, reply);
+
+  done = single ||
+    (!cursor->tailable && cursor->pos >= cursor->docs->len);
+  if (done)
+    {
+      mongo_reply_packet_header *rh =
+	(mongo_reply_packet_header *)reply->data;
+
+      rh->cursor_id = 0;
+      g_hash_table_remove (server->cursors, &cursor->id);
+    }
+  return reply;
+}
+
+static gboolean
+_mock_handle_query (mock_client *client, gint32 rid, mock_reader *r)
+{
+  mock_server *server = client->server;
+  gint32 flags, skip, ret, n;
+  const gchar *ns;
+  bson *query = NULL, *q;
+  bson_cursor *c;
+  mock_cursor *cursor;
+  GPtrArray *coll;
+  GByteArray *reply;
+  gboolean single;
+  guint i;
+
+  if (!_mock_read_int32 (r, &flags) ||
+      !_mock_read_cstring (r, &ns) ||
+      !_mock_read_int32 (r, &skip) ||
+      !_mock_read_int32 (r, &ret) ||
+      !_mock_read_bson (r, &query))
+    return FALSE;
+
+  if (g_str_has_suffix (ns, ".$cmd"))
+    {
+      gboolean res = _mock_handle_command (client, rid, ns, query);
+
+      bson_free (query);
+      return res;
+    }
+
+  /* Unwrap queries with modifiers. */
+  q = query;
+  c = bson_find (query, "$query");
+  if (!c)
+    c = bson_find (query, "query");
+  if (c && bson_cursor_type (c) == BSON_TYPE_DOCUMENT)
+    {
+      bson_cursor_get_document (c, &q);
+      bson_free (query);
+    }
+  bson_cursor_free (c);
+
+  g_mutex_lock (&server->lock);
+  if (!server->primary && !(flags & MONGO_WIRE_FLAG_QUERY_SLAVE_OK))
+    {
+      g_mutex_unlock (&server->lock);
+      bson_free (q);
+      return _mock_reply_error (client, rid,
+				"not master and slaveok=false") != -1;
+    }
+
+  cursor = g_new0 (mock_cursor, 1);
+  cursor->id = server->next_cursor_id++;
+  cursor->ns = g_strdup (ns);
+  cursor->docs = g_ptr_array_new_with_free_func (_mock_doc_unref);
+  cursor->tailable = (flags & MONGO_WIRE_FLAG_QUERY_TAILABLE_CURSOR);
+
+  coll = _mock_collection (server, ns, FALSE);
+  for (i = 0; coll && i < coll->len; i++)
+    {
+      mock_doc *d = g_ptr_array_index (coll, i);
+
+      if (_mock_match (d->b, q))
+	{
+	  if (skip > 0)
+	    skip--;
+	  else
+	    g_ptr_array_add (cursor->docs, _mock_doc_ref (d));
+	}
+    }
+  if (cursor->tailable)
+    {
+      cursor->query = q;
+      cursor->seen = (coll) ? coll->len : 0;
+
+      /* Like the real thing, do not keep a tailable cursor open on an
+	 empty collection. */
+      if (!coll || coll->len == 0)
+	cursor->tailable = FALSE;
+    }
+  else
+    bson_free (q);
+
+  g_hash_table_insert (server->cursors, &cursor->id, cursor);
+
+  n = (ret == 0) ? MOCK_SERVER_DEFAULT_BATCH : ABS (ret);
+  single = (ret < 0 || ret == 1);
+
+  if (!(flags & MONGO_WIRE_FLAG_QUERY_EXHAUST) || single)
+    {
+      reply = _mock_cursor_reply (server, cursor, n, single);
+      g_mutex_unlock (&server->lock);
+
+      return _mock_reply_send (client, rid, reply) != -1;
+    }
+
+  /* Exhaust: stream every batch, each one a response to the previous
+     one. */
+  for (;;)
+    {
+      gboolean done;
+
+      reply = _mock_cursor_reply (server, cursor, n, FALSE);
+      done = (((mongo_reply_packet_header *)reply->data)->cursor_id == 0);
+      g_mutex_unlock (&server->lock);
+
+      rid = _mock_reply_send (client, rid, reply);
+      if (rid == -1)
+	{
+	  g_mutex_lock (&server->lock);
+	  g_hash_table_remove (server->cursors, &cursor->id);
+	  g_mutex_unlock (&server->lock);
+	  return FALSE;
+	}
+      if (done)
+	return TRUE;
+
+      g_mutex_lock (&server->lock);
+    }
+}
+
+static gboolean
+_mock_handle_get_more (mock_client *client, gint32 rid, mock_reader *r)
+{
+  mock_server *server = client->server;
+  gint32 zero, ret;
+  gint64 cid;
+  const gchar *ns;
+  mock_cursor *cursor;
+  GByteArray *reply;
+
+  if (!_mock_read_int32 (r, &zero) ||
+      !_mock_read_cstring (r, &ns) ||
+      !_mock_read_int32 (r, &ret) ||
+      !_mock_read_int64 (r, &cid))
+    return FALSE;
+
+  g_mutex_lock (&server->lock);
+  cursor = g_hash_table_lookup (server->cursors, &cid);
+  if (!cursor)
+    {
+      g_mutex_unlock (&server->lock);
+      reply = _mock_reply_new (MONGO_REPLY_FLAG_NO_CURSOR, 0, 0);
+      return _mock_reply_send (client, rid, reply) != -1;
+    }
+
+  /* Await data: wait a little for new documents to arrive. */
+  if (cursor->tailable && cursor->pos >= cursor->docs->len)
+    {
+      gint64 deadline = g_get_monotonic_time () +
+	MOCK_SERVER_AWAIT_TIME * G_TIME_SPAN_MILLISECOND;
+      GPtrArray *coll = _mock_collection (server, cursor->ns, FALSE);
+
+      while (!server->stopping && (!coll || coll->len <= cursor->seen))
+	{
+	  if (!g_cond_wait_until (&server->data_cond, &server->lock,
+				  deadline))
+	    break;
+	  coll = _mock_collection (server, cursor->ns, FALSE);
+	  if (!g_hash_table_lookup (server->cursors, &cid))
+	    break;
+	}
+      cursor = g_hash_table_lookup (server->cursors, &cid);
+      if (!cursor)
+	{
+	  g_mutex_unlock (&server->lock);
+	  reply = _mock_reply_new (MONGO_REPLY_FLAG_NO_CURSOR, 0, 0);
+	  return _mock_reply_send (client, rid, reply) != -1;
+	}
+    }
+
+  reply = _mock_cursor_reply (server, cursor,
+			      (ret > 0) ? ret : MOCK_SERVER_DEFAULT_BATCH,
+			      FALSE);
+  g_mutex_unlock (&server->lock);
+
+  return _mock_reply_send (client, rid, reply) != -1;
+}
+
+static gboolean
+_mock_handle_kill_cursors (mock_client *client, mock_reader *r)
+{
+  mock_server *server = client->server;
+  gint32 zero, n, i;
+
+  if (!_mock_read_int32 (r, &zero) || !_mock_read_int32 (r, &n))
+    return FALSE;
+
+  g_mutex_lock (&server->lock);
+  for (i = 0; i < n; i++)
+    {
+      gint64 cid;
+
+      if (!_mock_read_int64 (r, &cid))
+	break;
+      g_hash_table_remove (server->cursors, &cid);
+    }
+  g_mutex_unlock (&server->lock);
+
+  return TRUE;
+}
+
+static gboolean
+_mock_handle_insert (mock_client *client, mock_reader *r)
+{
+  mock_server *server = client->server;
+  gint32 flags;
+  const gchar *ns;
+  GPtrArray *coll;
+  GPtrArray *docs;
+  bson *b;
+  guint i;
+
+  if (!_mock_read_int32 (r, &flags) || !_mock_read_cstring (r, &ns))
+    return FALSE;
+
+  docs = g_ptr_array_new_with_free_func (_mock_doc_unref);
+  while (r->pos < r->size)
+    {
+      if (!_mock_read_bson (r, &b))
+	{
+	  g_ptr_array_free (docs, TRUE);
+	  return FALSE;
+	}
+      g_ptr_array_add (docs, _mock_doc_new (b));
+    }
+
+  g_mutex_lock (&server->lock);
+  if (!server->primary)
+    _mock_set_last_error (client, "not master", 0);
+  else
+    {
+      coll = _mock_collection (server, ns, TRUE);
+      for (i = 0; i < docs->len; i++)
+	g_ptr_array_add (coll, _mock_doc_ref (g_ptr_array_index (docs, i)));
+      _mock_set_last_error (client, NULL, 0);
+      g_cond_broadcast (&server->data_cond);
+    }
+  g_mutex_unlock (&server->lock);
+
+  g_ptr_array_free (docs, TRUE);
+
+  return TRUE;
+}
+
+static gboolean
+_mock_handle_update (mock_client *client, mock_reader *r)
+{
+  mock_server *server = client->server;
+  gint32 zero, flags, n = 0;
+  const gchar *ns;
+  bson *sel, *upd;
+  bson_cursor *c;
+  GPtrArray *coll;
+  guint i;
+
+  if (!_mock_read_int32 (r, &zero) ||
+      !_mock_read_cstring (r, &ns) ||
+      !_mock_read_int32 (r, &flags) ||
+      !_mock_read_bson (r, &sel))
+    return FALSE;
+  if (!_mock_read_bson (r, &upd))
+    {
+      bson_free (sel);
+      return FALSE;
+    }
+
+  g_mutex_lock (&server->lock);
+
+  c = bson_cursor_new (upd);
+  if (bson_cursor_next (c) && bson_cursor_key (c)[0] == '$')
+    {
+      _mock_set_last_error (client, "update operators are not supported", 0);
+      goto out;
+    }
+  if (!server->primary)
+    {
+      _mock_set_last_error (client, "not master", 0);
+      goto out;
+    }
+
+  coll = _mock_collection (server, ns, TRUE);
+  for (i = 0; i < coll->len; i++)
+    {
+      mock_doc *d = g_ptr_array_index (coll, i);
+
+      if (!_mock_match (d->b, sel))
+	continue;
+
+      g_ptr_array_index (coll, i) =
+	_mock_doc_new (bson_new_from_data (bson_data (upd),
+					   bson_size (upd) - 1));
+      bson_finish (((mock_doc *)g_ptr_array_index (coll, i))->b);
+      _mock_doc_unref (d);
+      n++;
+
+      if (!(flags & MONGO_WIRE_FLAG_UPDATE_MULTI))
+	break;
+    }
+
+  if (n == 0 && (flags & MONGO_WIRE_FLAG_UPDATE_UPSERT))
+    {
+      g_ptr_array_add (coll, _mock_doc_new (upd));
+      upd = NULL;
+      n = 1;
+      g_cond_broadcast (&server->data_cond);
+    }
+  _mock_set_last_error (client, NULL, n);
+
+ out:
+  g_mutex_unlock (&server->lock);
+  bson_cursor_free (c);
+  bson_free (sel);
+  bson_free (upd);
+
+  return TRUE;
+}
+
+static gboolean
+_mock_handle_delete (mock_client *client, mock_reader *r)
+{
+  mock_server *server = client->server;
+  gint32 zero, flags, n = 0;
+  const gchar *ns;
+  bson *sel;
+  GPtrArray *coll;
+  guint i;
+
+  if (!_mock_read_int32 (r, &zero) ||
+      !_mock_read_cstring (r, &ns) ||
+      !_mock_read_int32 (r, &flags) ||
+      !_mock_read_bson (r, &sel))
+    return FALSE;
+
+  g_mutex_lock (&server->lock);
+  if (!server->primary)
+    _mock_set_last_error (client, "not master", 0);
+  else
+    {
+      coll = _mock_collection (server, ns, FALSE);
+      for (i = 0; coll && i < coll->len;)
+	{
+	  mock_doc *d = g_ptr_array_index (coll, i);
+
+	  if (!_mock_match (d->b, sel))
+	    {
+	      i++;
+	      continue;
+	    }
+	  g_ptr_array_remove_index (coll, i);
+	  n++;
+
+	  if (flags & MONGO_WIRE_FLAG_DELETE_SINGLE)
+	    break;
+	}
+      _mock_set_last_error (client, NULL, n);
+    }
+  g_mutex_unlock (&server->lock);
+
+  bson_free (sel);
+  return TRUE;
+}
+
+/*
+ * Connection handling.
+ */
+
+/** @internal Process a single request.
+ *
+ * @returns TRUE if the connection should be kept open, FALSE
+ * otherwise.
+ */
+static gboolean
+_mock_client_handle (mock_client *client, mongo_packet *p)
+{
+  mock_server *server = client->server;
+  mongo_packet_header h;
+  mock_reader r;
+  mock_server_failure failure = MOCK_SERVER_FAIL_NONE;
+  gint latency;
+
+  if (!mongo_wire_packet_get_header (p, &h))
+    return FALSE;
+  r.size = mongo_wire_packet_get_data (p, &r.data);
+  r.pos = 0;
+  if (r.size < 0)
+    return FALSE;
+
+  g_mutex_lock (&server->lock);
+  if (h.opcode >= 2000 && h.opcode < 2008)
+    server->op_counts[h.opcode - 2000]++;
+  latency = server->latency;
+  if (server->failure_count != 0)
+    {
+      failure = server->failure;
+      if (server->failure_count > 0)
+	server->failure_count--;
+    }
+  g_mutex_unlock (&server->lock);
+
+  if (latency > 0)
+    g_usleep (latency);
+
+  switch (failure)
+    {
+    case MOCK_SERVER_FAIL_DISCONNECT:
+      return FALSE;
+    case MOCK_SERVER_FAIL_HANG:
+      return TRUE;
+    case MOCK_SERVER_FAIL_ERROR:
+      if (h.opcode == MOCK_OP_QUERY || h.opcode == MOCK_OP_GET_MORE)
+	return _mock_reply_error (client, h.id, "injected failure") != -1;
+      g_mutex_lock (&server->lock);
+      _mock_set_last_error (client, "injected failure", 0);
+      g_mutex_unlock (&server->lock);
+      return TRUE;
+    default:
+      break;
+    }
+
+  switch (h.opcode)
+    {
+    case MOCK_OP_QUERY:
+      return _mock_handle_query (client, h.id, &r);
+    case MOCK_OP_GET_MORE:
+      return _mock_handle_get_more (client, h.id, &r);
+    case MOCK_OP_KILL_CURSORS:
+      return _mock_handle_kill_cursors (client, &r);
+    case MOCK_OP_INSERT:
+      return _mock_handle_insert (client, &r);
+    case MOCK_OP_UPDATE:
+      return _mock_handle_update (client, &r);
+    case MOCK_OP_DELETE:
+      return _mock_handle_delete (client, &r);
+    default:
+      return FALSE;
+    }
+}
+
+static gpointer
+_mock_client_run (gpointer data)
+{
+  mock_client *client = (mock_client *)data;
+  mongo_packet *p;
+
+  while ((p = mongo_packet_recv (&client->conn)) != NULL)
+    {
+      gboolean keep = _mock_client_handle (client, p);
+
+      mongo_wire_packet_free (p);
+      if (!keep)
+	break;
+    }
+
+  g_mutex_lock (&client->server->lock);
+  close (client->conn.fd);
+  client->conn.fd = -1;
+  g_mutex_unlock (&client->server->lock);
+
+  return NULL;
+}
+
+static gpointer
+_mock_server_accept (gpointer data)
+{
+  mock_server *server = (mock_server *)data;
+  struct pollfd pfd[2];
+
+  pfd[0].fd = server->fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = server->wakeup[0];
+  pfd[1].events = POLLIN;
+
+  for (;;)
+    {
+      mock_client *client;
+      gint fd, one = 1;
+
+      if (poll (pfd, 2, -1) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+      if (pfd[1].revents)
+	break;
+
+      fd = accept (server->fd, NULL, NULL);
+      if (fd < 0)
+	continue;
+      setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+      client = g_new0 (mock_client, 1);
+      client->server = server;
+      client->conn.fd = fd;
+
+      g_mutex_lock (&server->lock);
+      server->clients = g_list_prepend (server->clients, client);
+      server->connections++;
+      client->thread = g_thread_new ("mock-client", _mock_client_run, client);
+      g_mutex_unlock (&server->lock);
+    }
+
+  return NULL;
+}
+
+static guint
+_mock_int64_hash (gconstpointer v)
+{
+  gint64 i = *(const gint64 *)v;
+
+  return (guint)(i ^ (i >> 32));
+}
+
+static gboolean
+_mock_int64_equal (gconstpointer a, gconstpointer b)
+{
+  return *(const gint64 *)a == *(const gint64 *)b;
+}
+
+/** @internal Start serving on a listening socket. */
+static mock_server *
+_mock_server_start (gint fd, gint port, gchar *address)
+{
+  mock_server *server;
+
+  server = g_new0 (mock_server, 1);
+  server->fd = fd;
+  server->port = port;
+  server->address = address;
+  if (pipe (server->wakeup) != 0)
+    {
+      int e = errno;
+
+      close (fd);
+      g_free (server->address);
+      g_free (server);
+      errno = e;
+      return NULL;
+    }
+
+  g_mutex_init (&server->lock);
+  g_cond_init (&server->data_cond);
+  server->collections = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free,
+					       (GDestroyNotify)g_ptr_array_unref);
+  server->cursors = g_hash_table_new_full (_mock_int64_hash,
+					   _mock_int64_equal,
+					   NULL, _mock_cursor_free);
+  server->next_cursor_id = 1000;
+  server->next_reply_id = 1;
+  server->primary = TRUE;
+
+  server->acceptor = g_thread_new ("mock-acceptor", _mock_server_accept,
+				   server);
+
+  return server;
+}
+
+mock_server *
+mock_server_new (void)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof (addr);
+  gint fd, one = 1;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return NULL;
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) != 0 ||
+      listen (fd, 128) != 0 ||
+      getsockname (fd, (struct sockaddr *)&addr, &len) != 0)
+    {
+      int e = errno;
+
+      close (fd);
+      errno = e;
+      return NULL;
+    }
+
+  return _mock_server_start (fd, ntohs (addr.sin_port),
+			     g_strdup_printf ("127.0.0.1:%d",
+					      ntohs (addr.sin_port)));
+}
+
+mock_server *
+mock_server_new_unix (const gchar *path)
+{
+  mock_server *server;
+  struct sockaddr_un addr;
+  gint fd;
+
+  if (!path || strlen (path) >= sizeof (addr.sun_path))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return NULL;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  unlink (path);
+
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) != 0 ||
+      listen (fd, 128) != 0)
+    {
+      int e = errno;
+
+      close (fd);
+      errno = e;
+      return NULL;
+    }
+
+  server = _mock_server_start (fd, 0, g_strdup (path));
+  if (server)
+    server->path = g_strdup (path);
+  return server;
+}
+
+void
+mock_server_free (mock_server *server)
+{
+  GList *l;
+
+  if (!server)
+    return;
+
+  if (write (server->wakeup[1], "x", 1) != 1)
+    close (server->wakeup[1]);
+  g_thread_join (server->acceptor);
+
+  g_mutex_lock (&server->lock);
+  server->stopping = TRUE;
+  for (l = server->clients; l; l = g_list_next (l))
+    {
+      mock_client *client = (mock_client *)l->data;
+
+      if (client->conn.fd >= 0)
+	shutdown (client->conn.fd, SHUT_RDWR);
+    }
+  g_cond_broadcast (&server->data_cond);
+  g_mutex_unlock (&server->lock);
+
+  for (l = server->clients; l; l = g_list_next (l))
+    {
+      mock_client *client = (mock_client *)l->data;
+
+      g_thread_join (client->thread);
+      g_free (client->last_error);
+      g_free (client);
+    }
+  g_list_free (server->clients);
+
+  close (server->fd);
+  if (server->path)
+    unlink (server->path);
+  close (server->wakeup[0]);
+  close (server->wakeup[1]);
+
+  g_hash_table_destroy (server->cursors);
+  g_hash_table_destroy (server->collections);
+  g_mutex_clear (&server->lock);
+  g_cond_clear (&server->data_cond);
+
+  g_free (server->set_name);
+  g_free (server->set_primary);
+  g_strfreev (server->set_hosts);
+  g_free (server->address);
+  g_free (server->path);
+  g_free (server);
+}
+
+gint
+mock_server_get_port (const mock_server *server)
+{
+  return server->port;
+}
+
+const gchar *
+mock_server_get_address (const mock_server *server)
+{
+  return server->address;
+}
+
+void
+mock_server_set_latency (mock_server *server, gint latency)
+{
+  g_mutex_lock (&server->lock);
+  server->latency = latency;
+  g_mutex_unlock (&server->lock);
+}
+
+void
+mock_server_fail (mock_server *server, mock_server_failure failure,
+		  gint count)
+{
+  g_mutex_lock (&server->lock);
+  server->failure = failure;
+  server->failure_count = (failure == MOCK_SERVER_FAIL_NONE) ? 0 : count;
+  g_mutex_unlock (&server->lock);
+}
+
+void
+mock_server_set_primary (mock_server *server, gboolean primary)
+{
+  g_mutex_lock (&server->lock);
+  server->primary = primary;
+  g_mutex_unlock (&server->lock);
+}
+
+void
+mock_server_set_replica_set (mock_server *server, const gchar *name,
+			     const gchar *primary,
+			     const gchar * const *hosts)
+{
+  g_mutex_lock (&server->lock);
+  g_free (server->set_name);
+  g_free (server->set_primary);
+  g_strfreev (server->set_hosts);
+
+  server->set_name = g_strdup (name);
+  server->set_primary = g_strdup (primary);
+  server->set_hosts = g_strdupv ((gchar **)hosts);
+  g_mutex_unlock (&server->lock);
+}
+
+guint
+mock_server_get_op_count (mock_server *server, gint32 opcode)
+{
+  guint n = 0;
+
+  g_mutex_lock (&server->lock);
+  if (opcode >= 2000 && opcode < 2008)
+    n = server->op_counts[opcode - 2000];
+  g_mutex_unlock (&server->lock);
+
+  return n;
+}
+
+guint
+mock_server_get_connection_count (mock_server *server)
+{
+  guint n;
+
+  g_mutex_lock (&server->lock);
+  n = server->connections;
+  g_mutex_unlock (&server->lock);
+
+  return n;
+}
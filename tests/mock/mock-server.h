@@ -0,0 +1,158 @@
+/* mock-server.h - In-process MongoDB stand-in for tests and benchmarks
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_CLIENT_MOCK_SERVER_H
+#define LIBMONGO_CLIENT_MOCK_SERVER_H 1
+
+#include <glib.h>
+
+/** @file tests/mock/mock-server.h
+ *
+ * A small MongoDB stand-in, that listens on the loopback interface,
+ * and serves requests from threads of the calling process.
+ *
+ * It understands OP_QUERY, OP_INSERT, OP_UPDATE, OP_DELETE,
+ * OP_GET_MORE and OP_KILL_CURSORS, keeps documents in memory, and
+ * answers the ismaster, ping, getlasterror, reseterror, count and drop
+ * commands.
+ *
+ * Queries support equality, and the $gt, $gte, $lt, $lte and $ne
+ * operators on top-level fields. Updates replace whole documents,
+ * update operators are not supported.
+ *
+ * For testing failure handling, latency and failures can be
+ * injected, and the server can pretend to be a secondary, or a member
+ * of a replica set.
+ */
+
+/** Opaque mock server object. */
+typedef struct _mock_server mock_server;
+
+/** Failure modes that can be injected into a mock server. */
+typedef enum
+{
+  MOCK_SERVER_FAIL_NONE, /**< Serve requests normally. */
+  MOCK_SERVER_FAIL_DISCONNECT, /**< Close the connection upon
+				  receiving a request. */
+  MOCK_SERVER_FAIL_HANG, /**< Read the request, but never reply. */
+  MOCK_SERVER_FAIL_ERROR /**< Fail queries with an error reply, and
+			    writes with a last error. */
+} mock_server_failure;
+
+/** Start a new mock server.
+ *
+ * The server listens on an ephemeral port on 127.0.0.1, and starts
+ * out as a standalone master, with an empty store.
+ *
+ * @returns A newly allocated mock server, or NULL on error.
+ */
+mock_server *mock_server_new (void);
+
+/** Start a new mock server on a Unix domain socket.
+ *
+ * Works like mock_server_new(), except that the server listens on
+ * @a path, which is removed when the server is freed. The port of
+ * the server is zero, and its address is the path.
+ *
+ * @param path is the path of the socket to create.
+ *
+ * @returns A newly allocated mock server, or NULL on error.
+ */
+mock_server *mock_server_new_unix (const gchar *path);
+
+/** Stop a mock server, and free all resources associated with it.
+ *
+ * All client connections are closed.
+ *
+ * @param server is the server to stop.
+ */
+void mock_server_free (mock_server *server);
+
+/** Get the port a mock server listens on.
+ *
+ * @param server is the server to query.
+ *
+ * @returns The port number.
+ */
+gint mock_server_get_port (const mock_server *server);
+
+/** Get the address of a mock server.
+ *
+ * @param server is the server to query.
+ *
+ * @returns The address in HOST:PORT format, or the socket path of
+ * servers made with mock_server_new_unix(), owned by the server.
+ */
+const gchar *mock_server_get_address (const mock_server *server);
+
+/** Set the latency of a mock server.
+ *
+ * @param server is the server to configure.
+ * @param latency is the time to wait before processing each request,
+ * in microseconds.
+ */
+void mock_server_set_latency (mock_server *server, gint latency);
+
+/** Inject failures into a mock server.
+ *
+ * @param server is the server to configure.
+ * @param failure is the failure mode.
+ * @param count is the number of requests to fail, -1 for all of them.
+ */
+void mock_server_fail (mock_server *server, mock_server_failure failure,
+		       gint count);
+
+/** Set the replica set role of a mock server.
+ *
+ * A secondary refuses writes, and queries without the slave ok flag.
+ *
+ * @param server is the server to configure.
+ * @param primary signals whether the server is a primary.
+ */
+void mock_server_set_primary (mock_server *server, gboolean primary);
+
+/** Make a mock server a replica set member.
+ *
+ * Sets what the server reports about its replica set in ismaster
+ * replies.
+ *
+ * @param server is the server to configure.
+ * @param name is the name of the set.
+ * @param primary is the address of the primary, or NULL if unknown.
+ * @param hosts is a NULL terminated list of member addresses.
+ */
+void mock_server_set_replica_set (mock_server *server, const gchar *name,
+				  const gchar *primary,
+				  const gchar * const *hosts);
+
+/** Get the number of requests of a given type a mock server received.
+ *
+ * @param server is the server to query.
+ * @param opcode is the wire protocol opcode of the requests.
+ *
+ * @returns The number of requests received.
+ */
+guint mock_server_get_op_count (mock_server *server, gint32 opcode);
+
+/** Get the number of connections a mock server accepted.
+ *
+ * @param server is the server to query.
+ *
+ * @returns The number of connections accepted since start.
+ */
+guint mock_server_get_connection_count (mock_server *server);
+
+#endif
@@ -0,0 +1,299 @@
+/* bench.c - Micro-benchmark harness for libmongo-client
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file tests/perf/bench.c
+ * Micro-benchmark harness implementation.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+volatile gsize bench_sink;
+
+/*
+ * Allocation counting.
+ */
+
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+
+static gboolean bench_counting;
+static guint64 bench_allocs;
+static guint64 bench_bytes;
+
+void *
+malloc (size_t size)
+{
+  if (bench_counting)
+    {
+      bench_allocs++;
+      bench_bytes += size;
+    }
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  if (bench_counting)
+    {
+      bench_allocs++;
+      bench_bytes += nmemb * size;
+    }
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  if (bench_counting)
+    {
+      bench_allocs++;
+      bench_bytes += size;
+    }
+  return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+  __libc_free (ptr);
+}
+#endif
+
+/*
+ * Timing.
+ */
+
+static guint64
+_bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (guint64)ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static guint64
+_bench_target (void)
+{
+  const gchar *env = getenv ("BENCH_TIME");
+  gint ms = (env) ? atoi (env) : 0;
+
+  if (ms <= 0)
+    ms = 200;
+  return (guint64)ms * 1000000;
+}
+
+void
+bench_header (void)
+{
+  printf ("# name\titerations\tns/op\tallocs/op\tbytes/op\n");
+  fflush (stdout);
+}
+
+void
+bench_run (const gchar *name, bench_func func, gpointer data)
+{
+  guint64 n = 1, start, elapsed, target = _bench_target ();
+
+  /* Warm up, and calibrate the number of iterations. */
+  for (;;)
+    {
+      start = _bench_now ();
+      func (data, n);
+      elapsed = _bench_now () - start;
+
+      if (elapsed >= target / 10 || n >= G_GUINT64_CONSTANT (1) << 40)
+	break;
+      n *= (elapsed < target / 1000) ? 100 : 10;
+    }
+  if (elapsed > 0 && elapsed < target)
+    n = (guint64)((gdouble)n * target / elapsed) + 1;
+
+#ifdef BENCH_COUNT_ALLOCS
+  bench_allocs = 0;
+  bench_bytes = 0;
+  bench_counting = TRUE;
+#endif
+  start = _bench_now ();
+  func (data, n);
+  elapsed = _bench_now () - start;
+#ifdef BENCH_COUNT_ALLOCS
+  bench_counting = FALSE;
+
+  printf ("%s\t%" G_GUINT64_FORMAT "\t%.2f\t%.3f\t%.1f\n", name, n,
+	  (gdouble)elapsed / n, (gdouble)bench_allocs / n,
+	  (gdouble)bench_bytes / n);
+#else
+  printf ("%s\t%" G_GUINT64_FORMAT "\t%.2f\t-\t-\n", name, n,
+	  (gdouble)elapsed / n);
+#endif
+  fflush (stdout);
+}
+
+/*
+ * Document shapes.
+ */
+
+const gchar *
+bench_shape_name (bench_shape shape)
+{
+  switch (shape)
+    {
+    case BENCH_SHAPE_FLAT:
+      return "flat";
+    case BENCH_SHAPE_WIDE:
+      return "wide";
+    case BENCH_SHAPE_DEEP:
+      return "deep";
+    case BENCH_SHAPE_ARRAY:
+      return "array";
+    default:
+      return NULL;
+    }
+}
+
+static bson *
+_bench_shape_flat (void)
+{
+  bson *b;
+  guint8 oid[12] = "0123456789ab";
+
+  b = bson_new ();
+  bson_append_oid (b, "_id", oid);
+  bson_append_string (b, "name", "John Doe", -1);
+  bson_append_int32 (b, "age", 42);
+  bson_append_int64 (b, "visits", G_GINT64_CONSTANT (1234567890123));
+  bson_append_double (b, "score", 3.14159);
+  bson_append_boolean (b, "active", TRUE);
+  bson_append_utc_datetime (b, "created", 1294860709000);
+  bson_append_null (b, "parent");
+  bson_finish (b);
+
+  return b;
+}
+
+static bson *
+_bench_shape_wide (void)
+{
+  bson *b;
+  gchar key[16];
+  gint i;
+
+  b = bson_new ();
+  for (i = 0; i < 256; i++)
+    {
+      g_snprintf (key, sizeof (key), "field%03d", i);
+      if (i % 2)
+	bson_append_string (b, key, "some value", -1);
+      else
+	bson_append_int32 (b, key, i);
+    }
+  bson_finish (b);
+
+  return b;
+}
+
+static bson *
+_bench_shape_deep (void)
+{
+  bson *b, *inner;
+  gint i;
+
+  inner = bson_new ();
+  bson_append_int32 (inner, "leaf", 1);
+  bson_finish (inner);
+
+  for (i = 0; i < 32; i++)
+    {
+      b = bson_new ();
+      bson_append_int32 (b, "level", 32 - i);
+      bson_append_document (b, "child", inner);
+      bson_finish (b);
+      bson_free (inner);
+      inner = b;
+    }
+
+  return inner;
+}
+
+static bson *
+_bench_shape_array (void)
+{
+  bson *b, *a;
+  gchar key[16];
+  gint i, j;
+  const gchar *names[] = { "ints", "doubles", "strings", "longs" };
+
+  b = bson_new ();
+  for (j = 0; j < 4; j++)
+    {
+      a = bson_new ();
+      for (i = 0; i < 64; i++)
+	{
+	  g_snprintf (key, sizeof (key), "%d", i);
+	  switch (j)
+	    {
+	    case 0:
+	      bson_append_int32 (a, key, i);
+	      break;
+	    case 1:
+	      bson_append_double (a, key, i / 3.0);
+	      break;
+	    case 2:
+	      bson_append_string (a, key, "element", -1);
+	      break;
+	    default:
+	      bson_append_int64 (a, key, (gint64)i << 32);
+	      break;
+	    }
+	}
+      bson_finish (a);
+      bson_append_array (b, names[j], a);
+      bson_free (a);
+    }
+  bson_finish (b);
+
+  return b;
+}
+
+bson *
+bench_shape_build (bench_shape shape)
+{
+  switch (shape)
+    {
+    case BENCH_SHAPE_FLAT:
+      return _bench_shape_flat ();
+    case BENCH_SHAPE_WIDE:
+      return _bench_shape_wide ();
+    case BENCH_SHAPE_DEEP:
+      return _bench_shape_deep ();
+    case BENCH_SHAPE_ARRAY:
+      return _bench_shape_array ();
+    default:
+      return NULL;
+    }
+}
@@ -0,0 +1,91 @@
+/* bench.h - Micro-benchmark harness for libmongo-client
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBMONGO_CLIENT_BENCH_H
+#define LIBMONGO_CLIENT_BENCH_H 1
+
+#include <glib.h>
+#include "bson.h"
+
+/** @file tests/perf/bench.h
+ *
+ * A tiny harness for micro-benchmarks.
+ *
+ * Each benchmark is a function that runs its operation a given number
+ * of times. The harness calibrates the number of iterations so that a
+ * run takes at least BENCH_TIME milliseconds (200 by default), and
+ * prints one tab separated line per benchmark:
+ *
+ * @code
+ * name	iterations	ns/op	allocs/op	bytes/op
+ * @endcode
+ *
+ * Allocations are counted by interposing malloc() and friends, which
+ * is only supported on glibc. Elsewhere, the allocation columns are
+ * reported as "-".
+ */
+
+/** Benchmark function type.
+ *
+ * @param data is the user data passed to bench_run().
+ * @param n is the number of operations to run.
+ */
+typedef void (*bench_func) (gpointer data, guint64 n);
+
+/** Document shapes the benchmarks are run against. */
+typedef enum
+{
+  BENCH_SHAPE_FLAT, /**< A small document with a handful of fields
+		       of common types. */
+  BENCH_SHAPE_WIDE, /**< A document with hundreds of top-level
+		       fields. */
+  BENCH_SHAPE_DEEP, /**< A deeply nested document. */
+  BENCH_SHAPE_ARRAY, /**< A document made up of large arrays. */
+  BENCH_SHAPE_MAX
+} bench_shape;
+
+/** Sink to keep the compiler from optimising benchmarked code
+ * away. */
+extern volatile gsize bench_sink;
+
+/** Print the header of the benchmark output. */
+void bench_header (void);
+
+/** Run a benchmark, and print its results.
+ *
+ * @param name is the name of the benchmark.
+ * @param func is the benchmark function.
+ * @param data is passed to @a func as-is.
+ */
+void bench_run (const gchar *name, bench_func func, gpointer data);
+
+/** Get the name of a document shape.
+ *
+ * @param shape is the shape.
+ *
+ * @returns The name of the shape, as a static string.
+ */
+const gchar *bench_shape_name (bench_shape shape);
+
+/** Build a document of a given shape.
+ *
+ * @param shape is the shape of the document.
+ *
+ * @returns A newly allocated, finished BSON object.
+ */
+bson *bench_shape_build (bench_shape shape);
+
+#endif
@@ -0,0 +1,218 @@
+#include "bench.h"
+#include "bson.h"
+
+#include <string.h>
+
+static bson *
+make_typed_doc (void)
+{
+  bson *b, *sub;
+  guint8 oid[12] = "0123456789ab";
+
+  sub = bson_new ();
+  bson_append_int32 (sub, "0", 1);
+  bson_append_int32 (sub, "1", 2);
+  bson_finish (sub);
+
+  b = bson_new ();
+  bson_append_string (b, "string", "hello world", -1);
+  bson_append_double (b, "double", 3.14);
+  bson_append_document (b, "document", sub);
+  bson_append_array (b, "array", sub);
+  bson_append_binary (b, "binary", BSON_BINARY_SUBTYPE_GENERIC, oid,
+		      sizeof (oid));
+  bson_append_oid (b, "oid", oid);
+  bson_append_boolean (b, "boolean", TRUE);
+  bson_append_utc_datetime (b, "utc_datetime", 1294860709000);
+  bson_append_regex (b, "regex", "s/foo.*bar/", "i");
+  bson_append_javascript (b, "javascript", "alert (1);", -1);
+  bson_append_symbol (b, "symbol", "symbol", -1);
+  bson_append_javascript_w_scope (b, "javascript_w_scope", "alert (v);", -1,
+				  sub);
+  bson_append_int32 (b, "int32", 42);
+  bson_append_timestamp (b, "timestamp", 1294860709000);
+  bson_append_int64 (b, "int64", 42);
+  bson_finish (b);
+
+  bson_free (sub);
+  return b;
+}
+
+typedef struct
+{
+  const bson *b;
+  const gchar *key;
+} find_ctx;
+
+static void
+bench_find (gpointer data, guint64 n)
+{
+  find_ctx *ctx = (find_ctx *)data;
+  guint64 i;
+
+  for (i = 0; i < n; i++)
+    {
+      bson_cursor *c = bson_find (ctx->b, ctx->key);
+
+      bench_sink += (gsize)c;
+      bson_cursor_free (c);
+    }
+}
+
+static void
+bench_iterate (gpointer data, guint64 n)
+{
+  const bson *b = (const bson *)data;
+  guint64 i;
+
+  for (i = 0; i < n; i++)
+    {
+      bson_cursor *c = bson_cursor_new (b);
+
+      while (bson_cursor_next (c))
+	bench_sink += bson_cursor_type (c);
+      bson_cursor_free (c);
+    }
+}
+
+static void
+bench_new_from_data (gpointer data, guint64 n)
+{
+  const bson *b = (const bson *)data;
+  guint64 i;
+
+  for (i = 0; i < n; i++)
+    {
+      bson *copy = bson_new_from_data (bson_data (b), bson_size (b) - 1);
+
+      bson_finish (copy);
+      bench_sink += bson_size (copy);
+      bson_free (copy);
+    }
+}
+
+#define BENCH_GET(type, decl, call, use)			\
+  static void							\
+  bench_get_##type (gpointer data, guint64 n)			\
+  {								\
+    const bson_cursor *c = (const bson_cursor *)data;		\
+    guint64 i;							\
+    decl;							\
+								\
+    for (i = 0; i < n; i++)					\
+      {								\
+	call;							\
+	use;							\
+      }								\
+  }
+
+BENCH_GET (string, const gchar *s,
+	   bson_cursor_get_string (c, &s), bench_sink += (gsize)s)
+BENCH_GET (double, gdouble d,
+	   bson_cursor_get_double (c, &d), bench_sink += (gsize)d)
+BENCH_GET (document, bson *d,
+	   bson_cursor_get_document (c, &d), bson_free (d))
+BENCH_GET (array, bson *d,
+	   bson_cursor_get_array (c, &d), bson_free (d))
+BENCH_GET (binary, const guint8 *d; gint32 size; bson_binary_subtype st,
+	   bson_cursor_get_binary (c, &st, &d, &size),
+	   bench_sink += size)
+BENCH_GET (oid, const guint8 *o,
+	   bson_cursor_get_oid (c, &o), bench_sink += (gsize)o)
+BENCH_GET (boolean, gboolean v,
+	   bson_cursor_get_boolean (c, &v), bench_sink += v)
+BENCH_GET (utc_datetime, gint64 v,
+	   bson_cursor_get_utc_datetime (c, &v), bench_sink += v)
+BENCH_GET (regex, const gchar *r; const gchar *o,
+	   bson_cursor_get_regex (c, &r, &o), bench_sink += (gsize)r)
+BENCH_GET (javascript, const gchar *s,
+	   bson_cursor_get_javascript (c, &s), bench_sink += (gsize)s)
+BENCH_GET (symbol, const gchar *s,
+	   bson_cursor_get_symbol (c, &s), bench_sink += (gsize)s)
+BENCH_GET (javascript_w_scope, const gchar *s; bson *scope,
+	   bson_cursor_get_javascript_w_scope (c, &s, &scope),
+	   bson_free (scope))
+BENCH_GET (int32, gint32 v,
+	   bson_cursor_get_int32 (c, &v), bench_sink += v)
+BENCH_GET (timestamp, gint64 v,
+	   bson_cursor_get_timestamp (c, &v), bench_sink += v)
+BENCH_GET (int64, gint64 v,
+	   bson_cursor_get_int64 (c, &v), bench_sink += v)
+
+int
+main (void)
+{
+  bson *docs[BENCH_SHAPE_MAX], *typed;
+  bench_shape shape;
+
+  for (shape = 0; shape < BENCH_SHAPE_MAX; shape++)
+    docs[shape] = bench_shape_build (shape);
+  typed = make_typed_doc ();
+
+  bench_header ();
+
+  for (shape = 0; shape < BENCH_SHAPE_MAX; shape++)
+    {
+      const gchar *sname = bench_shape_name (shape);
+      gchar *name;
+      bson_cursor *c;
+      find_ctx ctx;
+
+      name = g_strconcat ("bson_new_from_data/", sname, NULL);
+      bench_run (name, bench_new_from_data, docs[shape]);
+      g_free (name);
+
+      name = g_strconcat ("bson_cursor_next/", sname, NULL);
+      bench_run (name, bench_iterate, docs[shape]);
+      g_free (name);
+
+      /* Look up the first, and the last key of the document. */
+      c = bson_cursor_new (docs[shape]);
+      bson_cursor_next (c);
+      ctx.b = docs[shape];
+      ctx.key = bson_cursor_key (c);
+      name = g_strconcat ("bson_find/", sname, "/first", NULL);
+      bench_run (name, bench_find, &ctx);
+      g_free (name);
+
+      while (bson_cursor_next (c))
+	ctx.key = bson_cursor_key (c);
+      name = g_strconcat ("bson_find/", sname, "/last", NULL);
+      bench_run (name, bench_find, &ctx);
+      g_free (name);
+      bson_cursor_free (c);
+    }
+
+#define RUN_GET(type)							\
+  do									\
+    {									\
+      bson_cursor *c = bson_find (typed, #type);			\
+									\
+      bench_run ("bson_cursor_get_" #type, bench_get_##type, c);	\
+      bson_cursor_free (c);						\
+    } while (0)
+
+  RUN_GET (string);
+  RUN_GET (double);
+  RUN_GET (document);
+  RUN_GET (array);
+  RUN_GET (binary);
+  RUN_GET (oid);
+  RUN_GET (boolean);
+  RUN_GET (utc_datetime);
+  RUN_GET (regex);
+  RUN_GET (javascript);
+  RUN_GET (symbol);
+  RUN_GET (javascript_w_scope);
+  RUN_GET (int32);
+  RUN_GET (timestamp);
+  RUN_GET (int64);
+
+#undef RUN_GET
+
+  bson_free (typed);
+  for (shape = 0; shape < BENCH_SHAPE_MAX; shape++)
+    bson_free (docs[shape]);
+
+  return 0;
+}
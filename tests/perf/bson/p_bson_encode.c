@@ -0,0 +1,163 @@
+#include "bench.h"
+#include "bson.h"
+
+/* Number of appends before the document under construction is
+   reset. */
+#define APPENDS_PER_DOC 64
+
+static const guint8 oid[12] = "0123456789ab";
+
+typedef struct
+{
+  bson *b;
+  bson *sub;
+} append_ctx;
+
+#define BENCH_APPEND(type, call)				\
+  static void							\
+  bench_append_##type (gpointer data, guint64 n)		\
+  {								\
+    append_ctx *ctx = (append_ctx *)data;			\
+    bson *b = ctx->b;						\
+    guint64 i;							\
+								\
+    (void)ctx;							\
+    for (i = 0; i < n; i++)					\
+      {								\
+	if (i % APPENDS_PER_DOC == 0)				\
+	  bson_reset (b);					\
+	call;							\
+      }								\
+  }
+
+BENCH_APPEND (string, bson_append_string (b, "key", "hello world", -1))
+BENCH_APPEND (double, bson_append_double (b, "key", 3.14))
+BENCH_APPEND (document, bson_append_document (b, "key", ctx->sub))
+BENCH_APPEND (array, bson_append_array (b, "key", ctx->sub))
+BENCH_APPEND (binary, bson_append_binary (b, "key",
+					  BSON_BINARY_SUBTYPE_GENERIC,
+					  oid, sizeof (oid)))
+BENCH_APPEND (oid, bson_append_oid (b, "key", oid))
+BENCH_APPEND (boolean, bson_append_boolean (b, "key", TRUE))
+BENCH_APPEND (utc_datetime, bson_append_utc_datetime (b, "key",
+						      1294860709000))
+BENCH_APPEND (null, bson_append_null (b, "key"))
+BENCH_APPEND (regex, bson_append_regex (b, "key", "s/foo.*bar/", "i"))
+BENCH_APPEND (javascript, bson_append_javascript (b, "key", "alert (1);",
+						  -1))
+BENCH_APPEND (symbol, bson_append_symbol (b, "key", "symbol", -1))
+BENCH_APPEND (javascript_w_scope,
+	      bson_append_javascript_w_scope (b, "key", "alert (v);", -1,
+					      ctx->sub))
+BENCH_APPEND (int32, bson_append_int32 (b, "key", 42))
+BENCH_APPEND (timestamp, bson_append_timestamp (b, "key", 1294860709000))
+BENCH_APPEND (int64, bson_append_int64 (b, "key", 42))
+
+static void
+bench_build (gpointer data, guint64 n)
+{
+  guint64 i;
+
+  (void)data;
+  for (i = 0; i < n; i++)
+    {
+      bson *b;
+
+      b = bson_build (BSON_TYPE_OID, "_id", oid,
+		      BSON_TYPE_STRING, "name", "John Doe", -1,
+		      BSON_TYPE_INT32, "age", 42,
+		      BSON_TYPE_INT64, "visits", G_GINT64_CONSTANT (1234567890123),
+		      BSON_TYPE_DOUBLE, "score", 3.14159,
+		      BSON_TYPE_BOOLEAN, "active", TRUE,
+		      BSON_TYPE_UTC_DATETIME, "created", (gint64)1294860709000,
+		      BSON_TYPE_NULL, "parent",
+		      BSON_TYPE_NONE);
+      bson_finish (b);
+      bench_sink += bson_size (b);
+      bson_free (b);
+    }
+}
+
+static void
+bench_finish (gpointer data, guint64 n)
+{
+  bson *b = (bson *)data;
+  guint64 i;
+
+  for (i = 0; i < n; i++)
+    {
+      bson_reset (b);
+      bson_append_int32 (b, "key", 42);
+      bson_finish (b);
+    }
+}
+
+static void
+bench_encode_shape (gpointer data, guint64 n)
+{
+  bench_shape shape = GPOINTER_TO_INT (data);
+  guint64 i;
+
+  for (i = 0; i < n; i++)
+    {
+      bson *b = bench_shape_build (shape);
+
+      bench_sink += bson_size (b);
+      bson_free (b);
+    }
+}
+
+int
+main (void)
+{
+  append_ctx ctx;
+  bench_shape shape;
+  bson *b;
+
+  ctx.b = bson_new ();
+  ctx.sub = bench_shape_build (BENCH_SHAPE_FLAT);
+
+  bench_header ();
+
+#define RUN_APPEND(type) \
+  bench_run ("bson_append_" #type, bench_append_##type, &ctx)
+
+  RUN_APPEND (string);
+  RUN_APPEND (double);
+  RUN_APPEND (document);
+  RUN_APPEND (array);
+  RUN_APPEND (binary);
+  RUN_APPEND (oid);
+  RUN_APPEND (boolean);
+  RUN_APPEND (utc_datetime);
+  RUN_APPEND (null);
+  RUN_APPEND (regex);
+  RUN_APPEND (javascript);
+  RUN_APPEND (symbol);
+  RUN_APPEND (javascript_w_scope);
+  RUN_APPEND (int32);
+  RUN_APPEND (timestamp);
+  RUN_APPEND (int64);
+
+#undef RUN_APPEND
+
+  bench_run ("bson_build/flat", bench_build, NULL);
+
+  b = bson_new ();
+  bench_run ("bson_finish", bench_finish, b);
+  bson_free (b);
+
+  for (shape = 0; shape < BENCH_SHAPE_MAX; shape++)
+    {
+      gchar *name = g_strconcat ("bson_encode/", bench_shape_name (shape),
+				 NULL);
+
+      bench_run (name, bench_encode_shape, GINT_TO_POINTER (shape));
+      g_free (name);
+    }
+
+  bson_free (ctx.sub);
+  bson_free (ctx.b);
+
+  return 0;
+}
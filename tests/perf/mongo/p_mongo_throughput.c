@@ -0,0 +1,482 @@
+/* p_mongo_throughput.c - End-to-end client throughput benchmark
+ * Copyright 2011 Gergely Nagy <algernon@balabit.hu>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file tests/perf/mongo/p_mongo_throughput.c
+ * Client throughput benchmark, against the mock server or a real one.
+ */
+
+#include "mock-server.h"
+#include <mongo.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define READ_NS "bench.throughput_read"
+#define WRITE_NS "bench.throughput_write"
+#define READ_DOCS 1000
+#define GET_MORE_BATCH 10
+
+typedef enum
+{
+  WORKLOAD_INSERT,
+  WORKLOAD_QUERY,
+  WORKLOAD_GET_MORE,
+  WORKLOAD_COMMAND,
+  WORKLOAD_MAX
+} workload_t;
+
+static const gchar *workload_names[] =
+  { "insert", "query", "getmore", "command" };
+
+typedef struct
+{
+  gchar *host;
+  gint port;
+  gint concurrency;
+  gint ops;
+  gchar *workload;
+  gchar *mode;
+  gint latency;
+} config_t;
+
+typedef struct
+{
+  const config_t *config;
+  workload_t workload;
+
+  /* Pool mode: the pool, and a lock around it, as the pool itself is
+     not thread safe. */
+  mongo_sync_pool *pool;
+  GMutex pool_lock;
+  GCond pool_cond;
+} run_t;
+
+typedef struct
+{
+  run_t *run;
+  gint id;
+  GThread *thread;
+
+  guint64 *samples; /* Latency of each operation, in nanoseconds. */
+  gint done;
+  gint errors;
+  guint64 cpu; /* Thread CPU time, in nanoseconds. */
+  guint64 wall; /* Wall clock time, in nanoseconds. */
+} worker_t;
+
+static guint64
+now_ns (clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime (clock, &ts);
+  return (guint64)ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static mongo_sync_connection *
+conn_get (run_t *run, mongo_sync_connection *own)
+{
+  mongo_sync_pool_connection *c;
+
+  if (!run->pool)
+    return own;
+
+  g_mutex_lock (&run->pool_lock);
+  while ((c = mongo_sync_pool_pick (run->pool, TRUE)) == NULL)
+    g_cond_wait (&run->pool_cond, &run->pool_lock);
+  g_mutex_unlock (&run->pool_lock);
+
+  return (mongo_sync_connection *)c;
+}
+
+static void
+conn_put (run_t *run, mongo_sync_connection *conn)
+{
+  if (!run->pool)
+    return;
+
+  g_mutex_lock (&run->pool_lock);
+  mongo_sync_pool_return (run->pool, (mongo_sync_pool_connection *)conn);
+  g_cond_signal (&run->pool_cond);
+  g_mutex_unlock (&run->pool_lock);
+}
+
+/* Run a single operation. For getMore, the query that opens a new
+   cursor is not part of the measured operation, so it is run from
+   here, before the clock starts. */
+static gboolean
+worker_op (worker_t *w, mongo_sync_connection *conn, gint i,
+	   gint64 *cursor_id, guint64 *latency)
+{
+  mongo_packet *p = NULL;
+  gboolean res = TRUE;
+  guint64 start;
+  bson *b;
+
+  switch (w->run->workload)
+    {
+    case WORKLOAD_INSERT:
+      b = bson_new ();
+      bson_append_int32 (b, "worker", w->id);
+      bson_append_int32 (b, "seq", i);
+      bson_append_string (b, "payload", "The quick brown fox jumps over "
+			  "the lazy dog", -1);
+      bson_finish (b);
+
+      start = now_ns (CLOCK_MONOTONIC);
+      res = mongo_sync_cmd_insert (conn, WRITE_NS, b, NULL);
+      *latency = now_ns (CLOCK_MONOTONIC) - start;
+      bson_free (b);
+      break;
+
+    case WORKLOAD_QUERY:
+      b = bson_new ();
+      bson_append_int32 (b, "seq", (i * 7 + w->id) % READ_DOCS);
+      bson_finish (b);
+
+      start = now_ns (CLOCK_MONOTONIC);
+      p = mongo_sync_cmd_query (conn, READ_NS, 0, 0, 1, b, NULL);
+      *latency = now_ns (CLOCK_MONOTONIC) - start;
+      bson_free (b);
+      res = (p != NULL);
+      break;
+
+    case WORKLOAD_GET_MORE:
+      {
+	mongo_reply_packet_header rh;
+
+	if (*cursor_id == 0)
+	  {
+	    b = bson_new ();
+	    bson_finish (b);
+	    p = mongo_sync_cmd_query (conn, READ_NS, 0, 0, GET_MORE_BATCH, b,
+				      NULL);
+	    bson_free (b);
+	    if (!p)
+	      return FALSE;
+	    mongo_wire_reply_packet_get_header (p, &rh);
+	    *cursor_id = rh.cursor_id;
+	    mongo_wire_packet_free (p);
+	  }
+
+	start = now_ns (CLOCK_MONOTONIC);
+	p = mongo_sync_cmd_get_more (conn, READ_NS, GET_MORE_BATCH,
+				     *cursor_id);
+	*latency = now_ns (CLOCK_MONOTONIC) - start;
+
+	res = (p != NULL);
+	*cursor_id = 0;
+	if (p && mongo_wire_reply_packet_get_header (p, &rh))
+	  *cursor_id = rh.cursor_id;
+	break;
+      }
+
+    case WORKLOAD_COMMAND:
+      start = now_ns (CLOCK_MONOTONIC);
+      res = mongo_sync_cmd_ping (conn);
+      *latency = now_ns (CLOCK_MONOTONIC) - start;
+      break;
+
+    default:
+      res = FALSE;
+      break;
+    }
+
+  mongo_wire_packet_free (p);
+  return res;
+}
+
+static gpointer
+worker_run (gpointer data)
+{
+  worker_t *w = (worker_t *)data;
+  run_t *run = w->run;
+  mongo_sync_connection *own = NULL;
+  guint64 cpu_start, wall_start;
+  gint64 cursor_id = 0;
+  gint i;
+
+  if (!run->pool)
+    {
+      own = mongo_sync_connect (run->config->host, run->config->port,
+				FALSE);
+      if (!own)
+	{
+	  w->errors = run->config->ops;
+	  return NULL;
+	}
+      mongo_sync_conn_set_safe_mode (own, TRUE);
+    }
+
+  cpu_start = now_ns (CLOCK_THREAD_CPUTIME_ID);
+  wall_start = now_ns (CLOCK_MONOTONIC);
+
+  for (i = 0; i < run->config->ops; i++)
+    {
+      mongo_sync_connection *conn = conn_get (run, own);
+
+      /* In pool mode, a cursor only lives as long as we hold the
+	 connection. */
+      if (run->pool)
+	cursor_id = 0;
+
+      if (worker_op (w, conn, i, &cursor_id, &w->samples[w->done]))
+	w->done++;
+      else
+	w->errors++;
+
+      if (run->pool && cursor_id != 0)
+	{
+	  mongo_sync_cmd_kill_cursors (conn, 1, cursor_id);
+	  cursor_id = 0;
+	}
+      conn_put (run, conn);
+    }
+
+  w->cpu = now_ns (CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  w->wall = now_ns (CLOCK_MONOTONIC) - wall_start;
+
+  if (own && cursor_id != 0)
+    mongo_sync_cmd_kill_cursors (own, 1, cursor_id);
+  mongo_sync_disconnect (own);
+
+  return NULL;
+}
+
+static gint
+cmp_guint64 (gconstpointer a, gconstpointer b)
+{
+  guint64 x = *(const guint64 *)a, y = *(const guint64 *)b;
+
+  return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static gdouble
+percentile_us (const guint64 *sorted, gint n, gdouble p)
+{
+  gint idx;
+
+  if (n == 0)
+    return 0;
+  idx = (gint)(p * n + 0.5) - 1;
+  idx = CLAMP (idx, 0, n - 1);
+  return sorted[idx] / 1000.0;
+}
+
+static gboolean
+run_workload (const config_t *config, gboolean use_pool, workload_t workload)
+{
+  run_t run;
+  worker_t *workers;
+  guint64 *all, start, elapsed, cpu = 0, wall = 0;
+  gint i, n = 0, errors = 0;
+
+  memset (&run, 0, sizeof (run));
+  run.config = config;
+  run.workload = workload;
+  g_mutex_init (&run.pool_lock);
+  g_cond_init (&run.pool_cond);
+
+  if (use_pool)
+    {
+      run.pool = mongo_sync_pool_new (config->host, config->port,
+				      MAX (config->concurrency / 2, 1), 0);
+      if (!run.pool)
+	{
+	  fprintf (stderr, "Error creating pool: %s\n", strerror (errno));
+	  return FALSE;
+	}
+    }
+
+  workers = g_new0 (worker_t, config->concurrency);
+
+  start = now_ns (CLOCK_MONOTONIC);
+  for (i = 0; i < config->concurrency; i++)
+    {
+      workers[i].run = &run;
+      workers[i].id = i;
+      workers[i].samples = g_new0 (guint64, config->ops);
+      workers[i].thread = g_thread_new ("bench-worker", worker_run,
+					&workers[i]);
+    }
+
+  all = g_new (guint64, (gsize)config->ops * config->concurrency);
+  for (i = 0; i < config->concurrency; i++)
+    {
+      g_thread_join (workers[i].thread);
+
+      memcpy (all + n, workers[i].samples,
+	      workers[i].done * sizeof (guint64));
+      n += workers[i].done;
+      errors += workers[i].errors;
+      cpu += workers[i].cpu;
+      wall += workers[i].wall;
+      g_free (workers[i].samples);
+    }
+  elapsed = now_ns (CLOCK_MONOTONIC) - start;
+
+  qsort (all, n, sizeof (guint64), cmp_guint64);
+
+  printf ("%s/%s\t%d\t%d\t%d\t%.0f\t%.1f\t%.1f\t%.1f\t%.1f\t%.2f\t%.2f\n",
+	  (use_pool) ? "pool" : "sync", workload_names[workload],
+	  config->concurrency, n, errors,
+	  n / (elapsed / 1e9),
+	  percentile_us (all, n, 0.50),
+	  percentile_us (all, n, 0.99),
+	  percentile_us (all, n, 0.999),
+	  (n > 0) ? all[n - 1] / 1000.0 : 0.0,
+	  (n > 0) ? cpu / 1000.0 / n : 0.0,
+	  (n > 0 && wall > cpu) ? (wall - cpu) / 1000.0 / n : 0.0);
+  fflush (stdout);
+
+  g_free (all);
+  g_free (workers);
+  if (run.pool)
+    mongo_sync_pool_free (run.pool);
+  g_mutex_clear (&run.pool_lock);
+  g_cond_clear (&run.pool_cond);
+
+  return errors == 0;
+}
+
+static gboolean
+seed (const config_t *config)
+{
+  mongo_sync_connection *conn;
+  gboolean res = TRUE;
+  gint i;
+
+  conn = mongo_sync_connect (config->host, config->port, FALSE);
+  if (!conn)
+    return FALSE;
+
+  mongo_sync_cmd_drop (conn, "bench", "throughput_read");
+  mongo_sync_cmd_drop (conn, "bench", "throughput_write");
+  mongo_sync_cmd_reset_error (conn, "bench");
+  mongo_sync_conn_set_safe_mode (conn, TRUE);
+
+  for (i = 0; res && i < READ_DOCS; i++)
+    {
+      bson *b;
+
+      b = bson_new ();
+      bson_append_int32 (b, "seq", i);
+      bson_append_string (b, "payload", "The quick brown fox jumps over "
+			  "the lazy dog", -1);
+      bson_finish (b);
+      res = mongo_sync_cmd_insert (conn, READ_NS, b, NULL);
+      bson_free (b);
+    }
+
+  mongo_sync_disconnect (conn);
+  return res;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError *error = NULL;
+  GOptionContext *context;
+  mock_server *server = NULL;
+  config_t config = {
+    NULL, 27017, 4, 2000, NULL, NULL, 0
+  };
+  gboolean ok = TRUE;
+  gint w, m;
+
+  GOptionEntry entries[] =
+    {
+      { "host", 'h', 0, G_OPTION_ARG_STRING, &config.host,
+	"Host to connect to, instead of starting a mock server", "HOST" },
+      { "port", 'p', 0, G_OPTION_ARG_INT, &config.port, "Port", "PORT" },
+      { "concurrency", 'c', 0, G_OPTION_ARG_INT, &config.concurrency,
+	"Number of client threads", "N" },
+      { "ops", 'n', 0, G_OPTION_ARG_INT, &config.ops,
+	"Number of operations per thread", "N" },
+      { "workload", 'w', 0, G_OPTION_ARG_STRING, &config.workload,
+	"Workload to run: insert, query, getmore or command (default: all)",
+	"NAME" },
+      { "mode", 'm', 0, G_OPTION_ARG_STRING, &config.mode,
+	"Client mode: sync or pool (default: both)", "MODE" },
+      { "latency", 'l', 0, G_OPTION_ARG_INT, &config.latency,
+	"Latency the mock server adds to each request", "USEC" },
+      { NULL, 0, 0, 0, NULL, NULL, NULL }
+    };
+
+  context = g_option_context_new ("- client throughput benchmark");
+  g_option_context_add_main_entries (context, entries, "p_mongo_throughput");
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "option parsing failed: %s\n", error->message);
+      exit (1);
+    }
+  g_option_context_free (context);
+
+  if (config.concurrency < 1 || config.ops < 1)
+    {
+      fprintf (stderr, "concurrency and ops must be positive\n");
+      exit (1);
+    }
+
+  if (!config.host)
+    {
+      server = mock_server_new ();
+      if (!server)
+	{
+	  fprintf (stderr, "Error starting mock server: %s\n",
+		   strerror (errno));
+	  exit (1);
+	}
+      mock_server_set_latency (server, config.latency);
+      config.host = g_strdup ("127.0.0.1");
+      config.port = mock_server_get_port (server);
+    }
+
+  if (!seed (&config))
+    {
+      fprintf (stderr, "Error seeding the server: %s\n", strerror (errno));
+      exit (1);
+    }
+
+  printf ("# name\tthreads\tops\terrors\tops/s\tp50_us\tp99_us\tp999_us"
+	  "\tmax_us\tcpu_us/op\twait_us/op\n");
+
+  for (m = 0; m < 2; m++)
+    {
+      const gchar *mode = (m == 0) ? "sync" : "pool";
+
+      if (config.mode && strcmp (config.mode, mode) != 0)
+	continue;
+
+      for (w = 0; w < WORKLOAD_MAX; w++)
+	{
+	  if (config.workload && strcmp (config.workload,
+					 workload_names[w]) != 0)
+	    continue;
+	  ok &= run_workload (&config, m == 1, w);
+	}
+    }
+
+  mock_server_free (server);
+  g_free (config.host);
+  g_free (config.workload);
+  g_free (config.mode);
+
+  return (ok) ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#include "bson.h"
+#include "test.h"
+#include "tap.h"
+
+#include <string.h>
+
+void
+test_bson_new_view (void)
+{
+  bson *orig, *view;
+  bson_cursor *c;
+  guint8 *raw;
+  gint32 i;
+
+  orig = test_bson_generate_full ();
+
+  ok (bson_new_view (NULL, bson_size (orig)) == NULL,
+      "bson_new_view() fails with NULL data");
+  ok (bson_new_view (bson_data (orig), 0) == NULL,
+      "bson_new_view() fails with a zero size");
+  ok (bson_new_view (bson_data (orig), bson_size (orig) - 1) == NULL,
+      "bson_new_view() fails if the size does not match the document");
+
+  raw = g_memdup (bson_data (orig), bson_size (orig));
+  raw[bson_size (orig) - 1] = 1;
+  ok (bson_new_view (raw, bson_size (orig)) == NULL,
+      "bson_new_view() fails if the document is not terminated");
+
+  raw[bson_size (orig) - 1] = 0;
+  ok ((view = bson_new_view (raw, bson_size (orig))) != NULL,
+      "bson_new_view() works");
+  ok (bson_data (view) == raw,
+      "The view points into the data, without copying it");
+  cmp_ok (bson_size (view), "==", bson_size (orig),
+	  "The view is finished, and has the size of the document");
+
+  c = bson_find (view, "int32");
+  ok (bson_cursor_get_int32 (c, &i) && i == 32,
+      "The view can be read with cursors");
+  bson_cursor_free (c);
+
+  bson_free (view);
+  ok (raw[0] == bson_data (orig)[0],
+      "bson_free() leaves the data of a view alone");
+
+  view = bson_new_view (raw, bson_size (orig));
+  bson_reset (view);
+  bson_append_int32 (view, "x", 1);
+  bson_finish (view);
+  ok (bson_data (view) != raw &&
+      memcmp (raw, bson_data (orig), bson_size (orig)) == 0,
+      "bson_reset() gives the view a buffer of its own");
+  bson_free (view);
+
+  g_free (raw);
+  bson_free (orig);
+}
+
+RUN_TEST (10, bson_new_view);
@@ -0,0 +1,72 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static void
+_write_cb (mongo_async_connection *conn, gint error, gpointer user_data)
+{
+  *(gint *)user_data = error;
+}
+
+void
+test_mongo_async_cmd_update (void)
+{
+  mongo_async_connection *conn;
+  GMainContext *ctx;
+  bson *b;
+  gint lfd, afd, port, error = 0;
+
+  b = test_bson_generate_full ();
+
+  ok (mongo_async_cmd_update (NULL, "test.ns", 0, b, b,
+			      _write_cb, &error) == FALSE,
+      "mongo_async_cmd_update() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  ctx = g_main_context_new ();
+  lfd = test_make_listener (&port);
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+  afd = accept (lfd, NULL, NULL);
+  mongo_async_conn_set_safe_mode (conn, TRUE);
+
+  ok (mongo_async_cmd_update (conn, NULL, 0, b, b,
+			      _write_cb, &error) == FALSE,
+      "mongo_async_cmd_update() fails with a NULL namespace");
+  ok (mongo_async_cmd_update (conn, "test.ns", 0, NULL, b,
+			      _write_cb, &error) == FALSE,
+      "mongo_async_cmd_update() fails with a NULL selector");
+  ok (mongo_async_cmd_update (conn, "test.ns", 0, b, NULL,
+			      _write_cb, &error) == FALSE,
+      "mongo_async_cmd_update() fails with a NULL update");
+
+  ok (mongo_async_cmd_update (conn, "test.ns", 0, b, b,
+			      _write_cb, &error),
+      "mongo_async_cmd_update() works");
+  cmp_ok (mongo_async_conn_get_pending (conn), "==", 1,
+	  "The command is pending");
+  cmp_ok (error, "==", 0,
+	  "The callback is not called right away");
+
+  close (afd);
+  while (error == 0)
+    g_main_context_iteration (ctx, TRUE);
+  cmp_ok (error, "==", ECONNRESET,
+	  "The write fails when the connection breaks");
+
+  ok (mongo_async_cmd_update (conn, "test.ns", 0, b, b,
+			      _write_cb, &error) == FALSE,
+      "mongo_async_cmd_update() fails on a broken connection");
+  cmp_ok (errno, "==", EBADF,
+	  "errno is set to EBADF");
+
+  mongo_async_disconnect (conn);
+  bson_free (b);
+  close (lfd);
+  g_main_context_unref (ctx);
+}
+
+RUN_TEST (11, mongo_async_cmd_update);
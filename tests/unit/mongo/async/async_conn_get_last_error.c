@@ -0,0 +1,33 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void
+test_mongo_async_conn_get_last_error (void)
+{
+  mongo_async_connection *conn;
+  GMainContext *ctx;
+  gint lfd, port;
+
+  ok (mongo_async_conn_get_last_error (NULL) == NULL,
+      "mongo_async_conn_get_last_error() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  ctx = g_main_context_new ();
+  lfd = test_make_listener (&port);
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+
+  ok (mongo_async_conn_get_last_error (conn) == NULL,
+      "A fresh connection has no last error");
+  cmp_ok (errno, "==", 0,
+	  "errno is cleared");
+
+  mongo_async_disconnect (conn);
+  close (lfd);
+  g_main_context_unref (ctx);
+}
+
+RUN_TEST (4, mongo_async_conn_get_last_error);
@@ -0,0 +1,57 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static void
+_write_cb (mongo_async_connection *conn, gint error, gpointer user_data)
+{
+  (*(gint *)user_data)++;
+}
+
+void
+test_mongo_async_conn_get_pending (void)
+{
+  mongo_async_connection *conn;
+  GMainContext *ctx;
+  bson *doc;
+  gint lfd, afd, port, done = 0;
+
+  ok (mongo_async_conn_get_pending (NULL) == -1,
+      "mongo_async_conn_get_pending() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  ctx = g_main_context_new ();
+  lfd = test_make_listener (&port);
+  doc = test_bson_generate_full ();
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+  afd = accept (lfd, NULL, NULL);
+
+  cmp_ok (mongo_async_conn_get_pending (conn), "==", 0,
+	  "A fresh connection has nothing pending");
+
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    _write_cb, &done);
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    NULL, NULL);
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    _write_cb, &done);
+  cmp_ok (mongo_async_conn_get_pending (conn), "==", 2,
+	  "Writes with a callback are pending until flushed");
+
+  while (done < 2)
+    g_main_context_iteration (ctx, TRUE);
+  cmp_ok (mongo_async_conn_get_pending (conn), "==", 0,
+	  "Nothing is pending once the output is flushed");
+
+  mongo_async_disconnect (conn);
+  bson_free (doc);
+  close (afd);
+  close (lfd);
+  g_main_context_unref (ctx);
+}
+
+RUN_TEST (5, mongo_async_conn_get_pending);
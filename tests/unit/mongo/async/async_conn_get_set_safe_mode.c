@@ -0,0 +1,45 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void
+test_mongo_async_conn_get_set_safe_mode (void)
+{
+  mongo_async_connection *conn;
+  GMainContext *ctx;
+  gint lfd, port;
+
+  ctx = g_main_context_new ();
+  lfd = test_make_listener (&port);
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+
+  errno = 0;
+  ok (mongo_async_conn_get_safe_mode (NULL) == FALSE,
+      "mongo_async_conn_get_safe_mode() returns FALSE with a NULL "
+      "connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is now set to ENOTCONN");
+
+  ok (mongo_async_conn_get_safe_mode (conn) == FALSE,
+      "mongo_async_conn_get_safe_mode() works");
+  cmp_ok (errno, "==", 0,
+	  "errno is now cleared");
+
+  ok (mongo_async_conn_set_safe_mode (NULL, TRUE) == FALSE,
+      "mongo_async_conn_set_safe_mode() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  ok (mongo_async_conn_set_safe_mode (conn, TRUE),
+      "mongo_async_conn_set_safe_mode() works");
+  ok (mongo_async_conn_get_safe_mode (conn) == TRUE,
+      "mongo_async_conn_set_safe_mode() worked");
+
+  mongo_async_disconnect (conn);
+  close (lfd);
+  g_main_context_unref (ctx);
+}
+
+RUN_TEST (8, mongo_async_conn_get_set_safe_mode);
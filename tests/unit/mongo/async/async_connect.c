@@ -0,0 +1,75 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static void
+_reply_cb (mongo_async_connection *conn, mongo_packet *reply, gint error,
+	   gpointer user_data)
+{
+  *(gint *)user_data = error;
+  if (reply)
+    mongo_wire_packet_free (reply);
+}
+
+void
+test_mongo_async_connect (void)
+{
+  mongo_async_connection *conn;
+  GMainContext *ctx;
+  bson *cmd;
+  gint lfd, afd, port, error = 0;
+
+  ctx = g_main_context_new ();
+
+  ok (mongo_async_connect (NULL, 27017, ctx) == NULL,
+      "mongo_async_connect() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_async_connect ("invalid.", 27017, ctx) == NULL,
+      "mongo_async_connect() fails with an unresolvable host");
+
+  lfd = test_make_listener (&port);
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+  ok (conn != NULL,
+      "mongo_async_connect() works");
+  afd = accept (lfd, NULL, NULL);
+
+  cmd = bson_new ();
+  bson_append_int32 (cmd, "ping", 1);
+  bson_finish (cmd);
+
+  ok (mongo_async_cmd_custom (conn, "admin", cmd, _reply_cb, &error),
+      "Commands can be queued while connecting");
+
+  close (afd);
+  while (error == 0)
+    g_main_context_iteration (ctx, TRUE);
+  cmp_ok (error, "==", ECONNRESET,
+	  "Commands fail when the server closes the connection");
+
+  mongo_async_disconnect (conn);
+  close (lfd);
+
+  /* Nothing listens on the port anymore. */
+  error = 0;
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+  if (conn)
+    {
+      mongo_async_cmd_custom (conn, "admin", cmd, _reply_cb, &error);
+      while (error == 0)
+	g_main_context_iteration (ctx, TRUE);
+      cmp_ok (error, "==", ECONNREFUSED,
+	      "Commands fail with the error of the connection attempt");
+      mongo_async_disconnect (conn);
+    }
+  else
+    pass ("Connection attempts may fail right away");
+
+  bson_free (cmd);
+  g_main_context_unref (ctx);
+}
+
+RUN_TEST (7, mongo_async_connect);
@@ -0,0 +1,74 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static void
+_write_cb (mongo_async_connection *conn, gint error, gpointer user_data)
+{
+  *(gint *)user_data = error;
+}
+
+static void
+_disconnect_cb (mongo_async_connection *conn, gint error,
+		gpointer user_data)
+{
+  *(gint *)user_data = error;
+  mongo_async_disconnect (conn);
+}
+
+void
+test_mongo_async_disconnect (void)
+{
+  mongo_async_connection *conn;
+  GMainContext *ctx;
+  bson *doc;
+  gint lfd, afd, port, error1 = 0, error2 = 0;
+
+  mongo_async_disconnect (NULL);
+  pass ("mongo_async_disconnect(NULL) does not crash");
+
+  ctx = g_main_context_new ();
+  lfd = test_make_listener (&port);
+  doc = test_bson_generate_full ();
+
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+  afd = accept (lfd, NULL, NULL);
+  mongo_async_conn_set_safe_mode (conn, TRUE);
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    _write_cb, &error1);
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    _write_cb, &error2);
+
+  mongo_async_disconnect (conn);
+  cmp_ok (error1, "==", ECANCELED,
+	  "Pending commands are cancelled");
+  cmp_ok (error2, "==", ECANCELED,
+	  "All of them");
+  close (afd);
+
+  error1 = error2 = 0;
+  conn = mongo_async_connect ("127.0.0.1", port, ctx);
+  afd = accept (lfd, NULL, NULL);
+  mongo_async_conn_set_safe_mode (conn, TRUE);
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    _disconnect_cb, &error1);
+  mongo_async_cmd_insert_n (conn, "test.ns", 1, (const bson **)&doc,
+			    _write_cb, &error2);
+
+  close (afd);
+  while (error1 == 0)
+    g_main_context_iteration (ctx, TRUE);
+  cmp_ok (error1, "==", ECONNRESET,
+	  "The first command fails with the error of the connection");
+  cmp_ok (error2, "==", ECONNRESET,
+	  "Disconnecting from a callback still completes the rest");
+
+  bson_free (doc);
+  close (lfd);
+  g_main_context_unref (ctx);
+}
+
+RUN_TEST (5, mongo_async_disconnect);
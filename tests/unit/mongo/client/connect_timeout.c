@@ -0,0 +1,82 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libmongo-private.h"
+
+/* Listen with a full backlog, so that further connects hang. */
+static gint
+_make_black_hole (gint *port, gint *filler)
+{
+  struct sockaddr_in sa;
+  gint fd;
+
+  fd = test_make_listener (port);
+  listen (fd, 0);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa.sin_port = htons (*port);
+
+  *filler = socket (AF_INET, SOCK_STREAM, 0);
+  fcntl (*filler, F_SETFL, O_NONBLOCK);
+  connect (*filler, (struct sockaddr *)&sa, sizeof (sa));
+  usleep (100000);
+
+  return fd;
+}
+
+void
+test_mongo_connect_timeout (void)
+{
+  mongo_connection *c;
+  gint hole, filler, port;
+  gint64 start;
+
+  ok (mongo_connect_timeout (NULL, 27010, 1000) == NULL,
+      "mongo_connect_timeout() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "mongo_connect_timeout() should fail with EINVAL if host is NULL");
+
+  ok (mongo_connect_timeout ("127.0.0.1", 27010, -1) == NULL,
+      "mongo_connect_timeout() fails with a negative timeout");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+
+#ifdef __linux__
+  hole = _make_black_hole (&port, &filler);
+  start = g_get_monotonic_time ();
+  ok (mongo_connect_timeout ("127.0.0.1", port, 300) == NULL &&
+      errno == ETIMEDOUT,
+      "mongo_connect_timeout() fails with ETIMEDOUT when the server "
+      "does not answer");
+  ok (g_get_monotonic_time () - start < G_USEC_PER_SEC,
+      "mongo_connect_timeout() gives up in time");
+  close (filler);
+  close (hole);
+#else
+  skip (TRUE, 2, "Backlog based black holes are Linux specific");
+  endskip;
+#endif
+
+  begin_network_tests (2);
+
+  c = mongo_connect_timeout (config.primary_host, config.primary_port, 1000);
+  ok (c != NULL,
+      "mongo_connect_timeout() works");
+  cmp_ok (mongo_connection_get_timeout (c), "==", 1000,
+	  "mongo_connect_timeout() sets the I/O timeout too");
+  mongo_disconnect (c);
+
+  end_network_tests ();
+}
+
+RUN_TEST (8, mongo_connect_timeout);
@@ -0,0 +1,95 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_connection_get_reset_stats (void)
+{
+  mongo_connection c, server;
+  mongo_connection_stats stats;
+  mongo_packet *p;
+  bson *b;
+  int fds[2];
+
+  memset (&c, 0, sizeof (c));
+  memset (&server, 0, sizeof (server));
+
+  ok (mongo_connection_get_stats (NULL, &stats) == FALSE,
+      "mongo_connection_get_stats() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+  ok (mongo_connection_get_stats (&c, NULL) == FALSE,
+      "mongo_connection_get_stats() fails without a destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_connection_reset_stats (NULL) == FALSE,
+      "mongo_connection_reset_stats() fails with a NULL connection");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+  server.fd = fds[1];
+
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+  p = mongo_wire_cmd_custom (1, "test", 0, b);
+  mongo_packet_send (&c, p);
+  mongo_wire_packet_free (p);
+  bson_free (b);
+
+  p = mongo_wire_cmd_kill_cursors (2, 1, (gint64)42);
+  mongo_packet_send (&c, p);
+  mongo_wire_packet_free (p);
+
+  ok (mongo_connection_get_stats (&c, &stats),
+      "mongo_connection_get_stats() works");
+  cmp_ok ((gint)stats.packets_sent, "==", 2,
+	  "Sent packets are counted");
+  cmp_ok ((gint)stats.ops[MONGO_CONNECTION_STATS_OP_QUERY], "==", 1,
+	  "Queries are counted");
+  cmp_ok ((gint)stats.ops[MONGO_CONNECTION_STATS_OP_KILL_CURSORS], "==", 1,
+	  "Kill cursors requests are counted");
+  ok (stats.bytes_sent > 0,
+      "Sent bytes are counted");
+
+  /* Answer the last request. */
+  p = test_mongo_wire_generate_reply (TRUE, 1, TRUE);
+  {
+    mongo_packet_header h;
+
+    mongo_wire_packet_get_header (p, &h);
+    h.resp_to = 2;
+    mongo_wire_packet_set_header (p, &h);
+  }
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  p = mongo_packet_recv (&c);
+  mongo_wire_packet_free (p);
+
+  mongo_connection_get_stats (&c, &stats);
+  cmp_ok ((gint)stats.packets_received, "==", 1,
+	  "Received packets are counted");
+  ok (stats.bytes_received > 0,
+      "Received bytes are counted");
+  cmp_ok ((gint)stats.round_trips, "==", 1,
+	  "A reply to the last request is a round trip");
+  cmp_ok ((gint)stats.latency.count, "==", 1,
+	  "The latency of the round trip is recorded");
+
+  ok (mongo_connection_reset_stats (&c),
+      "mongo_connection_reset_stats() works");
+  mongo_connection_get_stats (&c, &stats);
+  cmp_ok ((gint)stats.packets_sent, "==", 0,
+	  "The statistics are reset");
+
+  close (fds[0]);
+  close (fds[1]);
+}
+
+RUN_TEST (16, mongo_connection_get_reset_stats);
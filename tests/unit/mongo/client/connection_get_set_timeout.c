@@ -0,0 +1,53 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_connection_get_set_timeout (void)
+{
+  mongo_connection c;
+  int fds[2];
+
+  memset (&c, 0, sizeof (c));
+  c.fd = -1;
+  c.timeout = 0;
+
+  ok (mongo_connection_get_timeout (NULL) == -1,
+      "mongo_connection_get_timeout() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+  ok (mongo_connection_set_timeout (NULL, 100) == FALSE,
+      "mongo_connection_set_timeout() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  ok (mongo_connection_set_timeout (&c, -1) == FALSE,
+      "mongo_connection_set_timeout() fails with a negative timeout");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  cmp_ok (mongo_connection_get_timeout (&c), "==", 0,
+	  "An invalid timeout does not change the setting");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+
+  ok (mongo_connection_set_timeout (&c, 1500),
+      "mongo_connection_set_timeout() works");
+  cmp_ok (mongo_connection_get_timeout (&c), "==", 1500,
+	  "mongo_connection_get_timeout() works");
+
+  ok (mongo_connection_set_timeout (&c, 0),
+      "mongo_connection_set_timeout() can disable the timeout");
+  cmp_ok (mongo_connection_get_timeout (&c), "==", 0,
+	  "The timeout is disabled");
+
+  close (fds[0]);
+  close (fds[1]);
+}
+
+RUN_TEST (11, mongo_connection_get_set_timeout);
@@ -0,0 +1,43 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void
+test_mongo_connection_get_transport (void)
+{
+  mongo_connection *conn;
+  gint fd, port, t;
+
+  ok (mongo_connection_get_transport (NULL) == -1,
+      "mongo_connection_get_transport() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  fd = test_make_listener (&port);
+
+  conn = mongo_connect ("127.0.0.1", port);
+  cmp_ok (mongo_connection_get_transport (conn), "==",
+	  MONGO_TRANSPORT_SOCKET,
+	  "Connections use plain sockets by default");
+  mongo_disconnect (conn);
+
+  mongo_transport_set_default (MONGO_TRANSPORT_IO_URING);
+  conn = mongo_connect ("127.0.0.1", port);
+  t = mongo_connection_get_transport (conn);
+  ok (t == MONGO_TRANSPORT_IO_URING || t == MONGO_TRANSPORT_SOCKET,
+      "Connections use io_uring, or fall back to plain sockets");
+  mongo_disconnect (conn);
+
+  conn = mongo_connect_timeout ("127.0.0.1", port, 1000);
+  ok (conn != NULL &&
+      mongo_connection_get_transport (conn) == t,
+      "Connecting with a timeout picks the same transport");
+  mongo_disconnect (conn);
+  mongo_transport_set_default (MONGO_TRANSPORT_SOCKET);
+
+  close (fd);
+}
+
+RUN_TEST (5, mongo_connection_get_transport);
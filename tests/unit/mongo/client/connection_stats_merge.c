@@ -0,0 +1,46 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_connection_stats_merge (void)
+{
+  mongo_connection_stats a, b;
+
+  memset (&a, 0, sizeof (a));
+  memset (&b, 0, sizeof (b));
+
+  ok (mongo_connection_stats_merge (NULL, &b) == FALSE,
+      "mongo_connection_stats_merge() fails without a destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_connection_stats_merge (&a, NULL) == FALSE,
+      "mongo_connection_stats_merge() fails without a source");
+
+  a.ops[MONGO_CONNECTION_STATS_OP_INSERT] = 2;
+  a.bytes_sent = 100;
+  a.reconnects = 1;
+  mongo_histogram_record (&a.latency, 10);
+
+  b.ops[MONGO_CONNECTION_STATS_OP_INSERT] = 3;
+  b.bytes_sent = 50;
+  b.get_last_error_calls = 4;
+  mongo_histogram_record (&b.latency, 20);
+
+  ok (mongo_connection_stats_merge (&a, &b),
+      "mongo_connection_stats_merge() works");
+  cmp_ok ((gint)a.ops[MONGO_CONNECTION_STATS_OP_INSERT], "==", 5,
+	  "Operation counters are added up");
+  cmp_ok ((gint)a.bytes_sent, "==", 150,
+	  "Byte counters are added up");
+  cmp_ok ((gint)a.reconnects, "==", 1,
+	  "Counters of the destination are kept");
+  cmp_ok ((gint)a.get_last_error_calls, "==", 4,
+	  "Counters of the source are added");
+  cmp_ok ((gint)a.latency.count, "==", 2,
+	  "Latency histograms are merged");
+}
+
+RUN_TEST (9, mongo_connection_stats_merge);
@@ -2,6 +2,7 @@
 #include "mongo.h"
 
 #include <errno.h>
+#include <string.h>
 #include <sys/socket.h>
 
 #include "libmongo-private.h"
@@ -12,7 +13,9 @@ test_mongo_packet_recv (void)
   mongo_connection c, *conn;
   mongo_packet *p;
   bson *b;
+  int fds[2];
 
+  memset (&c, 0, sizeof (c));
   c.fd = -1;
 
   ok (mongo_packet_recv (NULL) == NULL,
@@ -25,6 +28,17 @@ test_mongo_packet_recv (void)
   ok (errno == EBADF,
       "mongo_packet_recv() sets errno to EBADF is the FD is bad");
 
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+  mongo_connection_set_timeout (&c, 100);
+
+  ok (mongo_packet_recv (&c) == NULL,
+      "mongo_packet_recv() fails if nothing arrives in time");
+  cmp_ok (errno, "==", ETIMEDOUT,
+	  "mongo_packet_recv() sets errno to ETIMEDOUT on timeout");
+  close (fds[0]);
+  close (fds[1]);
+
   begin_network_tests (2);
 
   b = bson_new ();
@@ -53,4 +67,4 @@ test_mongo_packet_recv (void)
   end_network_tests ();
 }
 
-RUN_TEST (6, mongo_packet_recv);
+RUN_TEST (8, mongo_packet_recv);
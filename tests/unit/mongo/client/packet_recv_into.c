@@ -0,0 +1,90 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+static void
+_write_packet (int fd, const mongo_packet *p)
+{
+  mongo_packet_header h;
+  const guint8 *data;
+  gint32 size;
+
+  mongo_wire_packet_get_header_raw (p, &h);
+  size = mongo_wire_packet_get_data (p, &data);
+  write (fd, &h, sizeof (h));
+  write (fd, data, size);
+}
+
+void
+test_mongo_packet_recv_into (void)
+{
+  mongo_connection c;
+  mongo_packet *reply, *p;
+  guint8 buffer[4096], small[16];
+  const guint8 *data;
+  gint32 size;
+  bson *doc;
+  int fds[2];
+
+  memset (&c, 0, sizeof (c));
+  c.fd = -1;
+
+  ok (mongo_packet_recv_into (NULL, buffer, sizeof (buffer)) == NULL,
+      "mongo_packet_recv_into() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+  ok (mongo_packet_recv_into (&c, NULL, sizeof (buffer)) == NULL,
+      "mongo_packet_recv_into() fails with a NULL buffer");
+  ok (mongo_packet_recv_into (&c, buffer, 0) == NULL,
+      "mongo_packet_recv_into() fails with a zero sized buffer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_packet_recv_into (&c, buffer, sizeof (buffer)) == NULL,
+      "mongo_packet_recv_into() fails if the FD is bad");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+  reply = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  size = mongo_wire_packet_get_data (reply, &data);
+
+  _write_packet (fds[1], reply);
+  ok ((p = mongo_packet_recv_into (&c, buffer, sizeof (buffer))) != NULL,
+      "mongo_packet_recv_into() works");
+  cmp_ok (mongo_wire_packet_get_data (p, &data), "==", size,
+	  "The whole payload is received");
+  ok (data == buffer,
+      "The payload is received into the supplied buffer");
+  ok (mongo_wire_reply_packet_get_nth_document_view (p, 2, &doc) &&
+      bson_data (doc) > buffer && bson_data (doc) < buffer + size,
+      "Documents can be viewed in the supplied buffer");
+  bson_free (doc);
+  mongo_wire_packet_free (p);
+
+  _write_packet (fds[1], reply);
+  p = mongo_packet_recv_into (&c, buffer, sizeof (buffer));
+  ok (p && mongo_wire_packet_get_data (p, &data) == size && data == buffer,
+      "The buffer can be reused once the packet is freed");
+  mongo_wire_packet_free (p);
+
+  _write_packet (fds[1], reply);
+  ok ((p = mongo_packet_recv_into (&c, small, sizeof (small))) != NULL,
+      "mongo_packet_recv_into() works with a buffer that is too small");
+  ok (mongo_wire_packet_get_data (p, &data) == size && data != small,
+      "The payload is received into a buffer of its own");
+  mongo_wire_packet_free (p);
+
+  close (fds[1]);
+  ok (mongo_packet_recv_into (&c, buffer, sizeof (buffer)) == NULL,
+      "mongo_packet_recv_into() fails on a closed socket");
+  close (fds[0]);
+
+  mongo_wire_packet_free (reply);
+}
+
+RUN_TEST (14, mongo_packet_recv_into);
@@ -4,6 +4,7 @@
 #include "mongo-client.h"
 
 #include <errno.h>
+#include <string.h>
 #include <sys/socket.h>
 
 #include "libmongo-private.h"
@@ -15,8 +16,12 @@ test_mongo_packet_send (void)
   mongo_connection c, *conn;
   mongo_packet_header h;
   bson *b;
+  int fds[2];
+  gint32 bufsize = 4096;
+  guint8 *big;
 
   p = mongo_wire_cmd_kill_cursors (1, 2, (gint64)3, (gint64)4);
+  memset (&c, 0, sizeof (c));
   c.fd = -1;
 
   ok (mongo_packet_send (NULL, p) == FALSE,
@@ -47,6 +52,26 @@ test_mongo_packet_send (void)
 
   mongo_wire_packet_free (p);
 
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  setsockopt (fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof (bufsize));
+  c.fd = fds[0];
+  mongo_connection_set_timeout (&c, 100);
+
+  big = g_malloc0 (1024 * 1024);
+  h.length = sizeof (mongo_packet_header) + 1024 * 1024;
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_header (p, &h);
+  mongo_wire_packet_set_data (p, big, 1024 * 1024);
+  g_free (big);
+
+  ok (mongo_packet_send (&c, p) == FALSE,
+      "mongo_packet_send() fails if the peer does not read in time");
+  cmp_ok (errno, "==", ETIMEDOUT,
+	  "mongo_packet_send() sets errno to ETIMEDOUT on timeout");
+  mongo_wire_packet_free (p);
+  close (fds[0]);
+  close (fds[1]);
+
   begin_network_tests (2);
 
   b = bson_new ();
@@ -72,4 +97,4 @@ test_mongo_packet_send (void)
   end_network_tests ();
 }
 
-RUN_TEST (9, mongo_packet_send);
+RUN_TEST (11, mongo_packet_send);
@@ -0,0 +1,71 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-wire.h"
+#include "mongo-client.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_packet_send_n (void)
+{
+  mongo_packet *p[3], *r;
+  mongo_connection c;
+  mongo_packet_header h;
+  bson *b;
+  int fds[2];
+  gint32 i;
+
+  memset (&c, 0, sizeof (c));
+  b = test_bson_generate_full ();
+  p[0] = mongo_wire_cmd_insert (1, "test.ns", b, NULL);
+  p[1] = mongo_wire_cmd_update (2, "test.ns", 0, b, b);
+  p[2] = mongo_wire_cmd_delete (3, "test.ns", 0, b);
+  bson_free (b);
+
+  ok (mongo_packet_send_n (NULL, (const mongo_packet **)p, 3) == FALSE,
+      "mongo_packet_send_n() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  c.fd = -1;
+  ok (mongo_packet_send_n (&c, NULL, 3) == FALSE,
+      "mongo_packet_send_n() fails with NULL packets");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_packet_send_n (&c, (const mongo_packet **)p, 0) == FALSE,
+      "mongo_packet_send_n() fails with zero packets");
+  ok (mongo_packet_send_n (&c, (const mongo_packet **)p, 3) == FALSE,
+      "mongo_packet_send_n() fails if the FD is less than zero");
+  cmp_ok (errno, "==", EBADF,
+	  "errno is set to EBADF");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+
+  ok (mongo_packet_send_n (&c, (const mongo_packet **)p, 3),
+      "mongo_packet_send_n() works");
+  cmp_ok (mongo_connection_get_requestid (&c), "==", 3,
+	  "The request ID of the last packet is remembered");
+  cmp_ok (c.stats.packets_sent, "==", 3,
+	  "All packets are counted as sent");
+
+  c.fd = fds[1];
+  for (i = 0; i < 3; i++)
+    {
+      r = mongo_packet_recv (&c);
+      mongo_wire_packet_get_header (r, &h);
+      cmp_ok (h.id, "==", i + 1,
+	      "Packet #%d arrives in order", i + 1);
+      mongo_wire_packet_free (r);
+    }
+
+  close (fds[0]);
+  close (fds[1]);
+  for (i = 0; i < 3; i++)
+    mongo_wire_packet_free (p[i]);
+}
+
+RUN_TEST (13, mongo_packet_send_n);
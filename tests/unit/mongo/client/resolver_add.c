@@ -0,0 +1,117 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static gulong lookup_delay;
+
+/* Slow the system resolver down, so that addresses can be added
+   while a lookup is in progress. */
+int
+getaddrinfo (const char *node, const char *service,
+	     const struct addrinfo *hints, struct addrinfo **res)
+{
+  SAVE_OLD_FUNC (getaddrinfo);
+
+  if (lookup_delay)
+    g_usleep (lookup_delay);
+  return (int)(glong)CALL_OLD_FUNC (getaddrinfo, node, service, hints, res);
+}
+
+static void
+_loopback (struct sockaddr_in *sa, gint port)
+{
+  memset (sa, 0, sizeof (*sa));
+  sa->sin_family = AF_INET;
+  sa->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa->sin_port = htons (port);
+}
+
+static gpointer
+_connect_thread (gpointer data)
+{
+  mongo_disconnect (mongo_connect ("127.0.0.1", GPOINTER_TO_INT (data)));
+  return NULL;
+}
+
+void
+test_mongo_resolver_add (void)
+{
+  struct sockaddr_in sa, closed;
+  mongo_connection *conn;
+  GThread *thread;
+  int lfd, cfd, port;
+
+  lfd = test_make_listener (&port);
+  _loopback (&sa, port);
+
+  ok (mongo_resolver_add (NULL, 27017, (struct sockaddr *)&sa,
+			  sizeof (sa)) == FALSE,
+      "mongo_resolver_add() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_resolver_add ("/tmp/mongodb.sock", 0, (struct sockaddr *)&sa,
+			  sizeof (sa)) == FALSE && errno == EINVAL,
+      "mongo_resolver_add() fails with a Unix domain socket path");
+  ok (mongo_resolver_add ("lmc-test.invalid", 27017, NULL,
+			  sizeof (sa)) == FALSE,
+      "mongo_resolver_add() fails with a NULL address");
+  ok (mongo_resolver_add ("lmc-test.invalid", 27017,
+			  (struct sockaddr *)&sa, 0) == FALSE,
+      "mongo_resolver_add() fails with a zero length address");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+
+  ok (mongo_resolver_add ("lmc-test.invalid", 27017,
+			  (struct sockaddr *)&sa, sizeof (sa)),
+      "mongo_resolver_add() works");
+  conn = mongo_connect ("lmc-test.invalid", 27017);
+  ok (conn != NULL,
+      "mongo_connect() uses the pre-resolved address");
+  mongo_disconnect (conn);
+  cfd = accept (lfd, NULL, NULL);
+  close (cfd);
+
+  /* A port nothing listens on: the listener's, once closed. */
+  cfd = test_make_listener (&port);
+  close (cfd);
+  _loopback (&closed, port);
+
+  mongo_resolver_add ("lmc-test-2.invalid", 27017,
+		      (struct sockaddr *)&closed, sizeof (closed));
+  mongo_resolver_add ("lmc-test-2.invalid", 27017,
+		      (struct sockaddr *)&sa, sizeof (sa));
+  conn = mongo_connect_timeout ("lmc-test-2.invalid", 27017, 1000);
+  ok (conn != NULL,
+      "Pre-resolved addresses are tried in the order they were added");
+  mongo_disconnect (conn);
+  cfd = accept (lfd, NULL, NULL);
+  close (cfd);
+
+  /* Pin an address while the real one is being looked up. */
+  lookup_delay = 200 * 1000;
+  thread = g_thread_new ("resolver", _connect_thread,
+			 GINT_TO_POINTER (port));
+  g_usleep (50 * 1000);
+  mongo_resolver_add ("127.0.0.1", port, (struct sockaddr *)&sa,
+		      sizeof (sa));
+  g_thread_join (thread);
+  lookup_delay = 0;
+
+  conn = mongo_connect ("127.0.0.1", port);
+  ok (conn != NULL,
+      "A lookup finishing late does not replace pinned addresses");
+  mongo_disconnect (conn);
+
+  close (lfd);
+  mongo_resolver_flush ();
+}
+
+RUN_TEST (10, mongo_resolver_add);
@@ -0,0 +1,47 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-client.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+void
+test_mongo_resolver_flush (void)
+{
+  struct sockaddr_in sa;
+  mongo_connection *conn;
+  int lfd, cfd, port, closed;
+
+  mongo_resolver_flush ();
+  pass ("mongo_resolver_flush() works on an empty cache");
+
+  lfd = test_make_listener (&port);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa.sin_port = htons (port);
+
+  /* Find a port nothing listens on, and map it to the listener. */
+  cfd = test_make_listener (&closed);
+  close (cfd);
+
+  mongo_resolver_add ("127.0.0.1", closed,
+		      (struct sockaddr *)&sa, sizeof (sa));
+  conn = mongo_connect ("127.0.0.1", closed);
+  ok (conn != NULL,
+      "The pre-resolved address overrides the real one");
+  mongo_disconnect (conn);
+  cfd = accept (lfd, NULL, NULL);
+  close (cfd);
+
+  mongo_resolver_flush ();
+  ok (mongo_connect ("127.0.0.1", closed) == NULL,
+      "mongo_resolver_flush() drops pre-resolved addresses");
+
+  close (lfd);
+}
+
+RUN_TEST (3, mongo_resolver_flush);
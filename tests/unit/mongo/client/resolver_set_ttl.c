@@ -0,0 +1,115 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+
+#define N_THREADS 4
+
+static gint lookups;
+static gulong lookup_delay;
+
+/* Count the lookups reaching the system resolver. Names under
+   .invalid fail without asking it. */
+int
+getaddrinfo (const char *node, const char *service,
+	     const struct addrinfo *hints, struct addrinfo **res)
+{
+  SAVE_OLD_FUNC (getaddrinfo);
+
+  g_atomic_int_inc (&lookups);
+  if (lookup_delay)
+    g_usleep (lookup_delay);
+  if (node && g_str_has_suffix (node, ".invalid"))
+    return EAI_NONAME;
+  return (int)(glong)CALL_OLD_FUNC (getaddrinfo, node, service, hints, res);
+}
+
+static gpointer
+_connect_thread (gpointer data)
+{
+  mongo_disconnect (mongo_connect ("127.0.0.1", GPOINTER_TO_INT (data)));
+  return NULL;
+}
+
+void
+test_mongo_resolver_set_ttl (void)
+{
+  mongo_connection *conn;
+  GThread *threads[N_THREADS];
+  gint i, lfd, port;
+
+  ok (mongo_resolver_set_ttl (-1, 5) == FALSE,
+      "mongo_resolver_set_ttl() fails with a negative TTL");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  ok (mongo_resolver_set_ttl (30, -1) == FALSE,
+      "mongo_resolver_set_ttl() fails with a negative negative TTL");
+
+  ok (mongo_resolver_set_ttl (0, 0),
+      "Caching can be disabled");
+  ok (mongo_connect ("127.0.0.1", 1) == NULL,
+      "Connecting still works the same without caching");
+  ok (mongo_resolver_set_ttl (30, 5),
+      "mongo_resolver_set_ttl() works");
+
+  /* A port nothing listens on: connects fail fast, but the name is
+     resolved all the same. */
+  lfd = test_make_listener (&port);
+  close (lfd);
+
+  mongo_resolver_set_ttl (1, 1);
+  mongo_resolver_flush ();
+  lookups = 0;
+
+  mongo_connect ("127.0.0.1", port);
+  mongo_connect ("127.0.0.1", port);
+  cmp_ok (lookups, "==", 1,
+	  "Successful lookups are cached");
+
+  mongo_connect ("lmc-test.invalid", port);
+  ok (mongo_connect ("lmc-test.invalid", port) == NULL &&
+      errno == EADDRNOTAVAIL,
+      "A cached failure fails the same way");
+  cmp_ok (lookups, "==", 2,
+	  "Failed lookups are cached");
+
+  g_usleep (1100 * 1000);
+  mongo_connect ("127.0.0.1", port);
+  mongo_connect ("lmc-test.invalid", port);
+  cmp_ok (lookups, "==", 4,
+	  "Cached lookups expire after their TTL");
+
+  mongo_resolver_flush ();
+  lookups = 0;
+  lookup_delay = 200 * 1000;
+  for (i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_new ("resolver", _connect_thread,
+			       GINT_TO_POINTER (port));
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads[i]);
+  lookup_delay = 0;
+  cmp_ok (lookups, "==", 1,
+	  "Concurrent lookups of the same name are done once");
+
+  mongo_resolver_set_ttl (30, 5);
+  mongo_resolver_flush ();
+
+  begin_network_tests (2);
+
+  conn = mongo_connect (config.primary_host, config.primary_port);
+  ok (conn != NULL,
+      "Connecting with a cold cache works");
+  mongo_disconnect (conn);
+  conn = mongo_connect (config.primary_host, config.primary_port);
+  ok (conn != NULL,
+      "Connecting with a warm cache works");
+  mongo_disconnect (conn);
+
+  end_network_tests ();
+}
+
+RUN_TEST (13, mongo_resolver_set_ttl);
@@ -0,0 +1,130 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+#define TRACE_MAX 8
+
+typedef struct
+{
+  gint n;
+  mongo_trace_info events[TRACE_MAX];
+  gchar ns[TRACE_MAX][64];
+} trace_log;
+
+static void
+trace_handler (const mongo_trace_info *info, gpointer user_data)
+{
+  trace_log *log = (trace_log *)user_data;
+
+  if (log->n >= TRACE_MAX)
+    return;
+
+  log->events[log->n] = *info;
+  if (info->ns)
+    g_strlcpy (log->ns[log->n], info->ns, sizeof (log->ns[0]));
+  log->events[log->n].ns = (info->ns) ? log->ns[log->n] : NULL;
+  log->n++;
+
+  /* Handlers must not be able to clobber errno. */
+  errno = EBADF;
+}
+
+void
+test_mongo_trace_set_handler (void)
+{
+  mongo_connection c, server;
+  mongo_packet *p;
+  mongo_packet_header h;
+  trace_log log;
+  bson *b;
+  int fds[2];
+
+  memset (&c, 0, sizeof (c));
+  memset (&server, 0, sizeof (server));
+  memset (&log, 0, sizeof (log));
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+  server.fd = fds[1];
+
+  mongo_trace_set_handler (trace_handler, &log);
+
+  b = bson_new ();
+  bson_append_int32 (b, "ping", 1);
+  bson_finish (b);
+  p = mongo_wire_cmd_custom (7, "test", 0, b);
+  bson_free (b);
+  ok (mongo_packet_send (&c, p),
+      "mongo_packet_send() works with a trace handler");
+  mongo_wire_packet_get_header (p, &h);
+  mongo_wire_packet_free (p);
+
+  cmp_ok (log.n, "==", 2,
+	  "Sending a packet produces two events");
+  ok (log.events[0].event == MONGO_TRACE_SEND_START &&
+      log.events[1].event == MONGO_TRACE_SEND_END,
+      "Send events arrive in order");
+  ok (log.events[0].conn == &c,
+      "Events carry the connection");
+  cmp_ok (log.events[0].opcode, "==", 2004,
+	  "Send events carry the opcode");
+  cmp_ok (log.events[0].request_id, "==", 7,
+	  "Send events carry the request ID");
+  is (log.events[0].ns, "test.$cmd",
+      "Send events carry the namespace");
+  cmp_ok (log.events[0].size, "==", h.length,
+	  "Send events carry the packet size");
+  ok (log.events[1].success == TRUE && log.events[1].error == 0,
+      "The send end event reports success");
+
+  /* Reply to the request. */
+  log.n = 0;
+  mongo_trace_set_handler (NULL, NULL);
+  p = test_mongo_wire_generate_reply (TRUE, 1, TRUE);
+  mongo_wire_packet_get_header (p, &h);
+  h.resp_to = 7;
+  mongo_wire_packet_set_header (p, &h);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+  cmp_ok (log.n, "==", 0,
+	  "No events are reported without a handler");
+
+  mongo_trace_set_handler (trace_handler, &log);
+  p = mongo_packet_recv (&c);
+  ok (p != NULL,
+      "mongo_packet_recv() works with a trace handler");
+  mongo_wire_packet_free (p);
+
+  cmp_ok (log.n, "==", 2,
+	  "Receiving a packet produces two events");
+  ok (log.events[0].event == MONGO_TRACE_RECV_START &&
+      log.events[1].event == MONGO_TRACE_RECV_END,
+      "Receive events arrive in order");
+  cmp_ok (log.events[0].opcode, "==", 0,
+	  "The receive start event has no opcode yet");
+  ok (log.events[1].opcode == 1 && log.events[1].response_to == 7 &&
+      log.events[1].size == h.length && log.events[1].ns == NULL,
+      "The receive end event describes the reply");
+
+  /* Failure is reported, errno is preserved. */
+  log.n = 0;
+  close (fds[1]);
+  errno = 0;
+  ok (mongo_packet_recv (&c) == NULL,
+      "mongo_packet_recv() fails on a closed socket");
+  cmp_ok (errno, "!=", EBADF,
+	  "errno is not clobbered by the handler");
+  ok (log.n == 2 && log.events[1].success == FALSE &&
+      log.events[1].error != 0,
+      "The receive end event reports the failure");
+
+  mongo_trace_set_handler (NULL, NULL);
+  close (fds[0]);
+}
+
+RUN_TEST (18, mongo_trace_set_handler);
@@ -0,0 +1,28 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_transport_get_set_default (void)
+{
+  cmp_ok (mongo_transport_get_default (), "==", MONGO_TRANSPORT_SOCKET,
+	  "The default transport is plain sockets");
+
+  ok (mongo_transport_set_default ((mongo_transport)42) == FALSE,
+      "mongo_transport_set_default() fails with an invalid transport");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  cmp_ok (mongo_transport_get_default (), "==", MONGO_TRANSPORT_SOCKET,
+	  "An invalid transport does not change the setting");
+
+  ok (mongo_transport_set_default (MONGO_TRANSPORT_IO_URING),
+      "mongo_transport_set_default() works");
+  cmp_ok (mongo_transport_get_default (), "==", MONGO_TRANSPORT_IO_URING,
+	  "mongo_transport_get_default() works");
+
+  ok (mongo_transport_set_default (MONGO_TRANSPORT_SOCKET),
+      "The default can be restored");
+}
+
+RUN_TEST (7, mongo_transport_get_set_default);
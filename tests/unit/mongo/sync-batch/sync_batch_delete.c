@@ -0,0 +1,38 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_delete (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  bson *sel;
+
+  sel = test_bson_generate_full ();
+
+  ok (mongo_sync_batch_delete (NULL, "test.ns", 0, sel) == FALSE,
+      "mongo_sync_batch_delete() fails with a NULL batch");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  batch = mongo_sync_batch_new (conn);
+
+  ok (mongo_sync_batch_delete (batch, NULL, 0, sel) == FALSE,
+      "mongo_sync_batch_delete() fails with a NULL namespace");
+  ok (mongo_sync_batch_delete (batch, "test.ns", 0, NULL) == FALSE,
+      "mongo_sync_batch_delete() fails with a NULL selector");
+
+  ok (mongo_sync_batch_delete (batch, "test.ns", 0, sel),
+      "mongo_sync_batch_delete() works");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 1,
+	  "The delete is pending");
+
+  bson_free (sel);
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (6, mongo_sync_batch_delete);
@@ -0,0 +1,37 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_flush (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  bson *b;
+
+  ok (mongo_sync_batch_flush (NULL) == FALSE,
+      "mongo_sync_batch_flush() fails with a NULL batch");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  batch = mongo_sync_batch_new (conn);
+
+  ok (mongo_sync_batch_flush (batch),
+      "Flushing an empty batch works, even on a broken connection");
+
+  b = test_bson_generate_full ();
+  mongo_sync_batch_insert (batch, "test.ns", b);
+  bson_free (b);
+
+  ok (mongo_sync_batch_flush (batch) == FALSE,
+      "mongo_sync_batch_flush() fails on a broken connection");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 0,
+	  "Pending operations are dropped on failure");
+
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (5, mongo_sync_batch_flush);
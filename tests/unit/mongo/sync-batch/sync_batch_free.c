@@ -0,0 +1,38 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+void
+test_mongo_sync_batch_free (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  bson *b;
+  guint8 buf[16];
+  int fds[2];
+
+  mongo_sync_batch_free (NULL);
+  pass ("mongo_sync_batch_free(NULL) does not crash");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], FALSE);
+
+  batch = mongo_sync_batch_new (conn);
+  mongo_sync_batch_free (batch);
+  pass ("mongo_sync_batch_free() works on an empty batch");
+
+  batch = mongo_sync_batch_new (conn);
+  b = test_bson_generate_full ();
+  mongo_sync_batch_insert (batch, "test.ns", b);
+  bson_free (b);
+  mongo_sync_batch_free (batch);
+  ok (recv (fds[1], buf, sizeof (buf), MSG_DONTWAIT) == -1,
+      "mongo_sync_batch_free() drops pending operations unsent");
+
+  mongo_sync_disconnect (conn);
+  close (fds[1]);
+}
+
+RUN_TEST (3, mongo_sync_batch_free);
@@ -0,0 +1,35 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_get_pending (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  bson *b;
+
+  cmp_ok (mongo_sync_batch_get_pending (NULL), "==", -1,
+	  "mongo_sync_batch_get_pending() fails with a NULL batch");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  batch = mongo_sync_batch_new (conn);
+  b = test_bson_generate_full ();
+
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 0,
+	  "An empty batch has nothing pending");
+  mongo_sync_batch_insert (batch, "test.ns", b);
+  mongo_sync_batch_delete (batch, "test.other", 0, b);
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 2,
+	  "Operations on any namespace are counted");
+
+  bson_free (b);
+  mongo_sync_batch_flush (batch);
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (4, mongo_sync_batch_get_pending);
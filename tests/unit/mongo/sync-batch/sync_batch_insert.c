@@ -0,0 +1,49 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_insert (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  bson *b, *tmp;
+
+  b = test_bson_generate_full ();
+
+  ok (mongo_sync_batch_insert (NULL, "test.ns", b) == FALSE,
+      "mongo_sync_batch_insert() fails with a NULL batch");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  batch = mongo_sync_batch_new (conn);
+
+  ok (mongo_sync_batch_insert (batch, NULL, b) == FALSE,
+      "mongo_sync_batch_insert() fails with a NULL namespace");
+  ok (mongo_sync_batch_insert (batch, "test.ns", NULL) == FALSE,
+      "mongo_sync_batch_insert() fails with a NULL document");
+  tmp = bson_new ();
+  ok (mongo_sync_batch_insert (batch, "test.ns", tmp) == FALSE,
+      "mongo_sync_batch_insert() fails with an unfinished document");
+  bson_free (tmp);
+
+  ok (mongo_sync_batch_insert (batch, "test.ns", b),
+      "mongo_sync_batch_insert() works");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 1,
+	  "The insert is pending");
+
+  mongo_sync_batch_set_limits (batch, 1024 * 1024, 2, 0);
+  ok (mongo_sync_batch_insert (batch, "test.ns", b) == FALSE,
+      "mongo_sync_batch_insert() flushes when the limit is reached, "
+      "and reports the failure of the flush");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 0,
+	  "The batch is empty after the flush");
+
+  bson_free (b);
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (9, mongo_sync_batch_insert);
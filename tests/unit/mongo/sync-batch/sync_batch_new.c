@@ -0,0 +1,27 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_new (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+
+  ok (mongo_sync_batch_new (NULL) == NULL,
+      "mongo_sync_batch_new() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  ok ((batch = mongo_sync_batch_new (conn)) != NULL,
+      "mongo_sync_batch_new() works");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 0,
+	  "A new batch is empty");
+
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (4, mongo_sync_batch_new);
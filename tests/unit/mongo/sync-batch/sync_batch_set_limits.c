@@ -0,0 +1,35 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_set_limits (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+
+  ok (mongo_sync_batch_set_limits (NULL, 1024, 10, 0) == FALSE,
+      "mongo_sync_batch_set_limits() fails with a NULL batch");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  batch = mongo_sync_batch_new (conn);
+
+  ok (mongo_sync_batch_set_limits (batch, 0, 10, 0) == FALSE,
+      "mongo_sync_batch_set_limits() fails with a zero size limit");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  ok (mongo_sync_batch_set_limits (batch, 1024, 0, 0) == FALSE,
+      "mongo_sync_batch_set_limits() fails with a zero operation limit");
+  ok (mongo_sync_batch_set_limits (batch, 1024, 10, -1) == FALSE,
+      "mongo_sync_batch_set_limits() fails with a negative delay");
+  ok (mongo_sync_batch_set_limits (batch, 1024, 10, 100),
+      "mongo_sync_batch_set_limits() works");
+
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (7, mongo_sync_batch_set_limits);
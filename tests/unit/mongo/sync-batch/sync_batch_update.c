@@ -0,0 +1,44 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_batch_update (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_batch *batch;
+  bson *sel, *upd;
+
+  sel = bson_new ();
+  bson_append_null (sel, "_id");
+  bson_finish (sel);
+  upd = test_bson_generate_full ();
+
+  ok (mongo_sync_batch_update (NULL, "test.ns", 0, sel, upd) == FALSE,
+      "mongo_sync_batch_update() fails with a NULL batch");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  batch = mongo_sync_batch_new (conn);
+
+  ok (mongo_sync_batch_update (batch, NULL, 0, sel, upd) == FALSE,
+      "mongo_sync_batch_update() fails with a NULL namespace");
+  ok (mongo_sync_batch_update (batch, "test.ns", 0, NULL, upd) == FALSE,
+      "mongo_sync_batch_update() fails with a NULL selector");
+  ok (mongo_sync_batch_update (batch, "test.ns", 0, sel, NULL) == FALSE,
+      "mongo_sync_batch_update() fails with a NULL update");
+
+  ok (mongo_sync_batch_update (batch, "test.ns", 0, sel, upd),
+      "mongo_sync_batch_update() works");
+  cmp_ok (mongo_sync_batch_get_pending (batch), "==", 1,
+	  "The update is pending");
+
+  bson_free (sel);
+  bson_free (upd);
+  mongo_sync_batch_free (batch);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (7, mongo_sync_batch_update);
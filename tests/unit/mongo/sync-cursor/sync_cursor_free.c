@@ -0,0 +1,64 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_cursor_free (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_connection server;
+  mongo_packet *p;
+  mongo_packet_header h;
+  struct pollfd pfd;
+  int fds[2];
+
+  mongo_sync_cursor_free (NULL);
+  pass ("mongo_sync_cursor_free(NULL) works");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], FALSE);
+  server.fd = fds[1];
+  server.timeout = 0;
+
+  pfd.fd = fds[1];
+  pfd.events = POLLIN;
+
+  p = test_mongo_wire_generate_cursor_reply (1, 0, 0, 2);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  mongo_sync_cursor_free (cursor);
+  ok (poll (&pfd, 1, 0) == 0,
+      "mongo_sync_cursor_free() sends nothing when the cursor is dead");
+
+  p = test_mongo_wire_generate_cursor_reply (1, 42, 0, 2);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  p = mongo_packet_recv (&server);
+  mongo_wire_packet_get_header (p, &h);
+  mongo_wire_packet_free (p);
+
+  p = test_mongo_wire_generate_cursor_reply (h.id, 42, 2, 2);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  mongo_sync_cursor_free (cursor);
+
+  pfd.fd = fds[0];
+  ok (poll (&pfd, 1, 0) == 0,
+      "mongo_sync_cursor_free() reads the reply of the pending getMore");
+
+  p = mongo_packet_recv (&server);
+  mongo_wire_packet_get_header (p, &h);
+  mongo_wire_packet_free (p);
+  cmp_ok (h.opcode, "==", 2007 /* OP_KILL_CURSORS */,
+	  "mongo_sync_cursor_free() kills a live cursor");
+
+  close (fds[1]);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (4, mongo_sync_cursor_free);
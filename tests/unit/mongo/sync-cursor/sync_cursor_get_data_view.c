@@ -0,0 +1,49 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_cursor_get_data_view (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_packet *p;
+  const bson *b;
+  bson_cursor *c;
+  gint32 seq;
+
+  errno = 0;
+  ok (mongo_sync_cursor_get_data_view (NULL) == NULL && errno == EINVAL,
+      "mongo_sync_cursor_get_data_view() fails with a NULL cursor");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  p = test_mongo_wire_generate_cursor_reply (1, 0, 10, 2);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+
+  errno = 0;
+  ok (mongo_sync_cursor_get_data_view (cursor) == NULL && errno == ERANGE,
+      "mongo_sync_cursor_get_data_view() fails before the first "
+      "mongo_sync_cursor_next()");
+
+  mongo_sync_cursor_next (cursor);
+  b = mongo_sync_cursor_get_data_view (cursor);
+  ok (b != NULL,
+      "mongo_sync_cursor_get_data_view() works");
+  c = bson_find (b, "seq");
+  ok (bson_cursor_get_int32 (c, &seq) && seq == 10,
+      "mongo_sync_cursor_get_data_view() returns the right document");
+  bson_cursor_free (c);
+
+  mongo_sync_cursor_next (cursor);
+  b = mongo_sync_cursor_get_data_view (cursor);
+  c = bson_find (b, "seq");
+  ok (bson_cursor_get_int32 (c, &seq) && seq == 11,
+      "mongo_sync_cursor_get_data_view() follows the cursor");
+  bson_cursor_free (c);
+
+  mongo_sync_cursor_free (cursor);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (5, mongo_sync_cursor_get_data_view);
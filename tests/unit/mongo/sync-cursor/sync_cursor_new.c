@@ -0,0 +1,75 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_cursor_new (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_connection server;
+  mongo_packet *p;
+  mongo_packet_header h;
+  struct pollfd pfd;
+  int fds[2];
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], FALSE);
+  server.fd = fds[1];
+  server.timeout = 0;
+
+  pfd.fd = fds[1];
+  pfd.events = POLLIN;
+
+  p = test_mongo_wire_generate_cursor_reply (1, 0, 0, 2);
+
+  errno = 0;
+  ok (mongo_sync_cursor_new (NULL, "test.ns", p) == NULL &&
+      errno == ENOTCONN,
+      "mongo_sync_cursor_new() fails with a NULL connection");
+  errno = 0;
+  ok (mongo_sync_cursor_new (conn, NULL, p) == NULL && errno == EINVAL,
+      "mongo_sync_cursor_new() fails with a NULL namespace");
+  errno = 0;
+  ok (mongo_sync_cursor_new (conn, "test.ns", NULL) == NULL &&
+      errno == EINVAL,
+      "mongo_sync_cursor_new() fails with a NULL packet");
+
+  mongo_wire_packet_free (p);
+  p = test_mongo_wire_generate_reply (FALSE, 0, FALSE);
+  ok (mongo_sync_cursor_new (conn, "test.ns", p) == NULL,
+      "mongo_sync_cursor_new() fails with a packet that is not a reply");
+  mongo_wire_packet_free (p);
+
+  p = test_mongo_wire_generate_cursor_reply (1, 0, 0, 2);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  ok (cursor != NULL,
+      "mongo_sync_cursor_new() works");
+  ok (poll (&pfd, 1, 0) == 0,
+      "mongo_sync_cursor_new() does not send a getMore for a dead cursor");
+  mongo_sync_cursor_free (cursor);
+
+  p = test_mongo_wire_generate_cursor_reply (1, 42, 0, 2);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  ok (cursor != NULL,
+      "mongo_sync_cursor_new() works with a live cursor");
+  ok (poll (&pfd, 1, 0) == 1,
+      "mongo_sync_cursor_new() sends the next getMore right away");
+
+  p = mongo_packet_recv (&server);
+  mongo_wire_packet_get_header (p, &h);
+  cmp_ok (h.opcode, "==", 2005 /* OP_GET_MORE */,
+	  "The request sent is a getMore");
+  mongo_wire_packet_free (p);
+
+  close (fds[1]);
+  mongo_sync_cursor_free (cursor);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (9, mongo_sync_cursor_new);
@@ -0,0 +1,144 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+static void
+_send_reply (mongo_connection *server, gint32 resp_to, gint64 cursor_id,
+	     gint32 start, gint32 nreturn)
+{
+  mongo_packet *p;
+
+  p = test_mongo_wire_generate_cursor_reply (resp_to, cursor_id,
+					     start, nreturn);
+  mongo_packet_send (server, p);
+  mongo_wire_packet_free (p);
+}
+
+void
+test_mongo_sync_cursor_new_exhaust (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_connection server;
+  mongo_packet *p;
+  const guint8 *data;
+  gint32 flags, rid;
+  bson *q;
+  struct pollfd pfd;
+  gint n = 0;
+  gboolean in_order = TRUE;
+  guint8 c;
+  int fds[2];
+
+  q = bson_new ();
+  bson_finish (q);
+
+  errno = 0;
+  ok (mongo_sync_cursor_new_exhaust (NULL, "test.ns", 0, 0, 0, q,
+				     NULL) == NULL && errno == ENOTCONN,
+      "mongo_sync_cursor_new_exhaust() fails with a NULL connection");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], TRUE);
+  server.fd = fds[1];
+  server.timeout = 0;
+
+  pfd.fd = fds[1];
+  pfd.events = POLLIN;
+
+  /* The whole stream is sent up front: the first reply is a response
+     to the query, the rest are responses to the previous reply, whose
+     ID is always 1984. */
+  rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+  _send_reply (&server, rid, 42, 0, 2);
+  _send_reply (&server, 1984, 42, 2, 2);
+  _send_reply (&server, 1984, 0, 4, 1);
+
+  cursor = mongo_sync_cursor_new_exhaust (conn, "test.ns", 0, 0, 2, q,
+					  NULL);
+  ok (cursor != NULL,
+      "mongo_sync_cursor_new_exhaust() works");
+
+  p = mongo_packet_recv (&server);
+  mongo_wire_packet_get_data (p, &data);
+  memcpy (&flags, data, sizeof (flags));
+  flags = GINT32_FROM_LE (flags);
+  ok (flags & MONGO_WIRE_FLAG_QUERY_EXHAUST,
+      "The query is sent with the exhaust flag set");
+  mongo_wire_packet_free (p);
+
+  while (mongo_sync_cursor_next (cursor))
+    {
+      bson *b;
+      bson_cursor *bc;
+      gint32 seq;
+
+      b = mongo_sync_cursor_get_data (cursor);
+      bc = bson_find (b, "seq");
+      if (!bson_cursor_get_int32 (bc, &seq) || seq != n)
+	in_order = FALSE;
+      bson_cursor_free (bc);
+      bson_free (b);
+      n++;
+    }
+  cmp_ok (errno, "==", ENOENT,
+	  "mongo_sync_cursor_next() stops at the end of the stream");
+  ok (n == 5 && in_order,
+      "mongo_sync_cursor_next() reads all streamed batches in order");
+  ok (poll (&pfd, 1, 0) == 0,
+      "No getMore requests are sent for an exhaust cursor");
+
+  mongo_sync_cursor_free (cursor);
+  ok (poll (&pfd, 1, 0) == 0,
+      "Freeing an exhausted cursor leaves the connection alone");
+
+  /* A reply that does not continue the stream. */
+  rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+  _send_reply (&server, rid, 42, 0, 2);
+  _send_reply (&server, 1983, 42, 2, 2);
+
+  cursor = mongo_sync_cursor_new_exhaust (conn, "test.ns", 0, 0, 2, q,
+					  NULL);
+  p = mongo_packet_recv (&server);
+  mongo_wire_packet_free (p);
+
+  n = 0;
+  while (mongo_sync_cursor_next (cursor))
+    n++;
+  ok (n == 2 && errno == EPROTO,
+      "mongo_sync_cursor_next() rejects a reply to something else");
+  mongo_sync_cursor_free (cursor);
+  mongo_sync_disconnect (conn);
+
+  close (fds[1]);
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], TRUE);
+  server.fd = fds[1];
+
+  /* Stopping early. */
+  rid = mongo_connection_get_requestid ((mongo_connection *)conn) + 1;
+  _send_reply (&server, rid, 42, 0, 2);
+  _send_reply (&server, 1984, 42, 2, 2);
+
+  cursor = mongo_sync_cursor_new_exhaust (conn, "test.ns", 0, 0, 2, q,
+					  NULL);
+  p = mongo_packet_recv (&server);
+  mongo_wire_packet_free (p);
+
+  mongo_sync_cursor_next (cursor);
+  mongo_sync_cursor_free (cursor);
+  ok (recv (fds[1], &c, 1, 0) == 0,
+      "Freeing an exhaust cursor early shuts the connection down");
+
+  bson_free (q);
+  close (fds[1]);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (9, mongo_sync_cursor_new_exhaust);
@@ -0,0 +1,156 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+static gint32
+_recv_get_more (mongo_connection *server)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+
+  p = mongo_packet_recv (server);
+  if (!p)
+    return -1;
+  mongo_wire_packet_get_header (p, &h);
+  mongo_wire_packet_free (p);
+
+  if (h.opcode != 2005 /* OP_GET_MORE */)
+    return -1;
+  return h.id;
+}
+
+static gint32
+_cursor_seq (mongo_sync_cursor *cursor)
+{
+  bson *b;
+  bson_cursor *c;
+  gint32 seq = -1;
+
+  b = mongo_sync_cursor_get_data (cursor);
+  c = bson_find (b, "seq");
+  bson_cursor_get_int32 (c, &seq);
+  bson_cursor_free (c);
+  bson_free (b);
+
+  return seq;
+}
+
+void
+test_mongo_sync_cursor_next (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_cursor *cursor;
+  mongo_connection server;
+  mongo_packet *p;
+  struct pollfd pfd;
+  gint32 rid;
+  int fds[2];
+
+  errno = 0;
+  ok (mongo_sync_cursor_next (NULL) == FALSE && errno == EINVAL,
+      "mongo_sync_cursor_next() fails with a NULL cursor");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], FALSE);
+  server.fd = fds[1];
+  server.timeout = 0;
+
+  pfd.fd = fds[1];
+  pfd.events = POLLIN;
+
+  /* Iterating over two batches. */
+  p = test_mongo_wire_generate_cursor_reply (1, 42, 0, 2);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  rid = _recv_get_more (&server);
+
+  ok (mongo_sync_cursor_next (cursor) == TRUE && _cursor_seq (cursor) == 0,
+      "mongo_sync_cursor_next() steps to the first document");
+  ok (mongo_sync_cursor_next (cursor) == TRUE && _cursor_seq (cursor) == 1,
+      "mongo_sync_cursor_next() steps to the second document");
+
+  p = test_mongo_wire_generate_cursor_reply (rid, 0, 2, 3);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  ok (mongo_sync_cursor_next (cursor) == TRUE && _cursor_seq (cursor) == 2,
+      "mongo_sync_cursor_next() continues with the next batch");
+  ok (poll (&pfd, 1, 0) == 0,
+      "No getMore is sent after the last batch");
+  ok (mongo_sync_cursor_next (cursor) == TRUE && _cursor_seq (cursor) == 3,
+      "mongo_sync_cursor_next() steps within the second batch");
+  ok (mongo_sync_cursor_next (cursor) == TRUE && _cursor_seq (cursor) == 4,
+      "mongo_sync_cursor_next() reaches the last document");
+
+  errno = 0;
+  ok (mongo_sync_cursor_next (cursor) == FALSE && errno == ENOENT,
+      "mongo_sync_cursor_next() stops at the end of the results");
+  mongo_sync_cursor_free (cursor);
+
+  /* Prefetching happens when a batch arrives. */
+  p = test_mongo_wire_generate_cursor_reply (1, 42, 0, 1);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  rid = _recv_get_more (&server);
+  p = test_mongo_wire_generate_cursor_reply (rid, 42, 1, 1);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  mongo_sync_cursor_next (cursor);
+  mongo_sync_cursor_next (cursor);
+  ok (_cursor_seq (cursor) == 1 && poll (&pfd, 1, 0) == 1,
+      "The getMore for the next batch is in flight while the current "
+      "one is consumed");
+  rid = _recv_get_more (&server);
+
+  /* An empty batch ends the iteration. */
+  p = test_mongo_wire_generate_cursor_reply (rid, 0, 2, 0);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  errno = 0;
+  ok (mongo_sync_cursor_next (cursor) == FALSE && errno == ENOENT,
+      "mongo_sync_cursor_next() stops at an empty batch");
+  mongo_sync_cursor_free (cursor);
+
+  /* An empty batch from a live, tailable cursor means no data yet. */
+  p = test_mongo_wire_generate_cursor_reply (1, 42, 0, 1);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  rid = _recv_get_more (&server);
+  p = test_mongo_wire_generate_cursor_reply (rid, 42, 1, 0);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  mongo_sync_cursor_next (cursor);
+  errno = 0;
+  ok (mongo_sync_cursor_next (cursor) == FALSE && errno == EAGAIN &&
+      (rid = _recv_get_more (&server)) > 0,
+      "mongo_sync_cursor_next() signals EAGAIN on an empty batch of a "
+      "live cursor, and keeps a getMore in flight");
+  p = test_mongo_wire_generate_cursor_reply (rid, 0, 1, 0);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+  mongo_sync_cursor_free (cursor);
+
+  /* Replies to something else are protocol errors. */
+  p = test_mongo_wire_generate_cursor_reply (1, 42, 0, 1);
+  cursor = mongo_sync_cursor_new (conn, "test.ns", p);
+  rid = _recv_get_more (&server);
+  p = test_mongo_wire_generate_cursor_reply (rid + 100, 42, 1, 1);
+  mongo_packet_send (&server, p);
+  mongo_wire_packet_free (p);
+
+  mongo_sync_cursor_next (cursor);
+  errno = 0;
+  ok (mongo_sync_cursor_next (cursor) == FALSE && errno == EPROTO,
+      "mongo_sync_cursor_next() fails on a reply to a different request");
+  mongo_sync_cursor_free (cursor);
+
+  close (fds[1]);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (12, mongo_sync_cursor_next);
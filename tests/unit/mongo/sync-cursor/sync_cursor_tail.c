@@ -0,0 +1,164 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "libmongo-private.h"
+
+static void
+_send_reply (mongo_connection *server, gint32 resp_to, gint64 cursor_id,
+	     gint32 start, gint32 nreturn, gint32 flags)
+{
+  mongo_packet *p;
+  const guint8 *data;
+  guint8 *d;
+  gint32 size;
+
+  p = test_mongo_wire_generate_cursor_reply (resp_to, cursor_id,
+					     start, nreturn);
+  if (flags)
+    {
+      size = mongo_wire_packet_get_data (p, &data);
+      d = g_memdup (data, size);
+      flags = GINT32_TO_LE (flags);
+      memcpy (d, &flags, sizeof (flags));
+      mongo_wire_packet_set_data (p, d, size);
+      g_free (d);
+    }
+  mongo_packet_send (server, p);
+  mongo_wire_packet_free (p);
+}
+
+static gboolean
+_tail_cb (const bson *doc, gpointer user_data)
+{
+  GArray *seqs = (GArray *)user_data;
+  bson_cursor *c;
+  gint32 seq = -1;
+
+  c = bson_find (doc, "seq");
+  bson_cursor_get_int32 (c, &seq);
+  bson_cursor_free (c);
+
+  g_array_append_val (seqs, seq);
+
+  return seq < 3;
+}
+
+static bson *
+_query_of (mongo_packet *p, const gchar *ns)
+{
+  const guint8 *data;
+  bson *q;
+
+  mongo_wire_packet_get_data (p, &data);
+  data += sizeof (gint32) + strlen (ns) + 1 + 2 * sizeof (gint32);
+  q = bson_new_from_data (data, _DOC_SIZE (data, 0) - 1);
+  bson_finish (q);
+
+  return q;
+}
+
+void
+test_mongo_sync_cursor_tail (void)
+{
+  mongo_sync_connection *conn;
+  mongo_connection server;
+  mongo_packet *p;
+  mongo_packet_header h;
+  GArray *seqs;
+  bson *q, *sub;
+  bson_cursor *c;
+  const gchar *type = NULL;
+  gint32 gt = -1;
+  gint32 opcodes[7], expected[7] = { 2004, 2005, 2005, 2004, 2004, 2005,
+				     2007 };
+  bson *requery = NULL;
+  gint i;
+  int fds[2];
+
+  seqs = g_array_new (FALSE, FALSE, sizeof (gint32));
+
+  q = bson_new ();
+  bson_append_string (q, "type", "event", -1);
+  bson_finish (q);
+
+  errno = 0;
+  ok (mongo_sync_cursor_tail (NULL, "test.ns", q, "seq", _tail_cb,
+			      seqs) == FALSE && errno == ENOTCONN,
+      "mongo_sync_cursor_tail() fails with a NULL connection");
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], TRUE);
+  server.fd = fds[1];
+  server.timeout = 0;
+
+  errno = 0;
+  ok (mongo_sync_cursor_tail (conn, NULL, q, "seq", _tail_cb,
+			      seqs) == FALSE && errno == EINVAL,
+      "mongo_sync_cursor_tail() fails with a NULL namespace");
+  errno = 0;
+  ok (mongo_sync_cursor_tail (conn, "test.ns", q, NULL, _tail_cb,
+			      seqs) == FALSE && errno == EINVAL,
+      "mongo_sync_cursor_tail() fails with a NULL key");
+  errno = 0;
+  ok (mongo_sync_cursor_tail (conn, "test.ns", q, "seq", NULL,
+			      seqs) == FALSE && errno == EINVAL,
+      "mongo_sync_cursor_tail() fails with a NULL callback");
+
+  /* The whole conversation is sent up front, request IDs are
+     predictable. */
+  _send_reply (&server, 1, 42, 0, 2, 0);
+  _send_reply (&server, 2, 42, 2, 0, 0);
+  _send_reply (&server, 3, 0, 0, 0, MONGO_REPLY_FLAG_NO_CURSOR);
+  _send_reply (&server, 4, 0, 0, 0, 0);
+  _send_reply (&server, 5, 42, 2, 2, 0);
+  _send_reply (&server, 6, 42, 4, 0, 0);
+
+  ok (mongo_sync_cursor_tail (conn, "test.ns", q, "seq", _tail_cb,
+			      seqs) == TRUE,
+      "mongo_sync_cursor_tail() returns TRUE when the callback stops it");
+
+  ok (seqs->len == 4 &&
+      g_array_index (seqs, gint32, 0) == 0 &&
+      g_array_index (seqs, gint32, 1) == 1 &&
+      g_array_index (seqs, gint32, 2) == 2 &&
+      g_array_index (seqs, gint32, 3) == 3,
+      "Every document is delivered once, in order, across cursor losses");
+
+  for (i = 0; i < 7; i++)
+    {
+      p = mongo_packet_recv (&server);
+      mongo_wire_packet_get_header (p, &h);
+      opcodes[i] = h.opcode;
+      if (i == 3)
+	requery = _query_of (p, "test.ns");
+      mongo_wire_packet_free (p);
+    }
+  ok (memcmp (opcodes, expected, sizeof (expected)) == 0,
+      "Empty batches are followed by a getMore, lost cursors by a "
+      "re-query, and the stopped cursor is killed");
+
+  c = bson_find (requery, "type");
+  bson_cursor_get_string (c, &type);
+  bson_cursor_free (c);
+  c = bson_find (requery, "seq");
+  bson_cursor_get_document (c, &sub);
+  bson_cursor_free (c);
+  c = bson_find (sub, "$gt");
+  bson_cursor_get_int32 (c, &gt);
+  bson_cursor_free (c);
+  ok (type && strcmp (type, "event") == 0 && gt == 1,
+      "The re-query continues from the last document seen");
+
+  bson_free (sub);
+  bson_free (requery);
+  bson_free (q);
+  g_array_free (seqs, TRUE);
+  close (fds[1]);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (8, mongo_sync_cursor_tail);
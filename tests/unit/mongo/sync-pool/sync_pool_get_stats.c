@@ -0,0 +1,25 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_get_stats (void)
+{
+  mongo_connection_stats stats;
+  void *pool;
+
+  pool = g_malloc0 (1024);
+
+  ok (mongo_sync_pool_get_stats (NULL, &stats) == FALSE,
+      "mongo_sync_pool_get_stats() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+  ok (mongo_sync_pool_get_stats ((mongo_sync_pool *)pool, NULL) == FALSE,
+      "mongo_sync_pool_get_stats() fails without a destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  g_free (pool);
+}
+
+RUN_TEST (4, mongo_sync_pool_get_stats);
@@ -0,0 +1,45 @@
+#include "test.h"
+#include "mock-server.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_pool_set_topology_monitor (void)
+{
+  mock_server *server;
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_pool *pool;
+  mongo_sync_pool_connection *pc;
+  gint port;
+
+  server = mock_server_new ();
+  port = mock_server_get_port (server);
+  pool = mongo_sync_pool_new ("127.0.0.1", port, 2, 0);
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", port, 60000);
+
+  ok (mongo_sync_pool_set_topology_monitor (NULL, monitor) == FALSE,
+      "mongo_sync_pool_set_topology_monitor() fails without a pool");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+  ok (mongo_sync_pool_set_topology_monitor (pool, monitor),
+      "mongo_sync_pool_set_topology_monitor() works");
+
+  pc = mongo_sync_pool_pick (pool, TRUE);
+  ok (mongo_sync_cmd_ping ((mongo_sync_connection *)pc),
+      "Connections of a subscribed pool work");
+  mongo_sync_pool_return (pool, pc);
+
+  ok (mongo_sync_pool_set_topology_monitor (pool, NULL),
+      "Unsubscribing a pool works");
+  pc = mongo_sync_pool_pick (pool, TRUE);
+  ok (mongo_sync_cmd_ping ((mongo_sync_connection *)pc),
+      "Connections keep working once unsubscribed");
+  mongo_sync_pool_return (pool, pc);
+
+  mongo_sync_pool_free (pool);
+  mongo_sync_topology_monitor_free (monitor);
+  mock_server_free (server);
+}
+
+RUN_TEST (6, mongo_sync_pool_set_topology_monitor);
@@ -0,0 +1,43 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_write_queue_flush (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  mongo_sync_write_queue_stats stats;
+  bson *b;
+  gint i;
+
+  ok (mongo_sync_write_queue_flush (NULL) == FALSE,
+      "mongo_sync_write_queue_flush() fails with a NULL queue");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 4);
+
+  ok (mongo_sync_write_queue_flush (queue),
+      "Flushing an empty queue works");
+
+  b = test_bson_generate_full ();
+  for (i = 0; i < 100; i++)
+    mongo_sync_write_queue_push (queue, b);
+  bson_free (b);
+
+  ok (mongo_sync_write_queue_flush (queue) == FALSE,
+      "mongo_sync_write_queue_flush() fails when inserts failed");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to the error of the insert");
+  mongo_sync_write_queue_get_stats (queue, &stats);
+  ok (stats.failed == 100 && stats.pending == 0,
+      "Every document is processed by the time the flush returns");
+
+  mongo_sync_write_queue_free (queue, TRUE);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (6, mongo_sync_write_queue_flush);
@@ -0,0 +1,41 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+void
+test_mongo_sync_write_queue_free (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  bson *b;
+  int fds[2], i;
+
+  mongo_sync_write_queue_free (NULL, TRUE);
+  pass ("mongo_sync_write_queue_free(NULL) does not crash");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 16);
+  mongo_sync_write_queue_free (queue, TRUE);
+  pass ("mongo_sync_write_queue_free() works on an empty queue");
+  mongo_sync_disconnect (conn);
+
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  conn = test_make_fake_sync_conn (fds[0], FALSE);
+  mongo_connection_set_timeout ((mongo_connection *)conn, 200);
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 16);
+
+  b = test_bson_generate_full ();
+  for (i = 0; i < 16; i++)
+    mongo_sync_write_queue_push (queue, b);
+  bson_free (b);
+
+  mongo_sync_write_queue_free (queue, FALSE);
+  pass ("mongo_sync_write_queue_free() can discard pending documents");
+
+  mongo_sync_disconnect (conn);
+  close (fds[1]);
+}
+
+RUN_TEST (3, mongo_sync_write_queue_free);
@@ -0,0 +1,42 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_write_queue_get_stats (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  mongo_sync_write_queue_stats stats;
+  bson *b;
+
+  ok (mongo_sync_write_queue_get_stats (NULL, &stats) == FALSE,
+      "mongo_sync_write_queue_get_stats() fails with a NULL queue");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 16);
+
+  ok (mongo_sync_write_queue_get_stats (queue, NULL) == FALSE,
+      "mongo_sync_write_queue_get_stats() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  b = test_bson_generate_full ();
+  mongo_sync_write_queue_push (queue, b);
+  mongo_sync_write_queue_push (queue, b);
+  bson_free (b);
+  mongo_sync_write_queue_flush (queue);
+
+  ok (mongo_sync_write_queue_get_stats (queue, &stats),
+      "mongo_sync_write_queue_get_stats() works");
+  cmp_ok (stats.written + stats.failed, "==", 2,
+	  "Processed documents are counted");
+
+  mongo_sync_write_queue_free (queue, TRUE);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (6, mongo_sync_write_queue_get_stats);
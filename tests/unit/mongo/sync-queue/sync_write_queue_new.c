@@ -0,0 +1,40 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_write_queue_new (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  mongo_sync_write_queue_stats stats;
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_write_queue_new (NULL, "test.ns", 16) == NULL,
+      "mongo_sync_write_queue_new() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+  ok (mongo_sync_write_queue_new (conn, NULL, 16) == NULL,
+      "mongo_sync_write_queue_new() fails with a NULL namespace");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_sync_write_queue_new (conn, "test.ns", 0) == NULL,
+      "mongo_sync_write_queue_new() fails with a zero capacity");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 10);
+  ok (queue != NULL,
+      "mongo_sync_write_queue_new() works");
+  mongo_sync_write_queue_get_stats (queue, &stats);
+  ok (stats.written == 0 && stats.failed == 0 && stats.dropped == 0 &&
+      stats.spilled == 0 && stats.pending == 0,
+      "A new queue starts with empty statistics");
+
+  mongo_sync_write_queue_free (queue, TRUE);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (8, mongo_sync_write_queue_new);
@@ -0,0 +1,114 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The I/O thread blocks on the first insert until the connection
+   times out, as nobody answers on the other end of the socket pair,
+   so the queue fills up quickly. */
+static mongo_sync_write_queue *
+_make_stuck_queue (int fds[2], mongo_sync_connection **conn)
+{
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  *conn = test_make_fake_sync_conn (fds[0], FALSE);
+  mongo_connection_set_timeout ((mongo_connection *)*conn, 200);
+
+  return mongo_sync_write_queue_new (*conn, "test.ns", 2);
+}
+
+void
+test_mongo_sync_write_queue_push (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  mongo_sync_write_queue_stats stats;
+  bson *b, *tmp;
+  gchar *path;
+  guint8 *pad;
+  struct stat st;
+  int fds[2], i, dropped = 0;
+
+  b = test_bson_generate_full ();
+
+  ok (mongo_sync_write_queue_push (NULL, b) == FALSE,
+      "mongo_sync_write_queue_push() fails with a NULL queue");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 16);
+
+  ok (mongo_sync_write_queue_push (queue, NULL) == FALSE,
+      "mongo_sync_write_queue_push() fails with a NULL document");
+  tmp = bson_new ();
+  ok (mongo_sync_write_queue_push (queue, tmp) == FALSE,
+      "mongo_sync_write_queue_push() fails with an unfinished document");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  bson_free (tmp);
+
+  tmp = bson_new_sized (mongo_sync_conn_get_max_insert_size (conn));
+  pad = g_malloc0 (mongo_sync_conn_get_max_insert_size (conn));
+  bson_append_binary (tmp, "pad", BSON_BINARY_SUBTYPE_GENERIC, pad,
+		      mongo_sync_conn_get_max_insert_size (conn));
+  bson_finish (tmp);
+  g_free (pad);
+  ok (mongo_sync_write_queue_push (queue, tmp) == FALSE,
+      "mongo_sync_write_queue_push() refuses oversized documents");
+  cmp_ok (errno, "==", EMSGSIZE,
+	  "errno is set to EMSGSIZE");
+  bson_free (tmp);
+
+  ok (mongo_sync_write_queue_push (queue, b),
+      "mongo_sync_write_queue_push() works");
+  mongo_sync_write_queue_flush (queue);
+  mongo_sync_write_queue_get_stats (queue, &stats);
+  cmp_ok (stats.failed, "==", 1,
+	  "Inserts failing on a broken connection are counted");
+
+  mongo_sync_write_queue_free (queue, TRUE);
+  mongo_sync_disconnect (conn);
+
+  queue = _make_stuck_queue (fds, &conn);
+  mongo_sync_write_queue_set_backpressure (queue,
+					   MONGO_SYNC_WRITE_QUEUE_DROP, NULL);
+  for (i = 0; i < 10; i++)
+    if (!mongo_sync_write_queue_push (queue, b))
+      {
+	dropped++;
+	cmp_ok (errno, "==", ENOBUFS,
+		"errno is set to ENOBUFS when dropping");
+	break;
+      }
+  ok (dropped > 0,
+      "Documents are dropped when the queue is full");
+  mongo_sync_write_queue_free (queue, FALSE);
+  mongo_sync_disconnect (conn);
+  close (fds[1]);
+
+  queue = _make_stuck_queue (fds, &conn);
+  path = g_strdup_printf ("/tmp/lmc-spill-%d.bson", (int) getpid ());
+  unlink (path);
+  mongo_sync_write_queue_set_backpressure (queue,
+					   MONGO_SYNC_WRITE_QUEUE_SPILL, path);
+  for (i = 0; i < 10; i++)
+    mongo_sync_write_queue_push (queue, b);
+  mongo_sync_write_queue_get_stats (queue, &stats);
+  ok (stats.spilled > 0 && stats.dropped == 0,
+      "Documents are spilled when the queue is full");
+  stat (path, &st);
+  cmp_ok (st.st_size, "==", stats.spilled * bson_size (b),
+	  "Spilled documents are appended to the spill file");
+  mongo_sync_write_queue_free (queue, FALSE);
+  mongo_sync_disconnect (conn);
+  close (fds[1]);
+  unlink (path);
+  g_free (path);
+
+  bson_free (b);
+}
+
+RUN_TEST (13, mongo_sync_write_queue_push);
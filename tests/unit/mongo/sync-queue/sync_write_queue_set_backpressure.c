@@ -0,0 +1,57 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void
+test_mongo_sync_write_queue_set_backpressure (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_write_queue *queue;
+  gchar *path;
+
+  ok (mongo_sync_write_queue_set_backpressure
+      (NULL, MONGO_SYNC_WRITE_QUEUE_DROP, NULL) == FALSE,
+      "mongo_sync_write_queue_set_backpressure() fails with a NULL queue");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  queue = mongo_sync_write_queue_new (conn, "test.ns", 16);
+
+  ok (mongo_sync_write_queue_set_backpressure
+      (queue, MONGO_SYNC_WRITE_QUEUE_SPILL, NULL) == FALSE,
+      "Spilling requires a spill file");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_sync_write_queue_set_backpressure
+      (queue, MONGO_SYNC_WRITE_QUEUE_SPILL,
+       "/nonexistent/directory/spill.bson") == FALSE,
+      "mongo_sync_write_queue_set_backpressure() fails with a bad path");
+  ok (mongo_sync_write_queue_set_backpressure
+      (queue, (mongo_sync_write_queue_backpressure) 42, NULL) == FALSE,
+      "mongo_sync_write_queue_set_backpressure() fails with a bad policy");
+
+  ok (mongo_sync_write_queue_set_backpressure
+      (queue, MONGO_SYNC_WRITE_QUEUE_DROP, NULL),
+      "Setting the drop policy works");
+
+  path = g_strdup_printf ("/tmp/lmc-spill-%d.bson", (int) getpid ());
+  ok (mongo_sync_write_queue_set_backpressure
+      (queue, MONGO_SYNC_WRITE_QUEUE_SPILL, path),
+      "Setting the spill policy works");
+  ok (access (path, F_OK) == 0,
+      "The spill file is created");
+  unlink (path);
+  g_free (path);
+
+  ok (mongo_sync_write_queue_set_backpressure
+      (queue, MONGO_SYNC_WRITE_QUEUE_BLOCK, NULL),
+      "Setting the block policy works");
+
+  mongo_sync_write_queue_free (queue, FALSE);
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (10, mongo_sync_write_queue_set_backpressure);
@@ -0,0 +1,93 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+
+static void
+_server_seen (const gchar *host, gboolean primary, gint64 rtt)
+{
+  bson *res;
+
+  res = bson_build (BSON_TYPE_BOOLEAN, "ismaster", primary,
+		    BSON_TYPE_BOOLEAN, "secondary", !primary,
+		    BSON_TYPE_STRING, "setName", "servers", -1,
+		    BSON_TYPE_NONE);
+  bson_finish (res);
+  _mongo_sync_server_seen (_mongo_sync_server_get (host, 27017), res, rtt);
+  bson_free (res);
+}
+
+void
+test_mongo_sync_conn_get_servers (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_server_info *servers;
+
+  ok (mongo_sync_conn_get_servers (NULL, &servers) == -1,
+      "mongo_sync_conn_get_servers() fails with a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_conn_get_servers (conn, NULL) == -1,
+      "mongo_sync_conn_get_servers() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  cmp_ok (mongo_sync_conn_get_servers (conn, &servers), "==", 0,
+	  "A connection without hosts has no servers");
+  g_free (servers);
+
+  mongo_sync_conn_seed_add (conn, "a.example.com", 27017);
+  mongo_sync_conn_seed_add (conn, "b.example.com", 27017);
+  mongo_sync_conn_seed_add (conn, "c.example.com", 27017);
+  mongo_sync_conn_seed_add (conn, "a.example.com", 27017);
+
+  cmp_ok (mongo_sync_conn_get_servers (conn, &servers), "==", 3,
+	  "Every server is returned once");
+  ok (strcmp (servers[0].host, "a.example.com") == 0 &&
+      strcmp (servers[1].host, "c.example.com") == 0 &&
+      strcmp (servers[2].host, "b.example.com") == 0,
+      "Servers never heard from keep the order of the host list");
+  g_free (servers);
+
+  _server_seen ("b.example.com", FALSE, 3000);
+  _server_seen ("c.example.com", FALSE, 1000);
+
+  mongo_sync_conn_get_servers (conn, &servers);
+  ok (strcmp (servers[0].host, "c.example.com") == 0 &&
+      strcmp (servers[1].host, "b.example.com") == 0 &&
+      strcmp (servers[2].host, "a.example.com") == 0,
+      "Secondaries come first, fastest first");
+  g_free (servers);
+
+  conn->rs.primary = _mongo_sync_server_get ("a.example.com", 27017);
+  mongo_sync_conn_get_servers (conn, &servers);
+  ok (strcmp (servers[0].host, "a.example.com") == 0,
+      "The primary advertised to the connection comes before "
+      "secondaries");
+  g_free (servers);
+
+  _server_seen ("b.example.com", TRUE, 3000);
+  mongo_sync_conn_get_servers (conn, &servers);
+  ok (strcmp (servers[0].host, "b.example.com") == 0 &&
+      servers[0].role == MONGO_SYNC_SERVER_PRIMARY,
+      "A primary known to the topology table comes first");
+  g_free (servers);
+
+  _server_seen ("c.example.com", TRUE, 1000);
+  mongo_sync_conn_get_servers (conn, &servers);
+  ok (strcmp (servers[0].host, "c.example.com") == 0 &&
+      servers[1].role != MONGO_SYNC_SERVER_PRIMARY &&
+      servers[2].role != MONGO_SYNC_SERVER_PRIMARY,
+      "A new primary replaces the old one");
+  g_free (servers);
+
+  mongo_sync_disconnect (conn);
+}
+
+RUN_TEST (11, mongo_sync_conn_get_servers);
@@ -0,0 +1,43 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_conn_set_topology_monitor (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_connection *conn;
+
+  ok (mongo_sync_conn_set_topology_monitor (NULL, NULL) == FALSE,
+      "mongo_sync_conn_set_topology_monitor() fails with a NULL "
+      "connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 60000);
+  mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2);
+  conn = test_make_fake_sync_conn (-1, FALSE);
+
+  ok (mongo_sync_conn_set_topology_monitor (conn, monitor),
+      "mongo_sync_conn_set_topology_monitor() works");
+  cmp_ok (g_list_length (conn->rs.hosts), "==", 2,
+	  "The members of the monitor are added to the host list");
+  ok (conn->rs.primary == NULL,
+      "No primary is set while the monitor knows none");
+
+  ok (mongo_sync_conn_set_topology_monitor (conn, NULL),
+      "Unsubscribing works");
+  ok (conn->topology.snapshot == NULL,
+      "Unsubscribing releases the snapshot");
+
+  mongo_sync_conn_set_topology_monitor (conn, monitor);
+  mongo_sync_disconnect (conn);
+  pass ("Subscribed connections can be freed");
+
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (8, mongo_sync_conn_set_topology_monitor);
@@ -0,0 +1,64 @@
+#include "test.h"
+#include "mongo.h"
+
+#include "libmongo-private.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_sync_server_lookup (void)
+{
+  mongo_sync_connection *conn;
+  mongo_sync_server_info info;
+  bson *res;
+
+  ok (mongo_sync_server_lookup (NULL, 27017, &info) == FALSE,
+      "mongo_sync_server_lookup() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_sync_server_lookup ("lookup.example.com", 27017, NULL) == FALSE,
+      "mongo_sync_server_lookup() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  ok (mongo_sync_server_lookup ("lookup.example.com", 27017, &info) == FALSE,
+      "mongo_sync_server_lookup() fails with an unknown server");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is set to ENOENT");
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  mongo_sync_conn_seed_add (conn, "lookup.example.com", 27017);
+
+  ok (mongo_sync_server_lookup ("lookup.example.com", 27017, &info),
+      "mongo_sync_server_lookup() finds seeds");
+  ok (strcmp (info.host, "lookup.example.com") == 0 && info.port == 27017,
+      "The address of the server is returned");
+  ok (info.role == MONGO_SYNC_SERVER_UNKNOWN && info.rtt == -1 &&
+      info.last_seen == 0 && info.config_version == -1 &&
+      info.set_name == NULL,
+      "Nothing else is known about a server never heard from");
+
+  res = bson_build (BSON_TYPE_BOOLEAN, "ismaster", FALSE,
+		    BSON_TYPE_BOOLEAN, "secondary", TRUE,
+		    BSON_TYPE_STRING, "setName", "lookup", -1,
+		    BSON_TYPE_INT32, "setVersion", 3,
+		    BSON_TYPE_NONE);
+  bson_finish (res);
+  _mongo_sync_server_seen ((mongo_sync_server *)conn->rs.seeds->data,
+			   res, 1500);
+  bson_free (res);
+
+  mongo_sync_server_lookup ("lookup.example.com", 27017, &info);
+  ok (info.role == MONGO_SYNC_SERVER_SECONDARY && info.rtt == 1500 &&
+      info.last_seen > 0 && info.config_version == 3 &&
+      strcmp (info.set_name, "lookup") == 0,
+      "mongo_sync_server_lookup() returns what the server last reported");
+
+  mongo_sync_disconnect (conn);
+
+  ok (mongo_sync_server_lookup ("lookup.example.com", 27017, &info),
+      "Servers outlive the connections that know about them");
+}
+
+RUN_TEST (11, mongo_sync_server_lookup);
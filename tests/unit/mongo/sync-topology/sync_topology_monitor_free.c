@@ -0,0 +1,23 @@
+#include "test.h"
+#include "mongo.h"
+
+void
+test_mongo_sync_topology_monitor_free (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  gint64 start;
+
+  mongo_sync_topology_monitor_free (NULL);
+  pass ("mongo_sync_topology_monitor_free(NULL) does not crash");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 60000);
+  mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2);
+
+  start = g_get_monotonic_time ();
+  mongo_sync_topology_monitor_free (monitor);
+  pass ("mongo_sync_topology_monitor_free() works");
+  ok (g_get_monotonic_time () - start < G_USEC_PER_SEC,
+      "mongo_sync_topology_monitor_free() does not wait for the next poll");
+}
+
+RUN_TEST (3, mongo_sync_topology_monitor_free);
@@ -0,0 +1,40 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_topology_monitor_get_snapshot (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot, *again;
+
+  ok (mongo_sync_topology_monitor_get_snapshot (NULL) == NULL,
+      "mongo_sync_topology_monitor_get_snapshot() fails with a NULL monitor");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 1000);
+
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  ok (snapshot != NULL,
+      "mongo_sync_topology_monitor_get_snapshot() works");
+  again = mongo_sync_topology_monitor_get_snapshot (monitor);
+  ok (again == snapshot,
+      "The same snapshot is returned while the topology does not change");
+
+  mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2);
+  mongo_sync_topology_snapshot_unref (again);
+  again = mongo_sync_topology_monitor_get_snapshot (monitor);
+  ok (again != snapshot,
+      "A new snapshot is returned once the topology changes");
+
+  mongo_sync_topology_monitor_free (monitor);
+
+  cmp_ok (mongo_sync_topology_snapshot_get_generation (snapshot), "==", 1,
+	  "Snapshots outlive their monitor");
+  mongo_sync_topology_snapshot_unref (snapshot);
+  mongo_sync_topology_snapshot_unref (again);
+}
+
+RUN_TEST (6, mongo_sync_topology_monitor_get_snapshot);
@@ -0,0 +1,30 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_topology_monitor_new (void)
+{
+  mongo_sync_topology_monitor *monitor;
+
+  ok (mongo_sync_topology_monitor_new (NULL, 27017, 1000) == NULL,
+      "mongo_sync_topology_monitor_new() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_sync_topology_monitor_new ("127.0.0.1", -1, 1000) == NULL,
+      "mongo_sync_topology_monitor_new() fails with an invalid port");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_sync_topology_monitor_new ("127.0.0.1", 1, 0) == NULL,
+      "mongo_sync_topology_monitor_new() fails with a zero interval");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 1000);
+  ok (monitor != NULL,
+      "mongo_sync_topology_monitor_new() works, even if the seed is down");
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (7, mongo_sync_topology_monitor_new);
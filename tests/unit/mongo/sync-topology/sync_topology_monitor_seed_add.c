@@ -0,0 +1,41 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_topology_monitor_seed_add (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot;
+  const mongo_sync_server_info *servers;
+
+  ok (mongo_sync_topology_monitor_seed_add (NULL, "127.0.0.1", 2) == FALSE,
+      "mongo_sync_topology_monitor_seed_add() fails with a NULL monitor");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 1000);
+
+  ok (mongo_sync_topology_monitor_seed_add (monitor, NULL, 2) == FALSE,
+      "mongo_sync_topology_monitor_seed_add() fails with a NULL host");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  ok (mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2),
+      "mongo_sync_topology_monitor_seed_add() works");
+  ok (mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2),
+      "Adding the same seed twice works");
+
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  cmp_ok (mongo_sync_topology_snapshot_get_servers (snapshot, &servers),
+	  "==", 2,
+	  "Seeds show up in the snapshots once");
+  ok (servers[1].port == 2,
+      "Seeds are added in order");
+  mongo_sync_topology_snapshot_unref (snapshot);
+
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (8, mongo_sync_topology_monitor_seed_add);
@@ -0,0 +1,43 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_topology_monitor_wait (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  gint64 start;
+
+  ok (mongo_sync_topology_monitor_wait (NULL, 1, 10) == FALSE,
+      "mongo_sync_topology_monitor_wait() fails with a NULL monitor");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 1000);
+
+  ok (mongo_sync_topology_monitor_wait (monitor, 1, -1) == FALSE,
+      "mongo_sync_topology_monitor_wait() fails with a negative timeout");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+
+  ok (mongo_sync_topology_monitor_wait (monitor, 0, 0),
+      "mongo_sync_topology_monitor_wait() returns at once when a newer "
+      "snapshot is available");
+
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_topology_monitor_wait (monitor, 1, 200) == FALSE,
+      "mongo_sync_topology_monitor_wait() fails when nothing changes");
+  cmp_ok (errno, "==", ETIMEDOUT,
+	  "errno is set to ETIMEDOUT");
+  ok (g_get_monotonic_time () - start >= 200000,
+      "mongo_sync_topology_monitor_wait() waits until the timeout");
+
+  mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2);
+  ok (mongo_sync_topology_monitor_wait (monitor, 1, 200),
+      "mongo_sync_topology_monitor_wait() notices new snapshots");
+
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (9, mongo_sync_topology_monitor_wait);
@@ -0,0 +1,33 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_topology_snapshot_get_generation (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot;
+
+  cmp_ok (mongo_sync_topology_snapshot_get_generation (NULL), "==", -1,
+	  "mongo_sync_topology_snapshot_get_generation() fails with a NULL "
+	  "snapshot");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 60000);
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  cmp_ok (mongo_sync_topology_snapshot_get_generation (snapshot), "==", 1,
+	  "The first snapshot is generation one");
+  mongo_sync_topology_snapshot_unref (snapshot);
+
+  mongo_sync_topology_monitor_seed_add (monitor, "127.0.0.1", 2);
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  cmp_ok (mongo_sync_topology_snapshot_get_generation (snapshot), "==", 2,
+	  "Each new snapshot is a new generation");
+  mongo_sync_topology_snapshot_unref (snapshot);
+
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (4, mongo_sync_topology_snapshot_get_generation);
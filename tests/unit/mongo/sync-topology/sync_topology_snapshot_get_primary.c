@@ -0,0 +1,30 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_topology_snapshot_get_primary (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot;
+
+  ok (mongo_sync_topology_snapshot_get_primary (NULL) == NULL,
+      "mongo_sync_topology_snapshot_get_primary() fails with a NULL "
+      "snapshot");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 60000);
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+
+  ok (mongo_sync_topology_snapshot_get_primary (snapshot) == NULL,
+      "mongo_sync_topology_snapshot_get_primary() fails without a primary");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is set to ENOENT");
+
+  mongo_sync_topology_snapshot_unref (snapshot);
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (4, mongo_sync_topology_snapshot_get_primary);
@@ -0,0 +1,42 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_sync_topology_snapshot_get_servers (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot;
+  const mongo_sync_server_info *servers;
+
+  ok (mongo_sync_topology_snapshot_get_servers (NULL, &servers) == -1,
+      "mongo_sync_topology_snapshot_get_servers() fails with a NULL "
+      "snapshot");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 60000);
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+
+  ok (mongo_sync_topology_snapshot_get_servers (snapshot, NULL) == -1,
+      "mongo_sync_topology_snapshot_get_servers() fails with a NULL "
+      "destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  cmp_ok (mongo_sync_topology_snapshot_get_servers (snapshot, &servers),
+	  "==", 1,
+	  "mongo_sync_topology_snapshot_get_servers() works");
+  ok (strcmp (servers[0].host, "127.0.0.1") == 0 && servers[0].port == 1,
+      "The seed is a member");
+  ok (servers[0].role != MONGO_SYNC_SERVER_PRIMARY &&
+      servers[0].role != MONGO_SYNC_SERVER_SECONDARY,
+      "A member that is down is neither a primary nor a secondary");
+
+  mongo_sync_topology_snapshot_unref (snapshot);
+  mongo_sync_topology_monitor_free (monitor);
+}
+
+RUN_TEST (7, mongo_sync_topology_snapshot_get_servers);
@@ -0,0 +1,28 @@
+#include "test.h"
+#include "mongo.h"
+
+void
+test_mongo_sync_topology_snapshot_unref (void)
+{
+  mongo_sync_topology_monitor *monitor;
+  mongo_sync_topology_snapshot *snapshot, *again;
+
+  mongo_sync_topology_snapshot_unref (NULL);
+  pass ("mongo_sync_topology_snapshot_unref(NULL) does not crash");
+
+  monitor = mongo_sync_topology_monitor_new ("127.0.0.1", 1, 60000);
+  snapshot = mongo_sync_topology_monitor_get_snapshot (monitor);
+  again = mongo_sync_topology_monitor_get_snapshot (monitor);
+
+  mongo_sync_topology_snapshot_unref (again);
+  cmp_ok (mongo_sync_topology_snapshot_get_generation (snapshot), "==", 1,
+	  "A snapshot stays valid while references remain");
+
+  mongo_sync_topology_monitor_free (monitor);
+  cmp_ok (mongo_sync_topology_snapshot_get_generation (snapshot), "==", 1,
+	  "A snapshot stays valid after its monitor is freed");
+  mongo_sync_topology_snapshot_unref (snapshot);
+  pass ("mongo_sync_topology_snapshot_unref() works");
+}
+
+RUN_TEST (4, mongo_sync_topology_snapshot_unref);
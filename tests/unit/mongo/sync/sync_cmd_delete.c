@@ -9,7 +9,6 @@ test_mongo_sync_cmd_delete_net_secondary (void)
 {
   mongo_sync_connection *conn;
   bson *b;
-  GList *l;
 
   skip (!config.secondary_host, 2,
 	"Secondary server not configured");
@@ -43,12 +42,7 @@ test_mongo_sync_cmd_delete_net_secondary (void)
   mongo_sync_conn_set_auto_reconnect (conn, TRUE);
 
   shutdown (conn->super.fd, SHUT_RDWR);
-  l = conn->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
+  g_list_free (conn->rs.hosts);
   conn->rs.hosts = NULL;
   sleep (3);
 
@@ -0,0 +1,129 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <string.h>
+#include <errno.h>
+#include "libmongo-private.h"
+
+void
+test_mongo_sync_cmd_insert_n_with_ids (void)
+{
+  mongo_sync_connection *c;
+  bson *b1, *b2, *b3;
+  const bson *docs[10];
+  guint8 ids[2 * 12];
+  mongo_packet *p;
+
+  mongo_util_oid_init (0);
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+  b1 = test_bson_generate_full ();
+  b2 = test_bson_generate_full ();
+  b3 = bson_new ();
+
+  docs[0] = b1;
+  docs[1] = b2;
+  docs[2] = b3;
+  docs[3] = NULL;
+  docs[4] = b1;
+
+  ok (mongo_sync_cmd_insert_n_with_ids (NULL, "test.ns", 2, docs,
+					ids) == FALSE,
+      "mongo_sync_cmd_insert_n_with_ids() fails with a NULL connection");
+  ok (mongo_sync_cmd_insert_n_with_ids (c, NULL, 2, docs, ids) == FALSE,
+      "mongo_sync_cmd_insert_n_with_ids() fails with a NULL namespace");
+  ok (mongo_sync_cmd_insert_n_with_ids (c, "test.ns", 0, docs,
+					ids) == FALSE,
+      "mongo_sync_cmd_insert_n_with_ids() fails with no documents");
+  ok (mongo_sync_cmd_insert_n_with_ids (c, "test.ns", 3, docs,
+					ids) == FALSE,
+      "mongo_sync_cmd_insert_n_with_ids() fails when the array contains "
+      "an unfinished document");
+  bson_finish (b3);
+  ok (mongo_sync_cmd_insert_n_with_ids (c, "test.ns", 2, docs,
+					ids) == FALSE,
+      "mongo_sync_cmd_insert_n_with_ids() fails with a bogus FD");
+
+  mongo_sync_disconnect (c);
+  bson_free (b1);
+  bson_free (b2);
+  bson_free (b3);
+
+  /* Only documents without an _id grow on the wire. */
+  c = test_make_fake_sync_conn (-1, FALSE);
+  b1 = bson_new ();
+  bson_append_oid (b1, "_id", (const guint8 *)"0123456789ab");
+  bson_append_string (b1, "sync_cmd_insert_n_with_ids", "sized", -1);
+  bson_finish (b1);
+  b2 = bson_new ();
+  bson_append_string (b2, "sync_cmd_insert_n_with_ids", "sized", -1);
+  bson_finish (b2);
+  docs[0] = b1;
+  docs[1] = b2;
+
+  mongo_sync_conn_set_max_insert_size (c, bson_size (b1) + 1);
+  errno = 0;
+  ok (mongo_sync_cmd_insert_n_with_ids (c, "test.ns", 1, docs,
+					ids) == FALSE && errno != EMSGSIZE,
+      "mongo_sync_cmd_insert_n_with_ids() does not count an _id for "
+      "documents that have one");
+
+  mongo_sync_conn_set_max_insert_size (c, bson_size (b2) +
+				       MONGO_WIRE_ID_ELEMENT_SIZE);
+  errno = 0;
+  ok (mongo_sync_cmd_insert_n_with_ids (c, "test.ns", 1, docs + 1,
+					ids) == FALSE && errno == EMSGSIZE,
+      "mongo_sync_cmd_insert_n_with_ids() counts the _id added to a "
+      "document that does not fit with it");
+
+  mongo_sync_disconnect (c);
+  bson_free (b1);
+  bson_free (b2);
+
+  begin_network_tests (4);
+
+  b1 = bson_new ();
+  bson_append_string (b1, "sync_cmd_insert_n_with_ids", "works", -1);
+  bson_finish (b1);
+
+  b2 = bson_new ();
+  bson_append_int32 (b2, "int32", 1984);
+  bson_finish (b2);
+
+  docs[0] = b1;
+  docs[1] = b2;
+
+  c = mongo_sync_connect (config.primary_host, config.primary_port,
+			  TRUE);
+
+  ok (mongo_sync_cmd_insert_n_with_ids (c, config.ns, 2, docs, ids),
+      "mongo_sync_cmd_insert_n_with_ids() works");
+  ok (memcmp (ids, ids + 12, 12) != 0,
+      "Every document got a different _id");
+
+  b3 = bson_new ();
+  bson_append_oid (b3, "_id", ids);
+  bson_finish (b3);
+  p = mongo_sync_cmd_query (c, config.ns, 0, 0, 1, b3, NULL);
+  ok (p != NULL,
+      "The first document can be found by its returned _id");
+  mongo_wire_packet_free (p);
+  bson_free (b3);
+
+  b3 = bson_new ();
+  bson_append_oid (b3, "_id", ids + 12);
+  bson_finish (b3);
+  p = mongo_sync_cmd_query (c, config.ns, 0, 0, 1, b3, NULL);
+  ok (p != NULL,
+      "The second document can be found by its returned _id");
+  mongo_wire_packet_free (p);
+  bson_free (b3);
+
+  mongo_sync_disconnect (c);
+  bson_free (b1);
+  bson_free (b2);
+
+  end_network_tests ();
+}
+
+RUN_TEST (11, mongo_sync_cmd_insert_n_with_ids);
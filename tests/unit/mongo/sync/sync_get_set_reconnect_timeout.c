@@ -0,0 +1,47 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+
+void
+test_mongo_sync_get_set_reconnect_timeout (void)
+{
+  mongo_sync_connection *c;
+
+  c = test_make_fake_sync_conn (-1, FALSE);
+
+  errno = 0;
+  ok (mongo_sync_conn_get_reconnect_timeout (NULL) == -1,
+      "mongo_sync_conn_get_reconnect_timeout() returns -1 with "
+      "a NULL connection");
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN");
+
+  cmp_ok (mongo_sync_conn_get_reconnect_timeout (c), "==",
+	  MONGO_SYNC_DEFAULT_RECONNECT_TIMEOUT,
+	  "mongo_sync_conn_get_reconnect_timeout() works");
+
+  errno = 0;
+  mongo_sync_conn_set_reconnect_timeout (NULL, 1000);
+  cmp_ok (errno, "==", ENOTCONN,
+	  "errno is set to ENOTCONN after "
+	  "mongo_sync_conn_set_reconnect_timeout(NULL)");
+
+  mongo_sync_conn_set_reconnect_timeout (c, 1000);
+  cmp_ok (errno, "==", 0,
+	  "errno is cleared");
+  ok (mongo_sync_conn_get_reconnect_timeout (c) == 1000,
+      "mongo_sync_conn_set_reconnect_timeout() worked");
+
+  ok (mongo_sync_conn_set_reconnect_timeout (c, 0) == FALSE,
+      "mongo_sync_conn_set_reconnect_timeout() with zero fails");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  ok (mongo_sync_conn_get_reconnect_timeout (c) == 1000,
+      "mongo_sync_conn_set_reconnect_timeout() with an invalid value "
+      "should not change the timeout");
+
+  mongo_sync_disconnect (c);
+}
+
+RUN_TEST (9, mongo_sync_get_set_reconnect_timeout);
@@ -5,11 +5,40 @@
 #include <sys/socket.h>
 #include "libmongo-private.h"
 
+/* Accept a single connection, and after a while, start a reply that
+   is never finished. */
+static gpointer
+_partial_reply_thread (gpointer data)
+{
+  mongo_packet_header h;
+  guint8 buf[256];
+  gint fd;
+
+  fd = accept (GPOINTER_TO_INT (data), NULL, NULL);
+  g_usleep (800 * 1000);
+
+  h.length = GINT32_TO_LE (1024);
+  h.id = GINT32_TO_LE (1);
+  h.resp_to = GINT32_TO_LE (1);
+  h.opcode = GINT32_TO_LE (1);
+  send (fd, &h, sizeof (h), MSG_NOSIGNAL);
+
+  /* Wait for the client to give up. */
+  while (recv (fd, buf, sizeof (buf), 0) > 0)
+    ;
+  close (fd);
+  return NULL;
+}
+
 void
 test_mongo_sync_reconnect (void)
 {
   mongo_sync_connection *conn, *o;
-  GList *l;
+  mongo_sync_server *known;
+  GThread *thread;
+  gint hole, port, hole2, port2;
+  gint64 start;
+  bson *b;
 
   ok (mongo_sync_reconnect (NULL, FALSE) == NULL,
       "mongo_sync_reconnect() fails with a NULL connection");
@@ -24,6 +53,72 @@ test_mongo_sync_reconnect (void)
 
   mongo_sync_disconnect (conn);
 
+  /* A listening socket that never accepts, nor answers anything. */
+  hole = test_make_listener (&port);
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  conn->rs.hosts = g_list_append (conn->rs.hosts,
+				  _mongo_sync_server_get ("127.0.0.1", port));
+  conn->rs.hosts = g_list_append (conn->rs.hosts,
+				  _mongo_sync_server_get ("localhost", port));
+  mongo_sync_conn_set_reconnect_timeout (conn, 500);
+
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_reconnect (conn, FALSE) == NULL,
+      "mongo_sync_reconnect() fails when no host answers");
+  ok (g_get_monotonic_time () - start < 2 * G_USEC_PER_SEC,
+      "mongo_sync_reconnect() gives up after the reconnect timeout, "
+      "not after a timeout per host");
+
+  mongo_sync_disconnect (conn);
+
+  /* A known primary is tried on its own first, then every host; the
+     two attempts share the time limit. */
+  hole2 = test_make_listener (&port2);
+  known = _mongo_sync_server_get ("127.0.0.1", port2);
+  b = bson_new ();
+  bson_append_boolean (b, "ismaster", TRUE);
+  bson_finish (b);
+  _mongo_sync_server_seen (known, b, 0);
+  bson_free (b);
+
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  conn->rs.hosts = g_list_append (conn->rs.hosts, known);
+  conn->rs.hosts = g_list_append (conn->rs.hosts,
+				  _mongo_sync_server_get ("127.0.0.1", port));
+  mongo_sync_conn_set_reconnect_timeout (conn, 1000);
+
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_reconnect (conn, FALSE) == NULL,
+      "mongo_sync_reconnect() fails when neither the known primary, "
+      "nor the others answer");
+  ok (g_get_monotonic_time () - start < 1500 * 1000,
+      "mongo_sync_reconnect() gives up after the reconnect timeout, "
+      "not after a timeout per attempt");
+
+  mongo_sync_disconnect (conn);
+  close (hole2);
+
+  /* A reply that starts in time, but is never finished. */
+  hole2 = test_make_listener (&port2);
+  thread = g_thread_new ("partial", _partial_reply_thread,
+			 GINT_TO_POINTER (hole2));
+  conn = test_make_fake_sync_conn (-1, FALSE);
+  conn->rs.hosts = g_list_append (conn->rs.hosts,
+				  _mongo_sync_server_get ("127.0.0.1",
+							  port2));
+  mongo_sync_conn_set_reconnect_timeout (conn, 1000);
+
+  start = g_get_monotonic_time ();
+  ok (mongo_sync_reconnect (conn, FALSE) == NULL,
+      "mongo_sync_reconnect() fails when a reply is never finished");
+  ok (g_get_monotonic_time () - start < 1400 * 1000,
+      "Reading a reply does not outlast the reconnect timeout");
+
+  g_thread_join (thread);
+  mongo_sync_disconnect (conn);
+  close (hole2);
+  close (hole);
+
   begin_network_tests (15);
 
   /* Connect & reconnect to master */
@@ -52,12 +147,7 @@ test_mongo_sync_reconnect (void)
 				 config.primary_port, TRUE);
   shutdown (conn->super.fd, SHUT_RDWR);
   sleep (3);
-  l = conn->rs.hosts;
-  while (l)
-    {
-      g_free (l->data);
-      l = g_list_delete_link (l, l);
-    }
+  g_list_free (conn->rs.hosts);
   conn->rs.hosts = NULL;
 
   conn = mongo_sync_reconnect (conn, FALSE);
@@ -66,18 +156,18 @@ test_mongo_sync_reconnect (void)
       "mongo_sync_reconnect() fails if it can't reconnect anywhere");
   mongo_sync_disconnect (o);
 
-  /* Gracefully ignore unparsable hosts during reconnect */
+  /* Gracefully ignore unresolvable hosts during reconnect */
   o = conn = mongo_sync_connect (config.primary_host,
 				 config.primary_port, TRUE);
   mongo_sync_cmd_is_master (conn);
   conn->rs.hosts = g_list_prepend (conn->rs.hosts,
-				   g_strdup ("invalid:-42"));
+				   _mongo_sync_server_get ("invalid.", 42));
   shutdown (conn->super.fd, SHUT_RDWR);
   sleep (3);
   conn = mongo_sync_reconnect (conn, TRUE);
 
   ok (conn == o,
-      "mongo_sync_reconnect() gracefully ignores unparsable hosts "
+      "mongo_sync_reconnect() gracefully ignores unresolvable hosts "
       "during reconnect");
   mongo_sync_disconnect (conn);
 
@@ -86,7 +176,8 @@ test_mongo_sync_reconnect (void)
 				 config.primary_port, TRUE);
   mongo_sync_cmd_is_master (conn);
   conn->rs.hosts = g_list_prepend (conn->rs.hosts,
-				   g_strdup ("example.com:27017"));
+				   _mongo_sync_server_get ("example.com",
+							   27017));
   shutdown (conn->super.fd, SHUT_RDWR);
   sleep (3);
   conn = mongo_sync_reconnect (conn, TRUE);
@@ -132,4 +223,4 @@ test_mongo_sync_reconnect (void)
   end_network_tests ();
 }
 
-RUN_TEST (19, mongo_sync_reconnect);
+RUN_TEST (25, mongo_sync_reconnect);
@@ -0,0 +1,47 @@
+#include "test.h"
+#include "mongo-utils.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_utils_histogram_merge (void)
+{
+  mongo_histogram a, b;
+  gint i;
+
+  memset (&a, 0, sizeof (a));
+  memset (&b, 0, sizeof (b));
+
+  ok (mongo_histogram_merge (NULL, &b) == FALSE,
+      "mongo_histogram_merge() fails without a destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_histogram_merge (&a, NULL) == FALSE,
+      "mongo_histogram_merge() fails without a source");
+
+  for (i = 0; i < 10; i++)
+    mongo_histogram_record (&a, 10);
+  for (i = 0; i < 10; i++)
+    mongo_histogram_record (&b, 1000);
+  mongo_histogram_record (&b, 2);
+
+  ok (mongo_histogram_merge (&a, &b),
+      "mongo_histogram_merge() works");
+  cmp_ok ((gint)a.count, "==", 21,
+	  "The counts are added up");
+  cmp_ok ((gint)a.min, "==", 2,
+	  "The minimum is updated");
+  cmp_ok ((gint)a.max, "==", 1000,
+	  "The maximum is updated");
+  cmp_ok ((gint)mongo_histogram_percentile (&a, 90), "==", 1000,
+	  "The buckets are added up");
+
+  memset (&b, 0, sizeof (b));
+  ok (mongo_histogram_merge (&a, &b),
+      "Merging an empty histogram works");
+  cmp_ok ((gint)a.min, "==", 2,
+	  "Merging an empty histogram leaves the minimum alone");
+}
+
+RUN_TEST (10, mongo_utils_histogram_merge);
@@ -0,0 +1,51 @@
+#include "test.h"
+#include "mongo-utils.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_utils_histogram_percentile (void)
+{
+  mongo_histogram h;
+  gint64 v;
+  gint i;
+
+  memset (&h, 0, sizeof (h));
+
+  ok (mongo_histogram_percentile (NULL, 50) == -1,
+      "mongo_histogram_percentile() fails with a NULL histogram");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_histogram_percentile (&h, 101) == -1,
+      "mongo_histogram_percentile() fails with an invalid percentile");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  ok (mongo_histogram_percentile (&h, 50) == -1,
+      "mongo_histogram_percentile() fails on an empty histogram");
+  cmp_ok (errno, "==", ENOENT,
+	  "errno is set to ENOENT");
+
+  for (i = 1; i <= 10; i++)
+    mongo_histogram_record (&h, i);
+
+  cmp_ok ((gint)mongo_histogram_percentile (&h, 50), "==", 5,
+	  "Small values are counted exactly");
+  cmp_ok ((gint)mongo_histogram_percentile (&h, 100), "==", 10,
+	  "The 100th percentile is the maximum");
+  cmp_ok ((gint)mongo_histogram_percentile (&h, 0), "==", 1,
+	  "The 0th percentile is the minimum");
+
+  memset (&h, 0, sizeof (h));
+  for (i = 1; i <= 1000; i++)
+    mongo_histogram_record (&h, i * 1000);
+
+  v = mongo_histogram_percentile (&h, 50);
+  ok (v >= 500000 && v <= 500000 * 1.0625,
+      "Large values are within 6.25%% of the real percentile");
+  v = mongo_histogram_percentile (&h, 99.9);
+  ok (v >= 999000 && v <= 1000000,
+      "The result is capped by the maximum");
+}
+
+RUN_TEST (11, mongo_utils_histogram_percentile);
@@ -0,0 +1,50 @@
+#include "test.h"
+#include "mongo-utils.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_utils_histogram_record (void)
+{
+  mongo_histogram h;
+  guint64 total = 0;
+  gint i;
+
+  memset (&h, 0, sizeof (h));
+
+  ok (mongo_histogram_record (NULL, 1) == FALSE,
+      "mongo_histogram_record() fails with a NULL histogram");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_histogram_record (&h, -1) == FALSE,
+      "mongo_histogram_record() fails with a negative value");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+
+  ok (mongo_histogram_record (&h, 100),
+      "mongo_histogram_record() works");
+  mongo_histogram_record (&h, 3);
+  mongo_histogram_record (&h, 5000);
+
+  cmp_ok ((gint)h.count, "==", 3,
+	  "The histogram counts the values recorded");
+  cmp_ok ((gint)h.sum, "==", 5103,
+	  "The histogram sums the values recorded");
+  cmp_ok ((gint)h.min, "==", 3,
+	  "The histogram keeps track of the minimum");
+  cmp_ok ((gint)h.max, "==", 5000,
+	  "The histogram keeps track of the maximum");
+
+  ok (mongo_histogram_record (&h, G_GINT64_CONSTANT (1) << 50),
+      "Values beyond the range of the histogram can be recorded");
+  cmp_ok ((gint)h.buckets[MONGO_HISTOGRAM_BUCKETS - 1], "==", 1,
+	  "Out of range values are counted in the last bucket");
+
+  for (i = 0; i < MONGO_HISTOGRAM_BUCKETS; i++)
+    total += h.buckets[i];
+  cmp_ok ((gint)total, "==", 4,
+	  "Every value lands in exactly one bucket");
+}
+
+RUN_TEST (12, mongo_utils_histogram_record);
@@ -0,0 +1,87 @@
+#include "tap.h"
+#include "test.h"
+#include "mongo-utils.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define THREADS 4
+#define OIDS_PER_THREAD 1000
+
+static gpointer
+_fill_thread (gpointer data)
+{
+  guint8 *buf = (guint8 *)data;
+  gint i;
+
+  /* Mix single and bulk reservations, to interleave the threads. */
+  for (i = 0; i < OIDS_PER_THREAD / 10; i++)
+    {
+      mongo_util_oid_fill (buf + i * 10 * 12, 1);
+      mongo_util_oid_fill (buf + (i * 10 + 1) * 12, 9);
+    }
+  return NULL;
+}
+
+static gint
+_oid_cmp (gconstpointer a, gconstpointer b)
+{
+  return memcmp (a, b, 12);
+}
+
+void
+test_mongo_utils_oid_fill (void)
+{
+  guint8 buf[5 * 12], *all;
+  GThread *threads[THREADS];
+  gint i, dups = 0, seq_ok = 1;
+
+  ok (mongo_util_oid_fill (buf, 5) == FALSE,
+      "mongo_util_oid_fill() fails before mongo_util_oid_init()");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is set to EAGAIN");
+
+  mongo_util_oid_init (0);
+
+  ok (mongo_util_oid_fill (NULL, 5) == FALSE,
+      "mongo_util_oid_fill() fails with a NULL buffer");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_util_oid_fill (buf, 0) == FALSE,
+      "mongo_util_oid_fill() fails with a zero count");
+
+  ok (mongo_util_oid_fill (buf, 5),
+      "mongo_util_oid_fill() works");
+  for (i = 1; i < 5; i++)
+    {
+      gint32 prev, cur;
+
+      prev = (buf[(i - 1) * 12 + 9] << 16) | (buf[(i - 1) * 12 + 10] << 8) |
+	buf[(i - 1) * 12 + 11];
+      cur = (buf[i * 12 + 9] << 16) | (buf[i * 12 + 10] << 8) |
+	buf[i * 12 + 11];
+      if (memcmp (buf, buf + i * 12, 9) != 0 ||
+	  ((cur - prev) & 0xffffff) != 1)
+	seq_ok = 0;
+    }
+  ok (seq_ok,
+      "A bulk fill shares the timestamp, and uses consecutive sequence "
+      "numbers");
+
+  all = g_new0 (guint8, THREADS * OIDS_PER_THREAD * 12);
+  for (i = 0; i < THREADS; i++)
+    threads[i] = g_thread_new ("oid", _fill_thread,
+			       all + i * OIDS_PER_THREAD * 12);
+  for (i = 0; i < THREADS; i++)
+    g_thread_join (threads[i]);
+
+  qsort (all, THREADS * OIDS_PER_THREAD, 12, _oid_cmp);
+  for (i = 1; i < THREADS * OIDS_PER_THREAD; i++)
+    if (memcmp (all + (i - 1) * 12, all + i * 12, 12) == 0)
+      dups++;
+  cmp_ok (dups, "==", 0,
+	  "OIDs generated from multiple threads are unique");
+  g_free (all);
+}
+
+RUN_TEST (8, mongo_utils_oid_fill);
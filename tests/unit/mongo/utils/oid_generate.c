@@ -0,0 +1,37 @@
+#include "tap.h"
+#include "test.h"
+#include "mongo-utils.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_utils_oid_generate (void)
+{
+  guint8 oid1[12], oid2[12];
+
+  ok (mongo_util_oid_generate (oid1) == FALSE,
+      "mongo_util_oid_generate() fails before mongo_util_oid_init()");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is set to EAGAIN");
+
+  mongo_util_oid_init (0);
+
+  ok (mongo_util_oid_generate (NULL) == FALSE,
+      "mongo_util_oid_generate() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  ok (mongo_util_oid_generate (oid1),
+      "mongo_util_oid_generate() works");
+  mongo_util_oid_generate (oid2);
+  ok (memcmp (oid1 + 4, oid2 + 4, 5) == 0,
+      "Consecutive OIDs share the machine ID and the PID");
+  ok (memcmp (oid1, oid2, 12) != 0,
+      "Consecutive OIDs differ");
+  cmp_ok ((((oid2[9] << 16) | (oid2[10] << 8) | oid2[11]) -
+	   ((oid1[9] << 16) | (oid1[10] << 8) | oid1[11])) & 0xffffff, "==", 1,
+	  "The sequence number is incremented by one");
+}
+
+RUN_TEST (8, mongo_utils_oid_generate);
@@ -62,6 +62,25 @@ test_mongo_utils_parse_addr (void)
   host = "deadbeef";
   port = 42;
 
+  ok (mongo_util_parse_addr ("/tmp/mongodb-27017.sock", &host, &port),
+      "mongo_util_parse_addr() recognizes Unix socket paths");
+  is (host, "/tmp/mongodb-27017.sock",
+      "The path is the host");
+  cmp_ok (port, "==", 42,
+	  "Port has been left alone");
+  g_free (host);
+  host = "deadbeef";
+
+  ok (mongo_util_parse_addr ("/run/mongo:db/mongod.sock", &host, &port),
+      "mongo_util_parse_addr() does not split paths at colons");
+  is (host, "/run/mongo:db/mongod.sock",
+      "The whole path is the host");
+  cmp_ok (port, "==", 42,
+	  "Port has been left alone");
+  g_free (host);
+  host = "deadbeef";
+  port = 42;
+
   ok (mongo_util_parse_addr (":27017", &host, &port) == FALSE,
       "mongo_util_parse_addr() should fail when no host is specified");
   is (host, NULL,
@@ -118,4 +137,4 @@ test_mongo_utils_parse_addr (void)
 	  "Failed parsing sets port to -1");
 }
 
-RUN_TEST (34, mongo_utils_parse_addr);
+RUN_TEST (40, mongo_utils_parse_addr);
@@ -0,0 +1,99 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <errno.h>
+#include <string.h>
+
+typedef struct
+{
+  gint allocs;
+  gint frees;
+} counting_allocator;
+
+static gpointer
+counting_malloc (gsize n_bytes, gpointer user_data)
+{
+  ((counting_allocator *)user_data)->allocs++;
+  return g_malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem, gsize n_bytes, gpointer user_data)
+{
+  if (!mem)
+    ((counting_allocator *)user_data)->allocs++;
+  return g_realloc (mem, n_bytes);
+}
+
+static void
+counting_free (gpointer mem, gpointer user_data)
+{
+  ((counting_allocator *)user_data)->frees++;
+  g_free (mem);
+}
+
+void
+test_mongo_utils_set_get_allocator (void)
+{
+  mongo_allocator a, current;
+  counting_allocator counts;
+  mongo_packet *p;
+  bson *b;
+  bson_cursor *c;
+
+  memset (&counts, 0, sizeof (counts));
+
+  ok (mongo_util_get_allocator (NULL) == FALSE,
+      "mongo_util_get_allocator() fails with a NULL destination");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  ok (mongo_util_get_allocator (&current),
+      "mongo_util_get_allocator() works");
+  ok (current.malloc != NULL && current.realloc != NULL &&
+      current.free != NULL,
+      "There is a default allocator");
+
+  memset (&a, 0, sizeof (a));
+  a.malloc = counting_malloc;
+  ok (mongo_util_set_allocator (&a) == FALSE,
+      "mongo_util_set_allocator() fails with an incomplete allocator");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+
+  a.realloc = counting_realloc;
+  a.free = counting_free;
+  a.user_data = &counts;
+  ok (mongo_util_set_allocator (&a),
+      "mongo_util_set_allocator() works");
+  mongo_util_get_allocator (&current);
+  ok (current.malloc == counting_malloc && current.user_data == &counts,
+      "mongo_util_get_allocator() returns the new allocator");
+
+  b = bson_new ();
+  bson_append_string (b, "hello", "world", -1);
+  bson_finish (b);
+  c = bson_find (b, "hello");
+  p = mongo_wire_cmd_insert (1, "test.ns", b, NULL);
+  ok (counts.allocs >= 5,
+      "BSON objects, cursors and packets use the custom allocator");
+
+  mongo_wire_packet_free (p);
+  bson_cursor_free (c);
+  bson_free (b);
+  mongo_wire_packet_cache_flush ();
+  cmp_ok (counts.allocs, "==", counts.frees,
+	  "Everything is freed through the custom allocator");
+
+  ok (mongo_util_set_allocator (NULL),
+      "mongo_util_set_allocator() can restore the default");
+  mongo_util_get_allocator (&current);
+  ok (current.malloc != counting_malloc && current.user_data == NULL,
+      "The default allocator is restored");
+
+  b = bson_new ();
+  bson_free (b);
+  ok (counts.allocs == counts.frees && counts.allocs >= 5,
+      "The custom allocator is not used anymore");
+}
+
+RUN_TEST (13, mongo_utils_set_get_allocator);
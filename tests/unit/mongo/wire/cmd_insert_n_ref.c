@@ -0,0 +1,110 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "libmongo-private.h"
+
+#define MANY_DOCS 2000
+
+void
+test_mongo_wire_cmd_insert_n_ref (void)
+{
+  bson *ins, *tmp;
+  const bson *docs[10];
+  const bson **many;
+  mongo_packet *p, *copy, *r;
+  mongo_connection c, server;
+  mongo_packet_header hdr, copy_hdr;
+  const guint8 *data, *copy_data;
+  gint32 data_size, copy_size, i;
+  int fds[2];
+
+  ins = test_bson_generate_full ();
+  tmp = bson_new ();
+
+  docs[0] = ins;
+  docs[1] = tmp;
+  docs[2] = ins;
+  docs[3] = NULL;
+
+  ok (mongo_wire_cmd_insert_n_ref (1, NULL, 1, docs) == NULL,
+      "mongo_wire_cmd_insert_n_ref() fails with a NULL namespace");
+  ok (mongo_wire_cmd_insert_n_ref (1, "test.ns", 1, NULL) == NULL,
+      "mongo_wire_cmd_insert_n_ref() fails with no documents");
+  ok (mongo_wire_cmd_insert_n_ref (1, "test.ns", 0, docs) == NULL,
+      "mongo_wire_cmd_insert_n_ref() fails with no documents");
+  ok (mongo_wire_cmd_insert_n_ref (1, "test.ns", 2, docs) == NULL,
+      "mongo_wire_cmd_insert_n_ref() fails with an unfinished document");
+  bson_finish (tmp);
+  ok (mongo_wire_cmd_insert_n_ref (1, "test.ns", 4, docs) == NULL,
+      "mongo_wire_cmd_insert_n_ref() fails with a NULL document in the "
+      "array");
+  ok ((p = mongo_wire_cmd_insert_n_ref (1, "test.ns", 3, docs)) != NULL,
+      "mongo_wire_cmd_insert_n_ref() works");
+
+  copy = mongo_wire_cmd_insert_n (1, "test.ns", 3, docs);
+  mongo_wire_packet_get_header (p, &hdr);
+  mongo_wire_packet_get_header (copy, &copy_hdr);
+  cmp_ok (hdr.length, "==", copy_hdr.length,
+	  "The packet length includes the referenced documents");
+
+  /* Send both packets, and compare what arrives. */
+  memset (&c, 0, sizeof (c));
+  memset (&server, 0, sizeof (server));
+  socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+  c.fd = fds[0];
+  server.fd = fds[1];
+
+  ok (mongo_packet_send (&c, p),
+      "A packet referencing documents can be sent");
+  r = mongo_packet_recv (&server);
+  copy_size = mongo_wire_packet_get_data (copy, &copy_data);
+  data_size = mongo_wire_packet_get_data (r, &data);
+  ok (data_size == copy_size && memcmp (data, copy_data, data_size) == 0,
+      "The sent packet is the same as a copying one");
+  mongo_wire_packet_free (r);
+
+  /* Flattening */
+  ok (mongo_wire_packet_get_data (p, &data) == -1,
+      "mongo_wire_packet_get_data() does not flatten the packet");
+  mongo_wire_packet_flatten (p);
+  data_size = mongo_wire_packet_get_data (p, &data);
+  ok (data_size == copy_size && memcmp (data, copy_data, data_size) == 0,
+      "mongo_wire_packet_flatten() copies the documents into the packet");
+  bson_free (ins);
+  bson_free (tmp);
+  mongo_wire_packet_get_data (p, &data);
+  ok (memcmp (data, copy_data, data_size) == 0,
+      "The packet does not depend on the documents after flattening");
+  mongo_wire_packet_free (p);
+  mongo_wire_packet_free (copy);
+
+  /* More documents than fit in a single sendmsg() call. */
+  tmp = bson_new ();
+  bson_finish (tmp);
+  many = g_new (const bson *, MANY_DOCS);
+  for (i = 0; i < MANY_DOCS; i++)
+    many[i] = tmp;
+
+  p = mongo_wire_cmd_insert_n_ref (2, "test.ns", MANY_DOCS, many);
+  ok (mongo_packet_send (&c, p),
+      "Packets with many documents can be sent");
+  r = mongo_packet_recv (&server);
+  mongo_wire_packet_get_header (p, &hdr);
+  mongo_wire_packet_get_header (r, &copy_hdr);
+  ok (r != NULL && hdr.length == copy_hdr.length,
+      "All of the documents arrive");
+  mongo_wire_packet_free (r);
+  mongo_wire_packet_free (p);
+
+  g_free (many);
+  bson_free (tmp);
+  close (fds[0]);
+  close (fds[1]);
+}
+
+RUN_TEST (14, mongo_wire_cmd_insert_n_ref);
@@ -0,0 +1,118 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-wire.h"
+#include "mongo-utils.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_wire_cmd_insert_n_with_ids (void)
+{
+  bson *plain, *with_id, *with_str_id, *tmp, *doc;
+  const bson *docs[3];
+  guint8 ids[3 * 12], zeroes[12];
+  const guint8 *data, *oid;
+  mongo_packet *p;
+  mongo_packet_header hdr;
+  gint32 data_size, pos;
+  bson_cursor *c;
+
+  plain = bson_new ();
+  bson_append_int32 (plain, "int32", 42);
+  bson_append_string (plain, "str", "plain", -1);
+  bson_finish (plain);
+
+  with_id = bson_new ();
+  bson_append_oid (with_id, "_id", (const guint8 *)"0123456789ab");
+  bson_append_int32 (with_id, "int32", 42);
+  bson_finish (with_id);
+
+  with_str_id = bson_new ();
+  bson_append_int32 (with_str_id, "int32", 42);
+  bson_append_string (with_str_id, "_id", "custom", -1);
+  bson_finish (with_str_id);
+
+  docs[0] = plain;
+  docs[1] = with_id;
+  docs[2] = with_str_id;
+
+  ok (mongo_wire_cmd_insert_n_with_ids (1, "test.ns", 3, docs, ids) == NULL,
+      "mongo_wire_cmd_insert_n_with_ids() fails before "
+      "mongo_util_oid_init()");
+  cmp_ok (errno, "==", EAGAIN,
+	  "errno is set to EAGAIN");
+  mongo_util_oid_init (0);
+
+  ok (mongo_wire_cmd_insert_n_with_ids (1, NULL, 3, docs, ids) == NULL,
+      "mongo_wire_cmd_insert_n_with_ids() fails with a NULL namespace");
+  ok (mongo_wire_cmd_insert_n_with_ids (1, "test.ns", 3, NULL, ids) == NULL,
+      "mongo_wire_cmd_insert_n_with_ids() fails with no documents");
+  ok (mongo_wire_cmd_insert_n_with_ids (1, "test.ns", 0, docs, ids) == NULL,
+      "mongo_wire_cmd_insert_n_with_ids() fails with zero documents");
+  tmp = bson_new ();
+  docs[1] = tmp;
+  ok (mongo_wire_cmd_insert_n_with_ids (1, "test.ns", 3, docs, ids) == NULL,
+      "mongo_wire_cmd_insert_n_with_ids() fails with an unfinished document");
+  docs[1] = with_id;
+  bson_free (tmp);
+
+  ok ((p = mongo_wire_cmd_insert_n_with_ids (1, "test.ns", 3, docs, ids))
+      != NULL,
+      "mongo_wire_cmd_insert_n_with_ids() works");
+
+  mongo_wire_packet_get_header (p, &hdr);
+  data_size = mongo_wire_packet_get_data (p, &data);
+  cmp_ok (hdr.length, "==", sizeof (mongo_packet_header) + data_size,
+	  "Packet header length is correct");
+  cmp_ok (data_size, "==", sizeof (gint32) + strlen ("test.ns") + 1 +
+	  bson_size (plain) + 17 + bson_size (with_id) +
+	  bson_size (with_str_id),
+	  "Only the document without an _id grew");
+
+  /* The first document got a fresh _id, in front. */
+  pos = sizeof (gint32) + strlen ("test.ns") + 1;
+  doc = bson_new_from_data (data + pos, _DOC_SIZE (data, pos) - 1);
+  bson_finish (doc);
+  cmp_ok (bson_size (doc), "==", bson_size (plain) + 17,
+	  "The length of the first document is patched");
+  c = bson_cursor_new (doc);
+  bson_cursor_next (c);
+  is (bson_cursor_key (c), "_id",
+      "The _id is the first element of the first document");
+  bson_cursor_get_oid (c, &oid);
+  ok (memcmp (oid, ids, 12) == 0,
+      "The generated _id is returned to the caller");
+  bson_cursor_next (c);
+  is (bson_cursor_key (c), "int32",
+      "The original elements follow the _id");
+  bson_cursor_free (c);
+  pos += bson_size (doc);
+  bson_free (doc);
+
+  /* The second document is left alone. */
+  ok (memcmp (data + pos, bson_data (with_id), bson_size (with_id)) == 0,
+      "A document with an _id is copied unchanged");
+  ok (memcmp (ids + 12, "0123456789ab", 12) == 0,
+      "An existing ObjectID _id is returned to the caller");
+  pos += bson_size (with_id);
+
+  ok (memcmp (data + pos, bson_data (with_str_id),
+	      bson_size (with_str_id)) == 0,
+      "A document with a non-ObjectID _id is copied unchanged");
+  memset (zeroes, 0, sizeof (zeroes));
+  ok (memcmp (ids + 24, zeroes, 12) == 0,
+      "A non-ObjectID _id is returned as zeroes");
+  mongo_wire_packet_free (p);
+
+  p = mongo_wire_cmd_insert_n_with_ids (2, "test.ns", 1, docs, NULL);
+  ok (p != NULL,
+      "mongo_wire_cmd_insert_n_with_ids() works without an ID array");
+  mongo_wire_packet_free (p);
+
+  bson_free (plain);
+  bson_free (with_id);
+  bson_free (with_str_id);
+}
+
+RUN_TEST (18, mongo_wire_cmd_insert_n_with_ids);
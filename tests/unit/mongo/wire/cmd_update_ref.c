@@ -0,0 +1,59 @@
+#include "test.h"
+#include "tap.h"
+#include "mongo-wire.h"
+
+#include <string.h>
+
+void
+test_mongo_wire_cmd_update_ref (void)
+{
+  bson *sel, *upd, *tmp;
+  mongo_packet *p, *copy;
+  mongo_packet_header hdr, copy_hdr;
+  const guint8 *data, *copy_data;
+  gint32 data_size, copy_size;
+
+  sel = bson_new ();
+  bson_append_null (sel, "_id");
+  bson_finish (sel);
+
+  upd = test_bson_generate_full ();
+
+  ok (mongo_wire_cmd_update_ref (1, NULL, 0, sel, upd) == NULL,
+      "mongo_wire_cmd_update_ref() with a NULL namespace should fail");
+  ok (mongo_wire_cmd_update_ref (1, "test.ns", 0, NULL, upd) == NULL,
+      "mongo_wire_cmd_update_ref() with NULL selector should fail");
+  ok (mongo_wire_cmd_update_ref (1, "test.ns", 0, sel, NULL) == NULL,
+      "mongo_wire_cmd_update_ref() with NULL update should fail");
+
+  tmp = bson_new ();
+  ok (mongo_wire_cmd_update_ref (1, "test.ns", 0, tmp, upd) == NULL,
+      "mongo_wire_cmd_update_ref() fails with unfinished selector");
+  ok (mongo_wire_cmd_update_ref (1, "test.ns", 0, sel, tmp) == NULL,
+      "mongo_wire_cmd_update_ref() fails with unfinished update");
+  bson_free (tmp);
+
+  ok ((p = mongo_wire_cmd_update_ref (1, "test.ns", 1, sel, upd)) != NULL,
+      "mongo_wire_cmd_update_ref() works");
+  copy = mongo_wire_cmd_update (1, "test.ns", 1, sel, upd);
+
+  mongo_wire_packet_get_header (p, &hdr);
+  mongo_wire_packet_get_header (copy, &copy_hdr);
+  cmp_ok (hdr.length, "==", copy_hdr.length,
+	  "The packet length includes the referenced documents");
+  cmp_ok (hdr.opcode, "==", copy_hdr.opcode,
+	  "The opcode is correct");
+
+  mongo_wire_packet_flatten (p);
+  data_size = mongo_wire_packet_get_data (p, &data);
+  copy_size = mongo_wire_packet_get_data (copy, &copy_data);
+  ok (data_size == copy_size && memcmp (data, copy_data, data_size) == 0,
+      "The flattened packet is the same as a copying one");
+
+  bson_free (sel);
+  bson_free (upd);
+  mongo_wire_packet_free (p);
+  mongo_wire_packet_free (copy);
+}
+
+RUN_TEST (9, mongo_wire_cmd_update_ref);
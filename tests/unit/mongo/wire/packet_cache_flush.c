@@ -0,0 +1,117 @@
+#include "test.h"
+#include "mongo.h"
+
+#include <string.h>
+
+typedef struct
+{
+  gint allocs;
+  gint frees;
+} counting_allocator;
+
+static gpointer
+counting_malloc (gsize n_bytes, gpointer user_data)
+{
+  ((counting_allocator *)user_data)->allocs++;
+  return g_malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem, gsize n_bytes, gpointer user_data)
+{
+  if (!mem)
+    ((counting_allocator *)user_data)->allocs++;
+  return g_realloc (mem, n_bytes);
+}
+
+static void
+counting_free (gpointer mem, gpointer user_data)
+{
+  ((counting_allocator *)user_data)->frees++;
+  g_free (mem);
+}
+
+void
+test_mongo_wire_packet_cache_flush (void)
+{
+  mongo_allocator a;
+  counting_allocator counts;
+  mongo_packet *p, *q;
+  bson *b;
+  guint8 *big;
+  gint allocs, frees, i;
+
+  memset (&counts, 0, sizeof (counts));
+  a.malloc = counting_malloc;
+  a.realloc = counting_realloc;
+  a.free = counting_free;
+  a.user_data = &counts;
+
+  b = test_bson_generate_full ();
+
+  mongo_wire_packet_cache_flush ();
+  mongo_util_set_allocator (&a);
+
+  p = mongo_wire_cmd_insert (1, "test.ns", b, NULL);
+  mongo_wire_packet_free (p);
+  allocs = counts.allocs;
+  cmp_ok (counts.frees, "==", 0,
+	  "Freed packets are cached");
+
+  for (i = 0; i < 100; i++)
+    {
+      p = mongo_wire_cmd_insert (i, "test.ns", b, NULL);
+      mongo_wire_packet_free (p);
+    }
+  cmp_ok (counts.allocs, "==", allocs,
+	  "Building packets reuses the cached ones");
+
+  p = mongo_wire_cmd_query (1, "test.ns", 0, 0, 10, b, NULL);
+  mongo_wire_packet_set_data (p, (const guint8 *)"abcd", 4);
+  cmp_ok (counts.allocs, "==", allocs,
+	  "mongo_wire_packet_set_data() reuses existing capacity");
+  mongo_wire_packet_free (p);
+
+  big = g_malloc0 (128 * 1024);
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_data (p, big, 128 * 1024);
+  q = mongo_wire_packet_new ();
+  mongo_wire_packet_set_data (q, big, 128 * 1024);
+  frees = counts.frees;
+  mongo_wire_packet_free (p);
+  cmp_ok (counts.frees, "==", frees,
+	  "A large buffer is kept for reuse");
+  mongo_wire_packet_free (q);
+  cmp_ok (counts.frees, "==", frees + 1,
+	  "Only one large buffer is kept");
+
+  allocs = counts.allocs;
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_data (p, big, 100 * 1024);
+  cmp_ok (counts.allocs, "==", allocs,
+	  "Large payloads reuse the kept buffer");
+  mongo_wire_packet_free (p);
+  g_free (big);
+
+  big = g_malloc0 (8 * 1024 * 1024);
+  p = mongo_wire_packet_new ();
+  mongo_wire_packet_set_data (p, big, 8 * 1024 * 1024);
+  frees = counts.frees;
+  mongo_wire_packet_free (p);
+  cmp_ok (counts.frees, "==", frees + 1,
+	  "Huge buffers are not kept");
+  g_free (big);
+
+  mongo_wire_packet_cache_flush ();
+  cmp_ok (counts.allocs, "==", counts.frees,
+	  "mongo_wire_packet_cache_flush() releases everything");
+
+  mongo_wire_packet_cache_flush ();
+  ok (counts.allocs == counts.frees,
+      "Flushing an empty cache works");
+
+  mongo_util_set_allocator (NULL);
+  bson_free (b);
+}
+
+RUN_TEST (9, mongo_wire_packet_cache_flush);
@@ -0,0 +1,68 @@
+#include "tap.h"
+#include "test.h"
+#include "mongo-wire.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "libmongo-private.h"
+
+void
+test_mongo_wire_packet_flatten (void)
+{
+  mongo_packet *p, *copy;
+  const bson *docs[2];
+  const guint8 *data, *copy_data, *seg_data;
+  const mongo_wire_segment *segments;
+  gint32 size, copy_size, seg_size;
+  bson *b;
+
+  ok (mongo_wire_packet_flatten (NULL) == FALSE,
+      "mongo_wire_packet_flatten() fails with a NULL packet");
+  cmp_ok (errno, "==", EINVAL,
+	  "errno is set to EINVAL");
+  p = mongo_wire_packet_new ();
+  ok (mongo_wire_packet_flatten (p) == FALSE,
+      "mongo_wire_packet_flatten() fails with an empty packet");
+  mongo_wire_packet_free (p);
+
+  b = test_bson_generate_full ();
+  docs[0] = b;
+  docs[1] = b;
+
+  p = mongo_wire_cmd_insert_n (1, "test.ns", 2, docs);
+  mongo_wire_packet_get_data (p, &data);
+  ok (mongo_wire_packet_flatten (p),
+      "Flattening a packet that holds its data works");
+  mongo_wire_packet_get_data (p, &copy_data);
+  ok (data == copy_data,
+      "...and leaves the data where it was");
+  mongo_wire_packet_free (p);
+
+  p = mongo_wire_cmd_insert_n_ref (1, "test.ns", 2, docs);
+  copy = mongo_wire_cmd_insert_n (1, "test.ns", 2, docs);
+  copy_size = mongo_wire_packet_get_data (copy, &copy_data);
+
+  ok (mongo_wire_packet_get_data (p, &data) == -1,
+      "mongo_wire_packet_get_data() fails on a referencing packet");
+  cmp_ok (errno, "==", ENOTSUP,
+	  "errno is set to ENOTSUP");
+  ok (mongo_wire_packet_get_segments (p, &seg_data, &seg_size,
+				      &segments) == 2,
+      "...and leaves its segments alone");
+
+  ok (mongo_wire_packet_flatten (p),
+      "mongo_wire_packet_flatten() works");
+  size = mongo_wire_packet_get_data (p, &data);
+  ok (size == copy_size && memcmp (data, copy_data, size) == 0,
+      "The flattened packet is the same as a copying one");
+  cmp_ok (mongo_wire_packet_get_segments (p, &seg_data, &seg_size,
+					  &segments), "==", 0,
+	  "The flattened packet references nothing");
+
+  mongo_wire_packet_free (copy);
+  mongo_wire_packet_free (p);
+  bson_free (b);
+}
+
+RUN_TEST (11, mongo_wire_packet_flatten);
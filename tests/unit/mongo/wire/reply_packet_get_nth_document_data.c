@@ -0,0 +1,81 @@
+#include "test.h"
+#include "tap.h"
+#include "bson.h"
+#include "mongo-wire.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_wire_reply_packet_get_nth_document_data (void)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  const guint8 *doc, *data;
+  guint8 *raw;
+  gint32 size;
+  bson *b;
+
+  p = mongo_wire_packet_new ();
+  memset (&h, 0, sizeof (mongo_packet_header));
+  h.opcode = 2;
+  h.length = sizeof (mongo_packet_header);
+  mongo_wire_packet_set_header (p, &h);
+
+  ok (mongo_wire_reply_packet_get_nth_document_data (NULL, 1, &doc,
+						     &size) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_data() fails with a NULL "
+      "packet");
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 0, &doc,
+						     &size) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_data() fails with n = 0");
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 1, NULL,
+						     &size) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_data() fails with a NULL "
+      "destination");
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 1, &doc,
+						     &size) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_data() fails with a "
+      "non-reply packet");
+  mongo_wire_packet_free (p);
+
+  b = test_bson_generate_full ();
+
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 2, &doc, &size),
+      "mongo_wire_reply_packet_get_nth_document_data() works");
+  cmp_ok (size, "==", bson_size (b),
+	  "The size of the document is returned");
+  ok (memcmp (doc, bson_data (b), size) == 0,
+      "The returned document is correct");
+  mongo_wire_reply_packet_get_data (p, &data);
+  ok (doc == data + bson_size (b),
+      "The document is not copied");
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 1, &doc, NULL),
+      "The size is optional");
+
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 3, &doc,
+						     &size) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_data() fails if the "
+      "requested document does not exist");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  mongo_wire_packet_free (p);
+
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  size = mongo_wire_packet_get_data (p, &data) - 10;
+  raw = g_memdup (data, size);
+  mongo_wire_packet_set_data (p, raw, size);
+  g_free (raw);
+  ok (mongo_wire_reply_packet_get_nth_document_data (p, 2, &doc,
+						     &size) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_data() fails if the "
+      "document is truncated");
+  cmp_ok (errno, "==", EPROTO,
+	  "errno is set to EPROTO");
+  mongo_wire_packet_free (p);
+
+  bson_free (b);
+}
+
+RUN_TEST (13, mongo_wire_reply_packet_get_nth_document_data);
@@ -0,0 +1,59 @@
+#include "test.h"
+#include "tap.h"
+#include "bson.h"
+#include "mongo-wire.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_wire_reply_packet_get_nth_document_view (void)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  const guint8 *data;
+  bson *b, *doc;
+
+  p = mongo_wire_packet_new ();
+  memset (&h, 0, sizeof (mongo_packet_header));
+  h.opcode = 2;
+  h.length = sizeof (mongo_packet_header);
+  mongo_wire_packet_set_header (p, &h);
+
+  ok (mongo_wire_reply_packet_get_nth_document_view (NULL, 1,
+						     &doc) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_view() fails with a NULL "
+      "packet");
+  ok (mongo_wire_reply_packet_get_nth_document_view (p, 1, NULL) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_view() fails with a NULL "
+      "destination");
+  ok (mongo_wire_reply_packet_get_nth_document_view (p, 1, &doc) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_view() fails with a "
+      "non-reply packet");
+  mongo_wire_packet_free (p);
+
+  b = test_bson_generate_full ();
+
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  ok (mongo_wire_reply_packet_get_nth_document_view (p, 2, &doc),
+      "mongo_wire_reply_packet_get_nth_document_view() works");
+  cmp_ok (bson_size (doc), "==", bson_size (b),
+	  "The view is finished, and has the size of the document");
+  ok (memcmp (bson_data (doc), bson_data (b), bson_size (b)) == 0,
+      "The view has the right contents");
+  mongo_wire_reply_packet_get_data (p, &data);
+  ok (bson_data (doc) == data + bson_size (b),
+      "The document is not copied");
+  bson_free (doc);
+
+  ok (mongo_wire_reply_packet_get_nth_document_view (p, 3, &doc) == FALSE,
+      "mongo_wire_reply_packet_get_nth_document_view() fails if the "
+      "requested document does not exist");
+  cmp_ok (errno, "==", ERANGE,
+	  "errno is set to ERANGE");
+  mongo_wire_packet_free (p);
+
+  bson_free (b);
+}
+
+RUN_TEST (9, mongo_wire_reply_packet_get_nth_document_view);
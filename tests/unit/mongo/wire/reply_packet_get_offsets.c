@@ -0,0 +1,81 @@
+#include "test.h"
+#include "tap.h"
+#include "bson.h"
+#include "mongo-wire.h"
+
+#include <errno.h>
+#include <string.h>
+
+void
+test_mongo_wire_reply_packet_get_offsets (void)
+{
+  mongo_packet *p;
+  mongo_packet_header h;
+  const gint32 *offsets;
+  const guint8 *data;
+  guint8 *raw;
+  gint32 size;
+  bson *b;
+
+  p = mongo_wire_packet_new ();
+  memset (&h, 0, sizeof (mongo_packet_header));
+  h.opcode = 2;
+  h.length = sizeof (mongo_packet_header);
+  mongo_wire_packet_set_header (p, &h);
+
+  ok (mongo_wire_reply_packet_get_offsets (NULL, &offsets) == -1,
+      "mongo_wire_reply_packet_get_offsets() fails with a NULL packet");
+  ok (mongo_wire_reply_packet_get_offsets (p, NULL) == -1,
+      "mongo_wire_reply_packet_get_offsets() fails with a NULL "
+      "destination");
+  ok (mongo_wire_reply_packet_get_offsets (p, &offsets) == -1,
+      "mongo_wire_reply_packet_get_offsets() fails with a non-reply "
+      "packet");
+  cmp_ok (errno, "==", EPROTO,
+	  "errno is set to EPROTO");
+  mongo_wire_packet_free (p);
+
+  p = test_mongo_wire_generate_reply (TRUE, 0, FALSE);
+  cmp_ok (mongo_wire_reply_packet_get_offsets (p, &offsets), "==", 0,
+	  "A reply without documents has no offsets");
+  mongo_wire_packet_free (p);
+
+  b = test_bson_generate_full ();
+
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  cmp_ok (mongo_wire_reply_packet_get_offsets (p, &offsets), "==", 2,
+	  "mongo_wire_reply_packet_get_offsets() works");
+  ok (offsets[0] == 0 && offsets[1] == bson_size (b),
+      "The offsets point at the start of each document");
+  mongo_wire_reply_packet_get_data (p, &data);
+  ok (memcmp (data + offsets[1], bson_data (b), bson_size (b)) == 0,
+      "The documents are where the offsets say");
+  mongo_wire_packet_free (p);
+
+  /* Claim more documents than there are. */
+  p = test_mongo_wire_generate_reply (TRUE, 3, TRUE);
+  cmp_ok (mongo_wire_reply_packet_get_offsets (p, &offsets), "==", 2,
+	  "Documents missing from the packet are left out");
+  mongo_wire_packet_free (p);
+
+  /* A bare header claiming the largest possible number of
+     documents must not make the index huge. */
+  p = test_mongo_wire_generate_reply (TRUE, G_MAXINT32, FALSE);
+  cmp_ok (mongo_wire_reply_packet_get_offsets (p, &offsets), "==", 0,
+	  "The document count of the wire is capped by the packet size");
+  mongo_wire_packet_free (p);
+
+  /* Truncate the second document. */
+  p = test_mongo_wire_generate_reply (TRUE, 2, TRUE);
+  size = mongo_wire_packet_get_data (p, &data) - 10;
+  raw = g_memdup (data, size);
+  mongo_wire_packet_set_data (p, raw, size);
+  g_free (raw);
+  cmp_ok (mongo_wire_reply_packet_get_offsets (p, &offsets), "==", 1,
+	  "Documents that do not fit into the packet are left out");
+  mongo_wire_packet_free (p);
+
+  bson_free (b);
+}
+
+RUN_TEST (11, mongo_wire_reply_packet_get_offsets);